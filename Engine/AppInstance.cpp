@@ -26,8 +26,14 @@
 
 #include <fstream>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm> // min, max
+#include <cmath>
 #include <stdexcept>
 
+#include <QtCore/QDebug>
 #include <QtCore/QDir>
 #include <QtCore/QTextStream>
 #include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt5
@@ -53,8 +59,10 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/Node.h"
 #include "Engine/NodeSerialization.h"
 #include "Engine/OfxHost.h"
+#include "Engine/OutputEffectInstance.h"
 #include "Engine/Plugin.h"
 #include "Engine/Project.h"
+#include "Engine/RenderPlan.h"
 #include "Engine/RotoLayer.h"
 #include "Engine/Settings.h"
 #include "Engine/ViewerInstance.h"
@@ -476,42 +484,7 @@ AppInstance::load(const CLArgs& cl,bool makeEmptyInstance)
         }
         
 
-        QFileInfo info(cl.getScriptFilename());
-        if (!info.exists()) {
-            throw std::invalid_argument(tr("Specified project file does not exist").toStdString());
-        }
-        
-        std::list<AppInstance::RenderRequest> writersWork;
-
-        if (info.suffix() == NATRON_PROJECT_FILE_EXT) {
-            
-            if ( !_imp->_currentProject->loadProject(info.path(),info.fileName()) ) {
-                throw std::invalid_argument(tr("Project file loading failed.").toStdString());
-            }
-            
-            getWritersWorkForCL(cl, writersWork);
-
-        } else if (info.suffix() == "py") {
-            
-            loadPythonScript(info);
-            getWritersWorkForCL(cl, writersWork);
-
-        } else {
-            throw std::invalid_argument(tr(NATRON_APPLICATION_NAME " only accepts python scripts or .ntp project files").toStdString());
-        }
-        
-        if (!extraOnProjectCreatedScript.isEmpty()) {
-            QFileInfo cbInfo(extraOnProjectCreatedScript);
-            if (cbInfo.exists()) {
-                loadPythonScript(cbInfo);
-            }
-        }
-        
-       
-        startWritersRendering(cl.areRenderStatsEnabled(), false, writersWork);
-       
-        
-        
+        renderFromCL(cl, true);
         
     } else if (appPTR->getAppType() == AppManager::eAppTypeInterpreter) {
         QFileInfo info(cl.getScriptFilename());
@@ -548,6 +521,50 @@ AppInstance::load(const CLArgs& cl,bool makeEmptyInstance)
     }
 }
 
+void
+AppInstance::renderFromCL(const CLArgs& cl, bool loadProject)
+{
+    std::list<AppInstance::RenderRequest> writersWork;
+    
+    if (!loadProject) {
+        getWritersWorkForCL(cl, writersWork);
+        startWritersRendering(cl.areRenderStatsEnabled(), false, writersWork);
+        return;
+    }
+    
+    QFileInfo info(cl.getScriptFilename());
+    if (!info.exists()) {
+        throw std::invalid_argument(tr("Specified project file does not exist").toStdString());
+    }
+    
+    if (info.suffix() == NATRON_PROJECT_FILE_EXT) {
+        
+        if ( !_imp->_currentProject->loadProject(info.path(),info.fileName()) ) {
+            throw std::invalid_argument(tr("Project file loading failed.").toStdString());
+        }
+        
+        getWritersWorkForCL(cl, writersWork);
+        
+    } else if (info.suffix() == "py") {
+        
+        loadPythonScript(info);
+        getWritersWorkForCL(cl, writersWork);
+        
+    } else {
+        throw std::invalid_argument(tr(NATRON_APPLICATION_NAME " only accepts python scripts or .ntp project files").toStdString());
+    }
+    
+    const QString& extraOnProjectCreatedScript = cl.getDefaultOnProjectLoadedScript();
+    if (!extraOnProjectCreatedScript.isEmpty()) {
+        QFileInfo cbInfo(extraOnProjectCreatedScript);
+        if (cbInfo.exists()) {
+            loadPythonScript(cbInfo);
+        }
+    }
+    
+    startWritersRendering(cl.areRenderStatsEnabled(), false, writersWork);
+}
+
 bool
 AppInstance::loadPythonScript(const QFileInfo& file)
 {
@@ -1279,6 +1296,188 @@ AppInstance::startWritersRendering(bool enableRenderStats,bool doBlockingRender,
     startWritersRendering(enableRenderStats, doBlockingRender, renderers);
 }
 
+namespace {
+/// Inserts in upstream all the nodes the given node depends upon
+void
+getUpstreamNodesRecursive(const NodePtr& node,
+                          std::set<Node*>* upstream)
+{
+    int maxInputs = node->getMaxInputCount();
+    for (int i = 0; i < maxInputs; ++i) {
+        ///getInput() goes through the Input and Output nodes of groups
+        NodePtr input = node->getInput(i);
+        if ( input && upstream->insert( input.get() ).second ) {
+            getUpstreamNodesRecursive(input, upstream);
+        }
+    }
+}
+
+bool
+shareNodes(const std::set<Node*>& a,
+           const std::set<Node*>& b)
+{
+    const std::set<Node*>& smallest = a.size() < b.size() ? a : b;
+    const std::set<Node*>& largest = a.size() < b.size() ? b : a;
+    for (std::set<Node*>::const_iterator it = smallest.begin(); it != smallest.end(); ++it) {
+        if ( largest.find(*it) != largest.end() ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Returns the frame range rendered by the writer: the one of the work if set, otherwise the one of the writer or of the project
+void
+getRenderWorkFrameRange(const AppInstance::RenderWork& work,
+                        double* first,
+                        double* last)
+{
+    if ( (work.firstFrame == INT_MIN) || (work.lastFrame == INT_MAX) ) {
+        work.writer->getFrameRange_public(work.writer->getHash(), first, last);
+        if ( (*first == INT_MIN) || (*last == INT_MAX) ) {
+            work.writer->getApp()->getFrameRange(first, last);
+        }
+    } else {
+        *first = work.firstFrame;
+        *last = work.lastFrame;
+    }
+}
+
+struct PlannedWriter
+{
+    AppInstance::RenderWork work;
+    std::set<Node*> upstream;
+    double firstFrame, lastFrame;
+    double cost;
+    int group;
+};
+
+bool
+isCostlierWriter(const PlannedWriter* a,
+                 const PlannedWriter* b)
+{
+    return a->cost > b->cost;
+}
+
+struct WritersGroup
+{
+    std::vector<PlannedWriter*> writers;
+    double cost;
+};
+
+bool
+isCostlierGroup(const WritersGroup& a,
+                const WritersGroup& b)
+{
+    return a.cost > b.cost;
+}
+
+} // anon namespace
+
+std::list<AppInstance::RenderWork>
+AppInstance::planWritersRendering(const std::list<RenderWork>& writers)
+{
+    std::vector<PlannedWriter> planned( writers.size() );
+    std::size_t nWriters = 0;
+
+    for (std::list<RenderWork>::const_iterator it = writers.begin(); it != writers.end(); ++it, ++nWriters) {
+        PlannedWriter& w = planned[nWriters];
+        w.work = *it;
+        getUpstreamNodesRecursive(it->writer->getNode(), &w.upstream);
+        getRenderWorkFrameRange(*it, &w.firstFrame, &w.lastFrame);
+        double nFrames = 1.;
+        if (w.lastFrame >= w.firstFrame) {
+            int step = (it->frameStep == INT_MIN || it->frameStep == INT_MAX) ? 1 : std::max(1, it->frameStep);
+            nFrames = std::floor( (w.lastFrame - w.firstFrame) / step ) + 1;
+        }
+        w.cost = (w.upstream.size() + 1) * nFrames;
+        w.group = (int)nWriters;
+    }
+
+    ///Merge the groups of the writers sharing nodes and rendering some frames in common: the writers of disjoint frame
+    ///ranges never find the images of the others in the cache
+    for (std::size_t i = 0; i < nWriters; ++i) {
+        for (std::size_t j = i + 1; j < nWriters; ++j) {
+            if ( (planned[i].group != planned[j].group) &&
+                 (planned[i].firstFrame <= planned[j].lastFrame) && (planned[j].firstFrame <= planned[i].lastFrame) &&
+                 shareNodes(planned[i].upstream, planned[j].upstream) ) {
+                int from = planned[j].group;
+                for (std::size_t k = 0; k < nWriters; ++k) {
+                    if (planned[k].group == from) {
+                        planned[k].group = planned[i].group;
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<WritersGroup> groups;
+    {
+        std::map<int, std::size_t> groupIndex;
+        for (std::size_t i = 0; i < nWriters; ++i) {
+            std::map<int, std::size_t>::iterator found = groupIndex.find(planned[i].group);
+            if ( found == groupIndex.end() ) {
+                found = groupIndex.insert( std::make_pair( planned[i].group, groups.size() ) ).first;
+                groups.push_back( WritersGroup() );
+                groups.back().cost = 0;
+            }
+            groups[found->second].writers.push_back(&planned[i]);
+            groups[found->second].cost += planned[i].cost;
+        }
+    }
+    std::stable_sort(groups.begin(), groups.end(), isCostlierGroup);
+
+    std::list<RenderWork> ret;
+    for (std::vector<WritersGroup>::iterator it = groups.begin(); it != groups.end(); ++it) {
+        std::stable_sort(it->writers.begin(), it->writers.end(), isCostlierWriter);
+        boost::shared_ptr<RenderPlan> plan;
+        if (it->writers.size() > 1) {
+            plan.reset( new RenderPlan( appPTR->getHardwareIdealThreadCount() ) );
+            QString names;
+            for (std::vector<PlannedWriter*>::iterator it2 = it->writers.begin(); it2 != it->writers.end(); ++it2) {
+                names += QString::fromUtf8( (*it2)->work.writer->getScriptName_mt_safe().c_str() ) + QLatin1Char(' ');
+            }
+            qDebug() << "Writers" << names << "share upstream nodes: their frames are rendered in lockstep";
+        }
+        for (std::vector<PlannedWriter*>::iterator it2 = it->writers.begin(); it2 != it->writers.end(); ++it2) {
+            (*it2)->work.writer->setRenderPlan(plan);
+            ret.push_back( (*it2)->work );
+        }
+    }
+
+    return ret;
+} // planWritersRendering
+
+namespace {
+/// Lets the other writers of its RenderPlan know that a writer is rendering
+class RenderPlanWriterScope
+{
+    boost::shared_ptr<RenderPlan> _plan;
+    OutputEffectInstance* _writer;
+
+public:
+
+    RenderPlanWriterScope(OutputEffectInstance* writer,
+                          int firstFrame,
+                          int lastFrame)
+        : _plan( writer->getRenderPlan() )
+        , _writer(writer)
+    {
+        if (_plan) {
+            _plan->notifyWriterStarted(_writer, firstFrame, lastFrame);
+        }
+    }
+
+    ~RenderPlanWriterScope()
+    {
+        if (_plan) {
+            _plan->notifyWriterFinished(_writer);
+        }
+    }
+};
+} // anon namespace
+
 void
 AppInstance::startWritersRendering(bool enableRenderStats,bool doBlockingRender, const std::list<RenderWork>& writers)
 {
@@ -1293,8 +1492,14 @@ AppInstance::startWritersRendering(bool enableRenderStats,bool doBlockingRender,
     
     if (appPTR->isBackground() || doBlockingRender) {
         
+        std::list<RenderWork> plannedWriters = planWritersRendering(writers);
+        
         //blocking call, we don't want this function to return pre-maturely, in which case it would kill the app
-        QtConcurrent::blockingMap( writers,boost::bind(&AppInstance::startRenderingBlockingFullSequence,this,enableRenderStats, _1,false,QString()) );
+        QtConcurrent::blockingMap( plannedWriters,boost::bind(&AppInstance::startRenderingBlockingFullSequence,this,enableRenderStats, _1,false,QString()) );
+        
+        for (std::list<RenderWork>::iterator it = plannedWriters.begin(); it != plannedWriters.end(); ++it) {
+            it->writer->setRenderPlan( boost::shared_ptr<RenderPlan>() );
+        }
     } else {
         
         //Take a snapshot of the graph at this time, this will be the version loaded by the process
@@ -1314,15 +1519,7 @@ AppInstance::startRenderingBlockingFullSequence(bool enableRenderStats,const Ren
 {
     BlockingBackgroundRender backgroundRender(writerWork.writer);
     double first,last;
-    if (writerWork.firstFrame == INT_MIN || writerWork.lastFrame == INT_MAX) {
-        writerWork.writer->getFrameRange_public(writerWork.writer->getHash(), &first, &last);
-        if (first == INT_MIN || last == INT_MAX) {
-            getFrameRange(&first, &last);
-        }
-    } else {
-        first = writerWork.firstFrame;
-        last = writerWork.lastFrame;
-    }
+    getRenderWorkFrameRange(writerWork, &first, &last);
     
     int frameStep;
     if (writerWork.frameStep == INT_MAX || writerWork.frameStep == INT_MIN) {
@@ -1332,6 +1529,7 @@ AppInstance::startRenderingBlockingFullSequence(bool enableRenderStats,const Ren
         frameStep = std::max(1, writerWork.frameStep);
     }
     
+    RenderPlanWriterScope planScope(writerWork.writer, (int)first, (int)last);
     backgroundRender.blockingRender(enableRenderStats,first,last,frameStep); //< doesn't return before rendering is finished
 }
 
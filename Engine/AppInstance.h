@@ -174,6 +174,15 @@ public:
     };
     
     virtual void load(const CLArgs& cl,bool makeEmptyInstance);
+    
+    /**
+     * @brief Renders the Write nodes passed on the command line (all of them if none was passed), creating the writers
+     * for which an output filename was given. Does not return before the render is finished in background mode.
+     * If loadProject is true, the project or Python script passed on the command line is loaded first and the script
+     * passed with --onload is executed, otherwise the current project is rendered.
+     * Throws an exception if the project cannot be loaded or the writers cannot be found.
+     **/
+    void renderFromCL(const CLArgs& cl, bool loadProject);
 
     int getAppID() const;
 
@@ -259,6 +268,14 @@ public:
     {
     }
 
+    virtual void loadProjectGui(boost::archive::binary_iarchive & /*archive*/) const
+    {
+    }
+
+    virtual void saveProjectGui(boost::archive::binary_oarchive & /*archive*/)
+    {
+    }
+
     virtual void setupViewersForViews(const std::vector<std::string>& /*viewNames*/)
     {
     }
@@ -323,6 +340,18 @@ public:
     void startWritersRendering(bool enableRenderStats, bool doBlockingRender, const std::list<RenderWork>& writers);
 
     void startRenderingBlockingFullSequence(bool enableRenderStats,const RenderWork& writerWork,bool renderInSeparateProcess,const QString& savePath);
+
+    /**
+     * @brief Orders the writers rendered concurrently by a background render and gives a RenderPlan to the writers sharing
+     * upstream nodes:
+     * - writers sharing upstream nodes (transitively) and whose frame ranges overlap form a group. The writers of a group
+     * are rendered in lockstep by a RenderPlan, so that the images of the shared nodes, which are cached because they have
+     * several outputs, are computed once and found in the cache by the other writers before being evicted.
+     * - the groups are ordered by decreasing cost, estimated by the number of nodes to render times the number of frames,
+     * and so are the writers in each group: when there are more writers than threads in the pool, the longest renders
+     * start first and the writers of a group start together.
+     **/
+    static std::list<RenderWork> planWritersRendering(const std::list<RenderWork>& writers);
     
     virtual void startRenderingFullSequence(bool enableRenderStats,const RenderWork& writerWork,bool renderInSeparateProcess,const QString& savePath);
 
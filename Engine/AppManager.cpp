@@ -71,6 +71,8 @@
 #include "Engine/ExistenceCheckThread.h"
 #include "Engine/GroupInput.h"
 #include "Engine/GroupOutput.h"
+#include "Engine/ImageAllocator.h"
+#include "Engine/ImageArena.h"
 #include "Engine/LibraryBinary.h"
 #include "Engine/Log.h"
 #include "Engine/Node.h"
@@ -81,10 +83,21 @@
 #include "Engine/Project.h"
 #include "Engine/PrecompNode.h"
 #include "Engine/RotoPaint.h"
+#include "Engine/RenderDaemon.h"
+#include "Engine/RenderMetrics.h"
+#include "Engine/RenderStats.h"
 #include "Engine/RotoSmear.h"
 #include "Engine/StandardPaths.h"
+#include "Engine/TaskPool.h"
+#include "Engine/Timer.h"
 #include "Engine/ViewerInstance.h" // RenderStatsMap
 
+// The input images converted by getImage() and shared between nodes may use this fraction of the memory of the node cache
+#define NATRON_IMAGE_CONVERSION_CACHE_FRACTION 0.1
+
+// The free buffers of the temporary images recycled by the ImageArena may use this fraction of the memory of the node cache
+#define NATRON_IMAGE_ARENA_FRACTION 0.05
+
 #if QT_VERSION < 0x050000
 Q_DECLARE_METATYPE(QAbstractSocket::SocketState)
 #endif
@@ -274,6 +287,8 @@ AppManager::load(int &argc,
     }
 
     _imp->idealThreadCount = QThread::idealThreadCount();
+    _imp->taskPool.reset( new TaskPool(_imp->idealThreadCount) );
+    _imp->ofxThreadPool.reset( new OfxThreadPool(_imp->idealThreadCount) );
     QThreadPool::globalInstance()->setExpiryTimeout(-1); //< make threads never exit on their own
     //otherwise it might crash with thread local storage
 
@@ -296,6 +311,7 @@ AppManager::load(int &argc,
 
 AppManager::~AppManager()
 {
+    RenderMetrics::stopWriter();
     
 #ifdef NATRON_USE_BREAKPAD
     if (_imp->breakpadAliveThread) {
@@ -346,6 +362,9 @@ AppManager::~AppManager()
 
     ///Caches may have launched some threads to delete images, wait for them to be done
     QThreadPool::globalInstance()->waitForDone();
+    _imp->taskPool.reset();
+    _imp->ofxThreadPool.reset();
+    _imp->imageConversionCache.reset();
     
     ///Kill caches now because decreaseNCacheFilesOpened can be called
     _imp->_nodeCache->waitForDeleterThread();
@@ -558,9 +577,15 @@ AppManager::loadInternalAfterInitGui(const CLArgs& cl)
         
         U64 maxDiskCacheNode = _imp->_settings->getMaximumDiskCacheNodeSize();
         
-        _imp->_nodeCache.reset( new Cache<Image>("NodeCache",NATRON_CACHE_VERSION, maxCacheRAM - playbackSize,1.) );
+        unsigned int nCacheShards = (unsigned int)_imp->_settings->getNumberOfCacheShards();
+        
+        _imp->_nodeCache.reset( new Cache<Image>("NodeCache",NATRON_CACHE_VERSION, maxCacheRAM - playbackSize,1., nCacheShards) );
         _imp->_diskCache.reset( new Cache<Image>("DiskCache",NATRON_CACHE_VERSION, maxDiskCacheNode,0.) );
-        _imp->_viewerCache.reset( new Cache<FrameEntry>("ViewerCache",NATRON_CACHE_VERSION,viewerCacheSize,(double)playbackSize / (double)viewerCacheSize) );
+        _imp->_viewerCache.reset( new Cache<FrameEntry>("ViewerCache",NATRON_CACHE_VERSION,viewerCacheSize,(double)playbackSize / (double)viewerCacheSize, nCacheShards) );
+        _imp->imageConversionCache.reset( new ImageConversionCache( (maxCacheRAM - playbackSize) * NATRON_IMAGE_CONVERSION_CACHE_FRACTION ) );
+        ImageArena::setMaximumMemory( (maxCacheRAM - playbackSize) * NATRON_IMAGE_ARENA_FRACTION, _imp->idealThreadCount );
+        ImageAllocator::setHugePagesEnabled( _imp->_settings->isHugePagesForImagesEnabled() );
+        ImageAllocator::setFirstTouchEnabled( _imp->_settings->isFirstTouchForImagesEnabled() );
     } catch (std::logic_error) {
         // ignore
     }
@@ -605,6 +630,12 @@ AppManager::loadInternalAfterInitGui(const CLArgs& cl)
         _imp->initProcessInputChannel(cl.getIPCPipeName());
     }
     
+    if ( !cl.getMetricsFilePath().isEmpty() ) {
+        if ( !RenderMetrics::startWriter(cl.getMetricsFilePath(), 1000) ) {
+            std::cerr << QObject::tr("WARNING: --metrics: could not open %1 for writing.").arg( cl.getMetricsFilePath() ).toStdString() << std::endl;
+        }
+    }
+    
     
     if (cl.isInterpreterMode()) {
         _imp->_appType = eAppTypeInterpreter;
@@ -622,6 +653,32 @@ AppManager::loadInternalAfterInitGui(const CLArgs& cl)
         _imp->_appType = eAppTypeGui;
     }
     
+    if ( !cl.getDaemonServerName().isEmpty() ) {
+        ///Each job of the daemon is rendered as a background project auto-run, in an instance that stays alive
+        _imp->_appType = eAppTypeBackgroundAutoRun;
+        AppInstance* daemonInstance = newAppInstance(cl, true);
+        if (!daemonInstance) {
+            return false;
+        }
+        onLoadCompleted();
+        
+        bool ok = RenderDaemon::exec(daemonInstance, cl.getDaemonServerName());
+        if ( getAppInstance( daemonInstance->getAppID() ) ) {
+            try {
+                daemonInstance->getProject()->closeProject(true);
+            } catch (std::logic_error) {
+                // ignore
+            }
+            try {
+                daemonInstance->quit();
+            } catch (std::logic_error) {
+                // ignore
+            }
+        }
+        
+        return ok;
+    }
+    
     //Now that the locale is set, re-parse the command line arguments because the filenames might have non UTF-8 encodings
     CLArgs args;
     if (!cl.getScriptFilename().isEmpty()) {
@@ -784,6 +841,8 @@ AppManager::clearNodeCache()
         it->second.app->clearAllLastRenderedImages();
     }
     _imp->_nodeCache->clear();
+    _imp->imageConversionCache->clear();
+    ImageArena::clear();
 }
 
 void
@@ -902,6 +961,8 @@ AppManager::setApplicationsCachesMaximumMemoryPercent(double p)
 
     _imp->_nodeCache->setMaximumCacheSize(maxCacheRAM - playbackSize);
     _imp->_nodeCache->setMaximumInMemorySize(1);
+    _imp->imageConversionCache->setMaximumMemory( (maxCacheRAM - playbackSize) * NATRON_IMAGE_CONVERSION_CACHE_FRACTION );
+    ImageArena::setMaximumMemory( (maxCacheRAM - playbackSize) * NATRON_IMAGE_ARENA_FRACTION, _imp->idealThreadCount );
     U64 maxDiskCacheSize = _imp->_settings->getMaximumViewerDiskCacheSize();
     _imp->_viewerCache->setMaximumInMemorySize( (double)playbackSize / (double)maxDiskCacheSize );
 }
@@ -930,6 +991,8 @@ AppManager::setPlaybackCacheMaximumSize(double p)
 
     _imp->_nodeCache->setMaximumCacheSize(maxCacheRAM - playbackSize);
     _imp->_nodeCache->setMaximumInMemorySize(1);
+    _imp->imageConversionCache->setMaximumMemory( (maxCacheRAM - playbackSize) * NATRON_IMAGE_CONVERSION_CACHE_FRACTION );
+    ImageArena::setMaximumMemory( (maxCacheRAM - playbackSize) * NATRON_IMAGE_ARENA_FRACTION, _imp->idealThreadCount );
     U64 maxDiskCacheSize = _imp->_settings->getMaximumViewerDiskCacheSize();
     _imp->_viewerCache->setMaximumInMemorySize( (double)playbackSize / (double)maxDiskCacheSize );
 }
@@ -944,12 +1007,17 @@ AppManager::loadAllPlugins()
     std::map<std::string,std::vector< std::pair<std::string,double> > > readersMap;
     std::map<std::string,std::vector< std::pair<std::string,double> > > writersMap;
 
+    ///Time each step for the startup timing report
+    TimeLapse timer;
+    
     /*loading node plugins*/
 
     loadBuiltinNodePlugins(&readersMap, &writersMap);
+    double builtinTime = timer.getTimeSinceCreation();
 
     /*loading ofx plugins*/
-    _imp->ofxHost->loadOFXPlugins( &readersMap, &writersMap);
+    OfxHost::PluginsLoadReport ofxReport;
+    _imp->ofxHost->loadOFXPlugins( &readersMap, &writersMap, &ofxReport);
     
     _imp->_settings->populateReaderPluginsAndFormats(readersMap);
     _imp->_settings->populateWriterPluginsAndFormats(writersMap);
@@ -958,12 +1026,20 @@ AppManager::loadAllPlugins()
     
     //Load python groups and init.py & initGui.py scripts
     //Should be done after settings are declared
+    double pythonStartTime = timer.getTimeSinceCreation();
     loadPythonGroups();
+    double pythonTime = timer.getTimeSinceCreation() - pythonStartTime;
 
     _imp->_settings->populatePluginsTab();
 
     
     onAllPluginsLoaded();
+    
+    qDebug() << "Plug-ins loaded in" << timer.getTimeSinceCreation() << "s: built-in" << builtinTime
+             << "s, OpenFX" << ofxReport.totalTime << "s (" << ofxReport.nBundles << "bundles,"
+             << ofxReport.nChangedBundles << "new or changed, prefetch" << ofxReport.prefetchTime
+             << "s, scan" << ofxReport.scanTime << "s, cache" << (ofxReport.cacheWritten ? "written" : "up to date")
+             << "), Python" << pythonTime << "s";
 }
 
 void
@@ -1826,6 +1902,39 @@ AppManager::getCachesTotalMemorySize() const
     return _imp->_viewerCache->getMemoryCacheSize() + _imp->_nodeCache->getMemoryCacheSize();
 }
 
+double
+AppManager::getNodeCacheMemoryOccupancy() const
+{
+    std::size_t maxSize = _imp->_nodeCache->getMaximumMemorySize();
+
+    return maxSize == 0 ? 0. : (double)_imp->_nodeCache->getMemoryCacheSize() / maxSize;
+}
+
+int
+AppManager::getNodeCacheNumEvictions() const
+{
+    return _imp->_nodeCache->getNumEvictions();
+}
+
+std::size_t
+AppManager::getNodeCacheMemorySize() const
+{
+    return _imp->_nodeCache->getMemoryCacheSize();
+}
+
+U64
+AppManager::getImageMemoryAllocated() const
+{
+    return (U64)RenderMetrics::getSnapshot().values[eRenderMetricImageMemoryAllocated] * NATRON_RENDER_METRICS_MEMORY_UNIT;
+}
+
+void
+AppManager::notifyImageMemoryAllocated(std::size_t size)
+{
+    ///Counted in the striped counters of the metrics: the render threads allocating images do not contend on a lock
+    RenderMetrics::add( eRenderMetricImageMemoryAllocated, (int)( (size + NATRON_RENDER_METRICS_MEMORY_UNIT - 1) / NATRON_RENDER_METRICS_MEMORY_UNIT ) );
+}
+
 CacheSignalEmitter*
 AppManager::getOrActivateViewerCacheSignalEmitter() const
 {
@@ -2087,6 +2196,11 @@ AppManager::checkCacheFreeMemoryIsGoodEnough()
     
 
     double playbackRAMPercent = appPTR->getCurrentSettings()->getRamPlaybackMaximumPercent();
+    if (totalFreeRAM <= systemRAMToKeepFree) {
+        ///The free buffers of the temporary images are the cheapest to give back
+        ImageArena::clear();
+        totalFreeRAM = getAmountFreePhysicalRAM();
+    }
     while (totalFreeRAM <= systemRAMToKeepFree) {
         
         size_t nodeCacheSize =  _imp->_nodeCache->getMemoryCacheSize();
@@ -2146,8 +2260,20 @@ AppManager::getOCIOConfigPath() const
 void
 AppManager::setNThreadsToRender(int nThreads)
 {
-    QMutexLocker l(&_imp->nThreadsMutex);
-    _imp->nThreadsToRender = nThreads;
+    {
+        QMutexLocker l(&_imp->nThreadsMutex);
+        _imp->nThreadsToRender = nThreads;
+    }
+    if (_imp->taskPool) {
+        ///-1 means no multi-threading at all: the tasks are executed by the thread that starts them
+        if (nThreads == -1) {
+            _imp->taskPool->setMaxThreadCount(0);
+        } else if (nThreads == 0) {
+            _imp->taskPool->setMaxThreadCount(_imp->idealThreadCount);
+        } else {
+            _imp->taskPool->setMaxThreadCount(nThreads);
+        }
+    }
 }
 
 void
@@ -2192,6 +2318,24 @@ AppManager::getNRunningThreads() const
     return (int)_imp->runningThreadsCount;
 }
 
+TaskPool*
+AppManager::getTaskPool() const
+{
+    return _imp->taskPool.get();
+}
+
+OfxThreadPool*
+AppManager::getOfxThreadPool() const
+{
+    return _imp->ofxThreadPool.get();
+}
+
+ImageConversionCache*
+AppManager::getImageConversionCache() const
+{
+    return _imp->imageConversionCache.get();
+}
+
 void
 AppManager::setThreadAsActionCaller(OfxImageEffectInstance* instance, bool actionCaller)
 {
@@ -3070,7 +3214,13 @@ Python::makeNameScriptFriendly(const std::string& str)
 PythonGILLocker::PythonGILLocker()
 //    : state(PyGILState_UNLOCKED)
 {
-    appPTR->takeNatronGIL();
+    if ( RenderStatsThreadScope::isActiveForCurrentThread() ) {
+        TimeLapse waitTimer;
+        appPTR->takeNatronGIL();
+        RenderStatsThreadScope::reportWait( eRenderTraceEventTypePythonWait, waitTimer.getTimeSinceCreation() );
+    } else {
+        appPTR->takeNatronGIL();
+    }
 //    ///Take the GIL for this thread
 //    state = PyGILState_Ensure();
 //    assert(PyThreadState_Get());
@@ -251,6 +251,32 @@ public:
 
     U64 getCachesTotalMemorySize() const;
 
+    /**
+     * @brief Returns the in-memory size of the node cache divided by its maximum in-memory size
+     **/
+    double getNodeCacheMemoryOccupancy() const;
+
+    /**
+     * @brief Returns the number of images evicted from the RAM portion of the node cache, see Cache::getNumEvictions()
+     **/
+    int getNodeCacheNumEvictions() const;
+
+    /**
+     * @brief Returns the in-memory size of the node cache in bytes
+     **/
+    std::size_t getNodeCacheMemorySize() const;
+
+    /**
+     * @brief Returns the number of bytes of RAM allocated for images since the application started, images released
+     * in the meantime included. This is used to estimate the memory needed to render a frame.
+     **/
+    U64 getImageMemoryAllocated() const;
+
+    /**
+     * @brief Called by the images each time they allocate their buffer in RAM
+     **/
+    void notifyImageMemoryAllocated(std::size_t size);
+
     CacheSignalEmitter* getOrActivateViewerCacheSignalEmitter() const;
 
     void setApplicationsCachesMaximumMemoryPercent(double p);
@@ -416,6 +442,23 @@ public:
      **/
     int getNRunningThreads() const;
     
+    /**
+     * @brief Returns the pool of threads used to render tiles, by the multi-thread suite and by the viewer.
+     * Its size follows the Number of render threads setting.
+     **/
+    TaskPool* getTaskPool() const;
+    
+    /**
+     * @brief Returns the persistent threads of the OpenFX multi-thread suite, for the plug-ins that cannot run on the TaskPool.
+     **/
+    OfxThreadPool* getOfxThreadPool() const;
+    
+    /**
+     * @brief Returns the cache of the input images converted to another bit depth, components or mipmap level by
+     * EffectInstance::getImage(). Its maximum size is a fraction of the node cache.
+     **/
+    ImageConversionCache* getImageConversionCache() const;
+    
     void setThreadAsActionCaller(OfxImageEffectInstance* instance, bool actionCaller);
 
     /**
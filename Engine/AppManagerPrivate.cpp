@@ -31,6 +31,7 @@
 
 #include <cstddef>
 #include <cstdlib>
+#include <cstdio> // for std::remove
 #include <stdexcept>
 
 GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
@@ -119,6 +120,9 @@ AppManagerPrivate::AppManagerPrivate()
 ,useThreadPool(true)
 ,nThreadsMutex()
 ,runningThreadsCount()
+,taskPool()
+,ofxThreadPool()
+,imageConversionCache()
 ,lastProjectLoadedCreatedDuringRC2Or3(false)
 ,args()
 ,mainModule(0)
@@ -318,6 +322,14 @@ AppManagerPrivate::declareSettingsToPython()
 template <typename T>
 void saveCache(Cache<T>* cache)
 {
+    if ( cache->hasJournal() ) {
+        ///Entries are recorded in the journal as soon as they are flushed to the disk portion:
+        ///there is no table of contents to write, just flush the memory portion.
+        cache->clearInMemoryPortion(false);
+
+        return;
+    }
+
     std::ofstream ofile;
     ofile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
     std::string cacheRestoreFilePath = cache->getRestoreFilePath();
@@ -362,7 +374,37 @@ AppManagerPrivate::saveCaches()
 } // saveCaches
 
 template <typename T>
-void restoreCache(AppManagerPrivate* p,Cache<T>* cache)
+void restoreCacheFromJournal(Cache<T>* cache,
+                             const CacheJournal::RecordList & records,
+                             std::set<std::string>* cacheFiles)
+{
+    typename Cache<T>::CacheTOC tableOfContents;
+
+    for (CacheJournal::RecordList::const_iterator it = records.begin(); it != records.end(); ++it) {
+        if (cacheFiles->erase(it->filePath) == 0) {
+            ///The file was removed since it was recorded
+            continue;
+        }
+        typename Cache<T>::SerializedEntry serialization;
+        if ( Cache<T>::deserializeJournalEntry(it->data, &serialization) ) {
+            tableOfContents.push_back(serialization);
+        } else {
+            std::remove( it->filePath.c_str() );
+        }
+    }
+
+    ///The remaining files are not referenced by the journal: they belong to entries that were in the
+    ///memory portion when the application exited without saving the cache.
+    for (std::set<std::string>::const_iterator it = cacheFiles->begin(); it != cacheFiles->end(); ++it) {
+        std::remove( it->c_str() );
+    }
+
+    ///The files were listed, no need to check again that each of them exists
+    cache->restore(tableOfContents, false);
+}
+
+template <typename T>
+void restoreCacheFromFile(AppManagerPrivate* p,Cache<T>* cache)
 {
     if ( p->checkForCacheDiskStructure( cache->getCachePath() ) ) {
         std::ifstream ifile;
@@ -412,6 +454,29 @@ void restoreCache(AppManagerPrivate* p,Cache<T>* cache)
     }
 }
 
+template <typename T>
+void restoreCache(AppManagerPrivate* p,Cache<T>* cache)
+{
+    boost::shared_ptr<CacheJournal> journal( new CacheJournal( cache->getJournalFilePath(), cache->cacheVersion() ) );
+
+    if ( QFile::exists( journal->getFilePath().c_str() ) ) {
+        CacheJournal::RecordList records;
+        std::set<std::string> cacheFiles;
+        if ( !journal->replay(&records) ) {
+            //Only load caches with same version, otherwise wipe it!
+            p->cleanUpCacheDiskStructure( cache->getCachePath() );
+        } else if ( p->checkForCacheDiskStructure(cache->getCachePath(), &cacheFiles) ) {
+            restoreCacheFromJournal(cache, records, &cacheFiles);
+        }
+    } else {
+        ///Cache saved by a version of Natron that did not have the journal
+        restoreCacheFromFile(p, cache);
+    }
+
+    ///From now on, the disk portion is recorded in the journal so it survives a crash
+    cache->setJournal(journal, &Cache<T>::serializeJournalEntry);
+}
+
 void
 AppManagerPrivate::restoreCaches()
 {
@@ -423,11 +488,13 @@ AppManagerPrivate::restoreCaches()
 } // restoreCaches
 
 bool
-AppManagerPrivate::checkForCacheDiskStructure(const QString & cachePath)
+AppManagerPrivate::checkForCacheDiskStructure(const QString & cachePath,
+                                              std::set<std::string>* cacheFiles)
 {
     QString settingsFilePath(cachePath + QDir::separator() + "restoreFile." NATRON_CACHE_FILE_EXT);
+    QString journalFilePath(cachePath + QDir::separator() + NATRON_CACHE_JOURNAL_FILE_NAME);
 
-    if ( !QFile::exists(settingsFilePath) ) {
+    if ( !QFile::exists(settingsFilePath) && !QFile::exists(journalFilePath) ) {
         cleanUpCacheDiskStructure(cachePath);
 
         return false;
@@ -454,6 +521,10 @@ AppManagerPrivate::checkForCacheDiskStructure(const QString & cachePath)
             for (int j = 0; j < items.size(); ++j) {
                 if ( ( items[j] != QString(".") ) && ( items[j] != QString("..") ) ) {
                     ++count;
+                    if (cacheFiles) {
+                        ///Same separators as the paths generated by the cache entries
+                        cacheFiles->insert( ( cachePath + QChar('/') + files[i] + QChar('/') + items[j] ).toStdString() );
+                    }
                 }
             }
         }
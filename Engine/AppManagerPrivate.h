@@ -27,6 +27,9 @@
 
 #include "Global/Macros.h"
 
+#include <set>
+#include <string>
+
 #include <QtCore/QMutex>
 #include <QtCore/QString>
 #include <QtCore/QAtomicInt>
@@ -48,7 +51,10 @@
 #include "Engine/Cache.h"
 #include "Engine/FrameEntry.h"
 #include "Engine/Image.h"
+#include "Engine/ImageConversionCache.h"
+#include "Engine/OfxThreadPool.h"
 #include "Engine/EngineFwd.h"
+#include "Engine/TaskPool.h"
 #include "Engine/TLSHolder.h"
 
 NATRON_NAMESPACE_ENTER;
@@ -110,6 +116,11 @@ struct AppManagerPrivate
     // Another method could be to analyse all cores running, but this is way more expensive and would impair performances.
     QAtomicInt runningThreadsCount;
     
+    boost::scoped_ptr<TaskPool> taskPool; // the work-stealing pool shared by tiled renders, the multi-thread suite and the viewer
+    boost::scoped_ptr<OfxThreadPool> ofxThreadPool; // the threads of the multi-thread suite for plug-ins that cannot use taskPool
+    
+    boost::scoped_ptr<ImageConversionCache> imageConversionCache; // input images converted by getImage, shared between nodes
+    
      //To by-pass a bug introduced in RC2 / RC3 with the serialization of bezier curves
     bool lastProjectLoadedCreatedDuringRC2Or3;
     
@@ -150,7 +161,11 @@ struct AppManagerPrivate
 
     void restoreCaches();
 
-    bool checkForCacheDiskStructure(const QString & cachePath);
+    /**
+     * @brief Returns false and resets the cache directory if it does not look like a valid cache.
+     * @param cacheFiles If not NULL, filled with the path of all files found in the cache sub-folders
+     **/
+    bool checkForCacheDiskStructure(const QString & cachePath, std::set<std::string>* cacheFiles = 0);
 
     void cleanUpCacheDiskStructure(const QString & cachePath);
 
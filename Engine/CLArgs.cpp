@@ -63,6 +63,13 @@ struct CLArgsPrivate
     
     bool enableRenderStats;
     
+    QString metricsFilePath;
+    
+    QString daemonServerName;
+    
+    QString submitServerName;
+    QStringList submitArgs;
+    
     bool isEmpty;
     
     mutable QString imageFilename;
@@ -89,6 +96,10 @@ struct CLArgsPrivate
     , frameRanges()
     , rangeSet(false)
     , enableRenderStats(false)
+    , metricsFilePath()
+    , daemonServerName()
+    , submitServerName()
+    , submitArgs()
     , isEmpty(true)
     , imageFilename()
     , breakpadPipeFilePath()
@@ -184,6 +195,10 @@ CLArgs::operator=(const CLArgs& other)
     _imp->frameRanges = other._imp->frameRanges;
     _imp->rangeSet = other._imp->rangeSet;
     _imp->enableRenderStats = other._imp->enableRenderStats;
+    _imp->metricsFilePath = other._imp->metricsFilePath;
+    _imp->daemonServerName = other._imp->daemonServerName;
+    _imp->submitServerName = other._imp->submitServerName;
+    _imp->submitArgs = other._imp->submitArgs;
     _imp->isEmpty = other._imp->isEmpty;
     _imp->imageFilename = other._imp->imageFilename;
 }
@@ -270,9 +285,29 @@ CLArgs::printUsage(const std::string& programName)
                               "     each frame in form of a file located next to the image produced by\n"
                               "     the Writer node, with the same name and a -stats.txt extension. The\n"
                               "     breakdown contains informations about each nodes, render times etc...\n"
+                              "     A trace of the render is also written with a -stats.json extension, in\n"
+                              "     the Chrome trace event format (chrome://tracing, Perfetto): it has the\n"
+                              "     tiles rendered by each thread, the cache hits and misses, and the time\n"
+                              "     spent waiting for images rendered by other threads and for Python.\n"
                               "     This option is useful for debugging purposes or to control that a render\n"
                               "     is working correctly.\n"
-                              "     **Please note** that it does not work when writing video files."
+                              "     **Please note** that it does not work when writing video files.\n"
+                              "  --metrics <file path> : Appends every second to the given file a line of\n"
+                              "     JSON with the counters of the render engine: cache hits, misses and\n"
+                              "     evictions, tiles and frames rendered and in flight, histograms of the\n"
+                              "     tile and frame render times, memory used by the caches and activity\n"
+                              "     of the threads. The file can be watched (e.g: tail -f) while a long\n"
+                              "     render is running.\n"
+                              "  --daemon <server name> : Instead of rendering a project, stays resident\n"
+                              "     with the plug-ins loaded and renders the jobs sent by\n"
+                              "     %1Renderer --submit to the local socket of the given name, one after\n"
+                              "     the other. A project is only loaded again if it changed on disk or\n"
+                              "     the previous job modified it, so that the caches stay warm between\n"
+                              "     jobs rendering the same project.\n"
+                              "  --submit <server name> <project file path> [options] : Sends the rest of\n"
+                              "     the command line as a job to the %1Renderer --daemon listening on\n"
+                              "     the given local socket and waits for the render to finish.\n"
+                              "     The exit code is 0 if the job succeeded.\n"
                               "Sample uses:\n"
                               "  %1 /Users/Me/MyNatronProjects/MyProject.ntp\n"
                               "  %1 -b -w MyWriter /Users/Me/MyNatronProjects/MyProject.ntp\n"
@@ -280,6 +315,8 @@ CLArgs::printUsage(const std::string& programName)
                               "  %1Renderer -w MyWriter /FastDisk/Pictures/sequence'###'.exr 1-100 /Users/Me/MyNatronProjects/MyProject.ntp\n"
                               "  %1Renderer -w MyWriter -w MySecondWriter 1-10 /Users/Me/MyNatronProjects/MyProject.ntp\n"
                               "  %1Renderer -w MyWriter 1-10 -l /Users/Me/Scripts/onProjectLoaded.py /Users/Me/MyNatronProjects/MyProject.ntp\n"
+                              "  %1Renderer --daemon MyDaemon\n"
+                              "  %1Renderer --submit MyDaemon -w MyWriter 1-10 /Users/Me/MyNatronProjects/MyProject.ntp\n"
                               "\n"
                               /* Text must hold in 80 columns ************************************************/
                               "Options for the execution of Python scripts:\n"
@@ -414,6 +451,30 @@ CLArgs::getIPCPipeName() const
     return _imp->ipcPipe;
 }
 
+const QString&
+CLArgs::getMetricsFilePath() const
+{
+    return _imp->metricsFilePath;
+}
+
+const QString&
+CLArgs::getDaemonServerName() const
+{
+    return _imp->daemonServerName;
+}
+
+const QString&
+CLArgs::getSubmitServerName() const
+{
+    return _imp->submitServerName;
+}
+
+const QStringList&
+CLArgs::getSubmitArguments() const
+{
+    return _imp->submitArgs;
+}
+
 bool
 CLArgs::areRenderStatsEnabled() const
 {
@@ -629,6 +690,24 @@ CLArgsPrivate::parse()
         }
     }
     
+    {
+        QStringList::iterator it = hasToken("submit", "");
+        if (it != args.end()) {
+            it = args.erase(it);
+            if (it != args.end()) {
+                submitServerName = *it;
+                args.erase(it);
+            } else {
+                std::cout << QObject::tr("--submit specified, you must enter the server name of a daemon afterwards.").toStdString() << std::endl;
+                error = 1;
+                return;
+            }
+            ///The job is parsed by the daemon, do not interpret the remaining arguments here
+            submitArgs = args.mid(1);
+            return;
+        }
+    }
+    
     {
         QStringList::iterator it = hasToken("background", "b");
         if (it != args.end()) {
@@ -656,6 +735,44 @@ CLArgsPrivate::parse()
         }
     }
     
+    {
+        QStringList::iterator it = hasToken("metrics", "");
+        if (it != args.end()) {
+            it = args.erase(it);
+            if (it != args.end()) {
+                metricsFilePath = *it;
+#ifdef __NATRON_UNIX__
+                metricsFilePath = AppManager::qt_tildeExpansion(metricsFilePath);
+#endif
+                args.erase(it);
+            } else {
+                std::cout << QObject::tr("--metrics specified, you must enter a file path afterwards.").toStdString() << std::endl;
+                error = 1;
+                return;
+            }
+        }
+    }
+    
+    {
+        QStringList::iterator it = hasToken("daemon", "");
+        if (it != args.end()) {
+            it = args.erase(it);
+            if (it != args.end()) {
+                daemonServerName = *it;
+                args.erase(it);
+            } else {
+                std::cout << QObject::tr("--daemon specified, you must enter a server name afterwards.").toStdString() << std::endl;
+                error = 1;
+                return;
+            }
+            if (!isBackground) {
+                std::cout << QObject::tr("--daemon can only be used with %1Renderer or in background mode.").arg(NATRON_APPLICATION_NAME).toStdString() << std::endl;
+                error = 1;
+                return;
+            }
+        }
+    }
+    
     {
         QStringList::iterator it = hasToken(NATRON_BREAKPAD_PROCESS_PID, "");
         if (it != args.end()) {
@@ -777,7 +894,7 @@ CLArgsPrivate::parse()
         QStringList::iterator it = findFileNameWithExtension(NATRON_PROJECT_FILE_EXT);
         if (it == args.end()) {
             it = findFileNameWithExtension("py");
-            if (it == args.end() && !isInterpreterMode && isBackground) {
+            if (it == args.end() && !isInterpreterMode && isBackground && daemonServerName.isEmpty()) {
                 std::cout << QObject::tr("You must specify the filename of a script or %1 project. (.%2)").arg(NATRON_APPLICATION_NAME).arg(NATRON_PROJECT_FILE_EXT).toStdString() << std::endl;
                 error = 1;
                 return;
@@ -106,6 +106,24 @@ public:
     
     const QString& getIPCPipeName() const;
     
+    /**
+     * @brief The file to which the render metrics are periodically appended, empty if --metrics was not given
+     **/
+    const QString& getMetricsFilePath() const;
+    
+    /**
+     * @brief The name of the local socket on which the render daemon listens, empty if --daemon was not given
+     **/
+    const QString& getDaemonServerName() const;
+    
+    /**
+     * @brief The name of the local socket of the daemon to which the job must be sent, empty if --submit was not given.
+     * In that case the other arguments are not parsed and getSubmitArguments() returns them.
+     **/
+    const QString& getSubmitServerName() const;
+    
+    const QStringList& getSubmitArguments() const;
+    
     bool isPythonScript() const;
     
     bool areRenderStatsEnabled() const;
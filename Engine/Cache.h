@@ -39,6 +39,7 @@
 #include "Global/GlobalDefines.h"
 #include "Global/MemoryInfo.h"
 GCC_DIAG_OFF(deprecated)
+#include <QtCore/QAtomicInt>
 #include <QtCore/QMutex>
 #include <QtCore/QThread>
 #include <QtCore/QWaitCondition>
@@ -54,7 +55,9 @@ GCC_DIAG_ON(deprecated)
 #include "Engine/AppManager.h" //for access to settings
 #include "Engine/Settings.h"
 #include "Engine/CacheEntry.h"
+#include "Engine/CacheJournal.h"
 #include "Engine/LRUHashTable.h"
+#include "Engine/RenderMetrics.h"
 #include "Engine/StandardPaths.h"
 #include "Engine/ImageLocker.h"
 #include "Global/MemoryInfo.h"
@@ -388,6 +391,9 @@ public:
 
     typedef std::list< SerializedEntry > CacheTOC;
 
+    ///Serializes the table of contents entry of an entry stored on disk, @see serializeJournalEntry()
+    typedef std::string (*JournalSerializeFunc)(const EntryType & entry);
+
 public:
 
 
@@ -453,6 +459,32 @@ public:
 
 private:
 
+    /**
+     * @brief A shard owns a portion of the hash space of the cache: an entry belongs to the shard
+     * hash % nShards. Each shard has its own LRU containers and its own locks so that threads
+     * looking-up entries that fall in different shards do not wait for each other.
+     * With a single shard the cache behaves as if it had a global lock.
+     **/
+    struct CacheShard
+    {
+        mutable QMutex lock; //protects memoryCache & diskCache
+        mutable QMutex getLock;  //prevents get() and getOrCreate() to be called simultaneously on this shard
+
+        /*These 2 are mutable because we need to modify the LRU list even
+           when we call get() and we want this function to be const.*/
+        mutable CacheContainer memoryCache;
+        mutable CacheContainer diskCache;
+
+        CacheShard()
+            : lock()
+            , getLock()
+            , memoryCache()
+            , diskCache()
+        {
+        }
+    };
+
+    typedef boost::shared_ptr<CacheShard> CacheShardPtr;
 
     std::size_t _maximumInMemorySize;     // the maximum size of the in-memory portion of the cache.(in % of the maximum cache size)
     std::size_t _maximumCacheSize;     // maximum size allowed for the cache
@@ -460,16 +492,15 @@ private:
     /*mutable because we need to change modify it in the sealEntryInternal function which
          is called by an external object that have a const ref to the cache.
      */
-    mutable std::size_t _memoryCacheSize;     // current size of the cache in bytes
+    mutable std::size_t _memoryCacheSize;     // current size of the cache in bytes, this is the sum of _shardsMemorySize
     mutable std::size_t _diskCacheSize;
-    mutable QMutex _sizeLock; // protects _memoryCacheSize & _diskCacheSize & _maximumInMemorySize & _maximumCacheSize
-    mutable QMutex _lock; //protects _memoryCache & _diskCache
-    mutable QMutex _getLock;  //prevents get() and getOrCreate() to be called simultaneously
-
-    /*These 2 are mutable because we need to modify the LRU list even
-         when we call get() and we want this function to be const.*/
-    mutable CacheContainer _memoryCache;
-    mutable CacheContainer _diskCache;
+    mutable std::vector<std::size_t> _shardsMemorySize; // current size in bytes of the in-memory portion of each shard
+    mutable std::size_t _evictionCursor; // round-robin index of the shard to evict from when no shard is preferred
+    mutable QMutex _sizeLock; // protects _memoryCacheSize & _diskCacheSize & _shardsMemorySize & _evictionCursor & _maximumInMemorySize & _maximumCacheSize
+    mutable QAtomicInt _nEvictions; // number of entries evicted from the in-memory portion, wraps around
+
+    ///The shards themselves are created in the constructor and the vector is never modified afterwards
+    std::vector<CacheShardPtr> _shards;
     const std::string _cacheName;
     const unsigned int _version;
 
@@ -484,6 +515,11 @@ private:
     mutable QWaitCondition _memoryFullCondition; //< protected by _sizeLock
     mutable CacheCleanerThread _cleanerThread;
 
+    ///When set, every entry entering the disk portion and every removed backing file is recorded in the journal
+    mutable QMutex _journalLock; // protects _journal & _journalSerializer
+    boost::shared_ptr<CacheJournal> _journal;
+    JournalSerializeFunc _journalSerializer;
+
 public:
 
 
@@ -493,17 +529,19 @@ public:
           ,
           U64 maximumCacheSize      // total size
           ,
-          double maximumInMemoryPercentage)      //how much should live in RAM
+          double maximumInMemoryPercentage      //how much should live in RAM
+          ,
+          unsigned int nShards = 1)      //how many independently locked portions of the hash space
         : CacheAPI()
         , _maximumInMemorySize(maximumCacheSize * maximumInMemoryPercentage)
         , _maximumCacheSize(maximumCacheSize)
         , _memoryCacheSize(0)
         , _diskCacheSize(0)
+        , _shardsMemorySize(std::max(nShards, 1U), 0)
+        , _evictionCursor(0)
         , _sizeLock()
-        , _lock()
-        , _getLock()
-        , _memoryCache()
-        , _diskCache()
+        , _nEvictions(0)
+        , _shards()
         , _cacheName(cacheName)
         , _version(version)
         , _signalEmitter(new CacheSignalEmitter)
@@ -512,16 +550,23 @@ public:
         , _deleterThread(this)
         , _memoryFullCondition()
         , _cleanerThread(this)
+        , _journalLock()
+        , _journal()
+        , _journalSerializer(0)
     {
+        for (std::size_t i = 0; i < _shardsMemorySize.size(); ++i) {
+            _shards.push_back( CacheShardPtr(new CacheShard) );
+        }
     }
 
     virtual ~Cache()
     {
-        QMutexLocker locker(&_lock);
-
         _tearingDown = true;
-        _memoryCache.clear();
-        _diskCache.clear();
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            QMutexLocker locker(&_shards[i]->lock);
+            _shards[i]->memoryCache.clear();
+            _shards[i]->diskCache.clear();
+        }
         delete _signalEmitter;
     }
 
@@ -531,6 +576,12 @@ public:
         _cleanerThread.quitThread();
     }
 
+    // const data member: no need to take the lock
+    std::size_t getNumberOfShards() const
+    {
+        return _shards.size();
+    }
+
     /**
      * @brief Look-up the cache for an entry whose key matches the params.
      * @param params The key identifying the entry we're looking for.
@@ -545,22 +596,138 @@ public:
     bool get(const typename EntryType::key_type & key,
              std::list<EntryTypePtr>* returnValue) const
     {
-        ///Be atomic, so it cannot be created by another thread in the meantime
-        QMutexLocker getlocker(&_getLock);
+        CacheShard & shard = getShard( key.getHash() );
+        std::list<EntryTypePtr> entriesToJournal;
+        bool found;
+        {
+            ///Be atomic, so it cannot be created by another thread in the meantime
+            QMutexLocker getlocker(&shard.getLock);
 
-        ///lock the cache before reading it.
-        QMutexLocker locker(&_lock);
+            ///lock the shard before reading it.
+            QMutexLocker locker(&shard.lock);
+            found = getInternal(shard, key, returnValue, &entriesToJournal);
+        }
+        journalAdditions(entriesToJournal);
+        RenderMetrics::add(found ? eRenderMetricCacheHits : eRenderMetricCacheMisses);
 
-        return getInternal(key, returnValue);
+        return found;
     } // get
 
 private:
 
+    std::size_t getShardIndex(U64 hash) const
+    {
+        ///Hash64 mixes all its bits, the modulo is enough to spread entries evenly across shards
+        return _shards.size() == 1 ? 0 : (std::size_t)(hash % _shards.size());
+    }
+
+    CacheShard & getShard(U64 hash) const
+    {
+        return *_shards[getShardIndex(hash)];
+    }
+
+    /**
+     * @brief Accounts a change of the in-memory size of an entry to its shard and to the whole cache.
+     * _sizeLock must be taken.
+     **/
+    void updateMemorySize(U64 hash,
+                          std::size_t added,
+                          std::size_t removed) const
+    {
+        assert( !_sizeLock.tryLock() );
+
+        ///Avoid overflows, the sizes may not always fallback to 0
+        std::size_t & shardSize = _shardsMemorySize[getShardIndex(hash)];
+        shardSize = removed > shardSize + added ? 0 : shardSize + added - removed;
+        _memoryCacheSize = removed > _memoryCacheSize + added ? 0 : _memoryCacheSize + added - removed;
+    }
+
+    /**
+     * @brief Evicts LRU entries from the in-memory portion until its occupation is under NATRON_CACHE_LIMIT_PERCENT.
+     * The shard preferredShard is evicted first, then the shards holding the most memory. Only one shard lock
+     * is held at a time so that this cannot deadlock with threads working on other shards.
+     * The shards locks must not be taken.
+     **/
+    void evictUntilUnderMemoryLimit(std::size_t preferredShard,
+                                    std::list<EntryTypePtr> & entriesToBeDeleted) const
+    {
+        U64 memoryCacheSize, maximumInMemorySize;
+        std::vector<std::size_t> shardsMemorySize;
+        {
+            QMutexLocker k(&_sizeLock);
+            memoryCacheSize = _memoryCacheSize;
+            maximumInMemorySize = std::max( (std::size_t)1, _maximumInMemorySize );
+            shardsMemorySize = _shardsMemorySize;
+        }
+        double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
+        std::vector<bool> exhausted(_shards.size(), false);
+        std::size_t shardIndex = preferredShard;
+
+        while (occupationPercentage > NATRON_CACHE_LIMIT_PERCENT) {
+            std::list<EntryTypePtr> entriesToJournal;
+            {
+                CacheShard & shard = *_shards[shardIndex];
+                QMutexLocker locker(&shard.lock);
+
+                ///While the current cache size can't fit the new entry, erase the last recently used entries.
+                ///Also if the total free RAM is under the limit of the system free RAM to keep free, erase LRU entries.
+                while (occupationPercentage > NATRON_CACHE_LIMIT_PERCENT) {
+                    std::list<EntryTypePtr> deleted;
+                    if ( !tryEvictEntry(shard, deleted, entriesToJournal) ) {
+                        break;
+                    }
+                    RenderMetrics::add( eRenderMetricCacheEvictions, (int)deleted.size() );
+                    _nEvictions.fetchAndAddRelaxed( (int)deleted.size() );
+
+                    for (typename std::list<EntryTypePtr>::iterator it = deleted.begin(); it != deleted.end(); ++it) {
+                        if ( !(*it)->isStoredOnDisk() ) {
+                            std::size_t entrySize = (*it)->size();
+                            memoryCacheSize = entrySize > memoryCacheSize ? 0 : memoryCacheSize - entrySize;
+                            shardsMemorySize[shardIndex] = entrySize > shardsMemorySize[shardIndex] ? 0 : shardsMemorySize[shardIndex] - entrySize;
+                        }
+                        entriesToBeDeleted.push_back(*it);
+                    }
+
+                    occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
+                }
+            }
+            journalAdditions(entriesToJournal);
+            exhausted[shardIndex] = true;
+
+            ///Move on to the shard holding the most memory among those we did not evict yet
+            bool foundShard = false;
+            for (std::size_t i = 0; i < _shards.size(); ++i) {
+                if ( !exhausted[i] && ( !foundShard || (shardsMemorySize[i] > shardsMemorySize[shardIndex]) ) ) {
+                    shardIndex = i;
+                    foundShard = true;
+                }
+            }
+            if (!foundShard) {
+                break;
+            }
+        }
+    } // evictUntilUnderMemoryLimit
+
+    /**
+     * @brief Returns the index of the next shard to evict from when the caller has no preference.
+     **/
+    std::size_t getNextEvictionShard() const
+    {
+        QMutexLocker k(&_sizeLock);
+        std::size_t ret = _evictionCursor;
+
+        _evictionCursor = (_evictionCursor + 1) % _shards.size();
+
+        return ret;
+    }
+
     void createInternal(const typename EntryType::key_type & key,
                         const ParamsTypePtr & params,
                         EntryTypePtr* returnValue) const
     {
-        //_lock must not be taken here
+        //the shard lock must not be taken here
+        std::size_t shardIndex = getShardIndex( key.getHash() );
+        CacheShard & shard = *_shards[shardIndex];
 
         ///Before allocating the memory check that there's enough space to fit in memory
         appPTR->checkCacheFreeMemoryIsGoodEnough();
@@ -579,33 +746,9 @@ private:
             ++safeCounter;
         }
 
-        U64 memoryCacheSize, maximumInMemorySize;
         {
-            QMutexLocker k(&_sizeLock);
-            memoryCacheSize = _memoryCacheSize;
-            maximumInMemorySize = std::max( (std::size_t)1, _maximumInMemorySize );
-        }
-        {
-            QMutexLocker locker(&_lock);
             std::list<EntryTypePtr> entriesToBeDeleted;
-            double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
-            ///While the current cache size can't fit the new entry, erase the last recently used entries.
-            ///Also if the total free RAM is under the limit of the system free RAM to keep free, erase LRU entries.
-            while (occupationPercentage > NATRON_CACHE_LIMIT_PERCENT) {
-                std::list<EntryTypePtr> deleted;
-                if ( !tryEvictEntry(deleted) ) {
-                    break;
-                }
-
-                for (typename std::list<EntryTypePtr>::iterator it = deleted.begin(); it != deleted.end(); ++it) {
-                    if ( !(*it)->isStoredOnDisk() ) {
-                        memoryCacheSize -= (*it)->size();
-                    }
-                    entriesToBeDeleted.push_back(*it);
-                }
-
-                occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
-            }
+            evictUntilUnderMemoryLimit(shardIndex, entriesToBeDeleted);
 
             if ( !entriesToBeDeleted.empty() ) {
                 ///Launch a separate thread whose function will be to delete all the entries to be deleted
@@ -629,7 +772,7 @@ private:
             }
         }
         {
-            QMutexLocker locker(&_lock);
+            QMutexLocker locker(&shard.lock);
             StorageModeEnum storage;
             if (params->getCost() == 0) {
                 storage = eStorageModeRAM;
@@ -654,23 +797,25 @@ private:
             }
 
             if (*returnValue) {
-                sealEntry(*returnValue, true);
+                sealEntry(shard, *returnValue, true);
             }
         }
     } // createInternal
 
 public:
-    
+
     void swapOrInsert(const EntryTypePtr& entryToBeEvicted,
                       const EntryTypePtr& newEntry)
     {
-        QMutexLocker locker(&_lock);
-        
         const typename EntryType::key_type& key = entryToBeEvicted->getKey();
         typename EntryType::hash_type hash = entryToBeEvicted->getHashKey();
+        CacheShard & shard = getShard(hash);
+
+        QMutexLocker locker(&shard.lock);
+
         ///find a matching value in the internal memory container
-        CacheIterator memoryCached = _memoryCache(hash);
-        if (memoryCached != _memoryCache.end()) {
+        CacheIterator memoryCached = shard.memoryCache(hash);
+        if (memoryCached != shard.memoryCache.end()) {
             std::list<EntryTypePtr> & ret = getValueFromIterator(memoryCached);
             for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                 if ( (*it)->getKey() == key && (*it)->getParams() == entryToBeEvicted->getParams()) {
@@ -682,8 +827,8 @@ public:
             ret.push_back(newEntry);
         } else {
             ///Look in disk cache
-            CacheIterator diskCached = _diskCache(hash);
-            if (diskCached != _diskCache.end()) {
+            CacheIterator diskCached = shard.diskCache(hash);
+            if (diskCached != shard.diskCache.end()) {
                 ///Remove the old entry
                 std::list<EntryTypePtr> & ret = getValueFromIterator(diskCached);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
@@ -695,7 +840,7 @@ public:
 
             }
             ///Insert in mem cache
-            _memoryCache.insert(hash, newEntry);
+            shard.memoryCache.insert(hash, newEntry);
         }
     }
 
@@ -733,30 +878,39 @@ public:
     {
         ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
+        CacheShard & shard = getShard( key.getHash() );
+        std::list<EntryTypePtr> entriesToJournal;
+        bool found = false;
 
         {
             ///Be atomic, so it cannot be created by another thread in the meantime
-            QMutexLocker getlocker(&_getLock);
+            QMutexLocker getlocker(&shard.getLock);
             std::list<EntryTypePtr> entries;
             bool didGetSucceed;
             {
-                QMutexLocker locker(&_lock);
-                didGetSucceed = getInternal(key, &entries);
+                QMutexLocker locker(&shard.lock);
+                didGetSucceed = getInternal(shard, key, &entries, &entriesToJournal);
             }
             if (didGetSucceed) {
                 for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
                     if (*(*it)->getParams() == *params) {
                         *returnValue = *it;
-
-                        return true;
+                        found = true;
+                        break;
                     }
                 }
             }
 
-            createInternal(key, params, returnValue);
-
-            return false;
+            if (found) {
+                RenderMetrics::add(eRenderMetricCacheHits);
+            } else {
+                RenderMetrics::add(eRenderMetricCacheMisses);
+                createInternal(key, params, returnValue);
+            }
         } // getlocker
+        journalAdditions(entriesToJournal);
+
+        return found;
     }
 
     /**
@@ -771,13 +925,16 @@ public:
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type, EntryTypePtr> evictedFromMemory = _memoryCache.evict();
-        while (evictedFromMemory.second) {
-            if ( evictedFromMemory.second->isStoredOnDisk() ) {
-                evictedFromMemory.second->removeAnyBackingFile();
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[i];
+            QMutexLocker locker(&shard.lock);
+            std::pair<hash_type, EntryTypePtr> evictedFromMemory = shard.memoryCache.evict();
+            while (evictedFromMemory.second) {
+                if ( evictedFromMemory.second->isStoredOnDisk() ) {
+                    evictedFromMemory.second->removeAnyBackingFile();
+                }
+                evictedFromMemory = shard.memoryCache.evict();
             }
-            evictedFromMemory = _memoryCache.evict();
         }
 
         if (_signalEmitter) {
@@ -796,17 +953,20 @@ public:
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-
-        /// An entry which has a use_count greater than 1 is not removable:
-        /// The backing file must not be removed because it might be read/written to
-        /// at the same time. The best we can do is just let it here in the cache.
-        std::pair<hash_type, EntryTypePtr> evictedFromDisk = _diskCache.evict();
-        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-        //we'll let the user of these entries purge the extra entries left in the cache later on
-        while (evictedFromDisk.second) {
-            evictedFromDisk.second->removeAnyBackingFile();
-            evictedFromDisk = _diskCache.evict();
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[i];
+            QMutexLocker locker(&shard.lock);
+
+            /// An entry which has a use_count greater than 1 is not removable:
+            /// The backing file must not be removed because it might be read/written to
+            /// at the same time. The best we can do is just let it here in the cache.
+            std::pair<hash_type, EntryTypePtr> evictedFromDisk = shard.diskCache.evict();
+            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+            //we'll let the user of these entries purge the extra entries left in the cache later on
+            while (evictedFromDisk.second) {
+                evictedFromDisk.second->removeAnyBackingFile();
+                evictedFromDisk = shard.diskCache.evict();
+            }
         }
 
 
@@ -823,49 +983,56 @@ public:
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type, EntryTypePtr> evictedFromMemory = _memoryCache.evict();
-        while (evictedFromMemory.second) {
-            ///move back the entry on disk if it can be store on disk
-            if ( evictedFromMemory.second->isStoredOnDisk() ) {
-                evictedFromMemory.second->deallocate();
-                /*insert it back into the disk portion */
-
-                U64 diskCacheSize, maximumCacheSize;
-                {
-                    QMutexLocker k(&_sizeLock);
-                    diskCacheSize = _diskCacheSize;
-                    maximumCacheSize = _maximumCacheSize;
-                }
-
-                /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
-                while (diskCacheSize + evictedFromMemory.second->size() >= maximumCacheSize) {
-                    {
-                        std::pair<hash_type, EntryTypePtr> evictedFromDisk = _diskCache.evict();
-                        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-                        //we'll let the user of these entries purge the extra entries left in the cache later on
-                        if (!evictedFromDisk.second) {
-                            break;
-                        }
-                        ///Erase the file from the disk if we reach the limit.
-                        evictedFromDisk.second->removeAnyBackingFile();
-                    }
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[i];
+            std::list<EntryTypePtr> entriesToJournal;
+            QMutexLocker locker(&shard.lock);
+            std::pair<hash_type, EntryTypePtr> evictedFromMemory = shard.memoryCache.evict();
+            while (evictedFromMemory.second) {
+                ///move back the entry on disk if it can be store on disk
+                if ( evictedFromMemory.second->isStoredOnDisk() ) {
+                    evictedFromMemory.second->deallocate();
+                    /*insert it back into the disk portion */
+
+                    U64 diskCacheSize, maximumCacheSize;
                     {
                         QMutexLocker k(&_sizeLock);
                         diskCacheSize = _diskCacheSize;
                         maximumCacheSize = _maximumCacheSize;
                     }
-                }
 
-                /*update the disk cache size*/
-                CacheIterator existingDiskCacheEntry = _diskCache( evictedFromMemory.second->getHashKey() );
-                /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
-                if ( existingDiskCacheEntry == _diskCache.end() ) {
-                    _diskCache.insert(evictedFromMemory.second->getHashKey(), evictedFromMemory.second);
+                    /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
+                    while (diskCacheSize + evictedFromMemory.second->size() >= maximumCacheSize) {
+                        {
+                            std::pair<hash_type, EntryTypePtr> evictedFromDisk = shard.diskCache.evict();
+                            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+                            //we'll let the user of these entries purge the extra entries left in the cache later on
+                            if (!evictedFromDisk.second) {
+                                break;
+                            }
+                            ///Erase the file from the disk if we reach the limit.
+                            evictedFromDisk.second->removeAnyBackingFile();
+                        }
+                        {
+                            QMutexLocker k(&_sizeLock);
+                            diskCacheSize = _diskCacheSize;
+                            maximumCacheSize = _maximumCacheSize;
+                        }
+                    }
+
+                    /*update the disk cache size*/
+                    CacheIterator existingDiskCacheEntry = shard.diskCache( evictedFromMemory.second->getHashKey() );
+                    /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
+                    if ( existingDiskCacheEntry == shard.diskCache.end() ) {
+                        shard.diskCache.insert(evictedFromMemory.second->getHashKey(), evictedFromMemory.second);
+                    }
+                    entriesToJournal.push_back(evictedFromMemory.second);
                 }
-            }
 
-            evictedFromMemory = _memoryCache.evict();
+                evictedFromMemory = shard.memoryCache.evict();
+            }
+            locker.unlock();
+            journalAdditions(entriesToJournal);
         }
 
         _signalEmitter->blockSignals(false);
@@ -880,30 +1047,7 @@ public:
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
         std::list<EntryTypePtr> entriesToBeDeleted;
 
-        {
-            QMutexLocker locker(&_lock);
-            U64 memoryCacheSize, maximumInMemorySize;
-            {
-                QMutexLocker k(&_sizeLock);
-                memoryCacheSize = _memoryCacheSize;
-                maximumInMemorySize = std::max( (std::size_t)1, _maximumInMemorySize );
-            }
-            double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
-            while (occupationPercentage >= NATRON_CACHE_LIMIT_PERCENT) {
-                std::list<EntryTypePtr> deleted;
-                if ( !tryEvictEntry(deleted) ) {
-                    break;
-                }
-
-                for (typename std::list<EntryTypePtr>::iterator it = deleted.begin(); it != deleted.end(); ++it) {
-                    if ( !(*it)->isStoredOnDisk() ) {
-                        memoryCacheSize -= (*it)->size();
-                    }
-                    entriesToBeDeleted.push_back(*it);
-                }
-                occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
-            }
-        }
+        evictUntilUnderMemoryLimit(getNextEvictionShard(), entriesToBeDeleted);
     }
 
     /**
@@ -913,15 +1057,18 @@ public:
      **/
     void getCopy(std::list<EntryTypePtr>* copy) const
     {
-        QMutexLocker locker(&_lock);
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[i];
+            QMutexLocker locker(&shard.lock);
 
-        for (CacheIterator it = _memoryCache.begin(); it != _memoryCache.end(); ++it) {
-            const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
-            copy->insert( copy->end(), entries.begin(), entries.end() );
-        }
-        for (CacheIterator it = _diskCache.begin(); it != _diskCache.end(); ++it) {
-            const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
-            copy->insert( copy->end(), entries.begin(), entries.end() );
+            for (CacheIterator it = shard.memoryCache.begin(); it != shard.memoryCache.end(); ++it) {
+                const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                copy->insert( copy->end(), entries.begin(), entries.end() );
+            }
+            for (CacheIterator it = shard.diskCache.begin(); it != shard.diskCache.end(); ++it) {
+                const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                copy->insert( copy->end(), entries.begin(), entries.end() );
+            }
         }
     }
 
@@ -929,49 +1076,69 @@ public:
      * @brief Removes the last recently used entry from the in-memory cache.
      * This is expensive since it takes the lock. Returns false
      * if there's nothing left to evict.
+     * When the cache is sharded, shards are visited in a round-robin fashion.
      **/
     bool evictLRUInMemoryEntry() const
     {
         ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
         std::list<EntryTypePtr> entriesToBeDeleted;
-        bool ret;
-        {
-            QMutexLocker locker(&_lock);
-            ret = tryEvictEntry(entriesToBeDeleted);
+        std::size_t first = getNextEvictionShard();
+
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[(first + i) % _shards.size()];
+            std::list<EntryTypePtr> entriesToJournal;
+            bool evicted;
+            {
+                QMutexLocker locker(&shard.lock);
+                evicted = tryEvictEntry(shard, entriesToBeDeleted, entriesToJournal);
+            }
+            journalAdditions(entriesToJournal);
+            if (evicted) {
+                return true;
+            }
         }
 
-        return ret;
+        return false;
     }
 
     /**
      * @brief Removes the last recently used entry from the disk cache.
      * This is expensive since it takes the lock. Returns false
      * if there's nothing left to evict.
+     * When the cache is sharded, shards are visited in a round-robin fashion.
      **/
     bool evictLRUDiskEntry() const
     {
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type, EntryTypePtr> evicted = _diskCache.evict();
+        std::size_t first = getNextEvictionShard();
 
-        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-        //we'll let the user of these entries purge the extra entries left in the cache later on
-        if (!evicted.second) {
-            return false;
-        }
-        /*if it is stored on disk, remove it from memory*/
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[(first + i) % _shards.size()];
+            QMutexLocker locker(&shard.lock);
+            std::pair<hash_type, EntryTypePtr> evicted = shard.diskCache.evict();
 
-        assert( evicted.second.unique() );
-        evicted.second->removeAnyBackingFile();
+            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+            //we'll let the user of these entries purge the extra entries left in the cache later on
+            if (!evicted.second) {
+                continue;
+            }
+            /*if it is stored on disk, remove it from memory*/
 
-        return true;
+            assert( evicted.second.unique() );
+            evicted.second->removeAnyBackingFile();
+
+            return true;
+        }
+
+        return false;
     }
 
     /**
      * @brief To be called by a CacheEntry whenever it's size changes.
      * This way the cache can keep track of the real memory footprint.
      **/
-    virtual void notifyEntrySizeChanged(std::size_t oldSize,
+    virtual void notifyEntrySizeChanged(U64 hash,
+                                        std::size_t oldSize,
                                         std::size_t newSize) const OVERRIDE FINAL
     {
         ///The entry has notified it's memory layout has changed, it must have been due to an action from the cache
@@ -979,15 +1146,7 @@ public:
 
         ///This function can only be called for RAM buffers or while a memory mapped file is mapped into the RAM, so
         ///we just have to modify the RAM size.
-
-        ///Avoid overflows, _memoryCacheSize may not always fallback to 0
-        qint64 diff = (qint64)newSize - (qint64)oldSize;
-
-        if (diff < 0) {
-            _memoryCacheSize = diff > (qint64)_memoryCacheSize ? 0 : _memoryCacheSize + diff;
-        } else {
-            _memoryCacheSize += diff;
-        }
+        updateMemorySize(hash, newSize, oldSize);
 #ifdef NATRON_DEBUG_CACHE
         qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
 #endif
@@ -996,7 +1155,8 @@ public:
     /**
      * @brief To be called by a CacheEntry on allocation.
      **/
-    virtual void notifyEntryAllocated(double time,
+    virtual void notifyEntryAllocated(U64 hash,
+                                      double time,
                                       std::size_t size,
                                       StorageModeEnum storage) const OVERRIDE FINAL
     {
@@ -1004,7 +1164,7 @@ public:
         ///lock should already be taken.
         QMutexLocker k(&_sizeLock);
 
-        _memoryCacheSize += size;
+        updateMemorySize(hash, size, 0);
         _signalEmitter->emitAddedEntry(time);
 
         if (storage == eStorageModeDisk) {
@@ -1018,14 +1178,15 @@ public:
     /**
      * @brief To be called by a CacheEntry on destruction.
      **/
-    virtual void notifyEntryDestroyed(double time,
+    virtual void notifyEntryDestroyed(U64 hash,
+                                      double time,
                                       std::size_t size,
                                       StorageModeEnum storage) const OVERRIDE FINAL
     {
         QMutexLocker k(&_sizeLock);
 
         if (storage == eStorageModeRAM) {
-            _memoryCacheSize = size > _memoryCacheSize ? 0 : _memoryCacheSize - size;
+            updateMemorySize(hash, 0, size);
 #ifdef NATRON_DEBUG_CACHE
             qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
 #endif
@@ -1051,7 +1212,8 @@ public:
      * @brief To be called whenever an entry is deallocated from memory and put back on disk or whenever
      * it is reallocated in the RAM.
      **/
-    virtual void notifyEntryStorageChanged(StorageModeEnum oldStorage,
+    virtual void notifyEntryStorageChanged(U64 hash,
+                                           StorageModeEnum oldStorage,
                                            StorageModeEnum newStorage,
                                            double time,
                                            std::size_t size) const OVERRIDE FINAL
@@ -1064,7 +1226,7 @@ public:
         assert(oldStorage != newStorage);
         assert(newStorage != eStorageModeNone);
         if (oldStorage == eStorageModeRAM) {
-            _memoryCacheSize = size > _memoryCacheSize ? 0 : _memoryCacheSize - size;
+            updateMemorySize(hash, 0, size);
             _diskCacheSize += size;
 #ifdef NATRON_DEBUG_CACHE
             qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
@@ -1073,7 +1235,7 @@ public:
             ///We switched from RAM to DISK that means the MemoryFile object has been destroyed hence the file has been closed.
             appPTR->decreaseNCacheFilesOpened();
         } else if (oldStorage == eStorageModeDisk) {
-            _memoryCacheSize += size;
+            updateMemorySize(hash, size, 0);
             _diskCacheSize = size > _diskCacheSize ? 0 : _diskCacheSize - size;
 #ifdef NATRON_DEBUG_CACHE
             qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
@@ -1083,7 +1245,7 @@ public:
             appPTR->increaseNCacheFilesOpened();
         } else {
             if (newStorage == eStorageModeRAM) {
-                _memoryCacheSize += size;
+                updateMemorySize(hash, size, 0);
             } else if (newStorage == eStorageModeDisk) {
                 _diskCacheSize += size;
             }
@@ -1097,6 +1259,19 @@ public:
         appPTR->decreaseNCacheFilesOpened();
     }
 
+    virtual void notifyBackingFileRemoved(const std::string & filePath) const OVERRIDE FINAL
+    {
+        boost::shared_ptr<CacheJournal> journal;
+        {
+            QMutexLocker k(&_journalLock);
+            journal = _journal;
+        }
+
+        if (journal) {
+            journal->appendRemoval(filePath);
+        }
+    }
+
     // const data member: no need to take the lock
     const std::string & cacheName() const
     {
@@ -1135,6 +1310,64 @@ public:
         return newCachePath.toStdString();
     }
 
+    std::string getJournalFilePath() const
+    {
+        QString newCachePath( getCachePath() );
+
+        newCachePath.append( QDir::separator() );
+        newCachePath.append(NATRON_CACHE_JOURNAL_FILE_NAME);
+
+        return newCachePath.toStdString();
+    }
+
+    /**
+     * @brief Starts recording the disk portion of the cache in the given journal. The journal is rewritten
+     * with the entries currently in the disk portion.
+     * The serializer is passed as a function so that only the translation units restoring the cache
+     * need to include the serialization headers, @see serializeJournalEntry()
+     **/
+    void setJournal(const boost::shared_ptr<CacheJournal> & journal,
+                    JournalSerializeFunc serializer)
+    {
+        CacheJournal::RecordList records;
+
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[i];
+            QMutexLocker l(&shard.lock);
+
+            for (CacheIterator it = shard.diskCache.begin(); it != shard.diskCache.end(); ++it) {
+                std::list<EntryTypePtr> & listOfValues  = getValueFromIterator(it);
+                for (typename std::list<EntryTypePtr>::const_iterator it2 = listOfValues.begin(); it2 != listOfValues.end(); ++it2) {
+                    if ( (*it2)->isStoredOnDisk() ) {
+                        CacheJournal::Record r;
+                        r.filePath = (*it2)->getFilePath();
+                        r.data = serializer(**it2);
+                        records.push_back(r);
+                    }
+                }
+            }
+        }
+        journal->rewrite(records);
+
+        QMutexLocker k(&_journalLock);
+        _journal = journal;
+        _journalSerializer = serializer;
+    }
+
+    bool hasJournal() const
+    {
+        QMutexLocker k(&_journalLock);
+
+        return _journal.get() != 0;
+    }
+
+    /**
+     * @brief Serialization of an entry and of its parameters as stored in the journal.
+     * Defined in CacheSerialization.h
+     **/
+    static std::string serializeJournalEntry(const EntryType & entry);
+    static bool deserializeJournalEntry(const std::string & data, SerializedEntry* serialization);
+
     void setMaximumCacheSize(U64 newSize)
     {
         QMutexLocker k(&_sizeLock);
@@ -1167,12 +1400,30 @@ public:
         return _memoryCacheSize;
     }
 
+    /**
+     * @brief Returns the number of entries evicted from the in-memory portion since the cache was created.
+     * The counter wraps around: only the difference between two calls is meaningful.
+     **/
+    int getNumEvictions() const
+    {
+        return (int)_nEvictions;
+    }
+
     std::size_t getDiskCacheSize() const
     {
         QMutexLocker k(&_sizeLock);
         return _diskCacheSize;
     }
 
+    /**
+     * @brief Returns the in-memory size of each shard, their sum is getMemoryCacheSize()
+     **/
+    void getShardsMemorySize(std::vector<std::size_t>* sizes) const
+    {
+        QMutexLocker k(&_sizeLock);
+        *sizes = _shardsMemorySize;
+    }
+
     CacheSignalEmitter* activateSignalEmitter() const
     {
         return _signalEmitter;
@@ -1190,9 +1441,10 @@ public:
         std::list<EntryTypePtr> toRemove;
 
         {
-            QMutexLocker l(&_lock);
-            CacheIterator existingEntry = _memoryCache( entry->getHashKey() );
-            if ( existingEntry != _memoryCache.end() ) {
+            CacheShard & shard = getShard( entry->getHashKey() );
+            QMutexLocker l(&shard.lock);
+            CacheIterator existingEntry = shard.memoryCache( entry->getHashKey() );
+            if ( existingEntry != shard.memoryCache.end() ) {
                 std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                     if ( (*it)->getKey() == entry->getKey() ) {
@@ -1203,11 +1455,11 @@ public:
                     }
                 }
                 if ( ret.empty() ) {
-                    _memoryCache.erase(existingEntry);
+                    shard.memoryCache.erase(existingEntry);
                 }
             } else {
-                existingEntry = _diskCache( entry->getHashKey() );
-                if ( existingEntry != _diskCache.end() ) {
+                existingEntry = shard.diskCache( entry->getHashKey() );
+                if ( existingEntry != shard.diskCache.end() ) {
                     std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                     for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                         if ( (*it)->getKey() == entry->getKey() ) {
@@ -1218,11 +1470,11 @@ public:
                         }
                     }
                     if ( ret.empty() ) {
-                        _diskCache.erase(existingEntry);
+                        shard.diskCache.erase(existingEntry);
                     }
                 }
             }
-        } // QMutexLocker l(&_lock);
+        } // QMutexLocker l(&shard.lock);
         if ( !toRemove.empty() ) {
             _deleterThread.appendToQueue(toRemove);
 
@@ -1236,27 +1488,28 @@ public:
     {
         std::list<EntryTypePtr> toRemove;
         {
-            QMutexLocker l(&_lock);
-            CacheIterator existingEntry = _memoryCache( hash);
-            if ( existingEntry != _memoryCache.end() ) {
+            CacheShard & shard = getShard(hash);
+            QMutexLocker l(&shard.lock);
+            CacheIterator existingEntry = shard.memoryCache( hash);
+            if ( existingEntry != shard.memoryCache.end() ) {
                 std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                     //(*it)->scheduleForDestruction();
                     toRemove.push_back(*it);
                 }
-                _memoryCache.erase(existingEntry);
+                shard.memoryCache.erase(existingEntry);
             } else {
-                existingEntry = _diskCache( hash );
-                if ( existingEntry != _diskCache.end() ) {
+                existingEntry = shard.diskCache( hash );
+                if ( existingEntry != shard.diskCache.end() ) {
                     std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                     for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                         //(*it)->scheduleForDestruction();
                         toRemove.push_back(*it);
                     }
-                    _diskCache.erase(existingEntry);
+                    shard.diskCache.erase(existingEntry);
                 }
             }
-        } // QMutexLocker l(&_lock);
+        } // QMutexLocker l(&shard.lock);
 
         if ( !toRemove.empty() ) {
             _deleterThread.appendToQueue(toRemove);
@@ -1272,8 +1525,9 @@ public:
     void save(CacheTOC* tableOfContents);
 
 
-    /*Restores the cache from disk.*/
-    void restore(const CacheTOC & tableOfContents);
+    /*Restores the cache from disk.
+       If checkFilesExist is false, the caller already knows the backing files exist.*/
+    void restore(const CacheTOC & tableOfContents, bool checkFilesExist = true);
 
     void removeAllEntriesWithDifferentNodeHashForHolderPublic(const CacheEntryHolder* holder,
                                                               U64 nodeHash)
@@ -1289,41 +1543,44 @@ public:
             _cleanerThread.appendToQueue(holder->getCacheID(), 0, true);
         }
     }
-    
+
     void getMemoryStatsForCacheEntryHolder(const CacheEntryHolder* holder,
                                       std::size_t* ramOccupied,
                                       std::size_t* diskOccupied) const
     {
         *ramOccupied = 0;
         *diskOccupied= 0;
-        
+
         std::string holderID = holder->getCacheID();
-        
-        QMutexLocker locker(&_lock);
-        
-        for (CacheIterator memIt = _memoryCache.begin(); memIt != _memoryCache.end(); ++memIt) {
-            std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
-            if ( !entries.empty() ) {
-                
-                const EntryTypePtr & front = entries.front();
-                
-                if (front->getKey().getCacheHolderID() == holderID) {
-                    for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
-                        *ramOccupied += (*it)->size();
+
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[i];
+            QMutexLocker locker(&shard.lock);
+
+            for (CacheIterator memIt = shard.memoryCache.begin(); memIt != shard.memoryCache.end(); ++memIt) {
+                std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
+                if ( !entries.empty() ) {
+
+                    const EntryTypePtr & front = entries.front();
+
+                    if (front->getKey().getCacheHolderID() == holderID) {
+                        for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
+                            *ramOccupied += (*it)->size();
+                        }
                     }
                 }
             }
-        }
-        
-        for (CacheIterator memIt = _diskCache.begin(); memIt != _diskCache.end(); ++memIt) {
-            std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
-            if ( !entries.empty() ) {
-                
-                const EntryTypePtr & front = entries.front();
-                
-                if (front->getKey().getCacheHolderID() == holderID) {
-                    for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
-                        *diskOccupied += (*it)->size();
+
+            for (CacheIterator memIt = shard.diskCache.begin(); memIt != shard.diskCache.end(); ++memIt) {
+                std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
+                if ( !entries.empty() ) {
+
+                    const EntryTypePtr & front = entries.front();
+
+                    if (front->getKey().getCacheHolderID() == holderID) {
+                        for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
+                            *diskOccupied += (*it)->size();
+                        }
                     }
                 }
             }
@@ -1337,11 +1594,13 @@ private:
                                                                        bool removeAll) OVERRIDE FINAL
     {
         std::list<EntryTypePtr> toDelete;
-        CacheContainer newMemCache, newDiskCache;
-        {
-            QMutexLocker locker(&_lock);
 
-            for (CacheIterator memIt = _memoryCache.begin(); memIt != _memoryCache.end(); ++memIt) {
+        for (std::size_t i = 0; i < _shards.size(); ++i) {
+            CacheShard & shard = *_shards[i];
+            CacheContainer newMemCache, newDiskCache;
+            QMutexLocker locker(&shard.lock);
+
+            for (CacheIterator memIt = shard.memoryCache.begin(); memIt != shard.memoryCache.end(); ++memIt) {
                 std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
                 if ( !entries.empty() ) {
                     const EntryTypePtr & front = entries.front();
@@ -1359,7 +1618,7 @@ private:
                 }
             }
 
-            for (CacheIterator dIt = _diskCache.begin(); dIt != _diskCache.end(); ++dIt) {
+            for (CacheIterator dIt = shard.diskCache.begin(); dIt != shard.diskCache.end(); ++dIt) {
                 std::list<EntryTypePtr> & entries = getValueFromIterator(dIt);
                 if ( !entries.empty() ) {
                     const EntryTypePtr & front = entries.front();
@@ -1377,9 +1636,9 @@ private:
                 }
             }
 
-            _memoryCache = newMemCache;
-            _diskCache = newDiskCache;
-        } // QMutexLocker locker(&_lock);
+            shard.memoryCache = newMemCache;
+            shard.diskCache = newDiskCache;
+        } // for all shards
 
         if ( !toDelete.empty() ) {
             _deleterThread.appendToQueue(toDelete);
@@ -1390,16 +1649,22 @@ private:
         }
     } // removeAllEntriesWithDifferentNodeHashForHolderPrivate
 
-    bool getInternal(const typename EntryType::key_type & key,
-                     std::list<EntryTypePtr>* returnValue) const
+    /**
+     * @brief The entries moved to the disk portion to make room are appended to entriesToJournal, the caller must
+     * record them in the journal once the shard lock is released, @see journalAdditions()
+     **/
+    bool getInternal(CacheShard & shard,
+                     const typename EntryType::key_type & key,
+                     std::list<EntryTypePtr>* returnValue,
+                     std::list<EntryTypePtr>* entriesToJournal) const
     {
         ///Private should be locked
-        assert( !_lock.tryLock() );
+        assert( !shard.lock.tryLock() );
 
         ///find a matching value in the internal memory container
-        CacheIterator memoryCached = _memoryCache( key.getHash() );
+        CacheIterator memoryCached = shard.memoryCache( key.getHash() );
 
-        if ( memoryCached != _memoryCache.end() ) {
+        if ( memoryCached != shard.memoryCache.end() ) {
             ///we found something with a matching hash key. There may be several entries linked to
             ///this key, we need to find one with matching params
             std::list<EntryTypePtr> & ret = getValueFromIterator(memoryCached);
@@ -1418,9 +1683,9 @@ private:
             return returnValue->size() > 0;
         } else {
             ///fallback on the disk cache internal container
-            CacheIterator diskCached = _diskCache( key.getHash() );
+            CacheIterator diskCached = shard.diskCache( key.getHash() );
 
-            if ( diskCached == _diskCache.end() ) {
+            if ( diskCached == shard.diskCache.end() ) {
                 /*the entry was neither in memory or disk, just allocate a new one*/
                 return false;
             } else {
@@ -1439,19 +1704,22 @@ private:
                             (*it)->reOpenFileMapping();
                         } catch (const std::exception & e) {
                             qDebug() << "Error while reopening cache file: " << e.what();
+                            ///The file is missing or invalid, forget about it so it is not accounted in the disk portion anymore
+                            (*it)->removeAnyBackingFile();
                             ret.erase(it);
 
                             return false;
                         } catch (...) {
                             qDebug() << "Error while reopening cache file";
+                            (*it)->removeAnyBackingFile();
                             ret.erase(it);
 
                             return false;
                         }
 
                         //put it back into the RAM
-                        _memoryCache.insert( (*it)->getHashKey(), *it );
-                        
+                        shard.memoryCache.insert( (*it)->getHashKey(), *it );
+
 
                         U64 memoryCacheSize, maximumInMemorySize;
                         {
@@ -1463,7 +1731,7 @@ private:
 
                         //now clear extra entries from the disk cache so it doesn't exceed the RAM limit.
                         while (memoryCacheSize > maximumInMemorySize) {
-                            if ( !tryEvictEntry(entriesToBeDeleted) ) {
+                            if ( !tryEvictEntry(shard, entriesToBeDeleted, *entriesToJournal) ) {
                                 break;
                             }
 
@@ -1481,10 +1749,10 @@ private:
                         if (_signalEmitter) {
                             _signalEmitter->emitAddedEntry( key.getTime() );
                         }
-                        
+
                         ///Remove it from the disk cache
-                        _diskCache.erase(diskCached);
-                        
+                        shard.diskCache.erase(diskCached);
+
                         return true;
                     }
                 }
@@ -1499,25 +1767,26 @@ private:
     /** @brief Inserts into the cache an entry that was previously allocated by the createInternal()
      * function. This is called directly by createInternal() if the allocation was successful
      **/
-    void sealEntry(const EntryTypePtr & entry,
+    void sealEntry(CacheShard & shard,
+                   const EntryTypePtr & entry,
                    bool inMemory) const
     {
-        assert( !_lock.tryLock() );   // must be locked
+        assert( !shard.lock.tryLock() );   // must be locked
         typename EntryType::hash_type hash = entry->getHashKey();
 
         if (inMemory) {
             /*if the entry doesn't exist on the memory cache,make a new list and insert it*/
-            CacheIterator existingEntry = _memoryCache(hash);
-            if ( existingEntry == _memoryCache.end() ) {
-                _memoryCache.insert(hash, entry);
+            CacheIterator existingEntry = shard.memoryCache(hash);
+            if ( existingEntry == shard.memoryCache.end() ) {
+                shard.memoryCache.insert(hash, entry);
             } else {
                 /*append to the existing list*/
                 getValueFromIterator(existingEntry).push_back(entry);
             }
         } else {
-            CacheIterator existingEntry = _diskCache(hash);
-            if ( existingEntry == _diskCache.end() ) {
-                _diskCache.insert(hash, entry);
+            CacheIterator existingEntry = shard.diskCache(hash);
+            if ( existingEntry == shard.diskCache.end() ) {
+                shard.diskCache.insert(hash, entry);
             } else {
                 /*append to the existing list*/
                 getValueFromIterator(existingEntry).push_back(entry);
@@ -1525,10 +1794,48 @@ private:
         }
     }
 
-    bool tryEvictEntry(std::list<EntryTypePtr> & entriesToBeDeleted) const
+    /**
+     * @brief Records in the journal that the entries are in the disk portion, their data must have been flushed.
+     * This serializes the entries and writes the journal file: the shard locks must not be taken.
+     * If the backing file of an entry is removed in the meantime, the record is harmless: restore() skips the entries
+     * whose file is missing.
+     **/
+    void journalAdditions(const std::list<EntryTypePtr> & entries) const
+    {
+        if ( entries.empty() ) {
+            return;
+        }
+        boost::shared_ptr<CacheJournal> journal;
+        JournalSerializeFunc serializer;
+        {
+            QMutexLocker k(&_journalLock);
+            journal = _journal;
+            serializer = _journalSerializer;
+        }
+
+        if (!journal) {
+            return;
+        }
+        for (typename std::list<EntryTypePtr>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            try {
+                journal->appendAddition( (*it)->getFilePath(), serializer(**it) );
+            } catch (const std::exception & e) {
+                qDebug() << "Failed to record cache entry in the journal:" << e.what();
+            }
+        }
+    }
+
+    /**
+     * @brief Evicts the LRU entry of the in-memory portion of the shard, whose lock must be taken.
+     * The entries to destroy are appended to entriesToBeDeleted, the entry moved to the disk portion is appended to
+     * entriesToJournal and must be recorded in the journal once the lock is released, @see journalAdditions()
+     **/
+    bool tryEvictEntry(CacheShard & shard,
+                       std::list<EntryTypePtr> & entriesToBeDeleted,
+                       std::list<EntryTypePtr> & entriesToJournal) const
     {
-        assert( !_lock.tryLock() );
-        std::pair<hash_type, EntryTypePtr> evicted = _memoryCache.evict();
+        assert( !shard.lock.tryLock() );
+        std::pair<hash_type, EntryTypePtr> evicted = shard.memoryCache.evict();
         //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
         //we'll let the user of these entries purge the extra entries left in the cache later on
         if (!evicted.second) {
@@ -1555,7 +1862,7 @@ private:
             /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
             while ( ( diskCacheSize  + evicted.second->size() ) >= (maximumCacheSize - maximumInMemorySize) ) {
                 {
-                    std::pair<hash_type, EntryTypePtr> evictedFromDisk = _diskCache.evict();
+                    std::pair<hash_type, EntryTypePtr> evictedFromDisk = shard.diskCache.evict();
                     //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
                     //we'll let the user of these entries purge the extra entries left in the cache later on
                     if (!evictedFromDisk.second) {
@@ -1576,13 +1883,16 @@ private:
                 }
             }
 
-            CacheIterator existingDiskCacheEntry = _diskCache(evicted.first);
+            CacheIterator existingDiskCacheEntry = shard.diskCache(evicted.first);
             /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
-            if ( existingDiskCacheEntry == _diskCache.end() ) {
-                _diskCache.insert(evicted.first, evicted.second);
+            if ( existingDiskCacheEntry == shard.diskCache.end() ) {
+                shard.diskCache.insert(evicted.first, evicted.second);
             } else {   /*append to the existing list*/
                 getValueFromIterator(existingDiskCacheEntry).push_back(evicted.second);
             }
+
+            ///deallocate() flushed the data to the backing file, it can be restored from now on
+            entriesToJournal.push_back(evicted.second);
         } else {
             entriesToBeDeleted.push_back(evicted.second);
         }
@@ -27,6 +27,7 @@
 
 #include "Global/Macros.h"
 
+#include <algorithm> // min
 #include <iostream>
 #include <cassert>
 #include <cstdio> // for std::remove
@@ -46,6 +47,8 @@
 #endif
 #include "Engine/Hash64.h"
 #include "Engine/CacheEntryHolder.h"
+#include "Engine/ImageAllocator.h"
+#include "Engine/ImageArena.h"
 #include "Engine/MemoryFile.h"
 #include "Engine/NonKeyParams.h"
 #include <SequenceParsing.h> // for removePath
@@ -61,16 +64,27 @@ class RamBuffer
 {
     T* data;
     U64 count;
+    bool useArena; // the memory comes from the ImageArena
     
 public:
     
     RamBuffer()
     : data(0)
     , count(0)
+    , useArena(false)
     {
         
     }
     
+    /**
+     * @brief Allocate the memory from the ImageArena instead of malloc. Must be called while no memory is allocated.
+     **/
+    void setUseArena(bool use)
+    {
+        assert(!data);
+        useArena = use;
+    }
+    
     T* getData()
     {
         return data;
@@ -85,6 +99,7 @@ public:
     {
         std::swap(data, other.data);
         std::swap(count, other.count);
+        std::swap(useArena, other.useArena);
     }
     
     U64 size() const
@@ -97,35 +112,66 @@ public:
         if (size == 0) {
             return;
         }
-        count = size;
         if (data) {
-            free(data);
-            data = 0;
+            release();
         }
-        if (count == 0) {
+        count = size;
+        if (useArena) {
+            data = (T*)ImageArena::allocate( size * sizeof(T) );
+        } else {
+            data = (T*)ImageAllocator::allocate( size * sizeof(T) );
+        }
+    }
+    
+    /**
+     * @brief Changes the size of the buffer, keeping its content up to the smallest of the two sizes.
+     * Unlike resize(), the allocation may be extended in place (or its pages remapped) instead of being copied.
+     **/
+    void reallocate(U64 size)
+    {
+        if (size == 0) {
+            clear();
             return;
         }
-        data = (T*)malloc(size * sizeof(T));
-        if (!data) {
-            throw std::bad_alloc();
+        if (useArena) {
+            T* newData = (T*)ImageArena::allocate( size * sizeof(T) );
+            if (data) {
+                memcpy( newData, data, std::min(count, size) * sizeof(T) );
+                release();
+            }
+            data = newData;
+            count = size;
+            return;
         }
+        data = (T*)ImageAllocator::reallocate( data, count * sizeof(T), size * sizeof(T) );
+        count = size;
     }
-    
+
     void clear()
     {
-        count = 0;
         if (data) {
-            free(data);
-            data = 0;
+            release();
         }
+        count = 0;
     }
     
     ~RamBuffer()
     {
         if (data) {
-            free(data);
-            data = 0;
+            release();
+        }
+    }
+    
+private:
+    
+    void release()
+    {
+        if (useArena) {
+            ImageArena::deallocate( data, count * sizeof(T) );
+        } else {
+            ImageAllocator::deallocate( data, count * sizeof(T) );
         }
+        data = 0;
     }
 };
 
@@ -162,6 +208,16 @@ public:
         deallocate();
     }
 
+    /**
+     * @brief If true, the RAM storage will be allocated from the ImageArena. Ignored if the memory is already allocated.
+     **/
+    void setUseArena(bool use)
+    {
+        if ( (_buffer.size() == 0) && !_backingFile ) {
+            _buffer.setUseArena(use);
+        }
+    }
+
     void allocate( U64 count,
                    StorageModeEnum storage,
                    std::string path = std::string() )
@@ -210,7 +266,7 @@ public:
     {
         if (_storageMode == eStorageModeRAM) {
             assert(_buffer.size() > 0); // could be 0 if we allocate 0...
-            _buffer.resize(count);
+            _buffer.reallocate(count);
         } else if (_storageMode == eStorageModeDisk) {
             assert(_backingFile);
             _backingFile->resize( count * sizeof(DataType) );
@@ -251,15 +307,24 @@ public:
         return _path;
     }
 
-    void reOpenFileMapping() const
+    /**
+     * @brief Re-opens the mapping of an existing backing file. Entries restored from the disk cache are not
+     * validated when the cache is restored, hence the file may have been removed or truncated in the meantime:
+     * throws if the file does not exist or is smaller than minimumSize bytes.
+     **/
+    void reOpenFileMapping(std::size_t minimumSize) const
     {
         assert(!_backingFile && _storageMode == eStorageModeDisk);
         try{
-            _backingFile.reset( new MemoryFile(_path,MemoryFile::eFileOpenModeEnumIfExistsKeepElseCreate) );
+            _backingFile.reset( new MemoryFile(_path,MemoryFile::eFileOpenModeEnumIfExistsKeepElseFail) );
         } catch (const std::exception & e) {
             _backingFile.reset();
             throw std::bad_alloc();
         }
+        if (_backingFile->size() < minimumSize) {
+            _backingFile.reset();
+            throw std::runtime_error("Cache file is truncated: " + _path);
+        }
     }
 
     void restoreBufferFromFile(const std::string & path)
@@ -357,7 +422,9 @@ private:
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////CACHE ENTRY////////////////////////////////////////////////////
 /**
- * @brief Defines the API of the Cache as seen by the cache entries
+ * @brief Defines the API of the Cache as seen by the cache entries.
+ * The hash passed to the notification functions is the hash key of the entry: the cache
+ * uses it to account the memory to the shard holding the entry.
  **/
 class CacheAPI
 {
@@ -368,17 +435,17 @@ public:
      * @brief To be called by a CacheEntry whenever it's size is changed.
      * This way the cache can keep track of the real memory footprint.
      **/
-    virtual void notifyEntrySizeChanged(size_t oldSize,size_t newSize) const = 0;
+    virtual void notifyEntrySizeChanged(U64 hash, size_t oldSize,size_t newSize) const = 0;
 
     /**
      * @brief To be called by a CacheEntry on allocation.
      **/
-    virtual void notifyEntryAllocated(double time, size_t size, StorageModeEnum storage) const = 0;
+    virtual void notifyEntryAllocated(U64 hash, double time, size_t size, StorageModeEnum storage) const = 0;
 
     /**
      * @brief To be called by a CacheEntry on destruction.
      **/
-    virtual void notifyEntryDestroyed(double time, size_t size, StorageModeEnum storage) const = 0;
+    virtual void notifyEntryDestroyed(U64 hash, double time, size_t size, StorageModeEnum storage) const = 0;
     
     /**
      * @brief Called by the Cache deleter thread to wake up sleeping threads that were attempting to create a new iamge
@@ -390,11 +457,16 @@ public:
      **/
     virtual void backingFileClosed() const = 0;
 
+    /**
+     * @brief To be called when the backing file of an entry stored on disk has been removed
+     **/
+    virtual void notifyBackingFileRemoved(const std::string & filePath) const = 0;
+
     /**
      * @brief To be called whenever an entry is deallocated from memory and put back on disk or whenever
      * it is reallocated in the RAM.
      **/
-    virtual void notifyEntryStorageChanged(StorageModeEnum oldStorage,StorageModeEnum newStorage,
+    virtual void notifyEntryStorageChanged(U64 hash, StorageModeEnum oldStorage,StorageModeEnum newStorage,
                                            double time,size_t size) const = 0;
     
     /**
@@ -587,20 +659,24 @@ public:
                 }
             }
             QWriteLocker k(&_entryLock);
+            ///Entries that are not held by a cache are temporary, their memory is recycled
+            _data.setUseArena(_cache == NULL);
             allocate(_params->getElementsCount(),_requestedStorage,_requestedPath);
             onMemoryAllocated(false);
         }
         
         if (_cache) {
-            _cache->notifyEntryAllocated( getTime(),size(),_data.getStorageMode() );
+            _cache->notifyEntryAllocated( getHashKey(), getTime(),size(),_data.getStorageMode() );
         }
     }
     
     /**
      * @brief To be called for disk-cached entries when restoring them from a file.
      * The file-path will be the one passed to the constructor
+     * @param checkFileExists If false, the caller already knows the file exists. If it disappears,
+     * this will be detected by reOpenFileMapping().
      **/
-    void restoreMetaDataFromFile(std::size_t size)
+    void restoreMetaDataFromFile(std::size_t size, bool checkFileExists = true)
     {
         if (!_cache || _requestedStorage != eStorageModeDisk) {
             return;
@@ -611,14 +687,14 @@ public:
         {
             QWriteLocker k(&_entryLock);
             
-            restoreBufferFromFile(_requestedPath);
+            restoreBufferFromFile(_requestedPath, checkFileExists);
             
             onMemoryAllocated(true);
 
         }
         
         if (_cache) {
-            _cache->notifyEntryStorageChanged(eStorageModeNone, eStorageModeDisk, getTime(),size);
+            _cache->notifyEntryStorageChanged(getHashKey(), eStorageModeNone, eStorageModeDisk, getTime(),size);
         }
     }
 
@@ -685,10 +761,10 @@ public:
     {
         {
             QWriteLocker k(&_entryLock);
-            _data.reOpenFileMapping();
+            _data.reOpenFileMapping( _params->getElementsCount() * sizeof(DataType) );
         }
         if (_cache) {
-            _cache->notifyEntryStorageChanged( eStorageModeDisk, eStorageModeRAM,getTime(), size() );
+            _cache->notifyEntryStorageChanged( getHashKey(), eStorageModeDisk, eStorageModeRAM,getTime(), size() );
         }
     }
 
@@ -708,11 +784,11 @@ public:
         if (_cache) {
             if ( isStoredOnDisk() ) {
                 if (dataAllocated) {
-                    _cache->notifyEntryStorageChanged( eStorageModeRAM, eStorageModeDisk, time, sz );
+                    _cache->notifyEntryStorageChanged( getHashKey(), eStorageModeRAM, eStorageModeDisk, time, sz );
                 }
             } else {
                 if (dataAllocated) {
-                    _cache->notifyEntryDestroyed(time, sz, eStorageModeRAM);
+                    _cache->notifyEntryDestroyed(getHashKey(), time, sz, eStorageModeRAM);
                 }
             }
         }
@@ -765,19 +841,22 @@ public:
         
         bool isAlloc = _data.isAllocated();
         bool hasRemovedFile;
+        std::string filePath;
         {
             QWriteLocker k(&_entryLock);
+            filePath = _data.getFilePath();
             hasRemovedFile = _data.removeAnyBackingFile();
         }
         
         if (hasRemovedFile) {
             _cache->backingFileClosed();
         }
+        _cache->notifyBackingFileRemoved(filePath);
         if ( isAlloc ) {
-            _cache->notifyEntryDestroyed(getTime(), _params->getElementsCount() * sizeof(DataType),eStorageModeRAM);
+            _cache->notifyEntryDestroyed(getHashKey(), getTime(), _params->getElementsCount() * sizeof(DataType),eStorageModeRAM);
         } else {
             ///size() will return 0 at this point, we have to recompute it
-            _cache->notifyEntryDestroyed(getTime(), _params->getElementsCount() * sizeof(DataType),eStorageModeDisk);
+            _cache->notifyEntryDestroyed(getHashKey(), getTime(), _params->getElementsCount() * sizeof(DataType),eStorageModeDisk);
         }
     }
     
@@ -808,7 +887,7 @@ protected:
         size_t oldSize = size();
         _data.reallocate(elemCount);
         if (_cache) {
-            _cache->notifyEntrySizeChanged( oldSize,size());
+            _cache->notifyEntrySizeChanged( getHashKey(), oldSize,size());
         }
     }
 
@@ -817,7 +896,7 @@ protected:
         size_t oldSize = size();
         _data.swap(other._data);
         if (_cache) {
-            _cache->notifyEntrySizeChanged( oldSize,size());
+            _cache->notifyEntrySizeChanged( getHashKey(), oldSize,size());
         }
     }
 
@@ -836,6 +915,16 @@ private:
      * We must ensure that this function is called ONLY by allocateMemory(), that's why
      * it is private.
      **/
+    /**
+     * @brief If true, the RAM storage will be allocated from the ImageArena. Ignored if the memory is already allocated.
+     **/
+    void setUseArena(bool use)
+    {
+        if ( (_buffer.size() == 0) && !_backingFile ) {
+            _buffer.setUseArena(use);
+        }
+    }
+
     void allocate( U64 count,
                    StorageModeEnum storage,
                    std::string path = std::string() )
@@ -879,10 +968,10 @@ private:
      * We must ensure that this function is called ONLY by allocateMemory(), that's why
      * it is private.
      **/
-    void restoreBufferFromFile(const std::string & path)
+    void restoreBufferFromFile(const std::string & path, bool checkFileExists)
     {
         
-        if (!fileExists(path)) {
+        if (checkFileExists && !fileExists(path)) {
             throw std::runtime_error("Cache restore, no such file: " + path);
         }
         _data.restoreBufferFromFile(path);
@@ -0,0 +1,422 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "CacheJournal.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#ifdef __NATRON_UNIX__
+#include <unistd.h> // fsync
+#endif
+#ifdef __NATRON_WIN32__
+#include <io.h> // _commit
+#endif
+
+#include <QtCore/QMutex>
+#include <QtCore/QDebug>
+
+#include "Global/GlobalDefines.h"
+
+#define NATRON_CACHE_JOURNAL_MAGIC "NTRCJNL"
+#define NATRON_CACHE_JOURNAL_RECORD_MAGIC 0x4E4A5243 // NJRC
+
+///Compact the journal when it has more than this number of records and most of them are stale
+#define NATRON_CACHE_JOURNAL_MIN_RECORDS_FOR_COMPACTION 1024
+
+///Sanity limits used to detect a corrupted record length
+#define NATRON_CACHE_JOURNAL_MAX_PATH_LENGTH 4096
+#define NATRON_CACHE_JOURNAL_MAX_DATA_LENGTH (64 * 1024 * 1024)
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+enum JournalRecordTypeEnum
+{
+    eJournalRecordTypeAddition = 1,
+    eJournalRecordTypeRemoval
+};
+
+struct JournalRecordHeader
+{
+    U32 magic;
+    U32 type;
+    U32 pathLength;
+    U32 dataLength;
+    U32 checksum;
+};
+
+///FNV-1a, enough to detect a torn record
+U32
+computeChecksum(U32 type,
+                const std::string & path,
+                const std::string & data)
+{
+    U32 h = 2166136261U;
+    const unsigned char* typeBytes = (const unsigned char*)&type;
+
+    for (std::size_t i = 0; i < sizeof(type); ++i) {
+        h = (h ^ typeBytes[i]) * 16777619U;
+    }
+    for (std::size_t i = 0; i < path.size(); ++i) {
+        h = (h ^ (unsigned char)path[i]) * 16777619U;
+    }
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        h = (h ^ (unsigned char)data[i]) * 16777619U;
+    }
+
+    return h;
+}
+
+bool
+writeHeader(std::FILE* file,
+            unsigned int cacheVersion)
+{
+    char magic[8];
+
+    std::memset(magic, 0, sizeof(magic));
+    std::strncpy(magic, NATRON_CACHE_JOURNAL_MAGIC, sizeof(magic) - 1);
+    U32 version = cacheVersion;
+
+    return std::fwrite(magic, sizeof(magic), 1, file) == 1 &&
+           std::fwrite(&version, sizeof(version), 1, file) == 1;
+}
+
+bool
+writeRecord(std::FILE* file,
+            JournalRecordTypeEnum type,
+            const std::string & path,
+            const std::string & data)
+{
+    JournalRecordHeader header;
+
+    header.magic = NATRON_CACHE_JOURNAL_RECORD_MAGIC;
+    header.type = (U32)type;
+    header.pathLength = (U32)path.size();
+    header.dataLength = (U32)data.size();
+    header.checksum = computeChecksum(header.type, path, data);
+
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    if ( !path.empty() && (std::fwrite(&path[0], path.size(), 1, file) != 1) ) {
+        return false;
+    }
+    if ( !data.empty() && (std::fwrite(&data[0], data.size(), 1, file) != 1) ) {
+        return false;
+    }
+
+    return true;
+}
+
+///Returns false when the end of the file is reached or the record is torn/corrupted
+bool
+readRecord(std::FILE* file,
+           JournalRecordTypeEnum* type,
+           std::string* path,
+           std::string* data)
+{
+    JournalRecordHeader header;
+
+    if (std::fread(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    if ( (header.magic != NATRON_CACHE_JOURNAL_RECORD_MAGIC) ||
+         ( (header.type != eJournalRecordTypeAddition) && (header.type != eJournalRecordTypeRemoval) ) ||
+         (header.pathLength == 0) || (header.pathLength > NATRON_CACHE_JOURNAL_MAX_PATH_LENGTH) ||
+         (header.dataLength > NATRON_CACHE_JOURNAL_MAX_DATA_LENGTH) ) {
+        return false;
+    }
+    path->resize(header.pathLength);
+    if (std::fread(&(*path)[0], header.pathLength, 1, file) != 1) {
+        return false;
+    }
+    data->resize(header.dataLength);
+    if ( (header.dataLength > 0) && (std::fread(&(*data)[0], header.dataLength, 1, file) != 1) ) {
+        return false;
+    }
+    if ( header.checksum != computeChecksum(header.type, *path, *data) ) {
+        return false;
+    }
+    *type = (JournalRecordTypeEnum)header.type;
+
+    return true;
+}
+
+///Makes sure the content of the file reached the disk and not only the OS buffers
+void
+syncFile(std::FILE* file)
+{
+    std::fflush(file);
+#ifdef __NATRON_UNIX__
+    fsync( fileno(file) );
+#endif
+#ifdef __NATRON_WIN32__
+    _commit( _fileno(file) );
+#endif
+}
+} // anon namespace
+
+struct CacheJournalPrivate
+{
+    mutable QMutex lock; // protects all fields below
+    std::string filePath;
+    unsigned int cacheVersion;
+
+    ///The journal opened in append mode, NULL until the first record is appended
+    std::FILE* file;
+
+    ///The live records, by backing file path, used to compact the journal
+    std::map<std::string, std::string> liveRecords;
+
+    ///The number of records in the journal file, including stale ones
+    std::size_t nRecords;
+
+    CacheJournalPrivate(const std::string & filePath,
+                        unsigned int cacheVersion)
+        : lock()
+        , filePath(filePath)
+        , cacheVersion(cacheVersion)
+        , file(0)
+        , liveRecords()
+        , nRecords(0)
+    {
+    }
+
+    void closeFile()
+    {
+        if (file) {
+            std::fclose(file);
+            file = 0;
+        }
+    }
+
+    bool openFileForAppending()
+    {
+        if (file) {
+            return true;
+        }
+        file = std::fopen(filePath.c_str(), "ab");
+        if (!file) {
+            qDebug() << "Could not open the cache journal" << filePath.c_str();
+
+            return false;
+        }
+        std::fseek(file, 0, SEEK_END);
+        if (std::ftell(file) == 0) {
+            // the journal did not exist
+            writeHeader(file, cacheVersion);
+        }
+
+        return true;
+    }
+
+    void append(JournalRecordTypeEnum type,
+                const std::string & path,
+                const std::string & data)
+    {
+        if ( !openFileForAppending() ) {
+            return;
+        }
+        if ( !writeRecord(file, type, path, data) ) {
+            qDebug() << "Failed to write to the cache journal" << filePath.c_str();
+        }
+        ///Flushing is enough to survive the application being killed, the record goes to the OS buffers
+        std::fflush(file);
+        ++nRecords;
+    }
+
+    void rewriteFromLiveRecords()
+    {
+        closeFile();
+
+        std::string tmpFilePath = filePath + ".tmp";
+        std::FILE* tmpFile = std::fopen(tmpFilePath.c_str(), "wb");
+        if (!tmpFile) {
+            qDebug() << "Could not compact the cache journal" << filePath.c_str();
+
+            return;
+        }
+        bool ok = writeHeader(tmpFile, cacheVersion);
+        for (std::map<std::string, std::string>::const_iterator it = liveRecords.begin(); ok && it != liveRecords.end(); ++it) {
+            ok = writeRecord(tmpFile, eJournalRecordTypeAddition, it->first, it->second);
+        }
+        syncFile(tmpFile);
+        std::fclose(tmpFile);
+        if (!ok) {
+            qDebug() << "Failed to compact the cache journal" << filePath.c_str();
+            std::remove( tmpFilePath.c_str() );
+
+            return;
+        }
+#ifdef __NATRON_WIN32__
+        ///rename() does not replace an existing file on Windows
+        std::remove( filePath.c_str() );
+#endif
+        if (std::rename( tmpFilePath.c_str(), filePath.c_str() ) != 0) {
+            qDebug() << "Failed to replace the cache journal" << filePath.c_str();
+            std::remove( tmpFilePath.c_str() );
+
+            return;
+        }
+        nRecords = liveRecords.size();
+    }
+
+    void compactIfNeeded()
+    {
+        if ( (nRecords > NATRON_CACHE_JOURNAL_MIN_RECORDS_FOR_COMPACTION) && (nRecords > 2 * liveRecords.size()) ) {
+            rewriteFromLiveRecords();
+        }
+    }
+};
+
+CacheJournal::CacheJournal(const std::string & filePath,
+                           unsigned int cacheVersion)
+    : _imp( new CacheJournalPrivate(filePath, cacheVersion) )
+{
+}
+
+CacheJournal::~CacheJournal()
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->closeFile();
+}
+
+const std::string &
+CacheJournal::getFilePath() const
+{
+    // const after construction, no need to lock
+    return _imp->filePath;
+}
+
+bool
+CacheJournal::replay(RecordList* records)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->closeFile();
+    _imp->liveRecords.clear();
+    _imp->nRecords = 0;
+
+    std::FILE* file = std::fopen(_imp->filePath.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    char magic[8];
+    U32 version = 0;
+    if ( (std::fread(magic, sizeof(magic), 1, file) != 1) ||
+         (std::fread(&version, sizeof(version), 1, file) != 1) ||
+         (std::strncmp(magic, NATRON_CACHE_JOURNAL_MAGIC, sizeof(magic)) != 0) ||
+         (version != _imp->cacheVersion) ) {
+        std::fclose(file);
+
+        return false;
+    }
+
+    JournalRecordTypeEnum type;
+    std::string path, data;
+    std::size_t nRecords = 0;
+    long validEnd = std::ftell(file);
+    while ( readRecord(file, &type, &path, &data) ) {
+        if (type == eJournalRecordTypeAddition) {
+            _imp->liveRecords[path].swap(data);
+        } else {
+            _imp->liveRecords.erase(path);
+        }
+        ++nRecords;
+        validEnd = std::ftell(file);
+    }
+    std::fseek(file, 0, SEEK_END);
+    bool tornTail = std::ftell(file) != validEnd;
+    std::fclose(file);
+
+    _imp->nRecords = nRecords;
+    if (tornTail) {
+        ///The application was killed while writing the last record: drop it, otherwise appending would
+        ///put the next records after garbage
+        qDebug() << "The cache journal" << _imp->filePath.c_str() << "was not closed properly, its last record was dropped";
+        _imp->rewriteFromLiveRecords();
+    }
+
+    for (std::map<std::string, std::string>::const_iterator it = _imp->liveRecords.begin(); it != _imp->liveRecords.end(); ++it) {
+        Record r;
+        r.filePath = it->first;
+        r.data = it->second;
+        records->push_back(r);
+    }
+
+    return true;
+}
+
+void
+CacheJournal::rewrite(const RecordList & records)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->liveRecords.clear();
+    for (RecordList::const_iterator it = records.begin(); it != records.end(); ++it) {
+        _imp->liveRecords[it->filePath] = it->data;
+    }
+    _imp->rewriteFromLiveRecords();
+}
+
+void
+CacheJournal::appendAddition(const std::string & filePath,
+                             const std::string & data)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->liveRecords[filePath] = data;
+    _imp->append(eJournalRecordTypeAddition, filePath, data);
+    _imp->compactIfNeeded();
+}
+
+void
+CacheJournal::appendRemoval(const std::string & filePath)
+{
+    QMutexLocker k(&_imp->lock);
+
+    if ( _imp->liveRecords.erase(filePath) == 0 ) {
+        ///The entry was never journaled, there's nothing to remove
+        return;
+    }
+    _imp->append(eJournalRecordTypeRemoval, filePath, std::string());
+    _imp->compactIfNeeded();
+}
+
+void
+CacheJournal::getStats(std::size_t* nLiveRecords,
+                       std::size_t* nRecords) const
+{
+    QMutexLocker k(&_imp->lock);
+
+    *nLiveRecords = _imp->liveRecords.size();
+    *nRecords = _imp->nRecords;
+}
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,118 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_CacheJournal_h
+#define Engine_CacheJournal_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <string>
+#include <list>
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/scoped_ptr.hpp>
+#endif
+
+#include "Engine/EngineFwd.h"
+
+///Name of the journal file, located at the root of the cache directory
+#define NATRON_CACHE_JOURNAL_FILE_NAME "journal." NATRON_CACHE_FILE_EXT
+
+NATRON_NAMESPACE_ENTER;
+
+struct CacheJournalPrivate;
+
+/**
+ * @brief An append-only index of the entries living in the disk portion of a cache.
+ * An entry is added to the journal when its data has been flushed to its backing file and removed
+ * when its backing file is removed, so the journal always describes valid backing files, even if the
+ * application is killed. Each record is checksummed: a record torn by a crash is ignored when the journal
+ * is replayed.
+ * When most records of the journal are stale, it is compacted: the live records are written to a
+ * temporary file which then atomically replaces the journal.
+ *
+ * The journal does not know anything about the entries themselves: each record holds an opaque
+ * serialization of the cache table of contents entry, identified by the backing file path.
+ * This class is MT-safe.
+ **/
+class CacheJournal
+{
+public:
+
+    struct Record
+    {
+        ///The backing file of the entry, this identifies the entry on disk
+        std::string filePath;
+
+        ///The serialized table of contents entry
+        std::string data;
+    };
+
+    typedef std::list<Record> RecordList;
+
+    CacheJournal(const std::string & filePath,
+                 unsigned int cacheVersion);
+
+    ~CacheJournal();
+
+    const std::string & getFilePath() const;
+
+    /**
+     * @brief Reads the journal and returns the records of the entries that were on disk when the journal
+     * was last written. This is O(journal size): the data of the records is neither deserialized nor validated.
+     * @returns False if the journal does not exist or was written by another version of the cache.
+     **/
+    bool replay(RecordList* records);
+
+    /**
+     * @brief Replaces the content of the journal with the given records.
+     **/
+    void rewrite(const RecordList & records);
+
+    /**
+     * @brief Records that the entry whose backing file is filePath is on disk. If the entry
+     * was already in the journal, its data is replaced.
+     **/
+    void appendAddition(const std::string & filePath,
+                        const std::string & data);
+
+    /**
+     * @brief Records that the backing file filePath was removed.
+     **/
+    void appendRemoval(const std::string & filePath);
+
+    /**
+     * @brief Returns the number of live records and the total number of records in the journal file.
+     **/
+    void getStats(std::size_t* nLiveRecords,
+                  std::size_t* nRecords) const;
+
+private:
+
+    boost::scoped_ptr<CacheJournalPrivate> _imp;
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_CacheJournal_h
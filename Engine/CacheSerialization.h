@@ -68,24 +68,28 @@ template<typename EntryType>
 void Cache<EntryType>::save(CacheTOC* tableOfContents)
 {
     clearInMemoryPortion(false);
-    QMutexLocker l(&_lock);     // must be locked
-
-    for (CacheIterator it = _diskCache.begin(); it != _diskCache.end(); ++it) {
-        std::list<EntryTypePtr> & listOfValues  = getValueFromIterator(it);
-        for (typename std::list<EntryTypePtr>::const_iterator it2 = listOfValues.begin(); it2 != listOfValues.end(); ++it2) {
-            if ( (*it2)->isStoredOnDisk() ) {
-                SerializedEntry serialization;
-                serialization.hash = (*it2)->getHashKey();
-                serialization.params = (*it2)->getParams();
-                serialization.key = (*it2)->getKey();
-                serialization.size = (*it2)->dataSize();
-                serialization.filePath = (*it2)->getFilePath();
-                tableOfContents->push_back(serialization);
+
+    for (std::size_t i = 0; i < _shards.size(); ++i) {
+        CacheShard & shard = *_shards[i];
+        QMutexLocker l(&shard.lock);     // must be locked
+
+        for (CacheIterator it = shard.diskCache.begin(); it != shard.diskCache.end(); ++it) {
+            std::list<EntryTypePtr> & listOfValues  = getValueFromIterator(it);
+            for (typename std::list<EntryTypePtr>::const_iterator it2 = listOfValues.begin(); it2 != listOfValues.end(); ++it2) {
+                if ( (*it2)->isStoredOnDisk() ) {
+                    SerializedEntry serialization;
+                    serialization.hash = (*it2)->getHashKey();
+                    serialization.params = (*it2)->getParams();
+                    serialization.key = (*it2)->getKey();
+                    serialization.size = (*it2)->dataSize();
+                    serialization.filePath = (*it2)->getFilePath();
+                    tableOfContents->push_back(serialization);
 #ifdef DEBUG
-                if (!CacheAPI::checkFileNameMatchesHash(serialization.filePath, serialization.hash)) {
-                    qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
-                }
+                    if (!CacheAPI::checkFileNameMatchesHash(serialization.filePath, serialization.hash)) {
+                        qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
+                    }
 #endif
+                }
             }
         }
     }
@@ -94,7 +98,7 @@ void Cache<EntryType>::save(CacheTOC* tableOfContents)
 
 /*Restores the cache from disk.*/
 template<typename EntryType>
-void Cache<EntryType>::restore(const CacheTOC & tableOfContents)
+void Cache<EntryType>::restore(const CacheTOC & tableOfContents, bool checkFilesExist)
 {
 
     ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
@@ -130,15 +134,16 @@ void Cache<EntryType>::restore(const CacheTOC & tableOfContents)
             value = new EntryType(it->key,it->params,this,storage,it->filePath);
 
             ///This will not put the entry back into RAM, instead we just insert back the entry into the disk cache
-            value->restoreMetaDataFromFile(it->size);
+            value->restoreMetaDataFromFile(it->size, checkFilesExist);
         } catch (const std::exception & e) {
             qDebug() << e.what();
             continue;
         }
 
         {
-            QMutexLocker locker(&_lock);
-            sealEntry(EntryTypePtr(value), false);
+            CacheShard & shard = getShard( value->getHashKey() );
+            QMutexLocker locker(&shard.lock);
+            sealEntry(shard, EntryTypePtr(value), false);
         }
     }
 }
@@ -188,6 +193,45 @@ struct Cache<EntryType>::SerializedEntry
 
 };
 
+/*Serializes the table of contents entry of an entry for the journal.
+   The archive header is skipped: the journal holds one archive per entry and has its own versioning.*/
+template<typename EntryType>
+std::string Cache<EntryType>::serializeJournalEntry(const EntryType & entry)
+{
+    SerializedEntry serialization;
+
+    serialization.hash = entry.getHashKey();
+    serialization.params = entry.getParams();
+    serialization.key = entry.getKey();
+    serialization.size = entry.dataSize();
+    serialization.filePath = entry.getFilePath();
+
+    std::ostringstream ss;
+    {
+        boost::archive::binary_oarchive oArchive(ss, boost::archive::no_header);
+        oArchive << serialization;
+    }
+
+    return ss.str();
+}
+
+template<typename EntryType>
+bool Cache<EntryType>::deserializeJournalEntry(const std::string & data, SerializedEntry* serialization)
+{
+    std::istringstream ss(data);
+
+    try {
+        boost::archive::binary_iarchive iArchive(ss, boost::archive::no_header);
+        iArchive >> *serialization;
+    } catch (const std::exception & e) {
+        qDebug() << "Failed to read cache journal entry:" << e.what();
+
+        return false;
+    }
+
+    return true;
+}
+
 NATRON_NAMESPACE_EXIT;
 
 
@@ -0,0 +1,1044 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "ColorSIMD.h"
+
+#include <algorithm> // min, max
+#include <cassert>
+#include <cstring> // for memcpy
+
+#include "Engine/Lut.h"
+
+/*
+ * The vectorized kernels are compiled with function-level target attributes so that the rest of Natron
+ * does not need to be compiled with -msse4.1/-mavx2, and are only called if the CPU supports them.
+ */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#if defined(__clang__) && ( (__clang_major__ > 3) || (__clang_major__ == 3 && __clang_minor__ >= 8) )
+#define NATRON_COLOR_SIMD
+#define NATRON_TARGET_SSE41 __attribute__( ( target("sse4.1") ) )
+#define NATRON_TARGET_AVX2 __attribute__( ( target("avx2") ) )
+#elif !defined(__clang__) && defined(__GNUC__) && ( (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) )
+#define NATRON_COLOR_SIMD
+#define NATRON_TARGET_SSE41 __attribute__( ( target("sse4.1") ) )
+#define NATRON_TARGET_AVX2 __attribute__( ( target("avx2") ) )
+#elif defined(_MSC_VER) && (_MSC_VER >= 1800)
+#define NATRON_COLOR_SIMD
+#define NATRON_TARGET_SSE41
+#define NATRON_TARGET_AVX2
+#endif
+#endif
+
+#ifdef NATRON_COLOR_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h> // __cpuid
+#endif
+#endif
+
+NATRON_NAMESPACE_ENTER;
+
+namespace Color {
+namespace {
+SIMDLevelEnum
+detectSIMDLevel()
+{
+#ifdef NATRON_COLOR_SIMD
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int nIds = info[0];
+    if (nIds < 1) {
+        return eSIMDLevelNone;
+    }
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if ( osxsave && avx && (nIds >= 7) ) {
+        // the OS must save the AVX registers
+        bool ymmEnabled = (_xgetbv(0) & 0x6) == 0x6;
+        __cpuidex(info, 7, 0);
+        avx2 = ymmEnabled && (info[1] & (1 << 5)) != 0;
+    }
+    if (avx2) {
+        return eSIMDLevelAVX2;
+    } else if (sse41) {
+        return eSIMDLevelSSE41;
+    }
+#else
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") ) {
+        return eSIMDLevelAVX2;
+    } else if ( __builtin_cpu_supports("sse4.1") ) {
+        return eSIMDLevelSSE41;
+    }
+#endif
+#endif // NATRON_COLOR_SIMD
+
+    return eSIMDLevelNone;
+}
+
+const SIMDLevelEnum supportedLevel = detectSIMDLevel();
+SIMDLevelEnum currentLevel = supportedLevel;
+
+inline unsigned int
+hipartIndex(float f)
+{
+    // same as hipart() in Lut.cpp, on any endianness
+    unsigned int bits;
+
+    std::memcpy( &bits, &f, sizeof(bits) );
+
+    return bits >> 16;
+}
+
+/////////////// Scalar versions, also used to process the end of the rows
+
+void
+floatToByteRow_scalar(const float* from,
+                      unsigned char* to,
+                      int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = (unsigned char)floatToInt<256>(from[i]);
+    }
+}
+
+void
+floatToShortRow_scalar(const float* from,
+                       unsigned short* to,
+                       int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = (unsigned short)floatToInt<65536>(from[i]);
+    }
+}
+
+void
+byteToFloatRow_scalar(const unsigned char* from,
+                      float* to,
+                      int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = intToFloat<256>(from[i]);
+    }
+}
+
+void
+shortToFloatRow_scalar(const unsigned short* from,
+                       float* to,
+                       int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = intToFloat<65536>(from[i]);
+    }
+}
+
+void
+lookupUint8ToFloatRow_scalar(const float* table,
+                             const unsigned char* from,
+                             float* to,
+                             int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = table[from[i]];
+    }
+}
+
+void
+lookupHipartRow_scalar(const unsigned short* table,
+                       const float* from,
+                       unsigned short* to,
+                       int n,
+                       bool premultRGBA)
+{
+    if (!premultRGBA) {
+        for (int i = 0; i < n; ++i) {
+            to[i] = table[hipartIndex(from[i])];
+        }
+    } else {
+        assert(n % 4 == 0);
+        for (int i = 0; i < n; i += 4) {
+            float a = from[i + 3];
+            to[i] = table[hipartIndex(from[i] * a)];
+            to[i + 1] = table[hipartIndex(from[i + 1] * a)];
+            to[i + 2] = table[hipartIndex(from[i + 2] * a)];
+            to[i + 3] = table[hipartIndex(a)];
+        }
+    }
+}
+
+void
+unpremultRGBARow_scalar(const float* from,
+                        float* to,
+                        int nPixels)
+{
+    for (int i = 0; i < nPixels * 4; i += 4) {
+        float a = from[i + 3];
+        if (a > 0.) {
+            to[i] = from[i] / a;
+            to[i + 1] = from[i + 1] / a;
+            to[i + 2] = from[i + 2] / a;
+        } else {
+            to[i] = to[i + 1] = to[i + 2] = 0.;
+        }
+        to[i + 3] = a;
+    }
+}
+
+void
+gainOffsetRow_scalar(const float* from,
+                     float* to,
+                     int n,
+                     double gain,
+                     double offset)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = (float)(from[i] * gain + offset);
+    }
+}
+
+inline float
+interpolateLut(const float* table,
+               int tableSize,
+               float value)
+{
+    if (value < 0.) {
+        return 0.;
+    } else if (value > 1.) {
+        return 1.;
+    } else if (value != value) {
+        return 0.;
+    }
+    int i = (int)(value * tableSize);
+    assert(0 <= i && i <= tableSize);
+    float alpha = std::max( 0.f, std::min(value * tableSize - i, 1.f) );
+    float a = table[i];
+    float b = (i < tableSize) ? table[i + 1] : 0.f;
+
+    return a * (1.f - alpha) + b * alpha;
+}
+
+void
+interpolateLutRow_scalar(const float* table,
+                         int tableSize,
+                         const float* from,
+                         float* to,
+                         int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = interpolateLut(table, tableSize, from[i]);
+    }
+}
+
+void
+clampRow_scalar(const float* from,
+                float* to,
+                int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = std::min(std::max(from[i], 0.f), 1.f);
+    }
+}
+
+template <typename PIX>
+void
+halveRows_scalar(const PIX* row0,
+                 const PIX* row1,
+                 PIX* to,
+                 int nPixels,
+                 int nComps)
+{
+    for (int i = 0; i < nPixels; ++i, row0 += 2 * nComps, row1 += 2 * nComps, to += nComps) {
+        for (int k = 0; k < nComps; ++k) {
+            // same expression as Image::halveRoIForDepth
+            to[k] = (row0[k] + row0[k + nComps] + row1[k] + row1[k + nComps]) / 4;
+        }
+    }
+}
+
+#ifdef NATRON_COLOR_SIMD
+
+/////////////// SSE4.1 versions
+
+/*
+ * floatToInt<numvals>(v) computes (int)(v * (numvals - 1) + 0.5) with the addition in double precision.
+ * Adding 0.5 in single precision may round up to the next integer, so instead we compute
+ * trunc(f) + (f - trunc(f) >= 0.5), which is exactly floor(f + 0.5) for f >= 0.
+ * NaNs give INT_MIN like the scalar conversion, which saturates to 0 once packed.
+ */
+NATRON_TARGET_SSE41
+inline __m128i
+floatToInt_sse41(__m128 v,
+                 float maxValue)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 f = _mm_mul_ps( v, _mm_set1_ps(maxValue) );
+    __m128i r = _mm_cvttps_epi32(f);
+    __m128 frac = _mm_sub_ps( f, _mm_cvtepi32_ps(r) );
+
+    // the mask is -1 where the fraction rounds up
+    r = _mm_sub_epi32( r, _mm_castps_si128( _mm_cmpge_ps( frac, _mm_set1_ps(0.5f) ) ) );
+    r = _mm_blendv_epi8( r, _mm_set1_epi32( (int)maxValue ), _mm_castps_si128( _mm_cmpge_ps(v, one) ) );
+    r = _mm_andnot_si128( _mm_castps_si128( _mm_cmple_ps(v, zero) ), r );
+
+    return r;
+}
+
+NATRON_TARGET_SSE41
+void
+floatToByteRow_sse41(const float* from,
+                     unsigned char* to,
+                     int n)
+{
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i r0 = floatToInt_sse41(_mm_loadu_ps(from + i), 255.f);
+        __m128i r1 = floatToInt_sse41(_mm_loadu_ps(from + i + 4), 255.f);
+        __m128i r2 = floatToInt_sse41(_mm_loadu_ps(from + i + 8), 255.f);
+        __m128i r3 = floatToInt_sse41(_mm_loadu_ps(from + i + 12), 255.f);
+        __m128i s01 = _mm_packs_epi32(r0, r1);
+        __m128i s23 = _mm_packs_epi32(r2, r3);
+        _mm_storeu_si128( (__m128i*)(to + i), _mm_packus_epi16(s01, s23) );
+    }
+    floatToByteRow_scalar(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_SSE41
+void
+floatToShortRow_sse41(const float* from,
+                      unsigned short* to,
+                      int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i r0 = floatToInt_sse41(_mm_loadu_ps(from + i), 65535.f);
+        __m128i r1 = floatToInt_sse41(_mm_loadu_ps(from + i + 4), 65535.f);
+        _mm_storeu_si128( (__m128i*)(to + i), _mm_packus_epi32(r0, r1) );
+    }
+    floatToShortRow_scalar(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_SSE41
+void
+byteToFloatRow_sse41(const unsigned char* from,
+                     float* to,
+                     int n)
+{
+    const __m128 maxValue = _mm_set1_ps(255.f);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        int packed;
+        std::memcpy( &packed, from + i, sizeof(packed) );
+        __m128i v = _mm_cvtepu8_epi32( _mm_cvtsi32_si128(packed) );
+        // a division, not a multiplication by the inverse, to give the same result as intToFloat
+        _mm_storeu_ps( to + i, _mm_div_ps(_mm_cvtepi32_ps(v), maxValue) );
+    }
+    byteToFloatRow_scalar(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_SSE41
+void
+shortToFloatRow_sse41(const unsigned short* from,
+                      float* to,
+                      int n)
+{
+    const __m128 maxValue = _mm_set1_ps(65535.f);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i*)(from + i) ) );
+        _mm_storeu_ps( to + i, _mm_div_ps(_mm_cvtepi32_ps(v), maxValue) );
+    }
+    shortToFloatRow_scalar(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_SSE41
+void
+unpremultRGBARow_sse41(const float* from,
+                       float* to,
+                       int nPixels)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    for (int i = 0; i < nPixels * 4; i += 4) {
+        __m128 p = _mm_loadu_ps(from + i);
+        __m128 a = _mm_shuffle_ps( p, p, _MM_SHUFFLE(3, 3, 3, 3) );
+        __m128 r = _mm_and_ps( _mm_div_ps(p, a), _mm_cmpgt_ps(a, zero) );
+        // keep alpha
+        _mm_storeu_ps( to + i, _mm_blend_ps(r, p, 0x8) );
+    }
+}
+
+NATRON_TARGET_SSE41
+void
+gainOffsetRow_sse41(const float* from,
+                    float* to,
+                    int n,
+                    double gain,
+                    double offset)
+{
+    const __m128d g = _mm_set1_pd(gain);
+    const __m128d o = _mm_set1_pd(offset);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(from + i);
+        __m128d lo = _mm_add_pd( _mm_mul_pd(_mm_cvtps_pd(v), g), o );
+        __m128d hi = _mm_add_pd( _mm_mul_pd(_mm_cvtps_pd( _mm_movehl_ps(v, v) ), g), o );
+        _mm_storeu_ps( to + i, _mm_movelh_ps( _mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi) ) );
+    }
+    gainOffsetRow_scalar(from + i, to + i, n - i, gain, offset);
+}
+
+NATRON_TARGET_SSE41
+void
+clampRow_sse41(const float* from,
+               float* to,
+               int n)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    int i = 0;
+
+    // with the operands in this order, maxps/minps handle NaNs and signed zeros like std::max/std::min
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps( to + i, _mm_min_ps( one, _mm_max_ps( zero, _mm_loadu_ps(from + i) ) ) );
+    }
+    clampRow_scalar(from + i, to + i, n - i);
+}
+
+/*
+ * Dividing by 4 and multiplying by 0.25 give exactly the same floats.
+ */
+NATRON_TARGET_SSE41
+void
+halveFloatRows_sse41(const float* row0,
+                     const float* row1,
+                     float* to,
+                     int nPixels,
+                     int nComps)
+{
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    int i = 0;
+
+    if (nComps == 4) {
+        for (; i < nPixels; ++i) {
+            __m128 sum = _mm_add_ps( _mm_loadu_ps(row0 + 8 * i), _mm_loadu_ps(row0 + 8 * i + 4) );
+            sum = _mm_add_ps( sum, _mm_loadu_ps(row1 + 8 * i) );
+            sum = _mm_add_ps( sum, _mm_loadu_ps(row1 + 8 * i + 4) );
+            _mm_storeu_ps( to + 4 * i, _mm_mul_ps(sum, quarter) );
+        }
+    } else if (nComps == 1) {
+        for (; i + 4 <= nPixels; i += 4) {
+            __m128 v0 = _mm_loadu_ps(row0 + 2 * i);
+            __m128 v1 = _mm_loadu_ps(row0 + 2 * i + 4);
+            __m128 w0 = _mm_loadu_ps(row1 + 2 * i);
+            __m128 w1 = _mm_loadu_ps(row1 + 2 * i + 4);
+            // even and odd pixels
+            __m128 sum = _mm_add_ps( _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(2, 0, 2, 0) ), _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            sum = _mm_add_ps( sum, _mm_shuffle_ps( w0, w1, _MM_SHUFFLE(2, 0, 2, 0) ) );
+            sum = _mm_add_ps( sum, _mm_shuffle_ps( w0, w1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            _mm_storeu_ps( to + i, _mm_mul_ps(sum, quarter) );
+        }
+    }
+    halveRows_scalar(row0 + 2 * i * nComps, row1 + 2 * i * nComps, to + i * nComps, nPixels - i, nComps);
+}
+
+NATRON_TARGET_SSE41
+void
+halveShortRows_sse41(const unsigned short* row0,
+                     const unsigned short* row1,
+                     unsigned short* to,
+                     int nPixels,
+                     int nComps)
+{
+    int i = 0;
+
+    if (nComps == 4) {
+        for (; i < nPixels; ++i) {
+            __m128i sum = _mm_add_epi32( _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i*)(row0 + 8 * i) ) ),
+                                         _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i*)(row0 + 8 * i + 4) ) ) );
+            sum = _mm_add_epi32( sum, _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i*)(row1 + 8 * i) ) ) );
+            sum = _mm_add_epi32( sum, _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i*)(row1 + 8 * i + 4) ) ) );
+            sum = _mm_srli_epi32(sum, 2);
+            _mm_storel_epi64( (__m128i*)(to + 4 * i), _mm_packus_epi32(sum, sum) );
+        }
+    } else if (nComps == 1) {
+        const __m128i lowMask = _mm_set1_epi32(0xffff);
+        for (; i + 4 <= nPixels; i += 4) {
+            __m128i v = _mm_loadu_si128( (const __m128i*)(row0 + 2 * i) );
+            __m128i w = _mm_loadu_si128( (const __m128i*)(row1 + 2 * i) );
+            // even pixels are in the low halves of the 32-bit lanes, odd pixels in the high halves
+            __m128i sum = _mm_add_epi32( _mm_and_si128(v, lowMask), _mm_srli_epi32(v, 16) );
+            sum = _mm_add_epi32( sum, _mm_and_si128(w, lowMask) );
+            sum = _mm_add_epi32( sum, _mm_srli_epi32(w, 16) );
+            sum = _mm_srli_epi32(sum, 2);
+            _mm_storel_epi64( (__m128i*)(to + i), _mm_packus_epi32(sum, sum) );
+        }
+    }
+    halveRows_scalar(row0 + 2 * i * nComps, row1 + 2 * i * nComps, to + i * nComps, nPixels - i, nComps);
+}
+
+NATRON_TARGET_SSE41
+void
+halveByteRows_sse41(const unsigned char* row0,
+                    const unsigned char* row1,
+                    unsigned char* to,
+                    int nPixels,
+                    int nComps)
+{
+    int i = 0;
+
+    if (nComps == 4) {
+        // 2 pixels at a time, the sums of 4 bytes fit in 16 bits
+        for (; i + 2 <= nPixels; i += 2) {
+            __m128i v = _mm_loadu_si128( (const __m128i*)(row0 + 8 * i) );
+            __m128i w = _mm_loadu_si128( (const __m128i*)(row1 + 8 * i) );
+            __m128i lo = _mm_add_epi16( _mm_cvtepu8_epi16(v), _mm_cvtepu8_epi16(w) );
+            __m128i hi = _mm_add_epi16( _mm_cvtepu8_epi16( _mm_srli_si128(v, 8) ), _mm_cvtepu8_epi16( _mm_srli_si128(w, 8) ) );
+            __m128i sum = _mm_add_epi16( _mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi) );
+            sum = _mm_srli_epi16(sum, 2);
+            _mm_storel_epi64( (__m128i*)(to + 4 * i), _mm_packus_epi16(sum, sum) );
+        }
+    } else if (nComps == 1) {
+        const __m128i ones = _mm_set1_epi8(1);
+        for (; i + 8 <= nPixels; i += 8) {
+            // maddubs adds the pairs of adjacent bytes
+            __m128i sum = _mm_add_epi16( _mm_maddubs_epi16(_mm_loadu_si128( (const __m128i*)(row0 + 2 * i) ), ones),
+                                         _mm_maddubs_epi16(_mm_loadu_si128( (const __m128i*)(row1 + 2 * i) ), ones) );
+            sum = _mm_srli_epi16(sum, 2);
+            _mm_storel_epi64( (__m128i*)(to + i), _mm_packus_epi16(sum, sum) );
+        }
+    }
+    halveRows_scalar(row0 + 2 * i * nComps, row1 + 2 * i * nComps, to + i * nComps, nPixels - i, nComps);
+}
+
+/////////////// AVX2 versions
+
+NATRON_TARGET_AVX2
+inline __m256i
+floatToInt_avx2(__m256 v,
+                float maxValue)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    __m256 f = _mm256_mul_ps( v, _mm256_set1_ps(maxValue) );
+    __m256i r = _mm256_cvttps_epi32(f);
+    __m256 frac = _mm256_sub_ps( f, _mm256_cvtepi32_ps(r) );
+
+    r = _mm256_sub_epi32( r, _mm256_castps_si256( _mm256_cmp_ps(frac, _mm256_set1_ps(0.5f), _CMP_GE_OQ) ) );
+    r = _mm256_blendv_epi8( r, _mm256_set1_epi32( (int)maxValue ), _mm256_castps_si256( _mm256_cmp_ps(v, one, _CMP_GE_OQ) ) );
+    r = _mm256_andnot_si256( _mm256_castps_si256( _mm256_cmp_ps(v, zero, _CMP_LE_OQ) ), r );
+
+    return r;
+}
+
+NATRON_TARGET_AVX2
+void
+floatToByteRow_avx2(const float* from,
+                    unsigned char* to,
+                    int n)
+{
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i r0 = floatToInt_avx2(_mm256_loadu_ps(from + i), 255.f);
+        __m256i r1 = floatToInt_avx2(_mm256_loadu_ps(from + i + 8), 255.f);
+        __m256i r2 = floatToInt_avx2(_mm256_loadu_ps(from + i + 16), 255.f);
+        __m256i r3 = floatToInt_avx2(_mm256_loadu_ps(from + i + 24), 255.f);
+        // the packs work within 128-bit lanes, the permutation restores the order
+        __m256i s01 = _mm256_packs_epi32(r0, r1);
+        __m256i s23 = _mm256_packs_epi32(r2, r3);
+        __m256i b = _mm256_packus_epi16(s01, s23);
+        b = _mm256_permutevar8x32_epi32( b, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7) );
+        _mm256_storeu_si256( (__m256i*)(to + i), b );
+    }
+    floatToByteRow_sse41(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_AVX2
+void
+floatToShortRow_avx2(const float* from,
+                     unsigned short* to,
+                     int n)
+{
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i r0 = floatToInt_avx2(_mm256_loadu_ps(from + i), 65535.f);
+        __m256i r1 = floatToInt_avx2(_mm256_loadu_ps(from + i + 8), 65535.f);
+        __m256i s = _mm256_permute4x64_epi64(_mm256_packus_epi32(r0, r1), _MM_SHUFFLE(3, 1, 2, 0) );
+        _mm256_storeu_si256( (__m256i*)(to + i), s );
+    }
+    floatToShortRow_sse41(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_AVX2
+void
+byteToFloatRow_avx2(const unsigned char* from,
+                    float* to,
+                    int n)
+{
+    const __m256 maxValue = _mm256_set1_ps(255.f);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)(from + i) ) );
+        _mm256_storeu_ps( to + i, _mm256_div_ps(_mm256_cvtepi32_ps(v), maxValue) );
+    }
+    byteToFloatRow_scalar(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_AVX2
+void
+shortToFloatRow_avx2(const unsigned short* from,
+                     float* to,
+                     int n)
+{
+    const __m256 maxValue = _mm256_set1_ps(65535.f);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)(from + i) ) );
+        _mm256_storeu_ps( to + i, _mm256_div_ps(_mm256_cvtepi32_ps(v), maxValue) );
+    }
+    shortToFloatRow_scalar(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_AVX2
+void
+lookupUint8ToFloatRow_avx2(const float* table,
+                           const unsigned char* from,
+                           float* to,
+                           int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i index = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)(from + i) ) );
+        _mm256_storeu_ps( to + i, _mm256_i32gather_ps(table, index, 4) );
+    }
+    lookupUint8ToFloatRow_scalar(table, from + i, to + i, n - i);
+}
+
+NATRON_TARGET_AVX2
+inline __m128i
+lookupHipart_avx2(const unsigned short* table,
+                  __m256 v)
+{
+    __m256i index = _mm256_srli_epi32(_mm256_castps_si256(v), 16);
+    // 32-bit gather of 16-bit entries: the high half belongs to the next entry, hence the padding of the table
+    __m256i values = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)table, index, 2 ), _mm256_set1_epi32(0xffff) );
+
+    return _mm_packus_epi32( _mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1) );
+}
+
+NATRON_TARGET_AVX2
+void
+lookupHipartRow_avx2(const unsigned short* table,
+                     const float* from,
+                     unsigned short* to,
+                     int n,
+                     bool premultRGBA)
+{
+    int i = 0;
+
+    if (!premultRGBA) {
+        for (; i + 8 <= n; i += 8) {
+            _mm_storeu_si128( (__m128i*)(to + i), lookupHipart_avx2( table, _mm256_loadu_ps(from + i) ) );
+        }
+    } else {
+        assert(n % 4 == 0);
+        // 2 RGBA pixels at a time, alpha is looked-up as is
+        for (; i + 8 <= n; i += 8) {
+            __m256 p = _mm256_loadu_ps(from + i);
+            __m256 a = _mm256_permute_ps( p, _MM_SHUFFLE(3, 3, 3, 3) );
+            __m256 premult = _mm256_blend_ps(_mm256_mul_ps(p, a), p, 0x88);
+            _mm_storeu_si128( (__m128i*)(to + i), lookupHipart_avx2(table, premult) );
+        }
+    }
+    lookupHipartRow_scalar(table, from + i, to + i, n - i, premultRGBA);
+}
+
+NATRON_TARGET_AVX2
+void
+unpremultRGBARow_avx2(const float* from,
+                      float* to,
+                      int nPixels)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    int i = 0;
+    int n = nPixels * 4;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 p = _mm256_loadu_ps(from + i);
+        __m256 a = _mm256_permute_ps( p, _MM_SHUFFLE(3, 3, 3, 3) );
+        __m256 r = _mm256_and_ps( _mm256_div_ps(p, a), _mm256_cmp_ps(a, zero, _CMP_GT_OQ) );
+        _mm256_storeu_ps( to + i, _mm256_blend_ps(r, p, 0x88) );
+    }
+    unpremultRGBARow_scalar(from + i, to + i, (n - i) / 4);
+}
+
+NATRON_TARGET_AVX2
+void
+gainOffsetRow_avx2(const float* from,
+                   float* to,
+                   int n,
+                   double gain,
+                   double offset)
+{
+    const __m256d g = _mm256_set1_pd(gain);
+    const __m256d o = _mm256_set1_pd(offset);
+    int i = 0;
+
+    // separate multiplication and addition: a fused multiply-add would round differently
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(from + i);
+        __m256d lo = _mm256_add_pd( _mm256_mul_pd(_mm256_cvtps_pd( _mm256_castps256_ps128(v) ), g), o );
+        __m256d hi = _mm256_add_pd( _mm256_mul_pd(_mm256_cvtps_pd( _mm256_extractf128_ps(v, 1) ), g), o );
+        _mm256_storeu_ps( to + i, _mm256_insertf128_ps(_mm256_castps128_ps256( _mm256_cvtpd_ps(lo) ), _mm256_cvtpd_ps(hi), 1) );
+    }
+    gainOffsetRow_sse41(from + i, to + i, n - i, gain, offset);
+}
+
+NATRON_TARGET_AVX2
+void
+interpolateLutRow_avx2(const float* table,
+                       int tableSize,
+                       const float* from,
+                       float* to,
+                       int n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 size = _mm256_set1_ps( (float)tableSize );
+    const __m256i lastIndex = _mm256_set1_epi32(tableSize);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(from + i);
+        // false for NaNs: the look-up is done at 0 and the result discarded
+        __m256 inside = _mm256_and_ps( _mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LE_OQ) );
+        __m256 f = _mm256_mul_ps(_mm256_and_ps(v, inside), size);
+        __m256i index = _mm256_cvttps_epi32(f);
+        __m256 alpha = _mm256_max_ps( _mm256_min_ps( one, _mm256_sub_ps( f, _mm256_cvtepi32_ps(index) ) ), zero );
+        __m256 a = _mm256_i32gather_ps(table, index, 4);
+        // b is 0 after the last entry
+        __m256i hasNext = _mm256_cmpgt_epi32(lastIndex, index);
+        __m256i nextIndex = _mm256_sub_epi32(index, hasNext);
+        __m256 b = _mm256_mask_i32gather_ps( zero, table, nextIndex, _mm256_castsi256_ps(hasNext), 4 );
+        __m256 r = _mm256_add_ps( _mm256_mul_ps( a, _mm256_sub_ps(one, alpha) ), _mm256_mul_ps(b, alpha) );
+        r = _mm256_and_ps(r, inside);
+        r = _mm256_blendv_ps( r, one, _mm256_cmp_ps(v, one, _CMP_GT_OQ) );
+        _mm256_storeu_ps(to + i, r);
+    }
+    interpolateLutRow_scalar(table, tableSize, from + i, to + i, n - i);
+}
+
+NATRON_TARGET_AVX2
+void
+clampRow_avx2(const float* from,
+              float* to,
+              int n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps( to + i, _mm256_min_ps( one, _mm256_max_ps( zero, _mm256_loadu_ps(from + i) ) ) );
+    }
+    clampRow_sse41(from + i, to + i, n - i);
+}
+
+NATRON_TARGET_AVX2
+void
+halveFloatRows_avx2(const float* row0,
+                    const float* row1,
+                    float* to,
+                    int nPixels,
+                    int nComps)
+{
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    int i = 0;
+
+    if (nComps == 4) {
+        for (; i + 2 <= nPixels; i += 2) {
+            __m256 v0 = _mm256_loadu_ps(row0 + 8 * i);
+            __m256 v1 = _mm256_loadu_ps(row0 + 8 * i + 8);
+            __m256 w0 = _mm256_loadu_ps(row1 + 8 * i);
+            __m256 w1 = _mm256_loadu_ps(row1 + 8 * i + 8);
+            // the first pixels of the 2x2 blocks in the low lanes, the second ones in the high lanes
+            __m256 sum = _mm256_add_ps( _mm256_permute2f128_ps(v0, v1, 0x20), _mm256_permute2f128_ps(v0, v1, 0x31) );
+            sum = _mm256_add_ps( sum, _mm256_permute2f128_ps(w0, w1, 0x20) );
+            sum = _mm256_add_ps( sum, _mm256_permute2f128_ps(w0, w1, 0x31) );
+            _mm256_storeu_ps( to + 4 * i, _mm256_mul_ps(sum, quarter) );
+        }
+    } else if (nComps == 1) {
+        for (; i + 8 <= nPixels; i += 8) {
+            __m256 v0 = _mm256_loadu_ps(row0 + 2 * i);
+            __m256 v1 = _mm256_loadu_ps(row0 + 2 * i + 8);
+            __m256 w0 = _mm256_loadu_ps(row1 + 2 * i);
+            __m256 w1 = _mm256_loadu_ps(row1 + 2 * i + 8);
+            // shuffle_ps works within 128-bit lanes: the sum is then in the order 0 1 4 5 2 3 6 7
+            __m256 sum = _mm256_add_ps( _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE(2, 0, 2, 0) ), _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            sum = _mm256_add_ps( sum, _mm256_shuffle_ps( w0, w1, _MM_SHUFFLE(2, 0, 2, 0) ) );
+            sum = _mm256_add_ps( sum, _mm256_shuffle_ps( w0, w1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            sum = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd(sum), _MM_SHUFFLE(3, 1, 2, 0) ) );
+            _mm256_storeu_ps( to + i, _mm256_mul_ps(sum, quarter) );
+        }
+    }
+    halveFloatRows_sse41(row0 + 2 * i * nComps, row1 + 2 * i * nComps, to + i * nComps, nPixels - i, nComps);
+}
+
+#endif // NATRON_COLOR_SIMD
+} // anon namespace
+
+SIMDLevelEnum
+getSupportedSIMDLevel()
+{
+    return supportedLevel;
+}
+
+SIMDLevelEnum
+getSIMDLevel()
+{
+    return currentLevel;
+}
+
+void
+setSIMDLevel(SIMDLevelEnum level)
+{
+    currentLevel = level > supportedLevel ? supportedLevel : level;
+}
+
+void
+floatToByteRow(const float* from,
+               unsigned char* to,
+               int n)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return floatToByteRow_avx2(from, to, n);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return floatToByteRow_sse41(from, to, n);
+    }
+#endif
+    floatToByteRow_scalar(from, to, n);
+}
+
+void
+floatToShortRow(const float* from,
+                unsigned short* to,
+                int n)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return floatToShortRow_avx2(from, to, n);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return floatToShortRow_sse41(from, to, n);
+    }
+#endif
+    floatToShortRow_scalar(from, to, n);
+}
+
+void
+byteToFloatRow(const unsigned char* from,
+               float* to,
+               int n)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return byteToFloatRow_avx2(from, to, n);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return byteToFloatRow_sse41(from, to, n);
+    }
+#endif
+    byteToFloatRow_scalar(from, to, n);
+}
+
+void
+shortToFloatRow(const unsigned short* from,
+                float* to,
+                int n)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return shortToFloatRow_avx2(from, to, n);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return shortToFloatRow_sse41(from, to, n);
+    }
+#endif
+    shortToFloatRow_scalar(from, to, n);
+}
+
+void
+lookupUint8ToFloatRow(const float* table,
+                      const unsigned char* from,
+                      float* to,
+                      int n)
+{
+#ifdef NATRON_COLOR_SIMD
+    // SSE4.1 has no gather instruction
+    if (currentLevel == eSIMDLevelAVX2) {
+        return lookupUint8ToFloatRow_avx2(table, from, to, n);
+    }
+#endif
+    lookupUint8ToFloatRow_scalar(table, from, to, n);
+}
+
+void
+lookupHipartRow(const unsigned short* table,
+                const float* from,
+                unsigned short* to,
+                int n,
+                bool premultRGBA)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return lookupHipartRow_avx2(table, from, to, n, premultRGBA);
+    }
+#endif
+    lookupHipartRow_scalar(table, from, to, n, premultRGBA);
+}
+
+void
+unpremultRGBARow(const float* from,
+                 float* to,
+                 int nPixels)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return unpremultRGBARow_avx2(from, to, nPixels);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return unpremultRGBARow_sse41(from, to, nPixels);
+    }
+#endif
+    unpremultRGBARow_scalar(from, to, nPixels);
+}
+
+void
+gainOffsetRow(const float* from,
+              float* to,
+              int n,
+              double gain,
+              double offset)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return gainOffsetRow_avx2(from, to, n, gain, offset);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return gainOffsetRow_sse41(from, to, n, gain, offset);
+    }
+#endif
+    gainOffsetRow_scalar(from, to, n, gain, offset);
+}
+
+void
+interpolateLutRow(const float* table,
+                  int tableSize,
+                  const float* from,
+                  float* to,
+                  int n)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return interpolateLutRow_avx2(table, tableSize, from, to, n);
+    }
+#endif
+    interpolateLutRow_scalar(table, tableSize, from, to, n);
+}
+
+void
+clampRow(const float* from,
+         float* to,
+         int n)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return clampRow_avx2(from, to, n);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return clampRow_sse41(from, to, n);
+    }
+#endif
+    clampRow_scalar(from, to, n);
+}
+
+void
+halveFloatRows(const float* row0,
+               const float* row1,
+               float* to,
+               int nPixels,
+               int nComps)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel == eSIMDLevelAVX2) {
+        return halveFloatRows_avx2(row0, row1, to, nPixels, nComps);
+    } else if (currentLevel == eSIMDLevelSSE41) {
+        return halveFloatRows_sse41(row0, row1, to, nPixels, nComps);
+    }
+#endif
+    halveRows_scalar(row0, row1, to, nPixels, nComps);
+}
+
+void
+halveShortRows(const unsigned short* row0,
+               const unsigned short* row1,
+               unsigned short* to,
+               int nPixels,
+               int nComps)
+{
+#ifdef NATRON_COLOR_SIMD
+    // the integer versions are limited by the memory bandwidth, AVX2 would not be faster
+    if (currentLevel >= eSIMDLevelSSE41) {
+        return halveShortRows_sse41(row0, row1, to, nPixels, nComps);
+    }
+#endif
+    halveRows_scalar(row0, row1, to, nPixels, nComps);
+}
+
+void
+halveByteRows(const unsigned char* row0,
+              const unsigned char* row1,
+              unsigned char* to,
+              int nPixels,
+              int nComps)
+{
+#ifdef NATRON_COLOR_SIMD
+    if (currentLevel >= eSIMDLevelSSE41) {
+        return halveByteRows_sse41(row0, row1, to, nPixels, nComps);
+    }
+#endif
+    halveRows_scalar(row0, row1, to, nPixels, nComps);
+}
+} // namespace Color
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,116 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_ColorSIMD_h
+#define Engine_ColorSIMD_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/*
+ * Vectorized row kernels used by the pixel depth and color-space conversions and by the mipmap downscaling.
+ *
+ * Each kernel has a scalar version and SSE4.1/AVX2 versions selected at runtime depending on the CPU.
+ * All versions give exactly the same results as the scalar functions of Lut.h (Color::floatToInt,
+ * Color::intToFloat and the look-up tables of Color::Lut): the dithering done by the callers does not
+ * depend on which version ran.
+ */
+namespace Color {
+enum SIMDLevelEnum
+{
+    eSIMDLevelNone = 0,
+    eSIMDLevelSSE41,
+    eSIMDLevelAVX2
+};
+
+/**
+ * @brief Returns the best instruction set supported by the CPU (and by the compiler used to build Natron).
+ **/
+SIMDLevelEnum getSupportedSIMDLevel();
+
+/**
+ * @brief Returns the instruction set currently used by the kernels.
+ **/
+SIMDLevelEnum getSIMDLevel();
+
+/**
+ * @brief Limits the instruction set used by the kernels, e.g to compare the vectorized and scalar versions.
+ * The level is clamped to getSupportedSIMDLevel(). This is not MT-safe and should not be called while rendering.
+ **/
+void setSIMDLevel(SIMDLevelEnum level);
+
+/// to[i] = floatToInt<256>(from[i])
+void floatToByteRow(const float* from, unsigned char* to, int n);
+
+/// to[i] = floatToInt<65536>(from[i])
+void floatToShortRow(const float* from, unsigned short* to, int n);
+
+/// to[i] = intToFloat<256>(from[i])
+void byteToFloatRow(const unsigned char* from, float* to, int n);
+
+/// to[i] = intToFloat<65536>(from[i])
+void shortToFloatRow(const unsigned short* from, float* to, int n);
+
+/// to[i] = table[from[i]], table has 256 entries
+void lookupUint8ToFloatRow(const float* table, const unsigned char* from, float* to, int n);
+
+/**
+ * @brief to[i] = table[hipart(from[i])] where hipart returns the 16 most significant bits of the float.
+ * If premultRGBA is true, from contains RGBA pixels and the color channels are multiplied by alpha before the look-up.
+ * table must contain 0x10000 entries plus one extra entry of padding so that it can be read with 32-bit gathers.
+ **/
+void lookupHipartRow(const unsigned short* table, const float* from, unsigned short* to, int n, bool premultRGBA);
+
+/// Divides the color channels of nPixels RGBA pixels by alpha, color channels are set to 0 where alpha <= 0
+void unpremultRGBARow(const float* from, float* to, int nPixels);
+
+/// to[i] = (float)(from[i] * gain + offset), the multiplication and addition being done in double precision
+void gainOffsetRow(const float* from, float* to, int n, double gain, double offset);
+
+/**
+ * @brief Piecewise-linear interpolation in a table of tableSize + 1 values sampled regularly over [0,1].
+ * Values below 0 give 0 and values above 1 give 1, NaNs give 0.
+ * This is the interpolation used by the viewer gamma look-up table. from and to may be the same buffer.
+ **/
+void interpolateLutRow(const float* table, int tableSize, const float* from, float* to, int n);
+
+/// to[i] = min(max(from[i], 0), 1), NaNs are kept
+void clampRow(const float* from, float* to, int n);
+
+/**
+ * @brief Averages blocks of 2x2 pixels, like Image::halveRoI: pixel i of to is (a + b + c + d) / 4 where a and b are
+ * the pixels 2i and 2i+1 of row0, and c and d those of row1. Pixels have nComps components.
+ * Integer averages are truncated.
+ **/
+void halveFloatRows(const float* row0, const float* row1, float* to, int nPixels, int nComps);
+void halveShortRows(const unsigned short* row0, const unsigned short* row1, unsigned short* to, int nPixels, int nComps);
+void halveByteRows(const unsigned char* row0, const unsigned char* row1, unsigned char* to, int nPixels, int nComps);
+} // namespace Color
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_ColorSIMD_h
@@ -294,6 +294,7 @@ Curve::~Curve()
 void
 Curve::operator=(const Curve & other)
 {
+    QMutexLocker l(&_imp->_lock);
     *_imp = *other._imp;
 }
 
@@ -303,6 +304,7 @@ Curve::clearKeyFrames()
     QMutexLocker l(&_imp->_lock);
 
     _imp->keyFrames.clear();
+    _imp->invalidateSnapshot();
 }
 
 bool
@@ -782,34 +784,36 @@ interParams(const KeyFrameSet &keyFrames,
     }
 }
 
-double
-Curve::getValueAt(double t,bool doClamp) const
+CurveSnapshot::CurveSnapshot(const KeyFrameSet& keyFrames)
+    : times()
+    , segments()
+    , firstFrame(0.)
+    , frameValues()
+    , type(0)
+    , hasYRange(false)
+    , yMin(0.)
+    , yMax(0.)
 {
-    QMutexLocker l(&_imp->_lock);
-
-    if ( _imp->keyFrames.empty() ) {
-        throw std::runtime_error("Curve has no control points!");
+    if ( keyFrames.empty() ) {
+        return;
     }
-    
-    std::map<double,double>::const_iterator foundCached = _imp->resultCache.find(t);
-    double v;
-    if (foundCached != _imp->resultCache.end()) {
-        v = foundCached->second;
-    } else {
-        
-        // even when there is only one keyframe, there may be tangents!
-        //if (_imp->keyFrames.size() == 1) {
-        //    //if there's only 1 keyframe, don't bother interpolating
-        //    return (*_imp->keyFrames.begin()).getValue();
-        //}
+    times.reserve( keyFrames.size() );
+    segments.resize(keyFrames.size() + 1);
+    int i = 0;
+    for (KeyFrameSet::const_iterator itup = keyFrames.begin();; ++itup, ++i) {
+        ///Same parameters as the interpolation of a time in [times[i - 1], times[i])
+        double t;
+        if ( itup == keyFrames.end() ) {
+            t = times.back();
+        } else if ( times.empty() ) {
+            t = itup->getTime() - 1.;
+        } else {
+            t = (times.back() + itup->getTime() ) / 2.;
+        }
         double tcur,tnext;
         double vcurDerivRight,vnextDerivLeft,vcur,vnext;
         KeyframeTypeEnum interp,interpNext;
-        KeyFrame k(t,0.);
-        // find the first keyframe with time greater than t
-        KeyFrameSet::const_iterator itup;
-        itup = _imp->keyFrames.upper_bound(k);
-        interParams(_imp->keyFrames,
+        interParams(keyFrames,
                     t,
                     itup,
                     &tcur,
@@ -820,22 +824,103 @@ Curve::getValueAt(double t,bool doClamp) const
                     &vnext,
                     &vnextDerivLeft,
                     &interpNext);
-        
-        v = Interpolation::interpolate(tcur,vcur,
-                                vcurDerivRight,
-                                vnextDerivLeft,
-                                tnext,vnext,
-                                t,
-                                interp,
-                                interpNext);
-        _imp->resultCache[t] = v;
+        Segment& segment = segments[i];
+        Interpolation::getCubicCoefficients(tcur, vcur, vcurDerivRight, vnextDerivLeft, tnext, vnext, interp, interpNext,
+                                            &segment.t0, &segment.dt, segment.c);
+        if ( itup == keyFrames.end() ) {
+            break;
+        }
+        times.push_back( itup->getTime() );
+    }
+
+    ///Sample the integer frames between the first and the last keyframes
+    double first = std::ceil( times.front() );
+    double last = std::floor( times.back() );
+    if ( (first <= last) && (last - first < NATRON_CURVE_MAX_FRAME_SAMPLES) ) {
+        firstFrame = first;
+        frameValues.resize( (std::size_t)(last - first) + 1 );
+        for (std::size_t f = 0; f < frameValues.size(); ++f) {
+            frameValues[f] = interpolate(first + f);
+        }
+    }
+}
+
+double
+CurveSnapshot::interpolate(double t) const
+{
+    ///The segment ending at the first keyframe with time greater than t
+    std::size_t i = std::upper_bound(times.begin(), times.end(), t) - times.begin();
+    const Segment& segment = segments[i];
+
+    return Interpolation::evaluateCubic(segment.c, (t - segment.t0) / segment.dt);
+}
+
+double
+CurveSnapshot::getValueAt(double t) const
+{
+    assert( !times.empty() );
+    double index = t - firstFrame;
+    if ( (index >= 0.) && ( index < (double)frameValues.size() ) && (index == std::floor(index)) ) {
+        return frameValues[(std::size_t)index];
+    }
+
+    return interpolate(t);
+}
+
+namespace {
+///Counts the calling thread in the readers of the snapshots of a curve while it is alive
+class CurveSnapshotReader
+{
+    CurvePrivate* _curve;
+
+public:
+
+    CurveSnapshotReader(CurvePrivate* curve)
+        : _curve(curve)
+    {
+        _curve->snapshotReaders.fetchAndAddOrdered(1);
+    }
+
+    ~CurveSnapshotReader()
+    {
+        ///The last reader deletes the snapshots retired while it was reading, unless a writer holds the lock: the writer
+        ///deletes them itself if the readers are gone by then
+        if ( (_curve->snapshotReaders.fetchAndAddOrdered(-1) == 1) && ( (int)_curve->nRetiredSnapshots > 0 ) &&
+             _curve->_lock.tryLock() ) {
+            _curve->deleteRetiredSnapshotsIfUnread();
+            _curve->_lock.unlock();
+        }
+    }
+};
+}
+
+double
+Curve::getValueAt(double t,bool doClamp) const
+{
+    ///Render threads only take the lock when the keyframes changed since the last call
+    CurveSnapshotReader reader( _imp.get() );
+    const CurveSnapshot* snapshot = _imp->snapshot;
+
+    if (!snapshot) {
+        QMutexLocker l(&_imp->_lock);
+        snapshot = _imp->getSnapshot();
     }
+    if ( snapshot->times.empty() ) {
+        throw std::runtime_error("Curve has no control points!");
+    }
+
+    double v = snapshot->getValueAt(t);
 
-    if ( doClamp && mustClamp() ) {
-        v = clampValueToCurveYRange(v);
+    if (doClamp) {
+        if (_imp->owner) {
+            ///The minimum and maximum of the knob, the owner of a curve never changes
+            v = clampValueToCurveYRange(v);
+        } else if (snapshot->hasYRange) {
+            v = std::max( snapshot->yMin, std::min(snapshot->yMax, v) );
+        }
     }
 
-    switch (_imp->type) {
+    switch ( (CurvePrivate::CurveTypeEnum)snapshot->type ) {
     case CurvePrivate::eCurveTypeString:
     case CurvePrivate::eCurveTypeInt:
 
@@ -1022,6 +1107,13 @@ std::pair<double,double>  Curve::getCurveYRange() const
 {
     QMutexLocker l(&_imp->_lock);
 
+    return getCurveYRange_internal();
+}
+
+std::pair<double,double>
+Curve::getCurveYRange_internal() const
+{
+    // PRIVATE - should not lock
     if ( !mustClamp() ) {
         throw std::logic_error("Curve::getCurveYRange() called for a curve without owner or Y range");
     }
@@ -1052,7 +1144,7 @@ Curve::clampValueToCurveYRange(double v) const
 {
     // PRIVATE - should not lock
     ////clamp to min/max if the owner of the curve is a Double or Int knob.
-    std::pair<double,double> minmax = getCurveYRange();
+    std::pair<double,double> minmax = getCurveYRange_internal();
 
     if (v > minmax.second) {
         return minmax.second;
@@ -1528,6 +1620,7 @@ Curve::setYRange(double yMin,
     _imp->yMin = yMin;
     _imp->yMax = yMax;
     _imp->hasYRange = true;
+    _imp->invalidateSnapshot();
 }
 
 bool
@@ -1551,7 +1644,7 @@ Curve::onCurveChanged()
     if (_imp->owner) {
         _imp->owner->clearExpressionsResults(_imp->dimensionInOwner);
     }
-    _imp->resultCache.clear();
+    _imp->invalidateSnapshot();
 }
 
 NATRON_NAMESPACE_EXIT;
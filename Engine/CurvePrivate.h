@@ -30,16 +30,55 @@
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/shared_ptr.hpp>
 #endif
+#include <vector>
+
 #include <QMutex>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
 
+#include "Engine/Curve.h"
 #include "Engine/Variant.h"
 #include "Engine/Knob.h"
 #include "Engine/KnobTypes.h"
 #include "Engine/KnobFile.h"
 #include "Engine/EngineFwd.h"
 
+///Integer frames sampled in a snapshot at most, this bounds its size to 8kiB plus the segments
+#define NATRON_CURVE_MAX_FRAME_SAMPLES 1024
+
 NATRON_NAMESPACE_ENTER;
 
+/**
+ * @brief An immutable copy of the keyframes of a curve, with the cubic of each segment already computed, that the render
+ * threads read without taking the lock of the curve. The values at the integer frames covered by the keyframes are also
+ * stored when there are not too many of them, since they are the most queried times.
+ **/
+struct CurveSnapshot
+{
+    struct Segment
+    {
+        double t0, dt; // the cubic is evaluated at (t - t0) / dt
+        double c[4];
+    };
+
+    std::vector<double> times; //< the times of the keyframes
+    std::vector<Segment> segments; //< segments[i] ends at times[i]: there is one before the first keyframe and one after the last
+    double firstFrame; //< the frame of frameValues[0]
+    std::vector<double> frameValues;
+    int type; //< the CurveTypeEnum of the curve
+    bool hasYRange;
+    double yMin, yMax;
+
+    CurveSnapshot(const KeyFrameSet& keyFrames);
+
+    ///The keyframes must not be empty
+    double getValueAt(double t) const WARN_UNUSED_RETURN;
+
+private:
+
+    double interpolate(double t) const WARN_UNUSED_RETURN;
+};
+
 struct CurvePrivate
 {
     enum CurveTypeEnum
@@ -53,7 +92,6 @@ struct CurvePrivate
     };
 
     KeyFrameSet keyFrames;
-    std::map<double,double> resultCache; //< a cache for interpolations
     KnobI* owner;
     int dimensionInOwner;
     CurveTypeEnum type;
@@ -62,11 +100,18 @@ struct CurvePrivate
     mutable QMutex _lock; //< the plug-ins can call getValueAt at any moment and we must make sure the user is not playing around
     bool isParametric;
     bool hasYRange;
+    
+    ///Built by the first getValueAt() following a change, NULL until then
+    QAtomicPointer<const CurveSnapshot> snapshot;
+    ///The number of threads that may be reading a snapshot: the replaced snapshots can only be deleted when it is 0
+    mutable QAtomicInt snapshotReaders;
+    std::vector<const CurveSnapshot*> retiredSnapshots; //< protected by _lock
+    ///The size of retiredSnapshots, read without the lock by the last reader leaving
+    QAtomicInt nRetiredSnapshots;
 
 
     CurvePrivate()
     : keyFrames()
-    , resultCache()
     , owner(NULL)
     , dimensionInOwner(-1)
     , type(eCurveTypeDouble)
@@ -77,15 +122,31 @@ struct CurvePrivate
     , _lock(QMutex::Recursive)
     , isParametric(false)
     , hasYRange(false)
+    , snapshot(0)
+    , snapshotReaders(0)
+    , retiredSnapshots()
+    , nRetiredSnapshots(0)
     {
     }
 
     CurvePrivate(const CurvePrivate & other)
         : _lock(QMutex::Recursive)
+        , snapshot(0)
+        , snapshotReaders(0)
+        , retiredSnapshots()
+        , nRetiredSnapshots(0)
     {
         *this = other;
     }
 
+    ~CurvePrivate()
+    {
+        delete (const CurveSnapshot*)snapshot;
+        for (std::size_t i = 0; i < retiredSnapshots.size(); ++i) {
+            delete retiredSnapshots[i];
+        }
+    }
+
     void operator=(const CurvePrivate & other)
     {
         keyFrames = other.keyFrames;
@@ -98,8 +159,59 @@ struct CurvePrivate
         yMin = other.yMin;
         yMax = other.yMax;
         hasYRange = other.hasYRange;
+        invalidateSnapshot();
+    }
+
+    /**
+     * @brief Must be called whenever the keyframes or the range change, with _lock taken (except by the constructors).
+     **/
+    void invalidateSnapshot()
+    {
+        const CurveSnapshot* old = snapshot.fetchAndStoreOrdered(0);
+
+        if (old) {
+            retiredSnapshots.push_back(old);
+            nRetiredSnapshots.fetchAndStoreOrdered( (int)retiredSnapshots.size() );
+        }
+        deleteRetiredSnapshotsIfUnread();
+    }
+
+    /**
+     * @brief Deletes the retired snapshots if no thread is reading a snapshot, must be called with _lock taken.
+     * The readers increment snapshotReaders before reading the pointer: once it is 0, the next ones can only read the
+     * current snapshot. When the writes keep overlapping the reads, the last reader leaving calls it instead.
+     **/
+    void deleteRetiredSnapshotsIfUnread()
+    {
+        if ( !retiredSnapshots.empty() && (snapshotReaders.fetchAndAddOrdered(0) == 0) ) {
+            for (std::size_t i = 0; i < retiredSnapshots.size(); ++i) {
+                delete retiredSnapshots[i];
+            }
+            retiredSnapshots.clear();
+            nRetiredSnapshots.fetchAndStoreOrdered(0);
+        }
+    }
+
+    /**
+     * @brief Returns the snapshot of the keyframes, building it if needed. Must be called with _lock taken, by a
+     * thread counted in snapshotReaders.
+     **/
+    const CurveSnapshot* getSnapshot()
+    {
+        const CurveSnapshot* ret = snapshot;
+
+        if (!ret) {
+            CurveSnapshot* newSnapshot = new CurveSnapshot(keyFrames);
+            newSnapshot->type = (int)type;
+            newSnapshot->hasYRange = hasYRange;
+            newSnapshot->yMin = yMin;
+            newSnapshot->yMax = yMax;
+            snapshot.fetchAndStoreOrdered(newSnapshot);
+            ret = newSnapshot;
+        }
+
+        return ret;
     }
-    
 };
 
 NATRON_NAMESPACE_EXIT;
@@ -52,6 +52,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/BlockingBackgroundRender.h"
 #include "Engine/DiskCacheNode.h"
 #include "Engine/Image.h"
+#include "Engine/ImageConversionCache.h"
 #include "Engine/ImageParams.h"
 #include "Engine/KnobFile.h"
 #include "Engine/KnobTypes.h"
@@ -63,6 +64,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/OutputSchedulerThread.h"
 #include "Engine/PluginMemory.h"
 #include "Engine/Project.h"
+#include "Engine/RenderMetrics.h"
 #include "Engine/RenderStats.h"
 #include "Engine/RotoContext.h"
 #include "Engine/RotoDrawableItem.h"
@@ -572,6 +574,28 @@ EffectInstance::getThreadLocalRegionsOfInterests(RoIMap & roiMap) const
     return true;
 }
 
+namespace {
+/**
+ * @brief Up-scales a whole image to mipmap level 0
+ **/
+struct MipMapUpscaler
+{
+    ImagePtr inputImage;
+    double par;
+
+    ImagePtr operator()(const RectI& /*rect*/) const
+    {
+        RectI bounds;
+        inputImage->getRoD().toPixelEnclosing(0, par, &bounds);
+        ImagePtr rescaledImg( new Image(inputImage->getComponents(), inputImage->getRoD(),
+                                        bounds, 0, par, inputImage->getBitDepth()) );
+        inputImage->upscaleMipMap( inputImage->getBounds(), inputImage->getMipMapLevel(), 0, rescaledImg.get() );
+
+        return rescaledImg;
+    }
+};
+} // anon namespace
+
 ImagePtr
 EffectInstance::getImage(int inputNb,
                          const double time,
@@ -898,17 +922,31 @@ EffectInstance::getImage(int inputNb,
     }
     unsigned int inputImgMipMapLevel = inputImg->getMipMapLevel();
 
+    ///While painting, the input images are rendered again in place at each stroke tick: do not share their conversions
+    ImageConversionCache* conversionCache = isDuringPaintStrokeCreationThreadLocal() ? 0 : appPTR->getImageConversionCache();
+
     ///If the plug-in doesn't support the render scale, but the image is downscaled, up-scale it.
     ///Note that we do NOT cache it because it is really low def!
     if ( !dontUpscale  && renderFullScaleThenDownscale && (inputImgMipMapLevel != 0) ) {
         assert(inputImgMipMapLevel != 0);
-        ///Resize the image according to the requested scale
-        ImageBitDepthEnum bitdepth = inputImg->getBitDepth();
-        RectI bounds;
-        inputImg->getRoD().toPixelEnclosing(0, par, &bounds);
-        ImagePtr rescaledImg( new Image(inputImg->getComponents(), inputImg->getRoD(),
-                                                bounds, 0, par, bitdepth) );
-        inputImg->upscaleMipMap( inputImg->getBounds(), inputImgMipMapLevel, 0, rescaledImg.get() );
+        ///Resize the image according to the requested scale, other nodes fetching this image at scale 1 share it
+        MipMapUpscaler upscaler;
+        upscaler.inputImage = inputImg;
+        upscaler.par = par;
+        ImageConversionCache::Key key;
+        key.components = inputImg->getComponents();
+        key.bitdepth = inputImg->getBitDepth();
+        key.mipMapLevel = 0;
+        bool isShared = false;
+        ImagePtr rescaledImg;
+        if (conversionCache) {
+            rescaledImg = conversionCache->getOrConvert(inputImg, key, inputImg->getBounds(), upscaler, &isShared);
+        } else {
+            rescaledImg = upscaler( inputImg->getBounds() );
+        }
+        if ( tls && tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
+            tls->frameArgs.stats->addImageConversionInfosForNode(getNode(), isShared);
+        }
         if (roiPixel) {
             RectD canonicalPixelRoI;
             pixelRoI.toCanonical(inputImgMipMapLevel, par, rod, &canonicalPixelRoI);
@@ -936,7 +974,12 @@ EffectInstance::getImage(int inputNb,
         getPreferredDepthAndComponents(inputNb, &prefComps, &prefDepth);
         assert(!prefComps.empty());
         
-        inputImg = convertPlanesFormatsIfNeeded(getApp(), inputImg, pixelRoI, prefComps.front(), prefDepth, getNode()->usesAlpha0ToConvertFromRGBToRGBA(), outputPremult, channelForMask);
+        bool isShared = false;
+        ImagePtr convertedImg = convertPlanesFormatsIfNeeded(getApp(), inputImg, pixelRoI, prefComps.front(), prefDepth, getNode()->usesAlpha0ToConvertFromRGBToRGBA(), outputPremult, channelForMask, conversionCache, &isShared);
+        if ( (convertedImg != inputImg) && tls && tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
+            tls->frameArgs.stats->addImageConversionInfosForNode(getNode(), isShared);
+        }
+        inputImg = convertedImg;
     }
     
     if (inputImagesThreadLocal.empty()) {
@@ -1796,6 +1839,15 @@ EffectInstance::Implementation::tiledRenderingFunctor(const RectToRender & rectT
     
     assert(!rectToRender.rect.isNull());
 
+    RenderMetrics::GaugeIncrementer tilesInFlight(eRenderMetricTilesInFlight);
+    RenderMetrics::TimeSampler tileTime(eRenderHistogramTileTime);
+
+    ///Report the time this thread spends waiting for images and for the Python GIL to this node
+    boost::scoped_ptr<RenderStatsThreadScope> statsScope;
+    if ( tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
+        statsScope.reset( new RenderStatsThreadScope( tls->frameArgs.stats, _publicInterface->getNode() ) );
+    }
+
     /*
      * renderMappedRectToRender is in the mapped mipmap level, i.e the expected mipmap level of the render action of the plug-in
      */
@@ -2016,6 +2068,7 @@ EffectInstance::Implementation::tiledRenderingFunctor(const RectToRender & rectT
                                                         originalImagePremultiplication,
                                                         *planes);
     if (handlerRet == eRenderingFunctorRetOK) {
+        RenderMetrics::add(eRenderMetricTilesRendered);
         if (isBeingRenderedElseWhere) {
             return eRenderingFunctorRetTakeImageLock;
         } else {
@@ -2284,6 +2337,7 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
                  */
                 for (std::map<ImageComponents, EffectInstance::PlaneToRender>::const_iterator it = outputPlanes.begin(); it != outputPlanes.end(); ++it) {
                     it->second.renderMappedImage->clearBitmap(renderMappedRectToRender);
+                    appPTR->getImageConversionCache()->invalidate( it->second.renderMappedImage.get() );
                 }
             }
 #endif
@@ -4324,6 +4378,22 @@ EffectInstance::isFrameVaryingOrAnimated_Recursive() const
     return ret;
 }
 
+bool
+EffectInstance::isOutputDerivedFromKnobs() const
+{
+    if ( isReader() ) {
+        return false;
+    }
+    const std::vector<boost::shared_ptr<KnobI> > & knobs = getKnobs();
+    for (std::vector<boost::shared_ptr<KnobI> >::const_iterator it = knobs.begin(); it != knobs.end(); ++it) {
+        if ( dynamic_cast<KnobFile*>( it->get() ) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool
 EffectInstance::isPaintingOverItselfEnabled() const
 {
@@ -326,6 +326,15 @@ public:
         return false;
     }
 
+    /**
+     * @brief Returns true if the output of this node only depends on its inputs and on the content of its knobs, in which
+     * case its hash may be derived from the content of its knobs (see Settings::isContentAddressedHashEnabled()).
+     * Nodes that are invalidated by other means than a knob change must return false.
+     * By default, readers and the nodes reading a file (LUT...) return false: the file may change on disk while
+     * its path stays the same.
+     **/
+    virtual bool isOutputDerivedFromKnobs() const WARN_UNUSED_RETURN;
+
     virtual bool isPaintingOverItselfEnabled() const WARN_UNUSED_RETURN;
 
     /**
@@ -574,11 +583,13 @@ public:
                                                    const boost::shared_ptr<Node> & node,
                                                    const boost::shared_ptr<Node> & treeRoot,
                                                    const RectD & canonicalRenderWindow,
-                                                   FrameRequestMap & requests);
+                                                   FrameRequestMap & requests,
+                                                   RequestPassCache* cache = 0);
 
     /**
      * @brief Visit recursively the compositing tree and computes required informations about region of interests for each node and
      * for each frame/view pair. This helps to call render a single time per frame/view pair for a node.
+     * If cache is not NULL, it is used to reuse the results of the other frames of the same sequence render.
      * Implem is in ParallelRenderArgs.cpp
      **/
     static StatusEnum computeRequestPass(double time,
@@ -586,7 +597,8 @@ public:
                                                  unsigned int mipMapLevel,
                                                  const RectD & renderWindow,
                                                  const boost::shared_ptr<Node> & treeRoot,
-                                                 FrameRequestMap & request);
+                                                 FrameRequestMap & request,
+                                                 RequestPassCache* cache = 0);
 
     // Implem is in ParallelRenderArgs.cpp
     static EffectInstance::RenderRoIRetCode treeRecurseFunctor(bool isRenderFunctor,
@@ -603,7 +615,8 @@ public:
                                                                        EffectInstance::InputImagesMap* inputImages, // render functor specific
                                                                        const EffectInstance::ComponentsNeededMap* neededComps, // render functor specific
                                                                        bool useScaleOneInputs, // render functor specific
-                                                                       bool byPassCache); // render functor specific
+                                                                       bool byPassCache, // render functor specific
+                                                                       RequestPassCache* requestPassCache = 0); // roi functor specific
 
 
     /**
@@ -735,6 +748,17 @@ public:
         return false;
     }
 
+    /**
+     * @brief Returns whether the RoD, identity and frames needed of the effect only depend on the frame through its
+     * inputs when its parameters are not animated, so that they may be deduced from the ones of another frame of
+     * the sequence (see RequestPassCache). This is not the case of an effect such as FrameRange, which is identity
+     * only inside its range.
+     **/
+    virtual bool isRequestPassTimeInvariant() const
+    {
+        return false;
+    }
+
     /**
      * @brief Returns whether the current node and/or the tree upstream is frame varying or animated.
      * It is frame varying/animated if at least one of the node is animated/varying
@@ -1836,7 +1860,9 @@ private:
                                                                          ImageBitDepthEnum targetDepth,
                                                                          bool useAlpha0ForRGBToRGBAConversion,
                                                                          ImagePremultiplicationEnum outputPremult,
-                                                                         int channelForAlpha);
+                                                                         int channelForAlpha,
+                                                                         ImageConversionCache* conversionCache = 0,
+                                                                         bool* conversionShared = 0);
 
 
     /**
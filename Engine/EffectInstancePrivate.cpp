@@ -27,6 +27,8 @@
 #include "Engine/AppInstance.h"
 #include "Engine/Node.h"
 #include "Engine/NodeGroup.h"
+#include "Engine/RenderStats.h"
+#include "Engine/Timer.h"
 
 
 NATRON_NAMESPACE_ENTER;
@@ -486,6 +488,10 @@ EffectInstance::Implementation::waitForImageBeingRenderedElsewhereAndUnmark(cons
 
     bool ab = _publicInterface->aborted();
     {
+        boost::scoped_ptr<TimeLapse> waitTimer;
+        if ( isBeingRenderedElseWhere && RenderStatsThreadScope::isActiveForCurrentThread() ) {
+            waitTimer.reset(new TimeLapse);
+        }
         QMutexLocker kk(&ibr->lock);
         while (!ab && isBeingRenderedElseWhere && !ibr->renderFailed && ibr->refCount > 1) {
             ibr->cond.wait(&ibr->lock);
@@ -493,6 +499,10 @@ EffectInstance::Implementation::waitForImageBeingRenderedElsewhereAndUnmark(cons
             img->getRestToRender_trimap(roi, restToRender, &isBeingRenderedElseWhere);
             ab = _publicInterface->aborted();
         }
+        if (waitTimer) {
+            kk.unlock();
+            RenderStatsThreadScope::reportWait( eRenderTraceEventTypeImageWait, waitTimer->getTimeSinceCreation() );
+        }
     }
 
     ///Everything should be rendered now.
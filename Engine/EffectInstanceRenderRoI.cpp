@@ -31,8 +31,7 @@
 #include <stdexcept>
 #include <fstream>
 
-#include <QtCore/QThreadPool>
-#include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt5
+#include <QtCore/QThread>
 #include <QtCore/QReadWriteLock>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QtConcurrentRun>
@@ -53,6 +52,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/DiskCacheNode.h"
 #include "Engine/Cache.h"
 #include "Engine/Image.h"
+#include "Engine/ImageConversionCache.h"
 #include "Engine/ImageParams.h"
 #include "Engine/KnobFile.h"
 #include "Engine/KnobTypes.h"
@@ -64,10 +64,12 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/OutputSchedulerThread.h"
 #include "Engine/PluginMemory.h"
 #include "Engine/Project.h"
+#include "Engine/RenderMetrics.h"
 #include "Engine/RenderStats.h"
 #include "Engine/RotoContext.h"
 #include "Engine/RotoDrawableItem.h"
 #include "Engine/Settings.h"
+#include "Engine/TaskPool.h"
 #include "Engine/Timer.h"
 #include "Engine/Transform.h"
 #include "Engine/ViewerInstance.h"
@@ -156,6 +158,41 @@ optimizeRectsToRender(EffectInstance* self,
     }
 } // optimizeRectsToRender
 
+namespace {
+/**
+ * @brief Converts a rectangle of an image to another bit depth and components, at the same mipmap level
+ **/
+struct ImageFormatConverter
+{
+    ImagePtr inputImage;
+    ImageConversionCache::Key key;
+
+    ImagePtr operator()(const RectI& rect) const
+    {
+        /**
+         * Lock the downscaled image so it cannot be resized while creating the temp image and calling convertToFormat.
+         **/
+        Image::ReadAccess acc = inputImage->getReadRights();
+        RectI bounds = inputImage->getBounds();
+        
+        ImagePtr tmp(new Image(key.components, inputImage->getRoD(), bounds, inputImage->getMipMapLevel(), inputImage->getPixelAspectRatio(), key.bitdepth, false));
+        
+        RectI clippedRoi;
+        rect.intersect(bounds, &clippedRoi);
+        
+        if (key.useAlpha0) {
+            inputImage->convertToFormatAlpha0( clippedRoi, key.srcColorSpace, key.dstColorSpace,
+                                              key.channelForAlpha, false, key.unPremult, tmp.get() );
+        } else {
+            inputImage->convertToFormat( clippedRoi, key.srcColorSpace, key.dstColorSpace,
+                                        key.channelForAlpha, false, key.unPremult, tmp.get() );
+        }
+        
+        return tmp;
+    }
+};
+} // anon namespace
+
 ImagePtr
 EffectInstance::convertPlanesFormatsIfNeeded(const AppInstance* app,
                                              const ImagePtr& inputImage,
@@ -164,38 +201,41 @@ EffectInstance::convertPlanesFormatsIfNeeded(const AppInstance* app,
                                              ImageBitDepthEnum targetDepth,
                                              bool useAlpha0ForRGBToRGBAConversion,
                                              ImagePremultiplicationEnum outputPremult,
-                                             int channelForAlpha)
+                                             int channelForAlpha,
+                                             ImageConversionCache* conversionCache,
+                                             bool* conversionShared)
 {
     bool imageConversionNeeded = (/*!targetIsMultiPlanar &&*/ targetComponents.getNumComponents() != inputImage->getComponents().getNumComponents()) || targetDepth != inputImage->getBitDepth();
     if (!imageConversionNeeded) {
         return inputImage;
     } else {
-        /**
-         * Lock the downscaled image so it cannot be resized while creating the temp image and calling convertToFormat.
-         **/
-        Image::ReadAccess acc = inputImage->getReadRights();
-        RectI bounds = inputImage->getBounds();
-        
-        ImagePtr tmp(new Image(targetComponents, inputImage->getRoD(), bounds, inputImage->getMipMapLevel(), inputImage->getPixelAspectRatio(), targetDepth, false));
-        
-        RectI clippedRoi;
-        roi.intersect(bounds, &clippedRoi);
-        
-        bool unPremultIfNeeded = outputPremult == eImagePremultiplicationPremultiplied && inputImage->getComponentsCount() == 4 && tmp->getComponentsCount() == 3;
+        ImageFormatConverter converter;
+        converter.inputImage = inputImage;
+        converter.key.components = targetComponents;
+        converter.key.bitdepth = targetDepth;
+        converter.key.mipMapLevel = inputImage->getMipMapLevel();
+        converter.key.srcColorSpace = app->getDefaultColorSpaceForBitDepth(inputImage->getBitDepth());
+        converter.key.dstColorSpace = app->getDefaultColorSpaceForBitDepth(targetDepth);
+        converter.key.channelForAlpha = channelForAlpha;
+        converter.key.useAlpha0 = useAlpha0ForRGBToRGBAConversion;
+        converter.key.unPremult = outputPremult == eImagePremultiplicationPremultiplied && inputImage->getComponentsCount() == 4 && targetComponents.getNumComponents() == 3;
         
-        if (useAlpha0ForRGBToRGBAConversion) {
-            inputImage->convertToFormatAlpha0( clippedRoi,
-                                              app->getDefaultColorSpaceForBitDepth(inputImage->getBitDepth()),
-                                              app->getDefaultColorSpaceForBitDepth(targetDepth),
-                                              channelForAlpha, false, unPremultIfNeeded, tmp.get() );
+        bool isShared = false;
+        ImagePtr ret;
+        if (conversionCache) {
+            RectI clippedRoi;
+            if (!roi.intersect(inputImage->getBounds(), &clippedRoi)) {
+                clippedRoi = RectI();
+            }
+            ret = conversionCache->getOrConvert(inputImage, converter.key, clippedRoi, converter, &isShared);
         } else {
-            inputImage->convertToFormat( clippedRoi,
-                                        app->getDefaultColorSpaceForBitDepth(inputImage->getBitDepth()),
-                                        app->getDefaultColorSpaceForBitDepth(targetDepth),
-                                        channelForAlpha, false, unPremultIfNeeded, tmp.get() );
+            ret = converter(roi);
+        }
+        if (conversionShared) {
+            *conversionShared = isShared;
         }
         
-        return tmp;
+        return ret;
     }
     
 }
@@ -214,6 +254,8 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
         return eRenderRoIRetCodeOk;
     }
 
+    RenderMetrics::add(eRenderMetricRenderRoICalls);
+
     //Create the TLS data for this node if it did not exist yet
     EffectDataTLSPtr tls = _imp->tlsData->getOrCreateTLSData();
     assert(tls);
@@ -230,6 +272,12 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
         assert(!tls->frameArgs.request || tls->frameArgs.nodeHash == tls->frameArgs.request->nodeHash);
     }
 
+    ///Report the time this thread spends waiting for images and for the Python GIL to this node
+    boost::scoped_ptr<RenderStatsThreadScope> statsScope;
+    if ( tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
+        statsScope.reset( new RenderStatsThreadScope( tls->frameArgs.stats, getNode() ) );
+    }
+
 
     ///For writer we never want to cache otherwise the next time we want to render it will skip writing the image on disk!
     bool byPassCache = args.byPassCache;
@@ -880,6 +928,7 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
             for (std::map<ImageComponents, EffectInstance::PlaneToRender>::iterator it2 = planesToRender->planes.begin();
                  it2 != planesToRender->planes.end(); ++it2) {
                 it2->second.fullscaleImage->clearBitmap(lastStrokePixelRoD);
+                appPTR->getImageConversionCache()->invalidate( it2->second.fullscaleImage.get() );
 
                 /*
                  * This is useful to optimize the bitmap checking
@@ -1312,6 +1361,7 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
                  */
                 if (hasResized && fillGrownBoundsWithZeroes) {
                     it->second.fullscaleImage->clearBitmap(lastStrokePixelRoD);
+                    appPTR->getImageConversionCache()->invalidate( it->second.fullscaleImage.get() );
                 }
 
                 if ( renderFullScaleThenDownscale && (it->second.fullscaleImage->getMipMapLevel() == 0) ) {
@@ -1646,9 +1696,10 @@ EffectInstance::renderRoIInternal(double time,
         ///If the plug-in is eRenderSafetyFullySafeFrame that means it wants the host to perform SMP aka slice up the RoI into chunks
         ///but if the effect doesn't support tiles it won't work.
         ///Also check that the number of threads indicating by the settings are appropriate for this render mode.
+        ///There is no need to check whether threads are available: the thread calling renderRoI executes tiles
+        ///while waiting for the others, see TaskPool.
         if ( !frameArgs.tilesSupported || (nbThreads == -1) || (nbThreads == 1) ||
             ( (nbThreads == 0) && (appPTR->getHardwareIdealThreadCount() == 1) ) ||
-            ( QThreadPool::globalInstance()->activeThreadCount() >= QThreadPool::globalInstance()->maxThreadCount() ) ||
             isRotoPaintNode() ) {
             safety = eRenderSafetyFullySafe;
         }
@@ -1736,14 +1787,17 @@ EffectInstance::renderRoIInternal(double time,
 #else
 
 
-            QFuture<RenderingFunctorRetEnum> ret = QtConcurrent::mapped( planesToRender->rectsToRender,
-                                                                        boost::bind(&EffectInstance::Implementation::tiledRenderingFunctor,
-                                                                                    _imp.get(),
-                                                                                    *tiledArgs,
-                                                                                    _1,
-                                                                                    currentThread) );
-            ret.waitForFinished();
-            QFuture<EffectInstance::RenderingFunctorRetEnum>::const_iterator it2;
+            std::vector<EffectInstance::RenderingFunctorRetEnum> ret;
+            if ( !appPTR->getTaskPool()->mapped( planesToRender->rectsToRender,
+                                                 boost::bind(&EffectInstance::Implementation::tiledRenderingFunctor,
+                                                             _imp.get(),
+                                                             *tiledArgs,
+                                                             _1,
+                                                             currentThread),
+                                                 &ret ) ) {
+                renderStatus = eRenderingFunctorRetFailed;
+            }
+            std::vector<EffectInstance::RenderingFunctorRetEnum>::const_iterator it2;
 
 #endif
             for (it2 = ret.begin(); it2 != ret.end(); ++it2) {
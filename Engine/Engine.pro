@@ -81,7 +81,9 @@ SOURCES += \
     BezierCP.cpp \
     BlockingBackgroundRender.cpp \
     Cache.cpp \
+    CacheJournal.cpp \
     CLArgs.cpp \
+    ColorSIMD.cpp \
     CoonsRegularization.cpp \
     Curve.cpp \
     CurveSerialization.cpp \
@@ -102,6 +104,9 @@ SOURCES += \
     Hash64.cpp \
     HistogramCPU.cpp \
     Image.cpp \
+    ImageAllocator.cpp \
+    ImageArena.cpp \
+    ImageConversionCache.cpp \
     ImageConvert.cpp \
     ImageCopyChannels.cpp \
     ImageComponents.cpp \
@@ -118,6 +123,7 @@ SOURCES += \
     Log.cpp \
     Lut.cpp \
     MemoryFile.cpp \
+    NativeExpression.cpp \
     Node.cpp \
     NodeGroup.cpp \
     NodeGroupWrapper.cpp \
@@ -127,6 +133,7 @@ SOURCES += \
     NodeSerialization.cpp \
     NodeGroupSerialization.cpp \
     NoOpBase.cpp \
+    OfxBundleIndex.cpp \
     OfxClipInstance.cpp \
     OfxHost.cpp \
     OfxImageEffectInstance.cpp \
@@ -134,10 +141,12 @@ SOURCES += \
     OfxMemory.cpp \
     OfxOverlayInteract.cpp \
     OfxParamInstance.cpp \
+    OfxThreadPool.cpp \
     OutputEffectInstance.cpp \
     OutputSchedulerThread.cpp \
     ParameterWrapper.cpp \
     ParallelRenderArgs.cpp \
+    ParallelRenderController.cpp \
     Plugin.cpp \
     PluginMemory.cpp \
     PrecompNode.cpp \
@@ -148,6 +157,9 @@ SOURCES += \
     PySideCompat.cpp \
     RectD.cpp \
     RectI.cpp \
+    RenderDaemon.cpp \
+    RenderMetrics.cpp \
+    RenderPlan.cpp \
     RenderStats.cpp \
     RotoContext.cpp \
     RotoDrawableItem.cpp \
@@ -161,6 +173,7 @@ SOURCES += \
     Settings.cpp \
     StandardPaths.cpp \
     StringAnimationManager.cpp \
+    TaskPool.cpp \
     TextureRect.cpp \
     TimeLine.cpp \
     Timer.cpp \
@@ -227,7 +240,9 @@ HEADERS += \
     Cache.h \
     CacheEntry.h \
     CacheEntryHolder.h \
+    CacheJournal.h \
     CacheSerialization.h \
+    ColorSIMD.h \
     CoonsRegularization.h \
     Curve.h \
     CurveSerialization.h \
@@ -257,7 +272,10 @@ HEADERS += \
     HistogramCPU.h \
     ImageInfo.h \
     Image.h \
+    ImageAllocator.h \
+    ImageArena.h \
     ImageComponents.h \
+    ImageConversionCache.h \
     ImageKey.h \
     ImageLocker.h \
     ImageSerialization.h \
@@ -278,6 +296,7 @@ HEADERS += \
     Lut.h \
     MemoryFile.h \
     MergingEnum.h \
+    NativeExpression.h \
     Node.h \
     NodeGroup.h \
     NodeGroupSerialization.h \
@@ -289,6 +308,7 @@ HEADERS += \
     NonKeyParamsSerialization.h \
     NodeSerialization.h \
     NoOpBase.h \
+    OfxBundleIndex.h \
     OfxClipInstance.h \
     OfxEffectInstance.h \
     OfxHost.h \
@@ -296,12 +316,14 @@ HEADERS += \
     OfxOverlayInteract.h \
     OfxMemory.h \
     OfxParamInstance.h \
+    OfxThreadPool.h \
     OpenGLViewerI.h \
     OutputEffectInstance.h \
     OutputSchedulerThread.h \
     OverlaySupport.h \
     ParameterWrapper.h \
     ParallelRenderArgs.h \
+    ParallelRenderController.h \
     Plugin.h \
     PluginMemory.h \
     PrecompNode.h \
@@ -314,6 +336,9 @@ HEADERS += \
     RectDSerialization.h \
     RectI.h \
     RectISerialization.h \
+    RenderDaemon.h \
+    RenderMetrics.h \
+    RenderPlan.h \
     RenderStats.h \
     RotoContext.h \
     RotoContextPrivate.h \
@@ -335,6 +360,7 @@ HEADERS += \
     Singleton.h \
     StandardPaths.h \
     StringAnimationManager.h \
+    TaskPool.h \
     TextureRect.h \
     TextureRectSerialization.h \
     ThreadStorage.h \
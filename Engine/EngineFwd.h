@@ -33,6 +33,8 @@ namespace boost {
 namespace archive {
 class xml_iarchive;
 class xml_oarchive;
+class binary_iarchive;
+class binary_oarchive;
 }
 namespace serialization {
 class access;
@@ -45,6 +47,7 @@ class access;
 class QChar;
 class QDateTime;
 class QFileInfo;
+class QIODevice;
 class QLocalServer;
 class QLocalSocket;
 class QMutex;
@@ -96,6 +99,7 @@ class BufferableObject;
 class ButtonParam;
 class CLArgs;
 class CacheEntryHolder;
+class CacheJournal;
 class CacheSignalEmitter;
 class ChoiceExtraData;
 class ChoiceParam;
@@ -118,6 +122,7 @@ class GroupParam;
 class Hash64;
 class Image;
 class ImageComponents;
+class ImageConversionCache;
 class ImageKey;
 class ImageLayer;
 class ImageParams;
@@ -160,6 +165,7 @@ class OfxOverlayInteract;
 class OfxParamOverlayInteract;
 class OfxParamToKnob;
 class OfxStringInstance;
+class OfxThreadPool;
 class OpenGLViewerI;
 class OutputEffectInstance;
 class OutputFileParam;
@@ -180,9 +186,12 @@ class ProjectSerialization;
 class RectD;
 class RectI;
 class RenderEngine;
+class RenderPlan;
 class RenderStats;
+class RenderThreadTask;
 class RenderingFlagSetter;
 class RequestedFrame;
+class RequestPassCache;
 class RichText_Knob;
 class Roto;
 class RotoContext;
@@ -196,6 +205,7 @@ class SeparatorParam;
 class Settings;
 class StringAnimationManager;
 class StringParam;
+class TaskPool;
 class TLSHolderBase;
 class TextureRect;
 class TimeLine;
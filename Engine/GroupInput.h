@@ -79,6 +79,12 @@ public:
         return true;
     }
 
+    ///The image comes from the input of the Group: its hash is changed by the Group itself
+    virtual bool isOutputDerivedFromKnobs() const OVERRIDE FINAL WARN_UNUSED_RETURN
+    {
+        return false;
+    }
+
     virtual void initializeKnobs() OVERRIDE FINAL;
     
     virtual void knobChanged(KnobI* k,
@@ -28,188 +28,434 @@
 
 #include <QDebug>
 
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/bind.hpp>
+#endif
+
 #include "Engine/AppManager.h"
+#include "Engine/ColorSIMD.h"
+#include "Engine/TaskPool.h"
 
 NATRON_NAMESPACE_ENTER;
 
-#define BM_GET(i,j) &_map[( i - _bounds.bottom() ) * _bounds.width() + ( j - _bounds.left() )]
-
 #define PIXEL_UNAVAILABLE 2
 
-template <int trimap>
-RectI minimalNonMarkedBbox_internal(const RectI& roi, const RectI& _bounds,const std::vector<char>& _map,
-                                    bool* isBeingRenderedElsewhere)
+#define BITMAP_TILE_SIZE_LOG2 6 // tiles of 64x64 pixels
+#define BITMAP_TILE_SIZE (1 << BITMAP_TILE_SIZE_LOG2)
+
+namespace {
+///The low bit of each 2-bit pixel of a word
+const U64 kBitmapLowBits = 0x5555555555555555ULL;
+
+///Mask of the pixels [from,to) of a word, with 0 <= from <= to <= 32
+inline U64
+bitmapPixelsMask(int from,
+                 int to)
 {
-    RectI bbox;
-    assert(_bounds.contains(roi));
-    bbox = roi;
-    
-    //find bottom
-    for (int i = bbox.bottom(); i < bbox.top(); ++i) {
-        const char* buf = BM_GET(i, bbox.left());
-        
-        if (trimap) {
-            
-            const char* lineEnd = buf + bbox.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (!*buf) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    metUnavailablePixel = true;
-                }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else if (metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
-                ++bbox.y1;
-            } else {
-                ++bbox.y1;
-            }
-        } else {
-            
-            const char* lineEnd = buf + bbox.width();
-            while (buf < lineEnd) {
-                if (!*buf || *buf == PIXEL_UNAVAILABLE) {
-                    buf = 0;
-                    break;
-                }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else {
-                ++bbox.y1;
-            }
+    U64 hi = (to >= 32) ? ~U64(0) : ( ( U64(1) << (to * 2) ) - 1 );
+    U64 lo = (from >= 32) ? ~U64(0) : ( ( U64(1) << (from * 2) ) - 1 );
+
+    return hi & ~lo;
+}
+
+///Returns the low bit of each pixel of the word whose state is in statesMask
+inline U64
+bitmapMatchingPixels(U64 word,
+                     int statesMask)
+{
+    U64 lo = word & kBitmapLowBits;
+    U64 hi = (word >> 1) & kBitmapLowBits;
+    U64 ret = 0;
+
+    if (statesMask & (1 << 0)) {
+        ret |= ~(lo | hi) & kBitmapLowBits;
+    }
+    if (statesMask & (1 << 1)) {
+        ret |= lo & ~hi;
+    }
+    if (statesMask & (1 << PIXEL_UNAVAILABLE)) {
+        ret |= hi & ~lo;
+    }
+
+    return ret;
+}
+
+///Returns the mask of the states of the pixels of the word selected by pixelsMask
+inline int
+bitmapStatesInWord(U64 word,
+                   U64 pixelsMask)
+{
+    int ret = 0;
+
+    for (int state = 0; state <= PIXEL_UNAVAILABLE; ++state) {
+        if (bitmapMatchingPixels(word, 1 << state) & pixelsMask) {
+            ret |= 1 << state;
         }
     }
-    
-    //find top (will do zero iteration if the bbox is already empty)
-    for (int i = bbox.top() - 1; i >= bbox.bottom(); --i) {
-        const char* buf = BM_GET(i, bbox.left());
-        
-        if (trimap) {
-            
-            const char* lineEnd = buf + bbox.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (!*buf) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    metUnavailablePixel = true;
-                }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else if (metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
-                --bbox.y2;
-            } else {
-                --bbox.y2;
-            }
-            
-        } else {
-            
-            const char* lineEnd = buf + bbox.width();
-            while (buf < lineEnd) {
-                if (!*buf || *buf == PIXEL_UNAVAILABLE) {
-                    buf = 0;
-                    break;
-                }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else {
-                --bbox.y2;
-            }
+
+    return ret;
+}
+
+inline int
+lowestBitIndex(U64 v)
+{
+    assert(v);
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    while ( !(v & 1) ) {
+        v >>= 1;
+        ++n;
+    }
+
+    return n;
+#endif
+}
+
+inline int
+highestBitIndex(U64 v)
+{
+    assert(v);
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int n = 0;
+    while (v >>= 1) {
+        ++n;
+    }
+
+    return n;
+#endif
+}
+
+///Index of the first pixel in [x1,x2) of the row whose state is in statesMask, or x2
+int
+bitmapFindFirstInRow(const U64* row,
+                     int x1,
+                     int x2,
+                     int statesMask)
+{
+    for (int w = x1 >> 5; x1 < x2; ++w) {
+        U64 m = bitmapMatchingPixels(row[w], statesMask) & bitmapPixelsMask( x1 - (w << 5), std::min(32, x2 - (w << 5) ) );
+        if (m) {
+            return (w << 5) + lowestBitIndex(m) / 2;
         }
+        x1 = (w + 1) << 5;
     }
-    
-    // avoid making bbox.width() iterations for nothing
-    if ( bbox.isNull() ) {
-        return bbox;
+
+    return x2;
+}
+
+///Index of the last pixel in [x1,x2) of the row whose state is in statesMask, or x1 - 1
+int
+bitmapFindLastInRow(const U64* row,
+                    int x1,
+                    int x2,
+                    int statesMask)
+{
+    for (int w = (x2 - 1) >> 5; x2 > x1; --w) {
+        U64 m = bitmapMatchingPixels(row[w], statesMask) & bitmapPixelsMask( std::max(0, x1 - (w << 5) ), x2 - (w << 5) );
+        if (m) {
+            return (w << 5) + highestBitIndex(m) / 2;
+        }
+        x2 = w << 5;
     }
-    
-    //find left
-    for (int j = bbox.left(); j < bbox.right(); ++j) {
-        const char* pix = BM_GET(bbox.bottom(), j);
 
-        bool metUnavailablePixel = false;
+    return x1 - 1;
+}
+} // anon namespace
+
+void
+Bitmap::initialize(const RectI & bounds)
+{
+    _bounds = bounds;
+    int w = std::max(0, _bounds.width());
+    int h = std::max(0, _bounds.height());
+    _wordsPerRow = (w + 31) >> 5;
+    _map.assign( (std::size_t)_wordsPerRow * h, 0 );
+    _tilesPerRow = (w + BITMAP_TILE_SIZE - 1) >> BITMAP_TILE_SIZE_LOG2;
+    int tileRows = (h + BITMAP_TILE_SIZE - 1) >> BITMAP_TILE_SIZE_LOG2;
+    _tiles.assign( (std::size_t)_tilesPerRow * tileRows, 1 << 0 );
+}
+
+void
+Bitmap::setTo1()
+{
+    fill(RectI( 0, 0, _bounds.width(), _bounds.height() ), 1);
+}
+
+void
+Bitmap::fill(const RectI& roi,
+             int state)
+{
+    if ( roi.isNull() ) {
+        return;
+    }
+    U64 pattern = (U64)state * kBitmapLowBits;
+    for (int y = roi.y1; y < roi.y2; ++y) {
+        U64* row = &_map[(std::size_t)y * _wordsPerRow];
+        for (int x = roi.x1; x < roi.x2; x = ( (x >> 5) + 1 ) << 5) {
+            int w = x >> 5;
+            U64 m = bitmapPixelsMask( x & 31, std::min(32, roi.x2 - (w << 5) ) );
+            row[w] = (row[w] & ~m) | (pattern & m);
+        }
+    }
+    updateTiles(roi, 1 << state);
+}
+
+U64
+Bitmap::readRun(int y,
+                int x,
+                int n) const
+{
+    assert(n > 0 && n <= 32);
+    const U64* row = &_map[(std::size_t)y * _wordsPerRow];
+    int w = x >> 5;
+    int shift = (x & 31) * 2;
+    U64 bits = row[w] >> shift;
+    if ( shift && ( (x & 31) + n > 32 ) ) {
+        bits |= row[w + 1] << (64 - shift);
+    }
+
+    return bits & bitmapPixelsMask(0, n);
+}
+
+void
+Bitmap::writeRun(int y,
+                 int x,
+                 int n,
+                 U64 bits)
+{
+    assert(n > 0 && n <= 32);
+    U64* row = &_map[(std::size_t)y * _wordsPerRow];
+    int w = x >> 5;
+    int offset = x & 31;
+    int n0 = std::min(n, 32 - offset);
+    U64 m0 = bitmapPixelsMask(offset, offset + n0);
+    row[w] = (row[w] & ~m0) | ( (bits << (offset * 2)) & m0 );
+    if (n0 < n) {
+        U64 m1 = bitmapPixelsMask(0, n - n0);
+        row[w + 1] = (row[w + 1] & ~m1) | ( (bits >> (n0 * 2)) & m1 );
+    }
+}
 
-        for (int i = bbox.bottom(); i < bbox.top(); ++i, pix += _bounds.width()) {
-            if (!*pix) {
-                pix = 0;
-                break;
+unsigned char
+Bitmap::computeTileStates(int tx,
+                          int ty) const
+{
+    int x1 = tx << BITMAP_TILE_SIZE_LOG2;
+    int x2 = std::min( _bounds.width(), (tx + 1) << BITMAP_TILE_SIZE_LOG2 );
+    int y1 = ty << BITMAP_TILE_SIZE_LOG2;
+    int y2 = std::min( _bounds.height(), (ty + 1) << BITMAP_TILE_SIZE_LOG2 );
+    int ret = 0;
+
+    for (int y = y1; y < y2; ++y) {
+        const U64* row = &_map[(std::size_t)y * _wordsPerRow];
+        for (int x = x1; x < x2; x += 32) {
+            int w = x >> 5;
+            ret |= bitmapStatesInWord( row[w], bitmapPixelsMask( 0, std::min(32, x2 - x) ) );
+        }
+        if ( ret == ( (1 << 0) | (1 << 1) | (1 << PIXEL_UNAVAILABLE) ) ) {
+            break;
+        }
+    }
+
+    return (unsigned char)ret;
+}
+
+void
+Bitmap::updateTiles(const RectI& roi,
+                    int statesMask)
+{
+    if ( roi.isNull() ) {
+        return;
+    }
+    int w = _bounds.width();
+    int h = _bounds.height();
+    for (int ty = roi.y1 >> BITMAP_TILE_SIZE_LOG2; ty <= (roi.y2 - 1) >> BITMAP_TILE_SIZE_LOG2; ++ty) {
+        int tileY1 = ty << BITMAP_TILE_SIZE_LOG2;
+        int tileY2 = std::min(h, tileY1 + BITMAP_TILE_SIZE);
+        for (int tx = roi.x1 >> BITMAP_TILE_SIZE_LOG2; tx <= (roi.x2 - 1) >> BITMAP_TILE_SIZE_LOG2; ++tx) {
+            int tileX1 = tx << BITMAP_TILE_SIZE_LOG2;
+            int tileX2 = std::min(w, tileX1 + BITMAP_TILE_SIZE);
+            bool covered = roi.x1 <= tileX1 && tileX2 <= roi.x2 && roi.y1 <= tileY1 && tileY2 <= roi.y2;
+            _tiles[ty * _tilesPerRow + tx] = (covered && statesMask) ? (unsigned char)statesMask : computeTileStates(tx, ty);
+        }
+    }
+}
+
+bool
+Bitmap::rectContains(const RectI& roi,
+                     int statesMask) const
+{
+    if ( roi.isNull() ) {
+        return false;
+    }
+    for (int ty = roi.y1 >> BITMAP_TILE_SIZE_LOG2; ty <= (roi.y2 - 1) >> BITMAP_TILE_SIZE_LOG2; ++ty) {
+        int y1 = std::max(roi.y1, ty << BITMAP_TILE_SIZE_LOG2);
+        int y2 = std::min(roi.y2, (ty + 1) << BITMAP_TILE_SIZE_LOG2);
+        for (int tx = roi.x1 >> BITMAP_TILE_SIZE_LOG2; tx <= (roi.x2 - 1) >> BITMAP_TILE_SIZE_LOG2; ++tx) {
+            int states = _tiles[ty * _tilesPerRow + tx];
+            if ( !(states & statesMask) ) {
+                continue;
             }
-            
-            else if (*pix == PIXEL_UNAVAILABLE) {
-                if (trimap) {
-                    metUnavailablePixel = true;
-                } else {
-                    pix = 0;
-                    break;
+            if ( !(states & ~statesMask) ) {
+                ///All the pixels of the tile match
+                return true;
+            }
+            int x1 = std::max(roi.x1, tx << BITMAP_TILE_SIZE_LOG2);
+            int x2 = std::min(roi.x2, (tx + 1) << BITMAP_TILE_SIZE_LOG2);
+            for (int y = y1; y < y2; ++y) {
+                if (bitmapFindFirstInRow(&_map[(std::size_t)y * _wordsPerRow], x1, x2, statesMask) < x2) {
+                    return true;
                 }
             }
-            
         }
-        if (pix) {
-            ++bbox.x1;
-            if (trimap && metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
+    }
+
+    return false;
+}
+
+int
+Bitmap::firstRowContaining(const RectI& roi,
+                           int statesMask) const
+{
+    if ( roi.isNull() ) {
+        return roi.y2;
+    }
+    for (int ty = roi.y1 >> BITMAP_TILE_SIZE_LOG2; ty <= (roi.y2 - 1) >> BITMAP_TILE_SIZE_LOG2; ++ty) {
+        RectI band( roi.x1, std::max(roi.y1, ty << BITMAP_TILE_SIZE_LOG2), roi.x2, std::min(roi.y2, (ty + 1) << BITMAP_TILE_SIZE_LOG2) );
+        if ( !rectContains(band, statesMask) ) {
+            continue;
+        }
+        for (int y = band.y1; y < band.y2; ++y) {
+            if ( rectContains(RectI(roi.x1, y, roi.x2, y + 1), statesMask) ) {
+                return y;
             }
-        } else {
-            break;
         }
     }
-    
-    //find right
-    for (int j = bbox.right() - 1; j >= bbox.left(); --j) {
-        const char* pix = BM_GET(bbox.bottom(), j);
 
-        bool metUnavailablePixel = false;
+    return roi.y2;
+}
 
-        for (int i = bbox.bottom(); i < bbox.top(); ++i, pix += _bounds.width()) {
-            if (!*pix) {
-                pix = 0;
-                break;
+int
+Bitmap::lastRowContaining(const RectI& roi,
+                          int statesMask) const
+{
+    if ( roi.isNull() ) {
+        return roi.y1 - 1;
+    }
+    for (int ty = (roi.y2 - 1) >> BITMAP_TILE_SIZE_LOG2; ty >= roi.y1 >> BITMAP_TILE_SIZE_LOG2; --ty) {
+        RectI band( roi.x1, std::max(roi.y1, ty << BITMAP_TILE_SIZE_LOG2), roi.x2, std::min(roi.y2, (ty + 1) << BITMAP_TILE_SIZE_LOG2) );
+        if ( !rectContains(band, statesMask) ) {
+            continue;
+        }
+        for (int y = band.y2 - 1; y >= band.y1; --y) {
+            if ( rectContains(RectI(roi.x1, y, roi.x2, y + 1), statesMask) ) {
+                return y;
             }
+        }
+    }
 
-            else if (*pix == PIXEL_UNAVAILABLE) {
-                if (trimap) {
-                    metUnavailablePixel = true;
-                } else {
-                    pix = 0;
-                    break;
-                }
-            }
+    return roi.y1 - 1;
+}
 
+int
+Bitmap::firstColumnContaining(const RectI& roi,
+                              int statesMask) const
+{
+    if ( roi.isNull() ) {
+        return roi.x2;
+    }
+    for (int tx = roi.x1 >> BITMAP_TILE_SIZE_LOG2; tx <= (roi.x2 - 1) >> BITMAP_TILE_SIZE_LOG2; ++tx) {
+        RectI band( std::max(roi.x1, tx << BITMAP_TILE_SIZE_LOG2), roi.y1, std::min(roi.x2, (tx + 1) << BITMAP_TILE_SIZE_LOG2), roi.y2 );
+        if ( !rectContains(band, statesMask) ) {
+            continue;
         }
-        if (pix) {
-            --bbox.x2;
-            if (trimap && metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
-            }
+        ///The first column is the minimum over the rows of the first matching pixel of each row
+        int first = band.x2;
+        for (int y = band.y1; y < band.y2 && first > band.x1; ++y) {
+            first = bitmapFindFirstInRow(&_map[(std::size_t)y * _wordsPerRow], band.x1, first, statesMask);
+        }
+        assert(first < band.x2);
 
-        } else {
-            break;
+        return first;
+    }
+
+    return roi.x2;
+}
+
+int
+Bitmap::lastColumnContaining(const RectI& roi,
+                             int statesMask) const
+{
+    if ( roi.isNull() ) {
+        return roi.x1 - 1;
+    }
+    for (int tx = (roi.x2 - 1) >> BITMAP_TILE_SIZE_LOG2; tx >= roi.x1 >> BITMAP_TILE_SIZE_LOG2; --tx) {
+        RectI band( std::max(roi.x1, tx << BITMAP_TILE_SIZE_LOG2), roi.y1, std::min(roi.x2, (tx + 1) << BITMAP_TILE_SIZE_LOG2), roi.y2 );
+        if ( !rectContains(band, statesMask) ) {
+            continue;
+        }
+        int last = band.x1 - 1;
+        for (int y = band.y1; y < band.y2 && last < band.x2 - 1; ++y) {
+            last = bitmapFindLastInRow(&_map[(std::size_t)y * _wordsPerRow], last + 1, band.x2, statesMask);
         }
+        assert(last >= band.x1);
+
+        return last;
     }
-    
-    return bbox;
 
+    return roi.x1 - 1;
 }
 
+/*
+ * The bounding box of the pixels that are not rendered. With the trimap, pixels being rendered by another thread count
+ * as rendered, and isBeingRenderedElsewhere is set if any of them is outside of the returned box.
+ * roi and the returned box are relative to the bottom-left corner of the bounds.
+ */
+template <int trimap>
+RectI
+Bitmap::minimalNonMarkedBbox_internal(const RectI& roi,
+                                      bool* isBeingRenderedElsewhere) const
+{
+    assert( RectI( 0, 0, _bounds.width(), _bounds.height() ).contains(roi) );
+    const int nonMarked = trimap ? (1 << 0) : ( (1 << 0) | (1 << PIXEL_UNAVAILABLE) );
+
+    RectI bbox = roi;
+    bbox.y1 = firstRowContaining(roi, nonMarked);
+    if (bbox.y1 == roi.y2) {
+        if (trimap && !*isBeingRenderedElsewhere && rectContains(roi, 1 << PIXEL_UNAVAILABLE)) {
+            *isBeingRenderedElsewhere = true;
+        }
+
+        return RectI();
+    }
+    bbox.y2 = lastRowContaining(bbox, nonMarked) + 1;
+    bbox.x1 = firstColumnContaining(bbox, nonMarked);
+    bbox.x2 = lastColumnContaining(bbox, nonMarked) + 1;
+    assert( !bbox.isNull() );
+
+    if (trimap && !*isBeingRenderedElsewhere) {
+        ///Only the rows and columns that were trimmed are flagged: pixels being rendered elsewhere inside the box
+        ///will be rendered by the caller
+        if ( rectContains(RectI(roi.x1, roi.y1, roi.x2, bbox.y1), 1 << PIXEL_UNAVAILABLE) ||
+             rectContains(RectI(roi.x1, bbox.y2, roi.x2, roi.y2), 1 << PIXEL_UNAVAILABLE) ||
+             rectContains(RectI(roi.x1, bbox.y1, bbox.x1, bbox.y2), 1 << PIXEL_UNAVAILABLE) ||
+             rectContains(RectI(bbox.x2, bbox.y1, roi.x2, bbox.y2), 1 << PIXEL_UNAVAILABLE) ) {
+            *isBeingRenderedElsewhere = true;
+        }
+    }
+
+    return bbox;
+}
 
 template <int trimap>
 void
-minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std::vector<char>& _map,
-                               std::list<RectI>& ret,bool* isBeingRenderedElsewhere)
+Bitmap::minimalNonMarkedRects_internal(const RectI & roi,
+                                       std::list<RectI>& ret,
+                                       bool* isBeingRenderedElsewhere) const
 {
     ///Any out of bounds portion is pushed to the rectangles to render
     RectI intersection;
@@ -243,13 +489,16 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     if (intersection.isNull()) {
         return;
     }
-    
-    RectI bboxM = minimalNonMarkedBbox_internal<trimap>(intersection, _bounds, _map, isBeingRenderedElsewhere);
     assert((trimap && isBeingRenderedElsewhere) || (!trimap && !isBeingRenderedElsewhere));
+
+    ///Work relative to the bottom-left corner of the bounds
+    intersection.translate(-_bounds.x1, -_bounds.y1);
+    RectI bboxM = minimalNonMarkedBbox_internal<trimap>(intersection, isBeingRenderedElsewhere);
     
     //#define NATRON_BITMAP_DISABLE_OPTIMIZATION
 #ifdef NATRON_BITMAP_DISABLE_OPTIMIZATION
     if ( !bboxM.isNull() ) { // empty boxes should not be pushed
+        bboxM.translate(_bounds.x1, _bounds.y1);
         ret.push_back(bboxM);
     }
 #else
@@ -277,160 +526,51 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     // CXXXXXXXXXXDDD
     // CXXXXXXXXXXDDD
     // AAAAAAAAAAAAAA
+    //
+    // Without the trimap the A, B, C and D rectangles may contain pixels being rendered elsewhere, which
+    // are rendered again. With the trimap they only contain zeroes, and isBeingRenderedElsewhere is set when
+    // the row or column that stops them contains pixels being rendered elsewhere.
+    const int marked = trimap ? ( (1 << 1) | (1 << PIXEL_UNAVAILABLE) ) : (1 << 1);
     
     // First, find if there's an "A" rectangle, and push it to the result
     //find bottom
     RectI bboxX = bboxM;
     RectI bboxA = bboxX;
-    bboxA.set_top( bboxX.bottom() );
-    for (int i = bboxX.bottom(); i < bboxX.top(); ++i) {
-        const char* buf = BM_GET(i, bboxX.left());
-        if (trimap) {
-            const char* lineEnd = buf + bboxX.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (*buf == 1) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE && trimap) {
-                    buf = 0;
-                    metUnavailablePixel = true;
-                    break;
-                }
-                ++buf;
-            }
-            if (buf) {
-                ++bboxX.y1;
-                bboxA.y2 = bboxX.y1;
-            } else {
-                if (metUnavailablePixel) {
-                    *isBeingRenderedElsewhere = true;
-                }
-                break;
-            }
-        } else {
-            if ( !memchr( buf, 1, bboxX.width() ) ) {
-                ++bboxX.y1;
-                bboxA.y2 = bboxX.y1;
-            } else {
-                break;
-            }
-        }
-    }
-    if ( !bboxA.isNull() ) { // empty boxes should not be pushed
-        ret.push_back(bboxA);
+    bboxX.y1 = firstRowContaining(bboxM, marked);
+    bboxA.y2 = bboxX.y1;
+    if ( trimap && bboxX.y1 < bboxX.y2 && rectContains(RectI(bboxX.x1, bboxX.y1, bboxX.x2, bboxX.y1 + 1), 1 << PIXEL_UNAVAILABLE) ) {
+        *isBeingRenderedElsewhere = true;
     }
     
     // Now, find the "B" rectangle
     //find top
     RectI bboxB = bboxX;
-    bboxB.set_bottom( bboxX.top() );
-    for (int i = bboxX.top() - 1; i >= bboxX.bottom(); --i) {
-        const char* buf = BM_GET(i, bboxX.left());
-        
-        if (trimap) {
-            const char* lineEnd = buf + bboxX.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (*buf == 1) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE && trimap) {
-                    buf = 0;
-                    metUnavailablePixel = true;
-                    break;
-                }
-                ++buf;
-            }
-            if (buf) {
-                --bboxX.y2;
-                bboxB.y1 = bboxX.y2;
-            } else {
-                if (metUnavailablePixel) {
-                    *isBeingRenderedElsewhere = true;
-                }
-                break;
-            }
-        } else {
-            if ( !memchr( buf, 1, bboxX.width() ) ) {
-                --bboxX.y2;
-                bboxB.y1 = bboxX.y2;
-            } else {
-                break;
-            }
-            
+    bboxX.y2 = lastRowContaining(bboxX, marked) + 1;
+    bboxB.y1 = bboxX.y2;
+    if ( trimap && bboxX.y1 < bboxX.y2 && rectContains(RectI(bboxX.x1, bboxX.y2 - 1, bboxX.x2, bboxX.y2), 1 << PIXEL_UNAVAILABLE) ) {
+        *isBeingRenderedElsewhere = true;
+    }
+    
+    //find left
+    RectI bboxC = bboxX;
+    bboxC.set_right( bboxX.left() );
+    if (bboxX.bottom() < bboxX.top()) {
+        bboxX.x1 = firstColumnContaining(bboxX, marked);
+        bboxC.x2 = bboxX.x1;
+        if ( trimap && rectContains(RectI(bboxX.x1, bboxX.y1, bboxX.x1 + 1, bboxX.y2), 1 << PIXEL_UNAVAILABLE) ) {
+            *isBeingRenderedElsewhere = true;
         }
     }
-    if ( !bboxB.isNull() ) { // empty boxes should not be pushed
-        ret.push_back(bboxB);
-    }
-    
-	//find left
-	RectI bboxC = bboxX;
-	bboxC.set_right( bboxX.left() );
-	if (bboxX.bottom() < bboxX.top()) {
-		for (int j = bboxX.left(); j < bboxX.right(); ++j) {
-			const char* pix = BM_GET(bboxX.bottom(), j);
-
-			bool metUnavailablePixel = false;
-
-			for (int i = bboxX.bottom(); i < bboxX.top(); ++i, pix += _bounds.width()) {
-				if (*pix == 1) {
-					pix = 0;
-					break;
-				} else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-					pix = 0;
-					metUnavailablePixel = true;
-					break;
-				}
-			}
-			if (pix) {
-                ++bboxX.x1;
-                bboxC.x2 = bboxX.x1;
-			} else {
-				if (metUnavailablePixel) {
-					*isBeingRenderedElsewhere = true;
-				}
-				break;
-			}
-		}
-	}
-    if ( !bboxC.isNull() ) { // empty boxes should not be pushed
-        ret.push_back(bboxC);
-    }
-
-	//find right
-	RectI bboxD = bboxX;
-	bboxD.set_left( bboxX.right() );
-	if (bboxX.bottom() < bboxX.top()) {
-		for (int j = bboxX.right() - 1; j >= bboxX.left(); --j) {
-			const char* pix = BM_GET(bboxX.bottom(), j);
-
-			bool metUnavailablePixel = false;
-
-			for (int i = bboxX.bottom(); i < bboxX.top(); ++i, pix += _bounds.width()) {
-				if (*pix == 1) {
-					pix = 0;
-					break;
-				} else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-					pix = 0;
-					metUnavailablePixel = true;
-					break;
-				}
-			}
-			if (pix) {
-                --bboxX.x2;
-                bboxD.x1 = bboxX.x2;
-			} else {
-				if (metUnavailablePixel) {
-					*isBeingRenderedElsewhere = true;
-				}
-				break;
-			}
-		}
-	}
-	if ( !bboxD.isNull() ) { // empty boxes should not be pushed
-        ret.push_back(bboxD);
+    
+    //find right
+    RectI bboxD = bboxX;
+    bboxD.set_left( bboxX.right() );
+    if (bboxX.bottom() < bboxX.top()) {
+        bboxX.x2 = lastColumnContaining(bboxX, marked) + 1;
+        bboxD.x1 = bboxX.x2;
+        if ( trimap && rectContains(RectI(bboxX.x2 - 1, bboxX.y1, bboxX.x2, bboxX.y2), 1 << PIXEL_UNAVAILABLE) ) {
+            *isBeingRenderedElsewhere = true;
+        }
     }
     
     assert( bboxA.bottom() == bboxM.bottom() );
@@ -454,10 +594,14 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     assert( bboxD.bottom() == bboxX.bottom() );
     
     // get the bounding box of what's left (the X rectangle in the drawing above)
-    bboxX = minimalNonMarkedBbox_internal<trimap>(bboxX,_bounds,_map,isBeingRenderedElsewhere);
+    bboxX = minimalNonMarkedBbox_internal<trimap>(bboxX, isBeingRenderedElsewhere);
     
-    if ( !bboxX.isNull() ) { // empty boxes should not be pushed
-        ret.push_back(bboxX);
+    RectI rects[5] = { bboxA, bboxB, bboxC, bboxD, bboxX };
+    for (int i = 0; i < 5; ++i) {
+        if ( !rects[i].isNull() ) { // empty boxes should not be pushed
+            rects[i].translate(_bounds.x1, _bounds.y1);
+            ret.push_back(rects[i]);
+        }
     }
     
 #endif // NATRON_BITMAP_DISABLE_OPTIMIZATION
@@ -467,15 +611,17 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
 RectI
 Bitmap::minimalNonMarkedBbox(const RectI & roi) const
 {
-    if (_dirtyZoneSet) {
-        RectI realRoi;
-        if (!roi.intersect(_dirtyZone, &realRoi)) {
-            return RectI();
-        }
-        return minimalNonMarkedBbox_internal<0>(realRoi, _bounds, _map, NULL);
-    } else {
-        return minimalNonMarkedBbox_internal<0>(roi, _bounds, _map, NULL);
+    RectI realRoi = roi;
+    if ( _dirtyZoneSet && !roi.intersect(_dirtyZone, &realRoi) ) {
+        return RectI();
+    }
+    realRoi.translate(-_bounds.x1, -_bounds.y1);
+    RectI ret = minimalNonMarkedBbox_internal<0>(realRoi, NULL);
+    if ( !ret.isNull() ) {
+        ret.translate(_bounds.x1, _bounds.y1);
     }
+
+    return ret;
 }
 
 void
@@ -486,9 +632,9 @@ Bitmap::minimalNonMarkedRects(const RectI & roi,std::list<RectI>& ret) const
         if (!roi.intersect(_dirtyZone, &realRoi)) {
             return;
         }
-        minimalNonMarkedRects_internal<0>(realRoi, _bounds, _map,ret , NULL);
+        minimalNonMarkedRects_internal<0>(realRoi, ret, NULL);
     } else {
-        minimalNonMarkedRects_internal<0>(roi, _bounds, _map,ret , NULL);
+        minimalNonMarkedRects_internal<0>(roi, ret, NULL);
     }
 }
 
@@ -496,16 +642,18 @@ Bitmap::minimalNonMarkedRects(const RectI & roi,std::list<RectI>& ret) const
 RectI
 Bitmap::minimalNonMarkedBbox_trimap(const RectI & roi,bool* isBeingRenderedElsewhere) const
 {
-    if (_dirtyZoneSet) {
-        RectI realRoi;
-        if (!roi.intersect(_dirtyZone, &realRoi)) {
-            *isBeingRenderedElsewhere = false;
-            return RectI();
-        }
-        return minimalNonMarkedBbox_internal<1>(realRoi, _bounds, _map, isBeingRenderedElsewhere);
-    } else {
-        return minimalNonMarkedBbox_internal<1>(roi, _bounds, _map, isBeingRenderedElsewhere);
+    RectI realRoi = roi;
+    if ( _dirtyZoneSet && !roi.intersect(_dirtyZone, &realRoi) ) {
+        *isBeingRenderedElsewhere = false;
+        return RectI();
+    }
+    realRoi.translate(-_bounds.x1, -_bounds.y1);
+    RectI ret = minimalNonMarkedBbox_internal<1>(realRoi, isBeingRenderedElsewhere);
+    if ( !ret.isNull() ) {
+        ret.translate(_bounds.x1, _bounds.y1);
     }
+
+    return ret;
 }
 
 
@@ -518,9 +666,9 @@ Bitmap::minimalNonMarkedRects_trimap(const RectI & roi,std::list<RectI>& ret,boo
             *isBeingRenderedElsewhere = false;
             return;
         }
-        minimalNonMarkedRects_internal<1>(realRoi, _bounds, _map ,ret , isBeingRenderedElsewhere);
+        minimalNonMarkedRects_internal<1>(realRoi, ret, isBeingRenderedElsewhere);
     } else {
-        minimalNonMarkedRects_internal<1>(roi, _bounds, _map ,ret , isBeingRenderedElsewhere);
+        minimalNonMarkedRects_internal<1>(roi, ret, isBeingRenderedElsewhere);
     }
 } 
 #endif
@@ -528,66 +676,69 @@ Bitmap::minimalNonMarkedRects_trimap(const RectI & roi,std::list<RectI>& ret,boo
 void
 Bitmap::markForRendered(const RectI & roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    int w = _bounds.width();
-    int roiw = roi.width();
-    for (int i = roi.y1; i < roi.y2; ++i, buf += w) {
-        memset( buf, 1, roiw);
-    }
+    RectI r = roi;
+    r.translate(-_bounds.x1, -_bounds.y1);
+    fill(r, 1);
 }
 
 #if NATRON_ENABLE_TRIMAP
 void
 Bitmap::markForRendering(const RectI & roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    int w = _bounds.width();
-    int roiw = roi.width();
-    for (int i = roi.y1; i < roi.y2; ++i, buf += w) {
-        memset( buf, PIXEL_UNAVAILABLE , roiw );
-    }
+    RectI r = roi;
+    r.translate(-_bounds.x1, -_bounds.y1);
+    fill(r, PIXEL_UNAVAILABLE);
 }
 #endif
 
 void
 Bitmap::clear(const RectI& roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    int w = _bounds.width();
-    int roiw = roi.width();
-    for (int i = roi.y1; i < roi.y2; ++i, buf += w) {
-        memset( buf, 0 , roiw );
-    }
+    RectI r = roi;
+    r.translate(-_bounds.x1, -_bounds.y1);
+    fill(r, 0);
 }
 
 void
 Bitmap::swap(Bitmap& other)
 {
     _map.swap(other._map);
+    _tiles.swap(other._tiles);
     _bounds = other._bounds;
+    _wordsPerRow = other._wordsPerRow;
+    _tilesPerRow = other._tilesPerRow;
     _dirtyZone.clear();//merge(other._dirtyZone);
     _dirtyZoneSet = false;
 }
 
-const char*
-Bitmap::getBitmapAt(int x,
-                            int y) const
-{
-    if ( ( x >= _bounds.left() ) && ( x < _bounds.right() ) && ( y >= _bounds.bottom() ) && ( y < _bounds.top() ) ) {
-        return BM_GET(y,x);
-    } else {
-        return NULL;
-    }
-}
-
-char*
-Bitmap::getBitmapAt(int x,
-                            int y)
+void
+Bitmap::setRowPortion(int x1,
+                      int x2,
+                      int y,
+                      const char* states)
 {
-    if ( ( x >= _bounds.left() ) && ( x < _bounds.right() ) && ( y >= _bounds.bottom() ) && ( y < _bounds.top() ) ) {
-        return BM_GET(y,x);
-    } else {
-        return NULL;
+    assert(x1 >= _bounds.x1 && x2 <= _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2);
+    int ly = y - _bounds.y1;
+    int statesMask = 0;
+    for (int x = x1 - _bounds.x1, n = x2 - x1; n > 0; ) {
+        int c = std::min(n, 32);
+        U64 bits = 0;
+        for (int i = 0; i < c; ++i) {
+            assert(states[i] >= 0 && states[i] <= PIXEL_UNAVAILABLE);
+            bits |= (U64)states[i] << (i * 2);
+            statesMask |= 1 << states[i];
+        }
+        writeRun(ly, x, c, bits);
+        states += c;
+        x += c;
+        n -= c;
+    }
+    ///The tiles keep the states that were there before: they may only contain more states than they actually have
+    if (x1 < x2) {
+        int ty = ly >> BITMAP_TILE_SIZE_LOG2;
+        for (int tx = (x1 - _bounds.x1) >> BITMAP_TILE_SIZE_LOG2; tx <= (x2 - 1 - _bounds.x1) >> BITMAP_TILE_SIZE_LOG2; ++tx) {
+            _tiles[ty * _tilesPerRow + tx] |= (unsigned char)statesMask;
+        }
     }
 }
 
@@ -600,10 +751,6 @@ Image::printUnrenderedPixels(const RectI& roi) const
     }
     QReadLocker k(&_entryLock);
     
-    const char* bm = _bitmap.getBitmapAt(roi.x1, roi.y1);
-    int roiw = roi.x2 - roi.x1;
-    int boundsW = _bitmap.getBounds().width();
-    
     RectD bboxUnrendered;
     bboxUnrendered.setupInfinity();
     RectD bboxUnavailable;
@@ -612,10 +759,10 @@ Image::printUnrenderedPixels(const RectI& roi) const
     bool hasUnrendered = false;
     bool hasUnavailable = false;
     
-    for (int y = roi.y1; y < roi.y2; ++y,
-         bm += (boundsW - roiw)) {
-        for (int x = roi.x1; x < roi.x2; ++x,++bm) {
-            if (*bm == 0) {
+    for (int y = roi.y1; y < roi.y2; ++y) {
+        for (int x = roi.x1; x < roi.x2; ++x) {
+            int state = _bitmap.get(x, y);
+            if (state == 0) {
                 if (x < bboxUnrendered.x1) {
                     bboxUnrendered.x1 = x;
                 }
@@ -629,7 +776,7 @@ Image::printUnrenderedPixels(const RectI& roi) const
                     bboxUnrendered.y2 = y;
                 }
                 hasUnrendered = true;
-            } else if (*bm == PIXEL_UNAVAILABLE) {
+            } else if (state == PIXEL_UNAVAILABLE) {
                 if (x < bboxUnavailable.x1) {
                     bboxUnavailable.x1 = x;
                 }
@@ -737,6 +884,9 @@ Image::onMemoryAllocated(bool diskRestoration)
 
     if (diskRestoration) {
         _bitmap.setTo1();
+    } else if ( appPTR && !isStoredOnDisk() ) {
+        ///Used by the render schedulers to estimate the memory needed by a frame
+        appPTR->notifyImageMemoryAllocated( dataSize() );
     }
     
 #ifdef DEBUG
@@ -969,9 +1119,7 @@ Image::resizeInternal(const Image* srcImg,
             std::size_t memsize = a * pixelSize;
             memset(pix, 0, memsize);
             if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
-                char* bm = wacc.bitmapAt(aRect.x1, aRect.y1);
-                assert(bm);
-                memset(bm, 1, a);
+                (*outputImage)->_bitmap.markForRendered(aRect);
             }
         }
         if (!cRect.isNull()) {
@@ -981,9 +1129,7 @@ Image::resizeInternal(const Image* srcImg,
             std::size_t memsize = a * pixelSize;
             memset(pix, 0, memsize);
             if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
-                char* bm = (char*)wacc.bitmapAt(cRect.x1, cRect.y1);
-                assert(bm);
-                memset(bm, 1, a);
+                (*outputImage)->_bitmap.markForRendered(cRect);
             }
         }
         if (!bRect.isNull()) {
@@ -995,13 +1141,11 @@ Image::resizeInternal(const Image* srcImg,
             int bw = bRect.width();
             std::size_t rectRowSize = bw * pixelSize;
             
-            char* bm = (setBitmapTo1 && (*outputImage)->usesBitMap()) ? wacc.bitmapAt(bRect.x1, bRect.y1) : 0;
             for (int y = bRect.y1; y < bRect.y2; ++y, pix += rowsize) {
                 memset(pix, 0, rectRowSize);
-                if (bm) {
-                    memset(bm, 1, bw);
-                    bm += mw;
-                }
+            }
+            if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
+                (*outputImage)->_bitmap.markForRendered(bRect);
             }
         }
         if (!dRect.isNull()) {
@@ -1013,13 +1157,11 @@ Image::resizeInternal(const Image* srcImg,
             int dw = dRect.width();
             std::size_t rectRowSize = dw * pixelSize;
             
-            char* bm = (setBitmapTo1 && (*outputImage)->usesBitMap()) ? wacc.bitmapAt(dRect.x1, dRect.y1) : 0;
             for (int y = dRect.y1; y < dRect.y2; ++y, pix += rowsize) {
                 memset(pix, 0, rectRowSize);
-                if (bm) {
-                    memset(bm, 1, dw);
-                    bm += mw;
-                }
+            }
+            if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
+                (*outputImage)->_bitmap.markForRendered(dRect);
             }
         }
         
@@ -1078,6 +1220,40 @@ Image::ensureBounds(const RectI& newBounds, bool fillWithBlackAndTransparent, bo
     RectI merge = newBounds;
     merge.merge(_bounds);
     
+    if ( (merge.x1 == _bounds.x1) && (merge.x2 == _bounds.x2) && !_bounds.isNull() && _data.isAllocated() ) {
+        ///Only rows are added: the rows are contiguous in the buffer so it can be grown in place, the existing rows
+        ///are only moved if rows are added below them
+        const RectI oldBounds = _bounds;
+        const std::size_t rowSize = (std::size_t)getComponentsCount() * getSizeOfForBitDepth( getBitDepth() ) * oldBounds.width();
+        const std::size_t rowsBelow = oldBounds.y1 - merge.y1;
+        const std::size_t rowsAbove = merge.y2 - oldBounds.y2;
+        const std::size_t oldRows = oldBounds.height();
+        
+        reallocate( (U64)rowSize * merge.height() );
+        unsigned char* data = _data.writable();
+        assert(data);
+        if (rowsBelow > 0) {
+            memmove(data + rowsBelow * rowSize, data, oldRows * rowSize);
+        }
+        _bounds = merge;
+        _params->setBounds(merge);
+        if ( usesBitMap() ) {
+            Bitmap bm(merge);
+            bm.copyBitmapPortion(oldBounds, _bitmap);
+            _bitmap.swap(bm);
+        }
+        if (fillWithBlackAndTransparent) {
+            memset(data, 0, rowsBelow * rowSize);
+            memset(data + (rowsBelow + oldRows) * rowSize, 0, rowsAbove * rowSize);
+            if ( setBitmapTo1 && usesBitMap() ) {
+                _bitmap.markForRendered( RectI(merge.x1, merge.y1, merge.x2, oldBounds.y1) );
+                _bitmap.markForRendered( RectI(merge.x1, oldBounds.y2, merge.x2, merge.y2) );
+            }
+        }
+        assert(_bounds.contains(newBounds));
+        return true;
+    }
+    
     ImagePtr tmpImg;
     resizeInternal(this, _bounds, merge, fillWithBlackAndTransparent, setBitmapTo1, false, &tmpImg);
     
@@ -1442,64 +1618,51 @@ Image::getRowElements() const
     return getComponentsCount() * _bounds.width();
 }
 
-// code proofread and fixed by @devernay on 4/12/2014
-template <typename PIX, int maxValue>
-void
-Image::halveRoIForDepth(const RectI & roi,
-                        bool copyBitMap,
-                        Image* output) const
+namespace {
+///The vectorized 2x2 averaging of a depth
+inline void
+halveRows(const unsigned char* row0,
+          const unsigned char* row1,
+          unsigned char* to,
+          int nPixels,
+          int nComps)
 {
-    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) ||
-           (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) ||
-           (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
+    Color::halveByteRows(row0, row1, to, nPixels, nComps);
+}
 
-    ///handle case where there is only 1 column/row
-    if ( (roi.width() == 1) || (roi.height() == 1) ) {
-        assert( !(roi.width() == 1 && roi.height() == 1) ); /// can't be 1x1
-        halve1DImage(roi, output);
+inline void
+halveRows(const unsigned short* row0,
+          const unsigned short* row1,
+          unsigned short* to,
+          int nPixels,
+          int nComps)
+{
+    Color::halveShortRows(row0, row1, to, nPixels, nComps);
+}
 
-        return;
-    }
-    
-    /// Take the lock for both bitmaps since we're about to read/write from them!
-    QWriteLocker k1(&output->_entryLock);
-    QReadLocker k2(&_entryLock);
+inline void
+halveRows(const float* row0,
+          const float* row1,
+          float* to,
+          int nPixels,
+          int nComps)
+{
+    Color::halveFloatRows(row0, row1, to, nPixels, nComps);
+}
+} // anon namespace
 
-    ///The source rectangle, intersected to this image region of definition in pixels
+template <typename PIX, int maxValue>
+void
+Image::halveRowsForDepth(const RectI & dstRoI,
+                         bool copyBitMap,
+                         Image* output) const
+{
     const RectI &srcBounds = _bounds;
     const RectI &dstBounds = output->_bounds;
-    const RectI &srcBmBounds = _bitmap.getBounds();
-    const RectI &dstBmBounds = output->_bitmap.getBounds();
-    assert(!copyBitMap || usesBitMap());
-    assert(!usesBitMap() ||(srcBmBounds == srcBounds && dstBmBounds == dstBounds));
-
-    // the srcRoD of the output should be enclosed in half the roi.
-    // It does not have to be exactly half of the input.
-    //    assert(dstRoD.x1*2 >= roi.x1 &&
-    //           dstRoD.x2*2 <= roi.x2 &&
-    //           dstRoD.y1*2 >= roi.y1 &&
-    //           dstRoD.y2*2 <= roi.y2 &&
-    //           dstRoD.width()*2 <= roi.width() &&
-    //           dstRoD.height()*2 <= roi.height());
-    assert( getComponents() == output->getComponents() );
-
     int nComponents = getComponents().getNumComponents();
-    RectI dstRoI;
-    RectI srcRoI = roi;
-    srcRoI.intersect(srcBounds, &srcRoI); // intersect srcRoI with the region of definition
 
-    dstRoI.x1 = std::floor(srcRoI.x1 / 2.);
-    dstRoI.y1 = std::floor(srcRoI.y1 / 2.);
-    dstRoI.x2 = std::ceil(srcRoI.x2 / 2.);
-    dstRoI.y2 = std::ceil(srcRoI.y2 / 2.);
-
-    
-  
-    
     const PIX* const srcPixels      = (const PIX*)pixelAt(srcBounds.x1,   srcBounds.y1);
-    const char* const srcBmPixels   = _bitmap.getBitmapAt(srcBmBounds.x1, srcBmBounds.y1);
     PIX* const dstPixels          = (PIX*)output->pixelAt(dstBounds.x1,   dstBounds.y1);
-    char* const dstBmPixels = output->_bitmap.getBitmapAt(dstBmBounds.x1, dstBmBounds.y1);
 
     int srcRowSize = srcBounds.width() * nComponents;
     int dstRowSize = dstBounds.width() * nComponents;
@@ -1508,17 +1671,16 @@ Image::halveRoIForDepth(const RectI & roi,
     const PIX* const srcData = srcPixels - (srcBounds.x1 * nComponents + srcRowSize * srcBounds.y1);
     PIX* const dstData       = dstPixels - (dstBounds.x1 * nComponents + dstRowSize * dstBounds.y1);
 
-    const int srcBmRowSize = srcBmBounds.width();
-    const int dstBmRowSize = dstBmBounds.width();
+    ///The columns whose 2x2 source pixels are all within srcBounds are halved by the vectorized kernels
+    int interiorX1 = std::max( dstRoI.x1, (int)std::ceil(srcBounds.x1 / 2.) );
+    int interiorX2 = std::max( interiorX1, std::min( dstRoI.x2, (int)std::floor(srcBounds.x2 / 2.) ) );
 
-    const char* const srcBmData = srcBmPixels - (srcBmBounds.x1 + srcBmRowSize * srcBmBounds.y1);
-    char* const dstBmData       = dstBmPixels - (dstBmBounds.x1 + dstBmRowSize * dstBmBounds.y1);
+    ///The bitmap states of a destination row, written to the packed bitmap once the row is done
+    std::vector<char> dstBmRow(copyBitMap ? std::max(0, dstRoI.width()) : 0);
 
     for (int y = dstRoI.y1; y < dstRoI.y2; ++y) {
         const PIX* const srcLineStart    = srcData + y * 2 * srcRowSize;
         PIX* const dstLineStart          = dstData + y     * dstRowSize;
-        const char* const srcBmLineStart = srcBmData + y * 2 * srcBmRowSize;
-        char* const dstBmLineStart       = dstBmData + y     * dstBmRowSize;
 
         // The current dst row, at y, covers the src rows y*2 (thisRow) and y*2+1 (nextRow).
         // Check that if are within srcBounds.
@@ -1528,12 +1690,22 @@ Image::halveRoIForDepth(const RectI & roi,
 
         int sumH = (int)pickNextRow + (int)pickThisRow;
         assert(sumH == 1 || sumH == 2);
-        
+
+        const bool vectorizedRow = sumH == 2 && interiorX1 < interiorX2;
+        if (vectorizedRow) {
+            halveRows(srcLineStart + interiorX1 * 2 * nComponents, srcLineStart + interiorX1 * 2 * nComponents + srcRowSize,
+                      dstLineStart + interiorX1 * nComponents, interiorX2 - interiorX1, nComponents);
+        }
+
         for (int x = dstRoI.x1; x < dstRoI.x2; ++x) {
+            const bool vectorizedPixel = vectorizedRow && interiorX1 <= x && x < interiorX2;
+            if (vectorizedPixel && !copyBitMap) {
+                x = interiorX2 - 1;
+                continue;
+            }
             const PIX* const srcPixStart    = srcLineStart   + x * 2 * nComponents;
-            const char* const srcBmPixStart = srcBmLineStart + x * 2;
             PIX* const dstPixStart          = dstLineStart   + x * nComponents;
-            char* const dstBmPixStart       = dstBmLineStart + x;
+            char* const dstBmPixStart       = copyBitMap ? &dstBmRow[x - dstRoI.x1] : 0;
 
             // The current dst col, at y, covers the src cols x*2 (thisCol) and x*2+1 (nextCol).
             // Check that if are within srcBounds.
@@ -1556,7 +1728,7 @@ Image::halveRoIForDepth(const RectI & roi,
                 continue;
             }
 
-            for (int k = 0; k < nComponents; ++k) {
+            for (int k = 0; k < nComponents && !vectorizedPixel; ++k) {
                 ///a b
                 ///c d
 
@@ -1574,10 +1746,10 @@ Image::halveRoIForDepth(const RectI & roi,
                 ///a b
                 ///c d
 
-                char a = (pickThisCol && pickThisRow) ? *(srcBmPixStart) : 0;
-                char b = (pickNextCol && pickThisRow) ? *(srcBmPixStart + 1) : 0;
-                char c = (pickThisCol && pickNextRow) ? *(srcBmPixStart + srcBmRowSize): 0;
-                char d = (pickNextCol && pickNextRow) ? *(srcBmPixStart + srcBmRowSize  + 1)  : 0;
+                char a = (pickThisCol && pickThisRow) ? (char)_bitmap.get(srcx, srcy) : 0;
+                char b = (pickNextCol && pickThisRow) ? (char)_bitmap.get(srcx + 1, srcy) : 0;
+                char c = (pickThisCol && pickNextRow) ? (char)_bitmap.get(srcx, srcy + 1) : 0;
+                char d = (pickNextCol && pickNextRow) ? (char)_bitmap.get(srcx + 1, srcy + 1) : 0;
 #if NATRON_ENABLE_TRIMAP
                 /*
                  The only correct solution is to convert pixels being rendered to 0 otherwise the caller
@@ -1604,6 +1776,90 @@ Image::halveRoIForDepth(const RectI & roi,
                 assert(dstBmPixStart[0] == 0 || dstBmPixStart[0] == 1);
             }
         }
+        if ( copyBitMap && !dstBmRow.empty() ) {
+            output->_bitmap.setRowPortion(dstRoI.x1, dstRoI.x2, y, &dstBmRow[0]);
+        }
+    }
+
+} // halveRowsForDepth
+
+// code proofread and fixed by @devernay on 4/12/2014
+template <typename PIX, int maxValue>
+void
+Image::halveRoIForDepth(const RectI & roi,
+                        bool copyBitMap,
+                        Image* output) const
+{
+    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) ||
+           (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) ||
+           (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
+
+    ///handle case where there is only 1 column/row
+    if ( (roi.width() == 1) || (roi.height() == 1) ) {
+        assert( !(roi.width() == 1 && roi.height() == 1) ); /// can't be 1x1
+        halve1DImage(roi, output);
+
+        return;
+    }
+    
+    /// Take the lock for both bitmaps since we're about to read/write from them!
+    QWriteLocker k1(&output->_entryLock);
+    QReadLocker k2(&_entryLock);
+
+    ///The source rectangle, intersected to this image region of definition in pixels
+    const RectI &srcBounds = _bounds;
+    const RectI &dstBounds = output->_bounds;
+    assert(!copyBitMap || usesBitMap());
+    assert(!usesBitMap() ||(_bitmap.getBounds() == srcBounds && output->_bitmap.getBounds() == dstBounds));
+
+    // the srcRoD of the output should be enclosed in half the roi.
+    // It does not have to be exactly half of the input.
+    //    assert(dstRoD.x1*2 >= roi.x1 &&
+    //           dstRoD.x2*2 <= roi.x2 &&
+    //           dstRoD.y1*2 >= roi.y1 &&
+    //           dstRoD.y2*2 <= roi.y2 &&
+    //           dstRoD.width()*2 <= roi.width() &&
+    //           dstRoD.height()*2 <= roi.height());
+    assert( getComponents() == output->getComponents() );
+
+    RectI dstRoI;
+    RectI srcRoI = roi;
+    srcRoI.intersect(srcBounds, &srcRoI); // intersect srcRoI with the region of definition
+
+    dstRoI.x1 = std::floor(srcRoI.x1 / 2.);
+    dstRoI.y1 = std::floor(srcRoI.y1 / 2.);
+    dstRoI.x2 = std::ceil(srcRoI.x2 / 2.);
+    dstRoI.y2 = std::ceil(srcRoI.y2 / 2.);
+
+    
+  
+    
+    if ( dstRoI.isNull() ) {
+        return;
+    }
+
+    ///Split the rows in bands aligned on the tiles of the output bitmap, so that the bands never write
+    ///the same bitmap tile, and halve them in parallel
+    std::vector<RectI> bands;
+    int bandY1 = dstRoI.y1;
+    while (bandY1 < dstRoI.y2) {
+        int bandY2 = dstBounds.y1 + ( (bandY1 - dstBounds.y1) / NATRON_IMAGE_TILE_SIZE + 1 ) * NATRON_IMAGE_TILE_SIZE;
+        bandY2 = std::min(bandY2, dstRoI.y2);
+        bands.push_back( RectI(dstRoI.x1, bandY1, dstRoI.x2, bandY2) );
+        bandY1 = bandY2;
+    }
+
+    TaskPool* pool = appPTR ? appPTR->getTaskPool() : 0;
+    if ( !pool || (bands.size() == 1) || ( (double)dstRoI.width() * dstRoI.height() < NATRON_IMAGE_TILE_SIZE * NATRON_IMAGE_TILE_SIZE * 4 ) ) {
+        for (std::size_t i = 0; i < bands.size(); ++i) {
+            halveRowsForDepth<PIX, maxValue>(bands[i], copyBitMap, output);
+        }
+    } else {
+        std::vector<TaskPool::Task> tasks;
+        for (std::size_t i = 0; i < bands.size(); ++i) {
+            tasks.push_back( boost::bind(&Image::halveRowsForDepth<PIX, maxValue>, this, bands[i], copyBitMap, output) );
+        }
+        pool->run(tasks);
     }
 
 } // halveRoIForDepth
@@ -1736,20 +1992,27 @@ Image::downscaleMipMap(const RectD& dstRod,
 //    roiCanonical.toPixelEnclosing(toLevel, par , &dstRoI);
     unsigned int downscaleLvls = toLevel - fromLevel;
 
-    assert(!copyBitMap || _bitmap.getBitmap());
+    assert(!copyBitMap || usesBitMap());
     
     RectI dstRoI  = roi.downscalePowerOfTwoSmallestEnclosing(downscaleLvls);
     
-    ImagePtr tmpImg( new Image( getComponents(), dstRod, dstRoI, toLevel, par, getBitDepth() , true) );
-
-    buildMipMapLevel( dstRod, roi, downscaleLvls, copyBitMap, tmpImg.get() );
-
     // check that the downscaled mipmap is inside the output image (it may not be equal to it)
     assert(dstRoI.x1 >= output->_bounds.x1);
     assert(dstRoI.x2 <= output->_bounds.x2);
     assert(dstRoI.y1 >= output->_bounds.y1);
     assert(dstRoI.y2 <= output->_bounds.y2);
 
+    ///When the output is exactly the downscaled roi, buildMipMapLevel writes the last level directly into it
+    if ( (output->_bounds == dstRoI) && ( output->getBitDepth() == getBitDepth() ) ) {
+        buildMipMapLevel(dstRod, roi, downscaleLvls, copyBitMap, output);
+
+        return;
+    }
+
+    ImagePtr tmpImg( new Image( getComponents(), dstRod, dstRoI, toLevel, par, getBitDepth() , true) );
+
+    buildMipMapLevel( dstRod, roi, downscaleLvls, copyBitMap, tmpImg.get() );
+
     ///Now copy the result of tmpImg into the output image
     output->pasteFrom(*tmpImg, dstRoI, copyBitMap);
 }
@@ -2177,6 +2440,18 @@ Image::buildMipMapLevel(const RectD& dstRoD,
         ///Halve the smallest enclosing po2 rect as we need to render a minimum of the renderWindow
         RectI halvedRoI = previousRoI.downscalePowerOfTwoSmallestEnclosing(1);
 
+        ///The last level is written directly in the output when it covers exactly the output bounds:
+        ///this is the case of downscaleMipMap and saves an allocation and a copy of the last level
+        if ( (i == level) && (output->getBounds() == halvedRoI) && srcImg->getBounds().contains(previousRoI) &&
+             ( output->getBitDepth() == getBitDepth() ) && ( !copyBitMap || output->usesBitMap() ) ) {
+            srcImg->halveRoI(previousRoI, copyBitMap, output);
+            if (mustFreeSrc) {
+                delete srcImg;
+            }
+
+            return;
+        }
+
         ///Allocate an image with half the size of the source image
         dstImg = new Image( getComponents(), dstRoD, halvedRoI, getMipMapLevel() + i, getPixelAspectRatio(),getBitDepth() , true);
 
@@ -2238,15 +2513,28 @@ Image::copyBitmapRowPortion(int x1, int x2,int y, const Image& other)
 void
 Bitmap::copyRowPortion(int x1,int x2,int y,const Bitmap& other)
 {
-    const char* srcBitmap = other.getBitmapAt(x1, y);
-    char* dstBitmap = getBitmapAt(x1, y);
-    const char* end = dstBitmap + (x2 - x1);
-    while (dstBitmap < end) {
-        *dstBitmap = /**srcBitmap == PIXEL_UNAVAILABLE ? 0 : */*srcBitmap;
-        ++dstBitmap;
-        ++srcBitmap;
+    assert(x1 >= _bounds.x1 && x2 <= _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2);
+    assert(x1 >= other._bounds.x1 && x2 <= other._bounds.x2 && y >= other._bounds.y1 && y < other._bounds.y2);
+    if (x2 <= x1) {
+        return;
+    }
+    int srcY = y - other._bounds.y1;
+    int dstY = y - _bounds.y1;
+    int statesMask = 0;
+    for (int srcX = x1 - other._bounds.x1, dstX = x1 - _bounds.x1, n = x2 - x1; n > 0; ) {
+        int c = std::min(n, 32);
+        U64 bits = other.readRun(srcY, srcX, c);
+        writeRun(dstY, dstX, c, bits);
+        statesMask |= bitmapStatesInWord( bits, bitmapPixelsMask(0, c) );
+        srcX += c;
+        dstX += c;
+        n -= c;
+    }
+    ///The tiles keep the states that were there before: they may only contain more states than they actually have
+    int ty = dstY >> BITMAP_TILE_SIZE_LOG2;
+    for (int tx = (x1 - _bounds.x1) >> BITMAP_TILE_SIZE_LOG2; tx <= (x2 - 1 - _bounds.x1) >> BITMAP_TILE_SIZE_LOG2; ++tx) {
+        _tiles[ty * _tilesPerRow + tx] |= (unsigned char)statesMask;
     }
-    
 }
 
 void
@@ -2261,26 +2549,23 @@ Bitmap::copyBitmapPortion(const RectI& roi, const Bitmap& other)
 {
     assert(roi.x1 >= _bounds.x1 && roi.x2 <= _bounds.x2 && roi.y1 >= _bounds.y1 && roi.y2 <= _bounds.y2);
     assert(roi.x1 >= other._bounds.x1 && roi.x2 <= other._bounds.x2 && roi.y1 >= other._bounds.y1 && roi.y2 <= other._bounds.y2);
-    
-    int srcRowSize = other._bounds.width();
-    int dstRowSize = _bounds.width();
-    
-    const char* srcBitmap = other.getBitmapAt(roi.x1, roi.y1);
-    char* dstBitmap = getBitmapAt(roi.x1, roi.y1);
-    
-    for (int y = roi.y1; y < roi.y2; ++y,
-         srcBitmap += srcRowSize,
-         dstBitmap += dstRowSize) {
-        
-        const char* srcCur = srcBitmap;
-        const char* srcEnd = srcBitmap + roi.width();
-        char* dstCur = dstBitmap;
-        while (srcCur < srcEnd) {
-            *dstCur = /**srcCur == PIXEL_UNAVAILABLE ? 0 : */*srcCur;
-            ++srcCur;
-            ++dstCur;
+    if ( roi.isNull() ) {
+        return;
+    }
+    for (int y = roi.y1; y < roi.y2; ++y) {
+        int srcY = y - other._bounds.y1;
+        int dstY = y - _bounds.y1;
+        for (int srcX = roi.x1 - other._bounds.x1, dstX = roi.x1 - _bounds.x1, n = roi.width(); n > 0; ) {
+            int c = std::min(n, 32);
+            writeRun( dstY, dstX, c, other.readRun(srcY, srcX, c) );
+            srcX += c;
+            dstX += c;
+            n -= c;
         }
     }
+    RectI localRoi = roi;
+    localRoi.translate(-_bounds.x1, -_bounds.y1);
+    updateTiles(localRoi, 0);
 }
 
 template <typename PIX, bool doPremult>
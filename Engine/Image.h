@@ -29,6 +29,7 @@
 #include <map>
 #include <algorithm> // min, max
 #include <bitset>
+#include <vector>
 
 #include "Global/GlobalDefines.h"
 
@@ -60,12 +61,24 @@ public:
     }
 };
 
+/**
+ * @brief Tracks the render state of each pixel of an image: 0 = not rendered, 1 = rendered and, with the trimap,
+ * PIXEL_UNAVAILABLE (2) = being rendered by another thread.
+ *
+ * The states are packed with 2 bits per pixel (32 pixels per 64-bit word, each row starting on a new word) and each
+ * tile of 64x64 pixels keeps a summary of the states that may be present in it. Tiles that contain a single state are
+ * skipped without reading their pixels, so that the queries done for each render (minimalNonMarkedRects) of an image
+ * that is entirely rendered or entirely unrendered are proportional to the number of tiles rather than of pixels.
+ **/
 class Bitmap
 {
 public:
     Bitmap(const RectI & bounds)
-    : _bounds(bounds)
-    , _map( bounds.area() )
+    : _bounds()
+    , _map()
+    , _wordsPerRow(0)
+    , _tiles()
+    , _tilesPerRow(0)
     , _dirtyZone()
     , _dirtyZoneSet(false)
     {
@@ -73,40 +86,42 @@ public:
         // "identities" images (i.e: images that are just a link to another image). See EffectInstance :
         // "!!!Note that if isIdentity is true it will allocate an empty image object with 0 bytes of data."
         //assert(!rod.isNull());
-        std::fill(_map.begin(), _map.end(), 0);
+        initialize(bounds);
     }
 
     Bitmap()
     : _bounds()
     , _map()
+    , _wordsPerRow(0)
+    , _tiles()
+    , _tilesPerRow(0)
     , _dirtyZone()
     , _dirtyZoneSet(false)
     {
     }
 
-    void initialize(const RectI & bounds)
-    {
-        _bounds = bounds;
-        _map.resize( _bounds.area() );
-
-        std::fill(_map.begin(), _map.end(), 0);
-    }
+    void initialize(const RectI & bounds);
 
     ~Bitmap()
     {
     }
 
 
-    void setTo1()
-    {
-        std::fill(_map.begin(),_map.end(),1);
-    }
+    void setTo1();
 
     const RectI & getBounds() const
     {
         return _bounds;
     }
 
+    /**
+     * @brief Returns the memory used by the bitmap, in bytes.
+     **/
+    std::size_t getSizeInBytes() const
+    {
+        return _map.size() * sizeof(U64) + _tiles.size();
+    }
+
 #if NATRON_ENABLE_TRIMAP
     void minimalNonMarkedRects_trimap(const RectI & roi,std::list<RectI>& ret,bool* isBeingRenderedElsewhere) const;
     RectI minimalNonMarkedBbox_trimap(const RectI & roi,bool* isBeingRenderedElsewhere) const;
@@ -128,18 +143,17 @@ public:
 
     void swap(Bitmap& other);
 
-    const char* getBitmap() const
+    ///Returns the state of the pixel (x,y), which must be within the bounds
+    int get(int x,int y) const
     {
-        return &_map.front();
-    }
+        assert( x >= _bounds.x1 && x < _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2 );
+        int lx = x - _bounds.x1;
 
-    char* getBitmap()
-    {
-        return &_map.front();
+        return (int)( ( _map[(y - _bounds.y1) * _wordsPerRow + (lx >> 5)] >> ( (lx & 31) * 2 ) ) & 3 );
     }
 
-    const char* getBitmapAt(int x,int y) const;
-    char* getBitmapAt(int x,int y);
+    ///Sets the states of the pixels (x1..x2-1,y) from one char per pixel
+    void setRowPortion(int x1,int x2,int y,const char* states);
 
     void copyRowPortion(int x1,int x2,int y,const Bitmap& other);
 
@@ -151,8 +165,47 @@ public:
     }
 
 private:
+
+    /*
+     * All the functions below take coordinates relative to the bottom-left corner of the bounds.
+     * States are given as masks of (1 << state).
+     */
+
+    void fill(const RectI& roi, int state);
+
+    void writeRun(int y, int x, int n, U64 bits);
+
+    U64 readRun(int y, int x, int n) const;
+
+    void updateTiles(const RectI& roi, int statesMask);
+
+    unsigned char computeTileStates(int tx, int ty) const;
+
+    bool rectContains(const RectI& roi, int statesMask) const;
+
+    int firstRowContaining(const RectI& roi, int statesMask) const;
+
+    int lastRowContaining(const RectI& roi, int statesMask) const;
+
+    int firstColumnContaining(const RectI& roi, int statesMask) const;
+
+    int lastColumnContaining(const RectI& roi, int statesMask) const;
+
+    template <int trimap>
+    RectI minimalNonMarkedBbox_internal(const RectI& roi, bool* isBeingRenderedElsewhere) const;
+
+    template <int trimap>
+    void minimalNonMarkedRects_internal(const RectI& roi, std::list<RectI>& ret, bool* isBeingRenderedElsewhere) const;
+
     RectI _bounds;
-    std::vector<char> _map;
+
+    // 2 bits per pixel, _wordsPerRow words per row
+    std::vector<U64> _map;
+    int _wordsPerRow;
+
+    // for each tile of 64x64 pixels, the mask of the states that may be present in the tile
+    std::vector<unsigned char> _tiles;
+    int _tilesPerRow;
 
     /**
      * This represents the zone that has potentially something to render. In minimalNonMarkedRects
@@ -232,6 +285,7 @@ public:
     /**
      * @brief Resizes this image so it contains newBounds, copying all the content of the current bounds of the image into
      * a new buffer. This is not thread-safe and should be called only while under an ImageLocker
+     * When only rows are added, the buffer is grown in place instead of being copied.
      **/
     bool ensureBounds(const RectI& newBounds, bool fillWithBlackAndTransparent = false, bool setBitmapTo1 = false);
 
@@ -285,7 +339,7 @@ public:
         std::size_t dt = dataSize();
 
         bool got = _entryLock.tryLockForRead();
-        dt += _bitmap.getBounds().area();
+        dt += _bitmap.getSizeInBytes();
         if (got) {
             _entryLock.unlock();
         }
@@ -386,12 +440,6 @@ public:
             assert(img);
             return img->pixelAt(x, y);
         }
-
-        const char* bitmapAt(int x, int y) const
-        {
-            assert(img);
-            return img->getBitmapAt(x, y);
-        }
     };
 
     /**
@@ -431,12 +479,6 @@ public:
         {
             return img->pixelAt(x, y);
         }
-
-        char* bitmapAt(int x, int y) const
-        {
-            assert(img);
-            return img->getBitmapAt(x, y);
-        }
     };
 
     ReadAccess getReadRights() const
@@ -459,18 +501,6 @@ private:
      * of an image.
      **/
 
-    const char* getBitmapAt(int x,
-                            int y) const
-    {
-        return this->_bitmap.getBitmapAt(x,y);
-    }
-
-    char* getBitmapAt(int x,
-                      int y)
-    {
-        return this->_bitmap.getBitmapAt(x,y);
-    }
-
     /**
      * @brief Access pixels. The pointer must be cast to the appropriate type afterwards.
      **/
@@ -950,6 +980,15 @@ private:
                           bool copyBitMap,
                           Image* output) const;
 
+    /**
+     * @brief Halves the source pixels of the rows dstRoI of output. The caller holds the locks of both images.
+     * Different rows of bitmap tiles of output may be halved concurrently.
+     **/
+    template <typename PIX, int maxValue>
+    void halveRowsForDepth(const RectI & dstRoI,
+                           bool copyBitMap,
+                           Image* output) const;
+
     /**
      * @brief Same as halveRoI but for 1D only (either width == 1 or height == 1)
      **/
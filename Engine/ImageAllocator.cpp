@@ -0,0 +1,265 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "ImageAllocator.h"
+
+#include <algorithm> // min
+#include <cstdlib> // malloc, realloc, free
+#include <cstring> // memcpy
+#include <map>
+#include <new> // bad_alloc
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+
+#if defined(__linux__) || defined(__linux) || defined(linux) || defined(__gnu_linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(MADV_HUGEPAGE)
+#define NATRON_IMAGE_ALLOCATOR_HUGE_PAGES
+#endif
+#endif
+
+///The size of a transparent huge page on x86-64 and the smallest one on the other architectures
+#define NATRON_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+///Pages are touched with this stride: the smallest page size of the supported systems
+#define NATRON_SMALL_PAGE_SIZE 4096
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+QAtomicInt hugePagesEnabled(0);
+QAtomicInt firstTouchEnabled(0);
+
+#ifdef NATRON_IMAGE_ALLOCATOR_HUGE_PAGES
+///The buffers mapped for huge pages and their mapped length
+struct HugePagesMappings
+{
+    QMutex lock;
+    std::map<void*, std::size_t> mappings;
+    QAtomicInt count; // number of mappings, checked before locking to find a buffer
+
+    HugePagesMappings()
+        : lock()
+        , mappings()
+        , count(0)
+    {
+    }
+};
+
+///Never destroyed: images may be freed after the destruction of the statics
+HugePagesMappings* hugePagesMappings = new HugePagesMappings;
+
+///Returns NULL if the mapping failed
+void*
+allocateHugePages(std::size_t size)
+{
+    std::size_t length = (size + NATRON_HUGE_PAGE_SIZE - 1) / NATRON_HUGE_PAGE_SIZE * NATRON_HUGE_PAGE_SIZE;
+    ///Map one more huge page so that the buffer can be aligned on a huge page, the kernel may only use huge pages for
+    ///aligned regions
+    std::size_t mappedLength = length + NATRON_HUGE_PAGE_SIZE;
+    void* mapped = mmap(0, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+    char* begin = (char*)mapped;
+    char* aligned = (char*)( ( (std::size_t)begin + NATRON_HUGE_PAGE_SIZE - 1 ) / NATRON_HUGE_PAGE_SIZE * NATRON_HUGE_PAGE_SIZE );
+    if (aligned > begin) {
+        munmap(begin, aligned - begin);
+    }
+    char* end = begin + mappedLength;
+    if (end > aligned + length) {
+        munmap(aligned + length, end - (aligned + length) );
+    }
+    ///Only a hint: the buffer is valid even if the kernel does not have huge pages
+    madvise(aligned, length, MADV_HUGEPAGE);
+
+    QMutexLocker k(&hugePagesMappings->lock);
+    hugePagesMappings->mappings[aligned] = length;
+    hugePagesMappings->count.fetchAndAddOrdered(1);
+
+    return aligned;
+}
+
+///Returns false if data was not allocated by allocateHugePages(size)
+bool
+deallocateHugePages(void* data,
+                    std::size_t size)
+{
+    ///Only the buffers of at least a huge page are mapped: do not lock for the others
+    if ( (size < NATRON_HUGE_PAGE_SIZE) || ( (int)hugePagesMappings->count == 0 ) ) {
+        return false;
+    }
+    std::size_t length;
+    {
+        QMutexLocker k(&hugePagesMappings->lock);
+        std::map<void*, std::size_t>::iterator found = hugePagesMappings->mappings.find(data);
+        if ( found == hugePagesMappings->mappings.end() ) {
+            return false;
+        }
+        length = found->second;
+        hugePagesMappings->mappings.erase(found);
+        hugePagesMappings->count.fetchAndAddOrdered(-1);
+    }
+    munmap(data, length);
+
+    return true;
+}
+
+bool
+isHugePagesMapping(void* data,
+                   std::size_t size)
+{
+    if ( (size < NATRON_HUGE_PAGE_SIZE) || ( (int)hugePagesMappings->count == 0 ) ) {
+        return false;
+    }
+    QMutexLocker k(&hugePagesMappings->lock);
+
+    return hugePagesMappings->mappings.find(data) != hugePagesMappings->mappings.end();
+}
+
+#endif // NATRON_IMAGE_ALLOCATOR_HUGE_PAGES
+
+///Writes a byte in each page of [begin, end) so that the system places them in the memory of the current CPU
+void
+touchPages(void* data,
+           std::size_t begin,
+           std::size_t end)
+{
+    volatile char* p = (volatile char*)data;
+
+    for (std::size_t i = begin; i < end; i += NATRON_SMALL_PAGE_SIZE) {
+        p[i] = 0;
+    }
+}
+} // anon namespace
+
+void*
+ImageAllocator::allocate(std::size_t size)
+{
+    void* ret = 0;
+
+#ifdef NATRON_IMAGE_ALLOCATOR_HUGE_PAGES
+    if ( (size >= NATRON_HUGE_PAGE_SIZE) && (int)hugePagesEnabled ) {
+        ret = allocateHugePages(size);
+    }
+#endif
+    if (!ret) {
+        ret = malloc(size);
+        if (!ret) {
+            throw std::bad_alloc();
+        }
+    }
+    if ( (int)firstTouchEnabled ) {
+        touchPages(ret, 0, size);
+    }
+
+    return ret;
+}
+
+void*
+ImageAllocator::reallocate(void* data,
+                           std::size_t oldSize,
+                           std::size_t newSize)
+{
+    if (!data) {
+        return allocate(newSize);
+    }
+#ifdef NATRON_IMAGE_ALLOCATOR_HUGE_PAGES
+    if ( isHugePagesMapping(data, oldSize) || ( (newSize >= NATRON_HUGE_PAGE_SIZE) && (int)hugePagesEnabled ) ) {
+        ///Mappings cannot be extended in place without possibly losing their alignment: move the content
+        void* ret = allocate(newSize);
+        memcpy( ret, data, std::min(oldSize, newSize) );
+        deallocate(data, oldSize);
+
+        return ret;
+    }
+#endif
+    void* ret = realloc(data, newSize);
+    if (!ret) {
+        throw std::bad_alloc();
+    }
+    if ( (newSize > oldSize) && (int)firstTouchEnabled ) {
+        touchPages(ret, oldSize, newSize);
+    }
+
+    return ret;
+}
+
+void
+ImageAllocator::deallocate(void* data,
+                           std::size_t size)
+{
+    if (!data) {
+        return;
+    }
+#ifdef NATRON_IMAGE_ALLOCATOR_HUGE_PAGES
+    if ( deallocateHugePages(data, size) ) {
+        return;
+    }
+#else
+    Q_UNUSED(size);
+#endif
+    free(data);
+}
+
+bool
+ImageAllocator::isHugePagesSupported()
+{
+#ifdef NATRON_IMAGE_ALLOCATOR_HUGE_PAGES
+
+    return true;
+#else
+
+    return false;
+#endif
+}
+
+void
+ImageAllocator::setHugePagesEnabled(bool enabled)
+{
+    hugePagesEnabled.fetchAndStoreOrdered( (enabled && isHugePagesSupported()) ? 1 : 0 );
+}
+
+bool
+ImageAllocator::isHugePagesEnabled()
+{
+    return (int)hugePagesEnabled != 0;
+}
+
+void
+ImageAllocator::setFirstTouchEnabled(bool enabled)
+{
+    firstTouchEnabled.fetchAndStoreOrdered(enabled ? 1 : 0);
+}
+
+bool
+ImageAllocator::isFirstTouchEnabled()
+{
+    return (int)firstTouchEnabled != 0;
+}
+
+NATRON_NAMESPACE_EXIT;
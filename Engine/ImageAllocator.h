@@ -0,0 +1,82 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_ImageAllocator_h
+#define Engine_ImageAllocator_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <cstddef>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief Allocates the memory of the cache entries (RamBuffer) and of the ImageArena.
+ *
+ * Two policies can be enabled from the Settings, for the large float images:
+ * - Huge pages: buffers of at least a huge page (2MiB) are mapped on their own, aligned on a huge page, and the kernel is
+ *   asked to back them with transparent huge pages (madvise(MADV_HUGEPAGE)). This divides the number of TLB misses
+ *   when processing them by 512. Only available on Linux, the other systems use malloc.
+ * - First touch: the pages of a new buffer are touched by the allocating thread, i.e the render thread creating the
+ *   image. With the default NUMA policy of the systems (Linux and Windows allocate a page on the node of the CPU that
+ *   touches it first), the whole image is then in the memory of that CPU instead of being scattered between the NUMA
+ *   nodes of the threads that happened to write each tile first.
+ * Changing a policy only affects the next allocations: buffers are always freed the way they were allocated.
+ *
+ * All the functions are thread-safe.
+ **/
+class ImageAllocator
+{
+public:
+
+    /**
+     * @brief Returns a buffer of size bytes. Throws std::bad_alloc if the allocation fails.
+     **/
+    static void* allocate(std::size_t size);
+
+    /**
+     * @brief Resizes a buffer returned by allocate(oldSize), keeping its content up to the smallest of the two sizes.
+     * data may be NULL. Throws std::bad_alloc if the allocation fails, in which case data is still valid.
+     **/
+    static void* reallocate(void* data, std::size_t oldSize, std::size_t newSize);
+
+    /**
+     * @brief Frees a buffer returned by allocate(size) or reallocate(..., size).
+     **/
+    static void deallocate(void* data, std::size_t size);
+
+    static bool isHugePagesSupported();
+    static void setHugePagesEnabled(bool enabled);
+    static bool isHugePagesEnabled();
+
+    static void setFirstTouchEnabled(bool enabled);
+    static bool isFirstTouchEnabled();
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_ImageAllocator_h
@@ -0,0 +1,346 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "ImageArena.h"
+
+#include <algorithm> // max
+#include <map>
+#include <set>
+#include <vector>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+
+#include "Engine/ImageAllocator.h"
+#include "Engine/RenderStats.h"
+#include "Engine/ThreadStorage.h"
+
+///Buffers smaller than that are not recycled. The size classes of the larger buffers are all multiples of
+///NATRON_IMAGE_ARENA_UNIT, in which the memory in use is counted
+#define NATRON_IMAGE_ARENA_MIN_SIZE (256 * 1024)
+#define NATRON_IMAGE_ARENA_UNIT (NATRON_IMAGE_ARENA_MIN_SIZE / 8)
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+typedef std::map<std::size_t, std::vector<void*> > FreeBlocks;
+
+///Rounds size up to a multiple of 1/8th of its power of two
+std::size_t
+getClassSize(std::size_t size)
+{
+    std::size_t step = 1;
+
+    while ( (step << 4) <= size ) {
+        step <<= 1;
+    }
+
+    return (size + step - 1) / step * step;
+}
+
+void
+freeBlocks(FreeBlocks& blocks)
+{
+    for (FreeBlocks::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        for (std::size_t i = 0; i < it->second.size(); ++i) {
+            ImageAllocator::deallocate(it->second[i], it->first);
+        }
+    }
+    blocks.clear();
+}
+
+///Takes a block of the given class from blocks, returns NULL if there is none
+void*
+takeBlock(FreeBlocks& blocks,
+          std::size_t classSize)
+{
+    FreeBlocks::iterator found = blocks.find(classSize);
+
+    if ( ( found == blocks.end() ) || found->second.empty() ) {
+        return 0;
+    }
+    void* ret = found->second.back();
+    found->second.pop_back();
+
+    return ret;
+}
+
+struct ArenaThreadCache;
+
+struct SharedArena
+{
+    QMutex lock;
+    FreeBlocks blocks;
+    std::size_t memory; // memory held by blocks
+    std::size_t maxMemory;
+    QAtomicInt maxThreadUnits; // maximum memory held by the free list of each thread
+    QAtomicInt unitsInUse;
+    QAtomicInt peakUnitsInUse;
+    QMutex threadCachesLock; // protects threadCaches, taken before the lock of a thread cache
+    std::set<ArenaThreadCache*> threadCaches; // the free lists of the threads, emptied by clear()
+
+    SharedArena()
+        : lock()
+        , blocks()
+        , memory(0)
+        , maxMemory(0)
+        , maxThreadUnits(0)
+        , unitsInUse(0)
+        , peakUnitsInUse(0)
+        , threadCachesLock()
+        , threadCaches()
+    {
+    }
+
+    ///Gives a block to the shared free list, or frees it if it does not fit
+    void release(void* data,
+                 std::size_t classSize)
+    {
+        QMutexLocker k(&lock);
+
+        if (classSize > maxMemory) {
+            ImageAllocator::deallocate(data, classSize);
+
+            return;
+        }
+        ///Make room by freeing the largest blocks of the other classes first: they are the most likely to fragment the heap
+        for (FreeBlocks::reverse_iterator it = blocks.rbegin(); it != blocks.rend() && memory + classSize > maxMemory; ++it) {
+            if (it->first == classSize) {
+                continue;
+            }
+            while ( !it->second.empty() && (memory + classSize > maxMemory) ) {
+                ImageAllocator::deallocate(it->second.back(), it->first);
+                it->second.pop_back();
+                memory -= it->first;
+            }
+        }
+        std::vector<void*>& sameClass = blocks[classSize];
+        while ( !sameClass.empty() && (memory + classSize > maxMemory) ) {
+            ImageAllocator::deallocate(sameClass.back(), classSize);
+            sameClass.pop_back();
+            memory -= classSize;
+        }
+        sameClass.push_back(data);
+        memory += classSize;
+    }
+
+    void* take(std::size_t classSize)
+    {
+        QMutexLocker k(&lock);
+        void* ret = takeBlock(blocks, classSize);
+
+        if (ret) {
+            memory -= classSize;
+        }
+
+        return ret;
+    }
+};
+
+///Never destroyed: threads may give back their free list after the destruction of the statics
+SharedArena* sharedArena = new SharedArena;
+
+struct ArenaThreadCache
+{
+    ///Only contended when another thread calls clear()
+    QMutex lock;
+    FreeBlocks blocks;
+    std::size_t memory;
+
+    ArenaThreadCache()
+        : lock()
+        , blocks()
+        , memory(0)
+    {
+        QMutexLocker k(&sharedArena->threadCachesLock);
+
+        sharedArena->threadCaches.insert(this);
+    }
+
+    ~ArenaThreadCache()
+    {
+        {
+            QMutexLocker k(&sharedArena->threadCachesLock);
+            sharedArena->threadCaches.erase(this);
+        }
+        for (FreeBlocks::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+            for (std::size_t i = 0; i < it->second.size(); ++i) {
+                sharedArena->release(it->second[i], it->first);
+            }
+        }
+    }
+};
+
+///Deleted by QThreadStorage when the thread exits
+ThreadStorage<ArenaThreadCache*> threadCaches;
+
+ArenaThreadCache&
+getThreadCache()
+{
+    ArenaThreadCache*& cache = threadCaches.localData();
+
+    if (!cache) {
+        cache = new ArenaThreadCache;
+    }
+
+    return *cache;
+}
+} // anon namespace
+
+void*
+ImageArena::allocate(std::size_t size)
+{
+    if (size < NATRON_IMAGE_ARENA_MIN_SIZE) {
+        return ImageAllocator::allocate(size);
+    }
+
+    std::size_t classSize = getClassSize(size);
+    ArenaThreadCache& cache = getThreadCache();
+
+    bool reused = true;
+    void* ret;
+    {
+        QMutexLocker k(&cache.lock);
+        ret = takeBlock(cache.blocks, classSize);
+        if (ret) {
+            cache.memory -= classSize;
+        }
+    }
+    if (!ret) {
+        ret = sharedArena->take(classSize);
+    }
+    if (!ret) {
+        reused = false;
+        ret = ImageAllocator::allocate(classSize);
+    }
+
+    int units = (int)(classSize / NATRON_IMAGE_ARENA_UNIT);
+    int inUse = sharedArena->unitsInUse.fetchAndAddOrdered(units) + units;
+    for (;;) {
+        int peak = (int)sharedArena->peakUnitsInUse;
+        if ( (inUse <= peak) || sharedArena->peakUnitsInUse.testAndSetOrdered(peak, inUse) ) {
+            break;
+        }
+    }
+
+    if ( RenderStatsThreadScope::isActiveForCurrentThread() ) {
+        RenderStatsThreadScope::reportArenaAllocation(reused, (std::size_t)inUse * NATRON_IMAGE_ARENA_UNIT);
+    }
+
+    return ret;
+}
+
+void
+ImageArena::deallocate(void* data,
+                       std::size_t size)
+{
+    if (!data) {
+        return;
+    }
+    if (size < NATRON_IMAGE_ARENA_MIN_SIZE) {
+        ImageAllocator::deallocate(data, size);
+
+        return;
+    }
+
+    std::size_t classSize = getClassSize(size);
+    sharedArena->unitsInUse.fetchAndAddOrdered( -(int)(classSize / NATRON_IMAGE_ARENA_UNIT) );
+
+    ArenaThreadCache& cache = getThreadCache();
+
+    std::size_t maxThreadMemory = (std::size_t)(int)sharedArena->maxThreadUnits * NATRON_IMAGE_ARENA_UNIT;
+    {
+        QMutexLocker k(&cache.lock);
+        if (cache.memory + classSize <= maxThreadMemory) {
+            cache.blocks[classSize].push_back(data);
+            cache.memory += classSize;
+
+            return;
+        }
+    }
+    sharedArena->release(data, classSize);
+}
+
+void
+ImageArena::setMaximumMemory(std::size_t maxMemory,
+                             int nThreads)
+{
+    {
+        QMutexLocker k(&sharedArena->lock);
+        ///Half for the threads, half for the shared free list
+        nThreads = std::max(1, nThreads);
+        std::size_t maxThreadMemory = maxMemory / 2 / nThreads;
+        sharedArena->maxThreadUnits.fetchAndStoreOrdered( (int)(maxThreadMemory / NATRON_IMAGE_ARENA_UNIT) );
+        sharedArena->maxMemory = maxMemory - maxThreadMemory * nThreads;
+    }
+    ///The free lists may hold more than the new maximum
+    clear();
+}
+
+void
+ImageArena::clear()
+{
+    {
+        QMutexLocker k(&sharedArena->lock);
+        freeBlocks(sharedArena->blocks);
+        sharedArena->memory = 0;
+    }
+    ///The threads may be idle for a long time: empty their free lists for them
+    QMutexLocker k(&sharedArena->threadCachesLock);
+    for (std::set<ArenaThreadCache*>::iterator it = sharedArena->threadCaches.begin(); it != sharedArena->threadCaches.end(); ++it) {
+        QMutexLocker c(&(*it)->lock);
+        freeBlocks( (*it)->blocks );
+        (*it)->memory = 0;
+    }
+}
+
+void
+ImageArena::getFreeMemory(std::size_t* threadsMemory,
+                          std::size_t* sharedMemory)
+{
+    {
+        QMutexLocker k(&sharedArena->lock);
+        *sharedMemory = sharedArena->memory;
+    }
+    *threadsMemory = 0;
+    QMutexLocker k(&sharedArena->threadCachesLock);
+    for (std::set<ArenaThreadCache*>::iterator it = sharedArena->threadCaches.begin(); it != sharedArena->threadCaches.end(); ++it) {
+        QMutexLocker c(&(*it)->lock);
+        *threadsMemory += (*it)->memory;
+    }
+}
+
+std::size_t
+ImageArena::getMemoryInUse()
+{
+    return (std::size_t)(int)sharedArena->unitsInUse * NATRON_IMAGE_ARENA_UNIT;
+}
+
+std::size_t
+ImageArena::getPeakMemoryInUse()
+{
+    return (std::size_t)(int)sharedArena->peakUnitsInUse * NATRON_IMAGE_ARENA_UNIT;
+}
+
+NATRON_NAMESPACE_EXIT;
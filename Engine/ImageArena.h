@@ -0,0 +1,93 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_ImageArena_h
+#define Engine_ImageArena_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <cstddef>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief Recycles the buffers of the images that are not held by a cache.
+ *
+ * The intermediate images of a render (images of nodes bypassing the cache, the temporary images used for the mask/mix
+ * and the downscaled renders, the format conversions...) are allocated and freed many times per frame, with the same
+ * few sizes, by all the render threads at once. Going through malloc/free for each of them fragments the heap and makes
+ * the threads contend on the allocator.
+ * The freed buffers are instead kept in free lists by size class (sizes are rounded up to 1/8th of their power of two)
+ * and handed back to the next allocation of the same class:
+ * - each thread has its own free list, whose lock is only contended by clear();
+ * - the buffers that do not fit in it go to a free list shared by all the threads.
+ * All the free lists together never hold more than the maximum memory given to the arena, the rest is freed.
+ * Buffers smaller than a few hundreds of kilobytes are cheap for malloc and are not recycled.
+ *
+ * All the functions are thread-safe. A buffer may be deallocated by another thread than the one that allocated it.
+ **/
+class ImageArena
+{
+public:
+
+    /**
+     * @brief Returns a buffer of at least size bytes. Throws std::bad_alloc if the allocation fails.
+     * If the current thread renders a node with in-depth profiling enabled, the allocation is reported to its RenderStats.
+     **/
+    static void* allocate(std::size_t size);
+
+    /**
+     * @brief Gives back a buffer returned by allocate(size).
+     **/
+    static void deallocate(void* data, std::size_t size);
+
+    /**
+     * @brief Sets the maximum memory held by the free lists, shared between the threads of the given number of threads
+     * and the shared free list. 0 disables the recycling.
+     **/
+    static void setMaximumMemory(std::size_t maxMemory, int nThreads);
+
+    /**
+     * @brief Frees the buffers of all the free lists, those of the threads included.
+     **/
+    static void clear();
+
+    /**
+     * @brief Returns the memory held by the free lists of all the threads, and by the shared free list.
+     **/
+    static void getFreeMemory(std::size_t* threadsMemory, std::size_t* sharedMemory);
+
+    /**
+     * @brief Returns the memory of the recycled buffers currently used by images, and the peak since startup.
+     **/
+    static std::size_t getMemoryInUse();
+    static std::size_t getPeakMemoryInUse();
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_ImageArena_h
@@ -0,0 +1,286 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "ImageConversionCache.h"
+
+#include <map>
+#include <utility>
+
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/weak_ptr.hpp>
+#endif
+
+#include "Engine/Image.h"
+
+NATRON_NAMESPACE_ENTER;
+
+bool
+ImageConversionCache::Key::operator<(const Key& other) const
+{
+    if (bitdepth != other.bitdepth) {
+        return bitdepth < other.bitdepth;
+    }
+    if (mipMapLevel != other.mipMapLevel) {
+        return mipMapLevel < other.mipMapLevel;
+    }
+    if (srcColorSpace != other.srcColorSpace) {
+        return srcColorSpace < other.srcColorSpace;
+    }
+    if (dstColorSpace != other.dstColorSpace) {
+        return dstColorSpace < other.dstColorSpace;
+    }
+    if (channelForAlpha != other.channelForAlpha) {
+        return channelForAlpha < other.channelForAlpha;
+    }
+    if (useAlpha0 != other.useAlpha0) {
+        return !useAlpha0;
+    }
+    if (unPremult != other.unPremult) {
+        return !unPremult;
+    }
+
+    return components < other.components;
+}
+
+namespace {
+struct ConversionEntry
+{
+    ///The image that was converted: the entry is stale once it is released, or if another image got its address
+    boost::weak_ptr<Image> source;
+
+    ///The converted image and the rectangle of the source that was converted in it
+    ImagePtr converted;
+    RectI convertedRect;
+    std::size_t size;
+
+    ///True while a thread is converting, the others wait for it
+    bool converting;
+
+    ///Set if the source was invalidated while converting: the conversion is not kept
+    bool invalidated;
+    U64 lastUse;
+
+    ConversionEntry()
+        : source()
+        , converted()
+        , convertedRect()
+        , size(0)
+        , converting(false)
+        , invalidated(false)
+        , lastUse(0)
+    {
+    }
+};
+
+typedef std::map<std::pair<const Image*, ImageConversionCache::Key>, ConversionEntry> ConversionMap;
+} // anon namespace
+
+struct ImageConversionCachePrivate
+{
+    mutable QMutex lock;
+    QWaitCondition conversionDone;
+    ConversionMap entries;
+    std::size_t maxMemory;
+    std::size_t memory; // sum of the sizes of the converted images held
+    U64 useCounter;
+
+    ImageConversionCachePrivate(std::size_t maxMemory)
+        : lock()
+        , conversionDone()
+        , entries()
+        , maxMemory(maxMemory)
+        , memory(0)
+        , useCounter(0)
+    {
+    }
+
+    void removeEntry(ConversionMap::iterator it)
+    {
+        memory -= it->second.size;
+        entries.erase(it);
+    }
+
+    ///Removes the entries whose source was released and the least recently used ones until the memory fits
+    void trim()
+    {
+        for (ConversionMap::iterator it = entries.begin(); it != entries.end();) {
+            if ( !it->second.converting && it->second.source.expired() ) {
+                ConversionMap::iterator toRemove = it++;
+                removeEntry(toRemove);
+            } else {
+                ++it;
+            }
+        }
+        while (memory > maxMemory) {
+            ConversionMap::iterator lru = entries.end();
+            for (ConversionMap::iterator it = entries.begin(); it != entries.end(); ++it) {
+                if ( !it->second.converting && ( ( lru == entries.end() ) || (it->second.lastUse < lru->second.lastUse) ) ) {
+                    lru = it;
+                }
+            }
+            if ( lru == entries.end() ) {
+                break;
+            }
+            removeEntry(lru);
+        }
+    }
+};
+
+ImageConversionCache::ImageConversionCache(std::size_t maxMemory)
+    : _imp( new ImageConversionCachePrivate(maxMemory) )
+{
+}
+
+ImageConversionCache::~ImageConversionCache()
+{
+}
+
+void
+ImageConversionCache::setMaximumMemory(std::size_t maxMemory)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->maxMemory = maxMemory;
+    _imp->trim();
+}
+
+ImagePtr
+ImageConversionCache::getOrConvert(const ImagePtr& source,
+                                   const Key& key,
+                                   const RectI& rect,
+                                   const ConvertFunctor& convert,
+                                   bool* isShared)
+{
+    assert(source);
+    *isShared = false;
+    if ( rect.isNull() ) {
+        return convert(rect);
+    }
+
+    std::pair<const Image*, Key> mapKey(source.get(), key);
+    RectI rectToConvert = rect;
+    {
+        QMutexLocker k(&_imp->lock);
+        for (;;) {
+            ConversionMap::iterator found = _imp->entries.find(mapKey);
+            if ( found == _imp->entries.end() ) {
+                break;
+            }
+            if (found->second.converting) {
+                ///Another thread is converting this image, its result may cover rect
+                _imp->conversionDone.wait(&_imp->lock);
+                continue;
+            }
+            if (found->second.source.lock() != source) {
+                _imp->removeEntry(found);
+                break;
+            }
+            if ( found->second.convertedRect.contains(rect) ) {
+                found->second.lastUse = ++_imp->useCounter;
+                *isShared = true;
+
+                return found->second.converted;
+            }
+            ///Convert the union so that the entry covers both the previous and the new requests
+            rectToConvert.merge(found->second.convertedRect);
+            _imp->removeEntry(found);
+            break;
+        }
+        ConversionEntry& e = _imp->entries[mapKey];
+        e.source = source;
+        e.converting = true;
+    }
+
+    ImagePtr converted;
+    try {
+        converted = convert(rectToConvert);
+    } catch (...) {
+        QMutexLocker k(&_imp->lock);
+        ConversionMap::iterator found = _imp->entries.find(mapKey);
+        if ( found != _imp->entries.end() ) {
+            _imp->entries.erase(found);
+        }
+        _imp->conversionDone.wakeAll();
+        throw;
+    }
+
+    QMutexLocker k(&_imp->lock);
+    ConversionMap::iterator found = _imp->entries.find(mapKey);
+    assert( found != _imp->entries.end() );
+    if ( found != _imp->entries.end() ) {
+        if (converted && !found->second.invalidated) {
+            found->second.converted = converted;
+            found->second.convertedRect = rectToConvert;
+            found->second.size = converted->size();
+            found->second.converting = false;
+            found->second.lastUse = ++_imp->useCounter;
+            _imp->memory += found->second.size;
+        } else {
+            _imp->entries.erase(found);
+        }
+    }
+    _imp->trim();
+    _imp->conversionDone.wakeAll();
+
+    return converted;
+} // getOrConvert
+
+void
+ImageConversionCache::invalidate(const Image* source)
+{
+    QMutexLocker k(&_imp->lock);
+
+    for (ConversionMap::iterator it = _imp->entries.begin(); it != _imp->entries.end();) {
+        if (it->first.first != source) {
+            ++it;
+        } else if (it->second.converting) {
+            it->second.invalidated = true;
+            ++it;
+        } else {
+            ConversionMap::iterator toRemove = it++;
+            _imp->removeEntry(toRemove);
+        }
+    }
+}
+
+void
+ImageConversionCache::clear()
+{
+    QMutexLocker k(&_imp->lock);
+
+    for (ConversionMap::iterator it = _imp->entries.begin(); it != _imp->entries.end();) {
+        ///Entries being converted are owned by the converting thread
+        if (it->second.converting) {
+            ++it;
+        } else {
+            ConversionMap::iterator toRemove = it++;
+            _imp->removeEntry(toRemove);
+        }
+    }
+}
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,125 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_ImageConversionCache_h
+#define Engine_ImageConversionCache_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+#include "Engine/ImageComponents.h"
+#include "Engine/RectI.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief Shares the conversions of the input images fetched by the effects (bit depth, components or mipmap level).
+ *
+ * When several nodes read the same image from the node cache but process another bit depth or components (e.g 10 nodes
+ * reading a 16-bit plate as float), each getImage() call used to allocate and convert its own copy. The converted image
+ * is now looked up by (source image, conversion) and converted only once, concurrent fetches of the same conversion
+ * wait for the thread converting it instead of doing it again.
+ *
+ * Entries are released as soon as their source image is released by the node cache, and the least recently used ones
+ * are dropped when the converted images exceed the maximum memory given to the cache.
+ * The converted images are shared: callers must not write to them. An image whose pixels are rendered again in place
+ * (e.g the bitmap cleared while painting) must be passed to invalidate() so that its conversions are done again.
+ **/
+struct ImageConversionCachePrivate;
+class ImageConversionCache
+{
+public:
+
+    struct Key
+    {
+        ImageComponents components;
+        ImageBitDepthEnum bitdepth;
+        unsigned int mipMapLevel;
+        ViewerColorSpaceEnum srcColorSpace;
+        ViewerColorSpaceEnum dstColorSpace;
+        int channelForAlpha;
+        bool useAlpha0;
+        bool unPremult;
+
+        Key()
+            : components()
+            , bitdepth(eImageBitDepthNone)
+            , mipMapLevel(0)
+            , srcColorSpace(eViewerColorSpaceLinear)
+            , dstColorSpace(eViewerColorSpaceLinear)
+            , channelForAlpha(-1)
+            , useAlpha0(false)
+            , unPremult(false)
+        {
+        }
+
+        bool operator<(const Key& other) const;
+    };
+
+    /**
+     * @brief Returns a new image in which at least the given rectangle, in pixel coordinates of the source image,
+     * was converted from the source image.
+     **/
+    typedef boost::function<boost::shared_ptr<Image> (const RectI&)> ConvertFunctor;
+
+    ImageConversionCache(std::size_t maxMemory);
+
+    ~ImageConversionCache();
+
+    void setMaximumMemory(std::size_t maxMemory);
+
+    /**
+     * @brief Returns the conversion of the given rectangle of source described by key, calling convert if it was
+     * not already converted. isShared is set to true if the image was converted by a previous call.
+     * rect must be contained in the bounds of source.
+     **/
+    boost::shared_ptr<Image> getOrConvert(const boost::shared_ptr<Image>& source,
+                                          const Key& key,
+                                          const RectI& rect,
+                                          const ConvertFunctor& convert,
+                                          bool* isShared);
+
+    /**
+     * @brief Drops the conversions of source. A conversion of source that is in progress is returned to the thread
+     * converting it but is not shared with the next calls.
+     **/
+    void invalidate(const Image* source);
+
+    void clear();
+
+private:
+
+    boost::scoped_ptr<ImageConversionCachePrivate> _imp;
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_ImageConversionCache_h
@@ -25,6 +25,7 @@
 #include "Image.h"
 
 #include <algorithm> // min, max
+#include <vector>
 
 #include <QDebug>
 #ifndef Q_MOC_RUN
@@ -33,6 +34,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
 GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #endif
 #include "Engine/AppManager.h"
+#include "Engine/ColorSIMD.h"
 #include "Engine/Lut.h"
 
 NATRON_NAMESPACE_ENTER;
@@ -104,6 +106,63 @@ Image::convertPixelDepth(float pix)
     return pix;
 }
 
+namespace {
+///Converts a row with convertPixelDepth() using the vectorized kernels.
+///Returns false if there is no kernel for this pair of depths.
+template <typename SRCPIX,typename DSTPIX>
+bool
+convertPixelDepthRow(const SRCPIX* /*from*/,
+                     DSTPIX* /*to*/,
+                     int /*n*/)
+{
+    return false;
+}
+
+template <>
+bool
+convertPixelDepthRow(const float* from,
+                     unsigned char* to,
+                     int n)
+{
+    Color::floatToByteRow(from, to, n);
+
+    return true;
+}
+
+template <>
+bool
+convertPixelDepthRow(const float* from,
+                     unsigned short* to,
+                     int n)
+{
+    Color::floatToShortRow(from, to, n);
+
+    return true;
+}
+
+template <>
+bool
+convertPixelDepthRow(const unsigned char* from,
+                     float* to,
+                     int n)
+{
+    Color::byteToFloatRow(from, to, n);
+
+    return true;
+}
+
+template <>
+bool
+convertPixelDepthRow(const unsigned short* from,
+                     float* to,
+                     int n)
+{
+    Color::shortToFloatRow(from, to, n);
+
+    return true;
+}
+} // anon namespace
+
 static const Color::Lut*
 lutFromColorspace(ViewerColorSpaceEnum cs)
 {
@@ -158,7 +217,37 @@ Image::convertToFormatInternal_sameComps(const RectI & renderWindow,
     if (intersection.isNull()) {
         return;
     }
+
+    const int rowElements = intersection.width() * nComp;
+
+    ///Without color-space conversion there is no dithering: convert whole rows with the vectorized kernels
+    ///(converting 0 elements only checks whether there is a kernel for these depths)
+    if ( !srcLut && !dstLut && convertPixelDepthRow<SRCPIX, DSTPIX>( (const SRCPIX*)0, (DSTPIX*)0, 0 ) ) {
+        for (int y = 0; y < intersection.height(); ++y) {
+            const SRCPIX* srcRow = (const SRCPIX*)srcImg.pixelAt(intersection.x1, intersection.y1 + y);
+            DSTPIX* dstRow = (DSTPIX*)dstImg.pixelAt(intersection.x1, intersection.y1 + y);
+            convertPixelDepthRow<SRCPIX, DSTPIX>(srcRow, dstRow, rowElements);
+        }
+        if (copyBitmap) {
+            dstImg.copyBitmapPortion(intersection, srcImg);
+        }
+
+        return;
+    }
+
+    ///The look-ups do not depend on the dithering: when possible they are done for the whole row first
+    const bool useSrcLutRow = srcLut && !dstLut && srcDepth == eImageBitDepthByte && dstDepth == eImageBitDepthFloat;
+    const bool useDstLutRow = dstLut && !srcLut && srcDepth == eImageBitDepthFloat && dstDepth == eImageBitDepthByte;
+    std::vector<float> srcLutRow(useSrcLutRow ? rowElements : 0);
+    std::vector<unsigned short> dstLutRow(useDstLutRow ? rowElements : 0);
+
     for (int y = 0; y < intersection.height(); ++y) {
+        if (useSrcLutRow) {
+            srcLut->fromColorSpaceUint8ToLinearFloatFastRow( (const unsigned char*)srcImg.pixelAt(intersection.x1, intersection.y1 + y), &srcLutRow[0], rowElements );
+        } else if (useDstLutRow) {
+            dstLut->toColorSpaceUint8xxFromLinearFloatFastRow( (const float*)srcImg.pixelAt(intersection.x1, intersection.y1 + y), &dstLutRow[0], rowElements, false );
+        }
+
         // coverity[dont_call]
         int start = rand() % intersection.width();
         const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1 + start, intersection.y1 + y);
@@ -184,7 +273,9 @@ Image::convertToFormatInternal_sameComps(const RectI & renderWindow,
                     } else {
                         float pixFloat;
 
-                        if (srcLut) {
+                        if (useSrcLutRow) {
+                            pixFloat = srcLutRow[x * nComp + k];
+                        } else if (srcLut) {
                             if (srcDepth == eImageBitDepthByte) {
                                 pixFloat = srcLut->fromColorSpaceUint8ToLinearFloatFast(srcPixels[k]);
                             } else if (srcDepth == eImageBitDepthShort) {
@@ -198,8 +289,12 @@ Image::convertToFormatInternal_sameComps(const RectI & renderWindow,
 
                         if (dstDepth == eImageBitDepthByte) {
                             ///small increase in perf we use Luts. This should be anyway the most used case.
-                            error[k] = (error[k] & 0xff) + ( dstLut ? dstLut->toColorSpaceUint8xxFromLinearFloatFast(pixFloat) :
-                                                             Color::floatToInt<0xff01>(pixFloat) );
+                            if (useDstLutRow) {
+                                error[k] = (error[k] & 0xff) + dstLutRow[x * nComp + k];
+                            } else {
+                                error[k] = (error[k] & 0xff) + ( dstLut ? dstLut->toColorSpaceUint8xxFromLinearFloatFast(pixFloat) :
+                                                                 Color::floatToInt<0xff01>(pixFloat) );
+                            }
                             pix = error[k] >> 8;
                         } else if (dstDepth == eImageBitDepthShort) {
                             pix = dstLut ? dstLut->toColorSpaceUint16FromLinearFloatFast(pixFloat) :
@@ -230,10 +325,9 @@ Image::convertToFormatInternal_sameComps(const RectI & renderWindow,
             srcPixels = srcStart - nComp;
             dstPixels = dstStart - nComp;
         }
-
-        if (copyBitmap) {
-            dstImg.copyBitmapRowPortion(intersection.x1, intersection.x2, intersection.y1 + y, srcImg);
-        }
+    }
+    if (copyBitmap) {
+        dstImg.copyBitmapPortion(intersection, srcImg);
     }
 } // convertToFormatInternal_sameComps
 
@@ -417,6 +417,34 @@ Interpolation::interpolate(double tcur,
                     double currentTime,
                     KeyframeTypeEnum interp,
                     KeyframeTypeEnum interpNext)
+{
+    // if the following is true, this makes the special case for eKeyframeTypeConstant at tnext useless, and we can always use a cubic - the strict "currentTime < tnext" is the key
+    assert( ( (interp == eKeyframeTypeNone) || (tcur <= currentTime) ) && ( (currentTime < tnext) || (interpNext == eKeyframeTypeNone) ) );
+    double t0, dt;
+    double c[4];
+    getCubicCoefficients(tcur, vcur, vcurDerivRight, vnextDerivLeft, tnext, vnext, interp, interpNext, &t0, &dt, c);
+
+    const double t = (currentTime - t0) / dt;
+    double ret = cubicEval(c[0], c[1], c[2], c[3], t);
+
+    // cubicDerive: divide the result by (tnext-tcur)
+
+    // cubicIntegrate: multiply the result by (tnext-tcur)
+    return ret;
+}
+
+void
+Interpolation::getCubicCoefficients(double tcur,
+                                    const double vcur,
+                                    const double vcurDerivRight,
+                                    const double vnextDerivLeft,
+                                    double tnext,
+                                    const double vnext,
+                                    KeyframeTypeEnum interp,
+                                    KeyframeTypeEnum interpNext,
+                                    double *t0,
+                                    double *dt,
+                                    double c[4])
 {
     double P0 = vcur;
     double P3 = vnext;
@@ -424,8 +452,6 @@ Interpolation::interpolate(double tcur,
     double P0pr = vcurDerivRight * (tnext - tcur); // normalize for x \in [0,1]
     double P3pl = vnextDerivLeft * (tnext - tcur); // normalize for x \in [0,1]
 
-    // if the following is true, this makes the special case for eKeyframeTypeConstant at tnext useless, and we can always use a cubic - the strict "currentTime < tnext" is the key
-    assert( ( (interp == eKeyframeTypeNone) || (tcur <= currentTime) ) && ( (currentTime < tnext) || (interpNext == eKeyframeTypeNone) ) );
     // after the last / before the first keyframe, derivatives are wrt currentTime (i.e. non-normalized)
     if (interp == eKeyframeTypeNone) {
         // virtual previous frame at t-1
@@ -443,16 +469,16 @@ Interpolation::interpolate(double tcur,
         P3 = P0 + P0pr;
         tnext = tcur + 1;
     }
-    double c0, c1, c2, c3;
-    hermiteToCubicCoeffs(P0, P0pr, P3pl, P3, &c0, &c1, &c2, &c3);
-
-    const double t = (currentTime - tcur) / (tnext - tcur);
-    double ret = cubicEval(c0, c1, c2, c3, t);
-
-    // cubicDerive: divide the result by (tnext-tcur)
+    hermiteToCubicCoeffs(P0, P0pr, P3pl, P3, &c[0], &c[1], &c[2], &c[3]);
+    *t0 = tcur;
+    *dt = tnext - tcur;
+}
 
-    // cubicIntegrate: multiply the result by (tnext-tcur)
-    return ret;
+double
+Interpolation::evaluateCubic(const double c[4],
+                             double t)
+{
+    return cubicEval(c[0], c[1], c[2], c[3], t);
 }
 
 /// derive at currentTime. The derivative is with respect to currentTime
@@ -48,6 +48,24 @@ double interpolate(double tcur, const double vcur, //start control point
                    KeyframeTypeEnum interp,
                    KeyframeTypeEnum interpNext) WARN_UNUSED_RETURN;
 
+/**
+ * @brief Computes the cubic used by interpolate() between the two control points: the value at currentTime is
+ * evaluateCubic(c, (currentTime - *t0) / *dt). It does not depend on currentTime, so that it can be computed once for
+ * each segment of a curve.
+ **/
+void getCubicCoefficients(double tcur, const double vcur, //start control point
+                          const double vcurDerivRight, //being the derivative dv/dt at tcur
+                          const double vnextDerivLeft, //being the derivative dv/dt at tnext
+                          double tnext, const double vnext, //end control point
+                          KeyframeTypeEnum interp,
+                          KeyframeTypeEnum interpNext,
+                          double *t0,
+                          double *dt,
+                          double c[4]);
+
+/// evaluate the cubic returned by getCubicCoefficients() at t
+double evaluateCubic(const double c[4], double t) WARN_UNUSED_RETURN;
+
 /// derive at currentTime. The derivative is with respect to currentTime
 double derive(double tcur, const double vcur, //start control point
               const double vcurDerivRight, //being the derivative dv/dt at tcur
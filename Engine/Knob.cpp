@@ -26,6 +26,8 @@
 #include "KnobImpl.h"
 
 #include <algorithm> // min, max
+#include <climits> // INT_MAX
+#include <cmath> // floor, fabs
 #include <stdexcept>
 
 #include <QtCore/QDataStream>
@@ -50,6 +52,7 @@
 #include "Engine/LibraryBinary.h"
 #include "Engine/AppInstance.h"
 #include "Engine/Hash64.h"
+#include "Engine/NativeExpression.h"
 #include "Engine/StringAnimationManager.h"
 #include "Engine/DockablePanelI.h"
 #include "Engine/EngineFwd.h"
@@ -204,9 +207,13 @@ struct Expr
     ///The list of pair<knob, dimension> dpendencies for an expression
     std::list< std::pair<KnobI*,int> > dependencies;
     
-    //PyObject* code;
+    ///The function evaluating the expression, resolved by the first evaluation. New ref, released with the GIL taken
+    PyObject* function;
     
-    Expr() : expression(), originalExpression(), hasRet(false) /*, code(0)*/{}
+    ///The expression compiled to be evaluated without Python, NULL if it does not fit the native grammar
+    boost::shared_ptr<NativeExpression> native;
+    
+    Expr() : expression(), originalExpression(), hasRet(false), function(0), native() {}
 };
 
 
@@ -386,7 +393,21 @@ KnobHelper::KnobHelper(KnobHolder* holder,
 
 KnobHelper::~KnobHelper()
 {
-    
+    ///Release the functions of the expressions, Python may already be finalized when the application quits
+    bool hasFunction = false;
+    for (std::size_t i = 0; i < _imp->expressions.size(); ++i) {
+        if (_imp->expressions[i].function) {
+            hasFunction = true;
+            break;
+        }
+    }
+    if ( hasFunction && Py_IsInitialized() ) {
+        PythonGILLocker pgl;
+        for (std::size_t i = 0; i < _imp->expressions.size(); ++i) {
+            Py_XDECREF(_imp->expressions[i].function); //< new ref
+            _imp->expressions[i].function = 0;
+        }
+    }
 }
 
 void
@@ -1976,6 +1997,12 @@ KnobHelper::setExpressionInternal(int dimension,const std::string& expression,bo
     std::string exprResult;
     std::string exprCpy = validateExpression(expression, dimension, hasRetVariable,&exprResult);
     
+    ///Most expressions are simple arithmetic that can be evaluated by the render threads without waiting for the GIL
+    boost::shared_ptr<NativeExpression> native;
+    if ( !hasRetVariable && !dynamic_cast<const Knob<std::string>*>(this) ) {
+        native = NativeExpression::compile(expression, this, dimension);
+    }
+    
     //Set internal fields
 
     {
@@ -1983,9 +2010,11 @@ KnobHelper::setExpressionInternal(int dimension,const std::string& expression,bo
         _imp->expressions[dimension].hasRet = hasRetVariable;
         _imp->expressions[dimension].expression = exprCpy;
         _imp->expressions[dimension].originalExpression = expression;
+        _imp->expressions[dimension].native = native;
         
-        ///This may throw an exception upon failure
-        //Python::compilePyScript(exprCpy, &_imp->expressions[dimension].code);
+        ///validateExpression() has just defined the function again: resolve it on the next evaluation
+        Py_XDECREF(_imp->expressions[dimension].function); //< new ref
+        _imp->expressions[dimension].function = 0;
     }
   
 
@@ -2066,8 +2095,9 @@ KnobHelper::clearExpression(int dimension,bool clearResults)
         hadExpression = !_imp->expressions[dimension].originalExpression.empty();
         _imp->expressions[dimension].expression.clear();
         _imp->expressions[dimension].originalExpression.clear();
-        //Py_XDECREF(_imp->expressions[dimension].code); //< new ref
-        //_imp->expressions[dimension].code = 0;
+        _imp->expressions[dimension].native.reset();
+        Py_XDECREF(_imp->expressions[dimension].function); //< new ref
+        _imp->expressions[dimension].function = 0;
     }
     {
         std::list<std::pair<KnobI*,int> > dependencies;
@@ -2149,27 +2179,56 @@ KnobHelper::expressionChanged(int dimension)
 PyObject*
 KnobHelper::executeExpression(double time, int dimension) const
 {
-    
     std::string expr;
+    PyObject* function;
     {
         QMutexLocker k(&_imp->expressionMutex);
         expr = _imp->expressions[dimension].expression;
+        function = _imp->expressions[dimension].function;
+        Py_XINCREF(function);
     }
     
-    //returns a new ref, this function's documentation is not clear onto what it returns...
-    //https://docs.python.org/2/c-api/veryhigh.html
     PyObject* mainModule = Python::getMainModule();
-    PyObject* globalDict = PyModule_GetDict(mainModule);
-    
-    std::stringstream ss;
-    ss << expr << '(' << time << ")\n";
-    std::string script = ss.str();
-    PyObject* v = PyRun_String(script.c_str(), Py_file_input, globalDict, 0);
-    Py_XDECREF(v);
     
+    ///The function of the expression is resolved once and kept until the expression changes: calling it
+    ///does not need to parse and compile a script each time
+    if (!function) {
+        ///expr assigns the function to the ret variable, evaluate the right-hand side to get it
+        std::size_t foundAssign = expr.find('=');
+        if (foundAssign != std::string::npos) {
+            PyObject* globalDict = PyModule_GetDict(mainModule);
+            function = PyRun_String(expr.c_str() + foundAssign + 1, Py_eval_input, globalDict, 0); //< new ref
+        }
+        if (function) {
+            QMutexLocker k(&_imp->expressionMutex);
+            Expr& cached = _imp->expressions[dimension];
+            if (!cached.function && cached.expression == expr) {
+                Py_INCREF(function);
+                cached.function = function;
+            }
+        }
+    }
     
+    PyObject* ret = 0;
+    if (function) {
+        ///Integer frames are passed as an int, as they were when the call was formatted in a script
+        PyObject* frame;
+        if ( (time == std::floor(time)) && (std::fabs(time) < (double)INT_MAX) ) {
+#ifndef IS_PYTHON_2
+            frame = PyLong_FromLong( (long)time );
+#else
+            frame = PyInt_FromLong( (long)time );
+#endif
+        } else {
+            frame = PyFloat_FromDouble(time);
+        }
+        ret = PyObject_CallFunctionObjArgs(function, frame, NULL); //< new ref
+        Py_XDECREF(frame);
+        Py_DECREF(function);
+    }
     
-    if (PyErr_Occurred()) {
+    if (!ret || PyErr_Occurred()) {
+        Py_XDECREF(ret);
 #ifdef DEBUG
         PyErr_Print();
         ///Gui session, do stdout, stderr redirection
@@ -2191,20 +2250,24 @@ KnobHelper::executeExpression(double time, int dimension) const
             }
 
         }
-
+#else
+        PyErr_Clear();
 #endif
         throw std::runtime_error("Failed to execute expression");
     }
-    PyObject *ret = PyObject_GetAttrString(mainModule,"ret"); //get our ret variable created above
     
-    if (!ret || PyErr_Occurred()) {
-#ifdef DEBUG
-        PyErr_Print();
-#endif
-        throw std::runtime_error("return value must be assigned to the \"ret\" variable");
-    }
     return ret;
-    
+}
+
+bool
+KnobHelper::executeNativeExpression(double time, int dimension, double* ret) const
+{
+    boost::shared_ptr<NativeExpression> native;
+    {
+        QMutexLocker k(&_imp->expressionMutex);
+        native = _imp->expressions[dimension].native;
+    }
+    return native && native->evaluate(time, ret);
 }
 
 std::string
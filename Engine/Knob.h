@@ -690,6 +690,14 @@ public:
      **/
     virtual bool hasAnimation() const = 0;
 
+    /**
+     * @brief Appends the content of the given dimension to the hash: its keyframes if it is animated, its value otherwise.
+     * Two knobs with the same content append the same data, whatever the edits that led to it.
+     * Returns false if the value is driven by an expression, which may depend on anything: nothing meaningful was appended.
+     * Can only be called by the main thread.
+     **/
+    virtual bool appendToHash(int dimension, Hash64* hash) const = 0;
+
     /**
      * @brief Returns a const ref to the curves held by this knob. This is MT-safe as they're
      * never deleted (except on program exit).
@@ -1320,6 +1328,9 @@ protected:
     
     ///The return value must be Py_DECRREF
     PyObject* executeExpression(double time, int dimension) const;
+    
+    ///Evaluates the expression without Python if it is simple enough, returns false if executeExpression() must be used
+    bool executeNativeExpression(double time, int dimension, double* ret) const;
 
 public:
 
@@ -1696,6 +1707,9 @@ public:
     virtual bool cloneAndCheckIfChanged(KnobI* other,int dimension = -1) OVERRIDE FINAL WARN_UNUSED_RETURN;
     
     virtual bool dequeueValuesSet(bool disableEvaluation) OVERRIDE FINAL;
+
+    ///Overloaded by the knobs holding data that is not in their dimensions, such as the KnobParametric curves
+    virtual bool appendToHash(int dimension, Hash64* hash) const OVERRIDE;
     
     ///MT-safe
     void setMinimum(const T& mini, int dimension = 0);
@@ -1757,6 +1771,8 @@ private:
     }
     
     void makeKeyFrame(Curve* curve,double time,const T& v,KeyFrame* key);
+
+    void appendValueToHash(const T& v, Hash64* hash) const;
     
     void queueSetValue(const T& v,int dimension);
     
@@ -1772,6 +1788,9 @@ public:
     
 private:
     
+    ///Converts the result of executeNativeExpression() as pyObjectToType() would convert the same Python number
+    T nativeResultToType(double v) const;
+    
     T evaluateExpression(double time, int dimension) const;
     
     /*
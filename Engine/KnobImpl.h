@@ -28,6 +28,7 @@
 #include "Knob.h"
 
 #include <cfloat>
+#include <climits> // INT_MIN, INT_MAX
 #include <stdexcept>
 #include <string>
 #include <algorithm> // min, max
@@ -54,6 +55,7 @@ GCC_DIAG_ON(unused-parameter)
 #include "Engine/AppInstance.h"
 #include "Engine/Project.h"
 #include "Engine/EffectInstance.h"
+#include "Engine/Hash64.h"
 #include "Engine/KnobTypes.h"
 #include "Engine/EngineFwd.h"
 
@@ -386,9 +388,53 @@ inline unsigned int hashFunction(unsigned int a)
     return a;
 }
 
+template <>
+int
+Knob<int>::nativeResultToType(double v) const
+{
+    ///Converting a double that does not fit in an int is undefined
+    if ( (boost::math::isnan)(v) ) {
+        return 0;
+    } else if (v >= (double)INT_MAX) {
+        return INT_MAX;
+    } else if (v <= (double)INT_MIN) {
+        return INT_MIN;
+    }
+
+    return (int)v;
+}
+
+template <>
+bool
+Knob<bool>::nativeResultToType(double v) const
+{
+    return v != 0.;
+}
+
+template <>
+double
+Knob<double>::nativeResultToType(double v) const
+{
+    return v;
+}
+
+template <>
+std::string
+Knob<std::string>::nativeResultToType(double /*v*/) const
+{
+    ///String expressions are never evaluated natively
+    assert(false);
+    return std::string();
+}
+
 template <typename T>
 T Knob<T>::evaluateExpression(double time, int dimension) const
 {
+    double nativeRet;
+    if (executeNativeExpression(time, dimension, &nativeRet)) {
+        return nativeResultToType(nativeRet);
+    }
+    
     PythonGILLocker pgl;
     PyObject *ret;
     
@@ -409,6 +455,11 @@ template <typename T>
 double
 Knob<T>::evaluateExpression_pod(double time, int dimension) const
 {
+    double nativeRet;
+    if (executeNativeExpression(time, dimension, &nativeRet)) {
+        return nativeRet;
+    }
+    
     PythonGILLocker pgl;
     PyObject *ret;
     
@@ -1158,6 +1209,64 @@ Knob<std::string>::makeKeyFrame(Curve* /*curve*/,double time,const std::string&
     *key = KeyFrame( (double)time,keyFrameValue );
 }
 
+template <typename T>
+void
+Knob<T>::appendValueToHash(const T& v, Hash64* hash) const
+{
+    hash->append(v);
+}
+
+template <>
+void
+Knob<std::string>::appendValueToHash(const std::string& v, Hash64* hash) const
+{
+    Hash64_appendQString( hash, QString::fromUtf8( v.c_str() ) );
+}
+
+template <typename T>
+bool
+Knob<T>::appendToHash(int dimension, Hash64* hash) const
+{
+    assert( QThread::currentThread() == qApp->thread() );
+    assert(dimension >= 0 && dimension < getDimension());
+
+    if ( !getExpression(dimension).empty() ) {
+        return false;
+    }
+
+    ///A slave has the content of its master
+    std::pair<int,boost::shared_ptr<KnobI> > master = getMaster(dimension);
+    if (master.second) {
+        return master.second->appendToHash(master.first, hash);
+    }
+
+    ///Same curve as the one getValue() reads in the main thread
+    boost::shared_ptr<Curve> curve = getGuiCurve(dimension);
+    if (!curve) {
+        curve = getCurve(dimension);
+    }
+    KeyFrameSet keys;
+    if (curve) {
+        keys = curve->getKeyFrames_mt_safe();
+    }
+    hash->append( (U64)keys.size() );
+    if ( keys.empty() ) {
+        appendValueToHash(getValue(dimension), hash);
+
+        return true;
+    }
+    for (KeyFrameSet::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        hash->append( it->getTime() );
+        hash->append( (int)it->getInterpolation() );
+        hash->append( it->getLeftDerivative() );
+        hash->append( it->getRightDerivative() );
+        ///The value of a string keyframe is an index in a table of strings: append the string itself
+        appendValueToHash(getValueAtTime(it->getTime(), dimension), hash);
+    }
+
+    return true;
+}
+
 template<typename T>
 bool
 Knob<T>::setValueAtTime(double time,
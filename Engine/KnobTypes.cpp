@@ -44,6 +44,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/Curve.h"
 #include "Engine/EffectInstance.h"
 #include "Engine/Format.h"
+#include "Engine/Hash64.h"
 #include "Engine/Image.h"
 #include "Engine/KnobFile.h"
 #include "Engine/KnobSerialization.h"
@@ -1749,6 +1750,27 @@ KnobParametric::cloneExtraData(KnobI* other,
     }
 }
 
+bool
+KnobParametric::appendToHash(int dimension,
+                             Hash64* hash) const
+{
+    if ( !Knob<double>::appendToHash(dimension, hash) ) {
+        return false;
+    }
+    ///The parametric curve is the actual content of the knob
+    KeyFrameSet keys = getParametricCurve(dimension)->getKeyFrames_mt_safe();
+    hash->append( (U64)keys.size() );
+    for (KeyFrameSet::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        hash->append( it->getTime() );
+        hash->append( it->getValue() );
+        hash->append( (int)it->getInterpolation() );
+        hash->append( it->getLeftDerivative() );
+        hash->append( it->getRightDerivative() );
+    }
+
+    return true;
+}
+
 void
 KnobParametric::saveParametricCurves(std::list< Curve >* curves) const
 {
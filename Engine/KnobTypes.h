@@ -913,6 +913,7 @@ private:
     virtual void cloneExtraData(KnobI* other,int dimension = -1) OVERRIDE FINAL;
     virtual bool cloneExtraDataAndCheckIfChanged(KnobI* other,int dimension = -1) OVERRIDE FINAL;
     virtual void cloneExtraData(KnobI* other, double offset, const RangeD* range,int dimension = -1) OVERRIDE FINAL;
+    virtual bool appendToHash(int dimension, Hash64* hash) const OVERRIDE FINAL;
     static const std::string _typeNameStr;
 };
 
@@ -27,7 +27,9 @@
 #include <cstring> // for memcpy
 #include <algorithm> // min, max
 #include <stdexcept>
+#include <vector>
 
+#include "Engine/ColorSIMD.h"
 #include "Engine/RectI.h"
 
 /*
@@ -316,6 +318,27 @@ Lut::fromColorSpaceUint16ToLinearFloatFast(unsigned short v) const
     return v32f_prev + (v - v16u_prev) * (v32f_next - v32f_prev) / (v16u_next - v16u_prev);
 }
 
+void
+Lut::fromColorSpaceUint8ToLinearFloatFastRow(const unsigned char* from,
+                                             float* to,
+                                             int n) const
+{
+    assert(init_);
+
+    lookupUint8ToFloatRow(fromFunc_uint8_to_float, from, to, n);
+}
+
+void
+Lut::toColorSpaceUint8xxFromLinearFloatFastRow(const float* from,
+                                               unsigned short* to,
+                                               int n,
+                                               bool premultRGBA) const
+{
+    assert(init_);
+
+    lookupHipartRow(toFunc_hipart_to_uint8xx, from, to, n, premultRGBA);
+}
+
 void
 Lut::fillTables() const
 {
@@ -328,6 +351,7 @@ Lut::fillTables() const
         float f = _toFunc(inp);
         toFunc_hipart_to_uint8xx[i] = Color::floatToInt<0xff01>(f);
     }
+    toFunc_hipart_to_uint8xx[0x10000] = 0;
     // fill fromFunc_uint8_to_float, and make sure that
     // the entries of toFunc_hipart_to_uint8xx corresponding
     // to the transform of each byte value contain the same value,
@@ -459,6 +483,9 @@ Lut::to_byte_packed(unsigned char* to,
 
     validate();
 
+    ///The look-ups do not depend on the dithering, they are done for the whole row first
+    std::vector<unsigned short> lutRow( (rect.x2 - rect.x1) * inPackingSize );
+
     for (int y = rect.y1; y < rect.y2; ++y) {
         // coverity[dont_call]
         int start = rand() % (rect.x2 - rect.x1) + rect.x1;
@@ -473,14 +500,16 @@ Lut::to_byte_packed(unsigned char* to,
         int dstY = dstBounds.y2 - y - 1;
         const float *src_pixels = from + (srcY * (srcBounds.x2 - srcBounds.x1) * inPackingSize);
         unsigned char *dst_pixels = to + (dstY * (dstBounds.x2 - dstBounds.x1) * outPackingSize);
+        toColorSpaceUint8xxFromLinearFloatFastRow(src_pixels + rect.x1 * inPackingSize, &lutRow[0], (int)lutRow.size(), inputHasAlpha && premult);
         /* go fowards from starting point to end of line: */
         for (int x = start; x < rect.x2; ++x) {
             int inCol = x * inPackingSize;
             int outCol = x * outPackingSize;
             float a = (inputHasAlpha && premult) ? src_pixels[inCol + inAOffset] : 1.f;
-            error_r = (error_r & 0xff) + toFunc_hipart_to_uint8xx[hipart(src_pixels[inCol + inROffset] * a)];
-            error_g = (error_g & 0xff) + toFunc_hipart_to_uint8xx[hipart(src_pixels[inCol + inGOffset] * a)];
-            error_b = (error_b & 0xff) + toFunc_hipart_to_uint8xx[hipart(src_pixels[inCol + inBOffset] * a)];
+            int lutCol = (x - rect.x1) * inPackingSize;
+            error_r = (error_r & 0xff) + lutRow[lutCol + inROffset];
+            error_g = (error_g & 0xff) + lutRow[lutCol + inGOffset];
+            error_b = (error_b & 0xff) + lutRow[lutCol + inBOffset];
             assert(error_r < 0x10000 && error_g < 0x10000 && error_b < 0x10000);
             dst_pixels[outCol + outROffset] = (unsigned char)(error_r >> 8);
             dst_pixels[outCol + outGOffset] = (unsigned char)(error_g >> 8);
@@ -496,9 +525,10 @@ Lut::to_byte_packed(unsigned char* to,
             int inCol = x * inPackingSize;
             int outCol = x * outPackingSize;
             float a = (inputHasAlpha && premult) ? src_pixels[inCol + inAOffset] : 1.f;
-            error_r = (error_r & 0xff) + toFunc_hipart_to_uint8xx[hipart(src_pixels[inCol + inROffset] * a)];
-            error_g = (error_g & 0xff) + toFunc_hipart_to_uint8xx[hipart(src_pixels[inCol + inGOffset] * a)];
-            error_b = (error_b & 0xff) + toFunc_hipart_to_uint8xx[hipart(src_pixels[inCol + inBOffset] * a)];
+            int lutCol = (x - rect.x1) * inPackingSize;
+            error_r = (error_r & 0xff) + lutRow[lutCol + inROffset];
+            error_g = (error_g & 0xff) + lutRow[lutCol + inGOffset];
+            error_b = (error_b & 0xff) + lutRow[lutCol + inBOffset];
             assert(error_r < 0x10000 && error_g < 0x10000 && error_b < 0x10000);
             dst_pixels[outCol + outROffset] = (unsigned char)(error_r >> 8);
             dst_pixels[outCol + outGOffset] = (unsigned char)(error_g >> 8);
@@ -669,6 +699,13 @@ Lut::from_byte_packed(float* to,
     outPackingSize = outputHasAlpha ? 4 : 3;
 
     validate();
+
+    ///Without premultiplication, the look-ups are done for the whole row first
+    std::vector<float> lutRow;
+    if ( !(inputHasAlpha && premult) ) {
+        lutRow.resize( (rect.x2 - rect.x1) * inPackingSize );
+    }
+
     for (int y = rect.y1; y < rect.y2; ++y) {
         int srcY = y;
         if (invertY) {
@@ -677,6 +714,9 @@ Lut::from_byte_packed(float* to,
 
         const unsigned char *src_pixels = from + (srcY * (srcBounds.x2 - srcBounds.x1) * inPackingSize);
         float *dst_pixels = to + (y * (dstBounds.x2 - dstBounds.x1) * outPackingSize);
+        if ( !lutRow.empty() ) {
+            fromColorSpaceUint8ToLinearFloatFastRow(src_pixels + rect.x1 * inPackingSize, &lutRow[0], (int)lutRow.size());
+        }
         for (int x = rect.x1; x < rect.x2; ++x) {
             int inCol = x * inPackingSize;
             int outCol = x * outPackingSize;
@@ -697,14 +737,10 @@ Lut::from_byte_packed(float* to,
                     dst_pixels[outCol + outAOffset] = a;
                 }
             } else {
-                int r8 = 0, g8 = 0, b8 = 0;
-                r8 = src_pixels[inCol + inROffset];
-                g8 = src_pixels[inCol + inGOffset];
-                b8 = src_pixels[inCol + inBOffset];
-                assert(r8 >= 0 && r8 < 256 && g8 >= 0 && g8 < 256 && b8 >= 0 && b8 < 256);
-                dst_pixels[outCol + outROffset] = fromFunc_uint8_to_float[r8];
-                dst_pixels[outCol + outGOffset] = fromFunc_uint8_to_float[g8];
-                dst_pixels[outCol + outBOffset] = fromFunc_uint8_to_float[b8];
+                int lutCol = (x - rect.x1) * inPackingSize;
+                dst_pixels[outCol + outROffset] = lutRow[lutCol + inROffset];
+                dst_pixels[outCol + outGOffset] = lutRow[lutCol + inGOffset];
+                dst_pixels[outCol + outBOffset] = lutRow[lutCol + inBOffset];
                 if (outputHasAlpha) {
                     // alpha is linear
                     float a = Color::intToFloat<256>(src_pixels[inCol + inAOffset]);
@@ -764,6 +800,12 @@ Lut::from_float_packed(float* to,
 
     validate();
 
+    ///Unpremultiply the whole row first
+    std::vector<float> unpremultRow;
+    if (inputHasAlpha && premult) {
+        unpremultRow.resize( (rect.x2 - rect.x1) * 4 );
+    }
+
     for (int y = rect.y1; y < rect.y2; ++y) {
         int srcY = y;
         if (invertY) {
@@ -771,16 +813,20 @@ Lut::from_float_packed(float* to,
         }
         const float *src_pixels = from + (srcY * (srcBounds.x2 - srcBounds.x1) * inPackingSize);
         float *dst_pixels = to + (y * (dstBounds.x2 - dstBounds.x1) * outPackingSize);
+        // without premultiplication, the source is read directly
+        const float* unpremult_pixels = src_pixels + rect.x1 * inPackingSize;
+        if ( !unpremultRow.empty() ) {
+            unpremultRGBARow(src_pixels + rect.x1 * 4, &unpremultRow[0], rect.x2 - rect.x1);
+            unpremult_pixels = &unpremultRow[0];
+        }
         for (int x = rect.x1; x < rect.x2; ++x) {
             int inCol = x * inPackingSize;
             int outCol = x * outPackingSize;
             float a = (inputHasAlpha && premult) ? src_pixels[inCol + inAOffset] : 1.f;;
-            float rf = 0., gf = 0., bf = 0.;
-            if (a > 0.) {
-                rf = src_pixels[inCol + inROffset] / a;
-                gf = src_pixels[inCol + inGOffset] / a;
-                bf = src_pixels[inCol + inBOffset] / a;
-            }
+            int unpremultCol = (x - rect.x1) * inPackingSize;
+            float rf = unpremult_pixels[unpremultCol + inROffset];
+            float gf = unpremult_pixels[unpremultCol + inGOffset];
+            float bf = unpremult_pixels[unpremultCol + inBOffset];
             dst_pixels[outCol + outROffset] = fromColorSpaceFloatToLinearFloat(rf) * a;
             dst_pixels[outCol + outGOffset] = fromColorSpaceFloatToLinearFloat(gf) * a;
             dst_pixels[outCol + outBOffset] = fromColorSpaceFloatToLinearFloat(bf) * a;
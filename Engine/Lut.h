@@ -132,7 +132,9 @@ class Lut
 
     /// the fast lookup tables are mutable, because they are automatically initialized post-construction,
     /// and never change afterwards
-    mutable unsigned short toFunc_hipart_to_uint8xx[0x10000];         /// contains  2^16 = 65536 values between 0-255
+    /// contains  2^16 = 65536 values between 0-255, plus one entry of padding so that the vectorized
+    /// look-ups can read it with 32-bit gathers (@see Color::lookupHipartRow)
+    mutable unsigned short toFunc_hipart_to_uint8xx[0x10000 + 1];
     mutable float fromFunc_uint8_to_float[256];         /// values between 0-1.f
     mutable bool init_;         ///< false if the tables are not yet initialized
     mutable QMutex _lock;         ///< protects init_
@@ -225,6 +227,15 @@ public:
      */
     float fromColorSpaceUint16ToLinearFloatFast(unsigned short v) const;
 
+    /* @brief Same as fromColorSpaceUint8ToLinearFloatFast() on n contiguous values, vectorized if the CPU allows it.
+     */
+    void fromColorSpaceUint8ToLinearFloatFastRow(const unsigned char* from, float* to, int n) const;
+
+    /* @brief Same as toColorSpaceUint8xxFromLinearFloatFast() on n contiguous values, vectorized if the CPU allows it.
+     * If premultRGBA is true, from contains RGBA pixels whose color channels are multiplied by alpha first.
+     */
+    void toColorSpaceUint8xxFromLinearFloatFastRow(const float* from, unsigned short* to, int n, bool premultRGBA) const;
+
 
     /////@TODO the following functions expects a float input buffer, one could extend it to cover all bitdepths.
 
@@ -0,0 +1,1211 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "NativeExpression.h"
+
+#include <cctype> // isdigit, isalpha, isalnum
+#include <cmath>
+#include <cstdlib> // strtod
+#include <set>
+#include <vector>
+
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/math/special_functions/sign.hpp> // copysign
+
+#include "Engine/AppInstance.h"
+#include "Engine/EffectInstance.h"
+#include "Engine/Knob.h"
+#include "Engine/KnobTypes.h"
+#include "Engine/Node.h"
+#include "Engine/NodeGroup.h"
+#include "Engine/Project.h"
+
+///The deepest stack an expression may need, deeper expressions are left to Python
+#define NATRON_NATIVE_EXPRESSION_MAX_STACK 32
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+enum NativeOpEnum
+{
+    eNativeOpPushConstant = 0,
+    eNativeOpPushFrame,
+    eNativeOpAdd,
+    eNativeOpSubtract,
+    eNativeOpMultiply,
+    eNativeOpDivide,
+    eNativeOpFloorDivide,
+    eNativeOpModulo,
+    eNativeOpPower,
+    eNativeOpNegate,
+    eNativeOpCall,
+    eNativeOpKnobValue
+};
+
+enum NativeFunctionEnum
+{
+    eNativeFunctionAbs = 0,
+    eNativeFunctionMin,
+    eNativeFunctionMax,
+    eNativeFunctionInt,
+    eNativeFunctionFloat,
+    eNativeFunctionSin,
+    eNativeFunctionCos,
+    eNativeFunctionTan,
+    eNativeFunctionAsin,
+    eNativeFunctionAcos,
+    eNativeFunctionAtan,
+    eNativeFunctionAtan2,
+    eNativeFunctionSinh,
+    eNativeFunctionCosh,
+    eNativeFunctionTanh,
+    eNativeFunctionExp,
+    eNativeFunctionLog,
+    eNativeFunctionLog10,
+    eNativeFunctionSqrt,
+    eNativeFunctionPow,
+    eNativeFunctionFabs,
+    eNativeFunctionFloor,
+    eNativeFunctionCeil,
+    eNativeFunctionFmod,
+    eNativeFunctionHypot,
+    eNativeFunctionDegrees,
+    eNativeFunctionRadians
+};
+
+struct NativeFunction
+{
+    const char* name;
+    NativeFunctionEnum function;
+    int minArgs;
+    int maxArgs; // -1: any number
+};
+
+///The builtins and the functions of the math module that are available in expressions (Natron does "from math import *")
+const NativeFunction nativeFunctions[] = {
+    { "abs", eNativeFunctionAbs, 1, 1 },
+    { "min", eNativeFunctionMin, 2, -1 },
+    { "max", eNativeFunctionMax, 2, -1 },
+    { "int", eNativeFunctionInt, 1, 1 },
+    { "float", eNativeFunctionFloat, 1, 1 },
+    { "sin", eNativeFunctionSin, 1, 1 },
+    { "cos", eNativeFunctionCos, 1, 1 },
+    { "tan", eNativeFunctionTan, 1, 1 },
+    { "asin", eNativeFunctionAsin, 1, 1 },
+    { "acos", eNativeFunctionAcos, 1, 1 },
+    { "atan", eNativeFunctionAtan, 1, 1 },
+    { "atan2", eNativeFunctionAtan2, 2, 2 },
+    { "sinh", eNativeFunctionSinh, 1, 1 },
+    { "cosh", eNativeFunctionCosh, 1, 1 },
+    { "tanh", eNativeFunctionTanh, 1, 1 },
+    { "exp", eNativeFunctionExp, 1, 1 },
+    { "log", eNativeFunctionLog, 1, 2 },
+    { "log10", eNativeFunctionLog10, 1, 1 },
+    { "sqrt", eNativeFunctionSqrt, 1, 1 },
+    { "pow", eNativeFunctionPow, 2, 2 },
+    { "fabs", eNativeFunctionFabs, 1, 1 },
+    { "floor", eNativeFunctionFloor, 1, 1 },
+    { "ceil", eNativeFunctionCeil, 1, 1 },
+    { "fmod", eNativeFunctionFmod, 2, 2 },
+    { "hypot", eNativeFunctionHypot, 2, 2 },
+    { "degrees", eNativeFunctionDegrees, 1, 1 },
+    { "radians", eNativeFunctionRadians, 1, 1 },
+};
+
+struct NativeInstruction
+{
+    NativeOpEnum op;
+    double value; // eNativeOpPushConstant
+    bool isInt; // eNativeOpPushConstant
+    NativeFunctionEnum function; // eNativeOpCall
+    int nArgs; // eNativeOpCall
+    int knob; // eNativeOpKnobValue: index in the knobs of the expression
+    int dimension; // eNativeOpKnobValue: -1 if it is on the stack
+    bool atTime; // eNativeOpKnobValue: the time is on the stack, below the dimension
+
+    NativeInstruction(NativeOpEnum op)
+        : op(op)
+        , value(0.)
+        , isInt(false)
+        , function(eNativeFunctionAbs)
+        , nArgs(0)
+        , knob(-1)
+        , dimension(0)
+        , atTime(false)
+    {
+    }
+};
+
+enum NativeKnobTypeEnum
+{
+    eNativeKnobTypeInt = 0,
+    eNativeKnobTypeDouble,
+    eNativeKnobTypeBool
+};
+
+struct NativeKnob
+{
+    boost::weak_ptr<KnobI> knob;
+    ///The nodes found along the script-name path of the knob: Python no longer finds it once one of them is deleted,
+    ///even if it is kept alive to be restored by an undo
+    std::vector< boost::weak_ptr<Node> > nodes;
+    NativeKnobTypeEnum type;
+    int nDims;
+};
+
+///A number as Python sees it
+struct NativeValue
+{
+    double v;
+    bool isInt;
+};
+
+bool
+isFinite(double v)
+{
+    return !(boost::math::isnan)(v) && !(boost::math::isinf)(v);
+}
+
+///Python raises an error when a math function returns NaN or infinity from finite arguments
+bool
+checkMathResult(double result,
+                const NativeValue* args,
+                int nArgs)
+{
+    if ( isFinite(result) ) {
+        return true;
+    }
+    for (int i = 0; i < nArgs; ++i) {
+        if ( !isFinite(args[i].v) ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+///Same computation as CPython's float floor division, so that the results match when a/b is not exact
+///(e.g 1 // 0.1 is 9.0, floor(1 / 0.1) is 10)
+double
+pythonFloorDivide(double a,
+                  double b)
+{
+    double mod = std::fmod(a, b);
+    double div = (a - mod) / b;
+
+    if ( (mod != 0.) && ( (b < 0.) != (mod < 0.) ) ) {
+        div -= 1.;
+    }
+    if (div == 0.) {
+        return boost::math::copysign(0., a / b);
+    }
+    double floorDiv = std::floor(div);
+    if (div - floorDiv > 0.5) {
+        floorDiv += 1.;
+    }
+
+    return floorDiv;
+}
+
+///The result has the sign of b, as in Python
+double
+pythonModulo(double a,
+             double b)
+{
+    double r = std::fmod(a, b);
+
+    if (r == 0.) {
+        return boost::math::copysign(0., b);
+    }
+    if ( (r < 0.) != (b < 0.) ) {
+        r += b;
+    }
+
+    return r;
+}
+
+///Returns false if Python would raise an error
+bool
+applyBinaryOp(NativeOpEnum op,
+              const NativeValue& a,
+              const NativeValue& b,
+              NativeValue* ret)
+{
+    bool bothInts = a.isInt && b.isInt;
+
+    switch (op) {
+    case eNativeOpAdd:
+        ret->v = a.v + b.v;
+        ret->isInt = bothInts;
+        break;
+    case eNativeOpSubtract:
+        ret->v = a.v - b.v;
+        ret->isInt = bothInts;
+        break;
+    case eNativeOpMultiply:
+        ret->v = a.v * b.v;
+        ret->isInt = bothInts;
+        break;
+    case eNativeOpDivide:
+        if (b.v == 0.) {
+            return false;
+        }
+#ifdef IS_PYTHON_2
+        ///Integer division in Python 2
+        if (bothInts) {
+            ret->v = pythonFloorDivide(a.v, b.v);
+            ret->isInt = true;
+            if (ret->v == 0.) {
+                ///Integers have no negative zero
+                ret->v = 0.;
+            }
+            break;
+        }
+#endif
+        ret->v = a.v / b.v;
+        ret->isInt = false;
+        break;
+    case eNativeOpFloorDivide:
+        if (b.v == 0.) {
+            return false;
+        }
+        ret->v = pythonFloorDivide(a.v, b.v);
+        ret->isInt = bothInts;
+        if (bothInts && ret->v == 0.) {
+            ret->v = 0.;
+        }
+        break;
+    case eNativeOpModulo:
+        if (b.v == 0.) {
+            return false;
+        }
+        ret->v = pythonModulo(a.v, b.v);
+        ret->isInt = bothInts;
+        if (bothInts && ret->v == 0.) {
+            ret->v = 0.;
+        }
+        break;
+    case eNativeOpPower:
+        if ( (a.v == 0.) && (b.v < 0.) ) {
+            return false;
+        }
+        if ( (a.v < 0.) && (b.v != std::floor(b.v)) ) {
+            return false;
+        }
+        ret->v = std::pow(a.v, b.v);
+        ret->isInt = bothInts && b.v >= 0.;
+        if ( isFinite(a.v) && isFinite(b.v) && !isFinite(ret->v) ) {
+            return false;
+        }
+        break;
+    default:
+        assert(false);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool
+applyFunction(NativeFunctionEnum function,
+              const NativeValue* args,
+              int nArgs,
+              NativeValue* ret)
+{
+    ret->isInt = false;
+    switch (function) {
+    case eNativeFunctionAbs:
+        ret->v = std::fabs(args[0].v);
+        ret->isInt = args[0].isInt;
+
+        return true;
+    case eNativeFunctionMin:
+    case eNativeFunctionMax: {
+        ///The first of the extreme values is returned, with its type
+        *ret = args[0];
+        for (int i = 1; i < nArgs; ++i) {
+            if ( (function == eNativeFunctionMin) ? (args[i].v < ret->v) : (args[i].v > ret->v) ) {
+                *ret = args[i];
+            }
+        }
+
+        return true;
+    }
+    case eNativeFunctionInt:
+        if ( !isFinite(args[0].v) ) {
+            return false;
+        }
+        ret->v = args[0].v < 0. ? std::ceil(args[0].v) : std::floor(args[0].v);
+        ret->isInt = true;
+
+        return true;
+    case eNativeFunctionFloat:
+        ret->v = args[0].v;
+
+        return true;
+    case eNativeFunctionSin:
+        ret->v = std::sin(args[0].v);
+        break;
+    case eNativeFunctionCos:
+        ret->v = std::cos(args[0].v);
+        break;
+    case eNativeFunctionTan:
+        ret->v = std::tan(args[0].v);
+        break;
+    case eNativeFunctionAsin:
+        ret->v = std::asin(args[0].v);
+        break;
+    case eNativeFunctionAcos:
+        ret->v = std::acos(args[0].v);
+        break;
+    case eNativeFunctionAtan:
+        ret->v = std::atan(args[0].v);
+        break;
+    case eNativeFunctionAtan2:
+        ret->v = std::atan2(args[0].v, args[1].v);
+        break;
+    case eNativeFunctionSinh:
+        ret->v = std::sinh(args[0].v);
+        break;
+    case eNativeFunctionCosh:
+        ret->v = std::cosh(args[0].v);
+        break;
+    case eNativeFunctionTanh:
+        ret->v = std::tanh(args[0].v);
+        break;
+    case eNativeFunctionExp:
+        ret->v = std::exp(args[0].v);
+        break;
+    case eNativeFunctionLog:
+        if ( (args[0].v <= 0.) || ( (nArgs == 2) && (args[1].v <= 0.) ) ) {
+            return false;
+        }
+        ret->v = std::log(args[0].v);
+        if (nArgs == 2) {
+            double logBase = std::log(args[1].v);
+            if (logBase == 0.) {
+                return false;
+            }
+            ret->v /= logBase;
+        }
+        break;
+    case eNativeFunctionLog10:
+        if (args[0].v <= 0.) {
+            return false;
+        }
+        ret->v = std::log10(args[0].v);
+        break;
+    case eNativeFunctionSqrt:
+        ret->v = std::sqrt(args[0].v);
+        break;
+    case eNativeFunctionPow:
+        if ( (args[0].v == 0.) && (args[1].v < 0.) ) {
+            return false;
+        }
+        ret->v = std::pow(args[0].v, args[1].v);
+        break;
+    case eNativeFunctionFabs:
+        ret->v = std::fabs(args[0].v);
+        break;
+    case eNativeFunctionFloor:
+    case eNativeFunctionCeil:
+        if ( !isFinite(args[0].v) ) {
+            return false;
+        }
+        ret->v = function == eNativeFunctionFloor ? std::floor(args[0].v) : std::ceil(args[0].v);
+#ifndef IS_PYTHON_2
+        ///They return an int since Python 3
+        ret->isInt = true;
+#endif
+
+        return true;
+    case eNativeFunctionFmod:
+        if (args[1].v == 0.) {
+            return false;
+        }
+        ret->v = std::fmod(args[0].v, args[1].v);
+        break;
+    case eNativeFunctionHypot:
+        ///Does not overflow nor underflow in the intermediate squares
+        ret->v = ::hypot(args[0].v, args[1].v);
+        break;
+    case eNativeFunctionDegrees:
+        ///The constants are rounded as in CPython
+        ret->v = args[0].v * (180. / M_PI);
+        break;
+    case eNativeFunctionRadians:
+        ret->v = args[0].v * (M_PI / 180.);
+        break;
+    }
+
+    return checkMathResult(ret->v, args, nArgs);
+}
+
+enum NativeTokenEnum
+{
+    eNativeTokenEnd = 0,
+    eNativeTokenNumber,
+    eNativeTokenName,
+    eNativeTokenOperator
+};
+
+struct NativeToken
+{
+    NativeTokenEnum type;
+    std::string text;
+    double number;
+    bool isInt;
+};
+
+///Returns false if the expression has characters that are not part of the grammar
+bool
+tokenize(const std::string& expression,
+         std::vector<NativeToken>* tokens)
+{
+    std::size_t i = 0;
+
+    while ( i < expression.size() ) {
+        char c = expression[i];
+        if ( (c == ' ') || (c == '\t') ) {
+            ++i;
+            continue;
+        }
+        NativeToken token;
+        token.number = 0.;
+        token.isInt = false;
+        if ( std::isdigit( (unsigned char)c ) || ( (c == '.') && ( i + 1 < expression.size() ) && std::isdigit( (unsigned char)expression[i + 1] ) ) ) {
+            std::size_t start = i;
+            bool isInt = true;
+            while ( i < expression.size() && std::isdigit( (unsigned char)expression[i] ) ) {
+                ++i;
+            }
+            if ( ( i < expression.size() ) && (expression[i] == '.') ) {
+                isInt = false;
+                ++i;
+                while ( i < expression.size() && std::isdigit( (unsigned char)expression[i] ) ) {
+                    ++i;
+                }
+            }
+            if ( ( i < expression.size() ) && ( (expression[i] == 'e') || (expression[i] == 'E') ) ) {
+                isInt = false;
+                ++i;
+                if ( ( i < expression.size() ) && ( (expression[i] == '+') || (expression[i] == '-') ) ) {
+                    ++i;
+                }
+                if ( ( i >= expression.size() ) || !std::isdigit( (unsigned char)expression[i] ) ) {
+                    return false;
+                }
+                while ( i < expression.size() && std::isdigit( (unsigned char)expression[i] ) ) {
+                    ++i;
+                }
+            }
+            ///Suffixes (1L, 1j) and octal literals have other meanings
+            if ( ( i < expression.size() ) && ( std::isalnum( (unsigned char)expression[i] ) || (expression[i] == '_') ) ) {
+                return false;
+            }
+            token.text = expression.substr(start, i - start);
+            if ( isInt && (token.text.size() > 1) && (token.text[0] == '0') ) {
+                return false;
+            }
+            token.type = eNativeTokenNumber;
+            token.number = std::strtod(token.text.c_str(), 0);
+            token.isInt = isInt;
+        } else if ( std::isalpha( (unsigned char)c ) || (c == '_') ) {
+            std::size_t start = i;
+            while ( i < expression.size() && ( std::isalnum( (unsigned char)expression[i] ) || (expression[i] == '_') ) ) {
+                ++i;
+            }
+            token.type = eNativeTokenName;
+            token.text = expression.substr(start, i - start);
+        } else {
+            token.type = eNativeTokenOperator;
+            if ( ( i + 1 < expression.size() ) && ( ( (c == '*') && (expression[i + 1] == '*') ) || ( (c == '/') && (expression[i + 1] == '/') ) ) ) {
+                token.text = expression.substr(i, 2);
+                i += 2;
+            } else if ( (c == '+') || (c == '-') || (c == '*') || (c == '/') || (c == '%') || (c == '(') || (c == ')') || (c == ',') ||
+                        (c == '.') ) {
+                token.text = std::string(1, c);
+                ++i;
+            } else {
+                return false;
+            }
+        }
+        tokens->push_back(token);
+    }
+    NativeToken end;
+    end.type = eNativeTokenEnd;
+    end.number = 0.;
+    end.isInt = false;
+    tokens->push_back(end);
+
+    return true;
+}
+
+///What a script-name refers to while resolving a path such as thisGroup.Blur1.size
+struct NativeScope
+{
+    boost::shared_ptr<NodeCollection> collection; // set for the application (the project)
+    NodePtr node; // set for a node
+    boost::shared_ptr<KnobI> knob; // set for a knob
+};
+} // anon namespace
+
+struct NativeExpressionPrivate
+{
+    std::vector<NativeInstruction> program;
+    std::vector<NativeKnob> knobs;
+    int dimension; // of the knob holding the expression
+};
+
+namespace {
+///Recursive descent parser following the Python grammar for the arithmetic expressions
+class NativeParser
+{
+public:
+
+    NativeParser(const std::vector<NativeToken>& tokens,
+                 const KnobI* knob,
+                 NativeExpressionPrivate* expression)
+        : _tokens(tokens)
+        , _pos(0)
+        , _knob(knob)
+        , _node()
+        , _localNames()
+        , _expression(expression)
+    {
+    }
+
+    bool parse()
+    {
+        if ( !initScope() ) {
+            return false;
+        }
+
+        return parseArith() && current().type == eNativeTokenEnd;
+    }
+
+private:
+
+    const NativeToken& current() const
+    {
+        return _tokens[_pos];
+    }
+
+    bool isOperator(const char* op) const
+    {
+        return current().type == eNativeTokenOperator && current().text == op;
+    }
+
+    bool accept(const char* op)
+    {
+        if ( isOperator(op) ) {
+            ++_pos;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    ///Collects the names declared as local variables of the Python function of the expression
+    bool initScope()
+    {
+        _localNames.insert("thisParam");
+        _localNames.insert("thisNode");
+        _localNames.insert("thisGroup");
+        _localNames.insert("random");
+        _localNames.insert("randomInt");
+        _localNames.insert("curve");
+        _localNames.insert("app");
+        if (!_knob) {
+            return true;
+        }
+        EffectInstance* effect = dynamic_cast<EffectInstance*>( _knob->getHolder() );
+        if (!effect) {
+            return false;
+        }
+        _node = effect->getNode();
+        if ( !_node || !_node->getGroup() ) {
+            return false;
+        }
+        _appID = _node->getApp()->getAppIDString();
+        NodeList siblings = _node->getGroup()->getNodes();
+        for (NodeList::iterator it = siblings.begin(); it != siblings.end(); ++it) {
+            if ( (*it)->isActivated() && !(*it)->getParentMultiInstance() ) {
+                _localNames.insert( (*it)->getScriptName_mt_safe() );
+            }
+        }
+
+        return true;
+    }
+
+    void emit(const NativeInstruction& instr)
+    {
+        _expression->program.push_back(instr);
+    }
+
+    // arith := term (('+'|'-') term)*
+    bool parseArith()
+    {
+        if ( !parseTerm() ) {
+            return false;
+        }
+        for (;;) {
+            NativeOpEnum op;
+            if ( accept("+") ) {
+                op = eNativeOpAdd;
+            } else if ( accept("-") ) {
+                op = eNativeOpSubtract;
+            } else {
+                return true;
+            }
+            if ( !parseTerm() ) {
+                return false;
+            }
+            emit( NativeInstruction(op) );
+        }
+    }
+
+    // term := factor (('*'|'/'|'//'|'%') factor)*
+    bool parseTerm()
+    {
+        if ( !parseFactor() ) {
+            return false;
+        }
+        for (;;) {
+            NativeOpEnum op;
+            if ( accept("*") ) {
+                op = eNativeOpMultiply;
+            } else if ( accept("/") ) {
+                op = eNativeOpDivide;
+            } else if ( accept("//") ) {
+                op = eNativeOpFloorDivide;
+            } else if ( accept("%") ) {
+                op = eNativeOpModulo;
+            } else {
+                return true;
+            }
+            if ( !parseFactor() ) {
+                return false;
+            }
+            emit( NativeInstruction(op) );
+        }
+    }
+
+    // factor := ('+'|'-') factor | power
+    bool parseFactor()
+    {
+        if ( accept("+") ) {
+            return parseFactor();
+        }
+        if ( accept("-") ) {
+            if ( !parseFactor() ) {
+                return false;
+            }
+            emit( NativeInstruction(eNativeOpNegate) );
+
+            return true;
+        }
+
+        return parsePower();
+    }
+
+    // power := atom ['**' factor]
+    bool parsePower()
+    {
+        if ( !parseAtom() ) {
+            return false;
+        }
+        if ( accept("**") ) {
+            if ( !parseFactor() ) {
+                return false;
+            }
+            emit( NativeInstruction(eNativeOpPower) );
+        }
+
+        return true;
+    }
+
+    // atom := NUMBER | '(' arith ')' | NAME ('.' NAME)* ['(' args ')' ['.' NAME]]
+    bool parseAtom()
+    {
+        const NativeToken& token = current();
+
+        if (token.type == eNativeTokenNumber) {
+            NativeInstruction instr(eNativeOpPushConstant);
+            instr.value = token.number;
+            instr.isInt = token.isInt;
+            emit(instr);
+            ++_pos;
+
+            return true;
+        }
+        if ( accept("(") ) {
+            return parseArith() && accept(")");
+        }
+        if (token.type != eNativeTokenName) {
+            return false;
+        }
+
+        std::vector<std::string> path;
+        path.push_back(token.text);
+        ++_pos;
+        while ( accept(".") ) {
+            if (current().type != eNativeTokenName) {
+                return false;
+            }
+            path.push_back(current().text);
+            ++_pos;
+        }
+        if ( !isOperator("(") ) {
+            if (path.size() != 1) {
+                return false;
+            }
+
+            return parseVariable(path[0]);
+        }
+        if (path.size() == 1) {
+            return parseFunctionCall(path[0]);
+        }
+
+        return parseKnobCall(path);
+    }
+
+    bool parseVariable(const std::string& name)
+    {
+        NativeInstruction instr(eNativeOpPushConstant);
+
+        if (name == "frame") {
+            emit( NativeInstruction(eNativeOpPushFrame) );
+
+            return true;
+        } else if (name == "dimension") {
+            instr.value = _expression->dimension;
+            instr.isInt = true;
+        } else if ( _localNames.count(name) ) {
+            return false;
+        } else if (name == "pi") {
+            instr.value = M_PI;
+        } else if (name == "e") {
+            instr.value = M_E;
+        } else {
+            return false;
+        }
+        emit(instr);
+
+        return true;
+    }
+
+    ///Parses the arguments of a call, returns their number or -1 on failure
+    int parseArguments()
+    {
+        if ( !accept("(") ) {
+            return -1;
+        }
+        if ( accept(")") ) {
+            return 0;
+        }
+        int nArgs = 0;
+        for (;;) {
+            if ( !parseArith() ) {
+                return -1;
+            }
+            ++nArgs;
+            if ( accept(")") ) {
+                return nArgs;
+            }
+            if ( !accept(",") ) {
+                return -1;
+            }
+        }
+    }
+
+    bool parseFunctionCall(const std::string& name)
+    {
+        if ( _localNames.count(name) || (name == "frame") || (name == "dimension") ) {
+            return false;
+        }
+        const NativeFunction* function = 0;
+        for (std::size_t i = 0; i < sizeof(nativeFunctions) / sizeof(nativeFunctions[0]); ++i) {
+            if (name == nativeFunctions[i].name) {
+                function = &nativeFunctions[i];
+                break;
+            }
+        }
+        if (!function) {
+            return false;
+        }
+        int nArgs = parseArguments();
+        if ( (nArgs < function->minArgs) || ( (function->maxArgs != -1) && (nArgs > function->maxArgs) ) ) {
+            return false;
+        }
+        NativeInstruction instr(eNativeOpCall);
+        instr.function = function->function;
+        instr.nArgs = nArgs;
+        emit(instr);
+
+        return true;
+    }
+
+    ///Resolves a path of script-names, as Python would find the attributes, to a knob
+    boost::shared_ptr<KnobI> resolveKnob(const std::vector<std::string>& path,
+                                         std::vector< boost::weak_ptr<Node> >* nodes)
+    {
+        boost::shared_ptr<KnobI> ret;
+
+        if (!_knob || !_node) {
+            return ret;
+        }
+
+        NativeScope scope;
+        const std::string& first = path[0];
+        if (first == "thisParam") {
+            scope.knob = _node->getKnobByName( _knob->getName() );
+        } else if (first == "thisNode") {
+            scope.node = _node;
+        } else if (first == "thisGroup") {
+            boost::shared_ptr<NodeCollection> group = _node->getGroup();
+            NodeGroup* isGroup = dynamic_cast<NodeGroup*>( group.get() );
+            if (isGroup) {
+                scope.node = isGroup->getNode();
+            } else {
+                scope.collection = group;
+            }
+        } else if ( (first == "app") || (first == _appID) ) {
+            scope.collection = _node->getApp()->getProject();
+        } else if ( _localNames.count(first) ) {
+            scope.node = _node->getGroup()->getNodeByName(first);
+        }
+
+        if (scope.knob) {
+            nodes->push_back(_node);
+        }
+
+        ///path ends with the name of the method
+        for (std::size_t i = 1; i < path.size() - 1; ++i) {
+            if (scope.knob) {
+                return ret;
+            }
+            if (scope.node) {
+                nodes->push_back(scope.node);
+            }
+            if (scope.collection) {
+                NodePtr child = scope.collection->getNodeByName(path[i]);
+                scope.collection.reset();
+                if ( child && child->isActivated() ) {
+                    scope.node = child;
+                }
+            } else if (scope.node) {
+                NodePtr node = scope.node;
+                scope.node.reset();
+                boost::shared_ptr<KnobI> knob = node->getKnobByName(path[i]);
+                NodeGroup* isGroup = dynamic_cast<NodeGroup*>( node->getLiveInstance() );
+                NodePtr child = isGroup ? isGroup->getNodeByName(path[i]) : NodePtr();
+                if ( child && !child->isActivated() ) {
+                    child.reset();
+                }
+                if (knob && child) {
+                    ///Ambiguous, let Python decide
+                    return ret;
+                }
+                scope.knob = knob;
+                scope.node = child;
+            } else {
+                return ret;
+            }
+        }
+
+        return scope.knob;
+    }
+
+    ///Parses <knob path>.get(...), getValue(...) or getValueAtTime(...), with the member of the tuple returned by get()
+    bool parseKnobCall(const std::vector<std::string>& path)
+    {
+        NativeKnob nativeKnob;
+        boost::shared_ptr<KnobI> knob = resolveKnob(path, &nativeKnob.nodes);
+
+        if (!knob) {
+            return false;
+        }
+        nativeKnob.knob = knob;
+        nativeKnob.nDims = knob->getDimension();
+        if ( dynamic_cast<KnobParametric*>( knob.get() ) ) {
+            return false;
+        } else if ( dynamic_cast<Knob<int>*>( knob.get() ) ) {
+            nativeKnob.type = eNativeKnobTypeInt;
+        } else if ( dynamic_cast<Knob<double>*>( knob.get() ) ) {
+            nativeKnob.type = eNativeKnobTypeDouble;
+        } else if ( dynamic_cast<Knob<bool>*>( knob.get() ) && !dynamic_cast<KnobButton*>( knob.get() ) ) {
+            nativeKnob.type = eNativeKnobTypeBool;
+        } else {
+            return false;
+        }
+
+        const std::string& method = path.back();
+        NativeInstruction instr(eNativeOpKnobValue);
+        instr.knob = (int)_expression->knobs.size();
+        int nArgs = parseArguments();
+        if (nArgs < 0) {
+            return false;
+        }
+        if (method == "get") {
+            if (nArgs > 1) {
+                return false;
+            }
+            instr.atTime = nArgs == 1;
+            if ( accept(".") ) {
+                if ( (nativeKnob.nDims == 1) || (current().type != eNativeTokenName) ) {
+                    return false;
+                }
+                const std::string& member = current().text;
+                ++_pos;
+                const char* members = dynamic_cast<KnobColor*>( knob.get() ) ? "rgba" : "xyz";
+                std::size_t found = member.size() == 1 ? std::string(members).find(member[0]) : std::string::npos;
+                if ( (found == std::string::npos) || ( (int)found >= nativeKnob.nDims ) ) {
+                    return false;
+                }
+                instr.dimension = (int)found;
+            } else if (nativeKnob.nDims != 1) {
+                ///A tuple
+                return false;
+            }
+        } else if (method == "getValue") {
+            if (nArgs > 1) {
+                return false;
+            }
+            instr.dimension = nArgs == 1 ? -1 : 0;
+        } else if (method == "getValueAtTime") {
+            if ( (nArgs < 1) || (nArgs > 2) ) {
+                return false;
+            }
+            instr.atTime = true;
+            instr.dimension = nArgs == 2 ? -1 : 0;
+        } else {
+            return false;
+        }
+        if ( accept(".") ) {
+            return false;
+        }
+        _expression->knobs.push_back(nativeKnob);
+        emit(instr);
+
+        return true;
+    }
+
+    const std::vector<NativeToken>& _tokens;
+    std::size_t _pos;
+    const KnobI* _knob;
+    NodePtr _node;
+    std::string _appID;
+    std::set<std::string> _localNames;
+    NativeExpressionPrivate* _expression;
+};
+
+///Returns the number of values the program pushes on the stack at most, or -1 if it is not balanced
+int
+getStackDepth(const std::vector<NativeInstruction>& program)
+{
+    int depth = 0;
+    int maxDepth = 0;
+
+    for (std::size_t i = 0; i < program.size(); ++i) {
+        const NativeInstruction& instr = program[i];
+        switch (instr.op) {
+        case eNativeOpPushConstant:
+        case eNativeOpPushFrame:
+            ++depth;
+            break;
+        case eNativeOpNegate:
+            break;
+        case eNativeOpCall:
+            depth -= instr.nArgs - 1;
+            break;
+        case eNativeOpKnobValue:
+            depth -= (instr.atTime ? 1 : 0) + (instr.dimension == -1 ? 1 : 0) - 1;
+            break;
+        default:
+            --depth;
+            break;
+        }
+        if (depth < 1) {
+            return -1;
+        }
+        maxDepth = std::max(maxDepth, depth);
+    }
+
+    return depth == 1 ? maxDepth : -1;
+}
+
+bool
+getKnobValue(const NativeKnob& nativeKnob,
+             bool atTime,
+             double time,
+             int dimension,
+             NativeValue* ret)
+{
+    boost::shared_ptr<KnobI> knob = nativeKnob.knob.lock();
+
+    if ( !knob || (dimension < 0) || (dimension >= nativeKnob.nDims) ) {
+        return false;
+    }
+    for (std::size_t i = 0; i < nativeKnob.nodes.size(); ++i) {
+        NodePtr node = nativeKnob.nodes[i].lock();
+        if ( !node || !node->isActivated() ) {
+            return false;
+        }
+    }
+    ///Same calls as the Python parameters
+    switch (nativeKnob.type) {
+    case eNativeKnobTypeInt: {
+        Knob<int>* isInt = dynamic_cast<Knob<int>*>( knob.get() );
+        assert(isInt);
+        ret->v = atTime ? isInt->getValueAtTime(time, dimension) : isInt->getValue(dimension);
+        ret->isInt = true;
+        break;
+    }
+    case eNativeKnobTypeDouble: {
+        Knob<double>* isDouble = dynamic_cast<Knob<double>*>( knob.get() );
+        assert(isDouble);
+        ret->v = atTime ? isDouble->getValueAtTime(time, dimension) : isDouble->getValue(dimension);
+        ret->isInt = false;
+        break;
+    }
+    case eNativeKnobTypeBool: {
+        Knob<bool>* isBool = dynamic_cast<Knob<bool>*>( knob.get() );
+        assert(isBool);
+        ret->v = ( atTime ? isBool->getValueAtTime(time, dimension) : isBool->getValue(dimension) ) ? 1. : 0.;
+        ret->isInt = true;
+        break;
+    }
+    }
+
+    return true;
+}
+} // anon namespace
+
+NativeExpression::NativeExpression()
+    : _imp( new NativeExpressionPrivate() )
+{
+}
+
+NativeExpression::~NativeExpression()
+{
+}
+
+boost::shared_ptr<NativeExpression>
+NativeExpression::compile(const std::string& expression,
+                          const KnobI* knob,
+                          int dimension)
+{
+    boost::shared_ptr<NativeExpression> ret;
+    std::vector<NativeToken> tokens;
+
+    if ( !tokenize(expression, &tokens) ) {
+        return ret;
+    }
+    boost::shared_ptr<NativeExpression> compiled( new NativeExpression() );
+    compiled->_imp->dimension = dimension;
+    NativeParser parser(tokens, knob, compiled->_imp.get());
+    if ( !parser.parse() ) {
+        return ret;
+    }
+    int depth = getStackDepth(compiled->_imp->program);
+    if ( (depth < 1) || (depth > NATRON_NATIVE_EXPRESSION_MAX_STACK) ) {
+        return ret;
+    }
+
+    return compiled;
+}
+
+bool
+NativeExpression::evaluate(double time,
+                           double* result) const
+{
+    NativeValue stack[NATRON_NATIVE_EXPRESSION_MAX_STACK];
+    int size = 0;
+
+    for (std::size_t i = 0; i < _imp->program.size(); ++i) {
+        const NativeInstruction& instr = _imp->program[i];
+        switch (instr.op) {
+        case eNativeOpPushConstant:
+            stack[size].v = instr.value;
+            stack[size].isInt = instr.isInt;
+            ++size;
+            break;
+        case eNativeOpPushFrame:
+            ///Integer frames are ints in Python
+            stack[size].v = time;
+            stack[size].isInt = time == std::floor(time);
+            ++size;
+            break;
+        case eNativeOpNegate:
+            stack[size - 1].v = -stack[size - 1].v;
+            break;
+        case eNativeOpCall: {
+            NativeValue value;
+            if ( !applyFunction(instr.function, &stack[size - instr.nArgs], instr.nArgs, &value) ) {
+                return false;
+            }
+            size -= instr.nArgs;
+            stack[size++] = value;
+            break;
+        }
+        case eNativeOpKnobValue: {
+            int dimension = instr.dimension;
+            if (dimension == -1) {
+                const NativeValue& dimValue = stack[--size];
+                if (!dimValue.isInt) {
+                    return false;
+                }
+                dimension = (int)dimValue.v;
+            }
+            double knobTime = 0.;
+            if (instr.atTime) {
+                knobTime = stack[--size].v;
+            }
+            if ( !getKnobValue(_imp->knobs[instr.knob], instr.atTime, knobTime, dimension, &stack[size]) ) {
+                return false;
+            }
+            ++size;
+            break;
+        }
+        default: {
+            NativeValue value;
+            if ( !applyBinaryOp(instr.op, stack[size - 2], stack[size - 1], &value) ) {
+                return false;
+            }
+            size -= 2;
+            stack[size++] = value;
+            break;
+        }
+        }
+    }
+    assert(size == 1);
+    *result = stack[0].v;
+
+    return true;
+}
+
+NATRON_NAMESPACE_EXIT;
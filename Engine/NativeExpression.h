@@ -0,0 +1,89 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_NativeExpression_h
+#define Engine_NativeExpression_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <string>
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+struct NativeExpressionPrivate;
+
+/**
+ * @brief A knob expression evaluated without Python, hence without taking the Python GIL.
+ *
+ * Most expressions are simple arithmetic on the frame and on the values of other knobs, e.g:
+ * thisGroup.Blur1.size.get() * 2 + frame
+ * Those are compiled to a small stack program that gives the same result as Python would:
+ * - numbers, frame, dimension, pi, e;
+ * - the operators + - * / // % ** and parenthesis, with the int/float semantics of the Python version Natron is built with;
+ * - abs, min, max, int, float and the functions of the math module declared by Natron (sin, sqrt, pow, floor...);
+ * - the int, double and boolean parameters referred to by script-name as in Python (thisParam, thisNode, thisGroup,
+ *   app, the nodes of the group and their children) with get(), get(frame), getValue(dimension) and
+ *   getValueAtTime(frame, dimension), followed by .x/.y/.z or .r/.g/.b/.a for the multi-dimensional ones.
+ * Anything else (other functions, multi-line expressions, string parameters...) is left to Python: compile() returns
+ * NULL. Errors that Python would raise (division by zero, math domain errors...) make evaluate() fail, so that the
+ * Python evaluation reports them as usual.
+ **/
+class NativeExpression
+{
+    NativeExpression();
+
+public:
+
+    ~NativeExpression();
+
+    /**
+     * @brief Compiles the expression of the given dimension of knob, as written by the user (not multi-line).
+     * Returns NULL if it cannot be evaluated natively. knob may be NULL, in which case parameters cannot be referred to.
+     * Must be called by the main thread, since the script-names are resolved to the knobs at this time.
+     **/
+    static boost::shared_ptr<NativeExpression> compile(const std::string& expression, const KnobI* knob, int dimension);
+
+    /**
+     * @brief Evaluates the expression at the given frame. Returns false if Python would raise an error or if a referred
+     * parameter was deleted.
+     * MT-safe.
+     **/
+    bool evaluate(double time, double* result) const WARN_UNUSED_RETURN;
+
+private:
+
+    boost::scoped_ptr<NativeExpressionPrivate> _imp;
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_NativeExpression_h
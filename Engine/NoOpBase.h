@@ -100,6 +100,11 @@ public:
     
     virtual bool isHostChannelSelectorSupported(bool* defaultR,bool* defaultG, bool* defaultB, bool* defaultA) const OVERRIDE FINAL;
 
+    virtual bool isRequestPassTimeInvariant() const OVERRIDE FINAL WARN_UNUSED_RETURN
+    {
+        return true;
+    }
+
 private:
 
     /**
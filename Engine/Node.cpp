@@ -69,6 +69,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/Plugin.h"
 #include "Engine/PrecompNode.h"
 #include "Engine/Project.h"
+#include "Engine/RenderStats.h"
 #include "Engine/RotoLayer.h"
 #include "Engine/RotoPaint.h"
 #include "Engine/RotoStrokeItem.h"
@@ -1209,6 +1210,30 @@ Node::getCacheID() const
     return _imp->cacheID;
 }
 
+namespace {
+///Appends the content of the knobs that affect the render to the hash.
+///Returns false if one of them is driven by an expression.
+bool
+appendKnobsContentToHash(const std::vector<boost::shared_ptr<KnobI> >& knobs,
+                         Hash64* hash)
+{
+    for (std::vector<boost::shared_ptr<KnobI> >::const_iterator it = knobs.begin(); it != knobs.end(); ++it) {
+        KnobI* knob = it->get();
+        if ( !knob->getEvaluateOnChange() || dynamic_cast<KnobButton*>(knob) || dynamic_cast<KnobPage*>(knob) ||
+             dynamic_cast<KnobGroup*>(knob) || dynamic_cast<KnobSeparator*>(knob) ) {
+            continue;
+        }
+        for (int i = 0; i < knob->getDimension(); ++i) {
+            if ( !knob->appendToHash(i, hash) ) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+} // anon namespace
+
 bool
 Node::computeHashInternal()
 {
@@ -1221,6 +1246,18 @@ Node::computeHashInternal()
         qDebug() << "Node::computeHash(): inputs not initialized";
     }
     
+    boost::shared_ptr<RotoDrawableItem> attachedStroke = _imp->paintStroke.lock();
+    
+    ///If enabled, identify the node by the content of its knobs rather than by their age, so that setting back a value
+    ///gives back the previous hash. The roto nodes are changed by their items, which are not knobs.
+    Hash64 knobsContentHash;
+    bool hashKnobsContent = appPTR->getCurrentSettings()->isContentAddressedHashEnabled() &&
+                            _imp->liveInstance->isOutputDerivedFromKnobs() && !_imp->rotoContext && !attachedStroke;
+    if (hashKnobsContent) {
+        hashKnobsContent = appendKnobsContentToHash(_imp->liveInstance->getKnobs(), &knobsContentHash);
+        knobsContentHash.computeHash();
+    }
+    
     U64 oldHash,newHash;
     {
         QWriteLocker l(&_imp->knobsAgeMutex);
@@ -1230,11 +1267,15 @@ Node::computeHashInternal()
         ///reset the hash value
         _imp->hash.reset();
         
-        ///append the effect's own age
-        _imp->hash.append(_imp->knobsAge);
+        ///append the effect's own age, or the content of its knobs
+        if (hashKnobsContent) {
+            _imp->hash.append( knobsContentHash.value() );
+            Hash64_appendQString( &_imp->hash, QString::fromUtf8( _imp->liveInstance->getPluginID().c_str() ) );
+        } else {
+            _imp->hash.append(_imp->knobsAge);
+        }
         
         ///append all inputs hash
-        boost::shared_ptr<RotoDrawableItem> attachedStroke = _imp->paintStroke.lock();
         NodePtr attachedStrokeContextNode;
         if (attachedStroke) {
             attachedStrokeContextNode = attachedStroke->getContext()->getNode();
@@ -1283,10 +1324,21 @@ Node::computeHashInternal()
         ///Also append the effect's label to distinguish 2 instances with the same parameters
         Hash64_appendQString( &_imp->hash, QString( getScriptName().c_str() ) );
         
-        ///Also append the project's creation time in the hash because 2 projects openend concurrently
-        ///could reproduce the same (especially simple graphs like Viewer-Reader)
-        qint64 creationTime =  getApp()->getProject()->getProjectCreationTime();
-        _imp->hash.append(creationTime);
+        if (hashKnobsContent) {
+            ///A change of the project format changes the age of all nodes since some effects depend on it
+            Format projectFormat;
+            getApp()->getProject()->getProjectDefaultFormat(&projectFormat);
+            _imp->hash.append(projectFormat.x1);
+            _imp->hash.append(projectFormat.y1);
+            _imp->hash.append(projectFormat.x2);
+            _imp->hash.append(projectFormat.y2);
+            _imp->hash.append( projectFormat.getPixelAspectRatio() );
+        } else {
+            ///Also append the project's creation time in the hash because 2 projects openend concurrently
+            ///could reproduce the same (especially simple graphs like Viewer-Reader)
+            qint64 creationTime =  getApp()->getProject()->getProjectCreationTime();
+            _imp->hash.append(creationTime);
+        }
         
         _imp->hash.computeHash();
         
@@ -1298,10 +1350,12 @@ Node::computeHashInternal()
 
     if (hashChanged) {
         _imp->liveInstance->onNodeHashChanged(newHash);
-        if (_imp->nodeCreated && !getApp()->getProject()->isProjectClosing()) {
+        if (_imp->nodeCreated && !getApp()->getProject()->isProjectClosing() && !hashKnobsContent) {
             /*
              * We changed the node hash. That means all cache entries for this node with a different hash
              * are impossible to re-create again. Just discard them all. This is done in a separate thread.
+             * When the hash is derived from the knobs content, the previous hash comes back as soon as the
+             * knobs are set back to their previous values: keep the entries, the cache will evict them if needed.
              */
             removeAllImagesFromCacheWithMatchingIDAndDifferentKey(newHash);
         }
@@ -5887,6 +5941,10 @@ Node::lock(const boost::shared_ptr<Image> & image)
     std::list<boost::shared_ptr<Image> >::iterator it =
     std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
     
+    boost::scoped_ptr<TimeLapse> waitTimer;
+    if ( it != _imp->imagesBeingRendered.end() && RenderStatsThreadScope::isActiveForCurrentThread() ) {
+        waitTimer.reset(new TimeLapse);
+    }
     while ( it != _imp->imagesBeingRendered.end() ) {
         _imp->imageBeingRenderedCond.wait(&_imp->imagesBeingRenderedMutex);
         it = std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
@@ -5894,6 +5952,10 @@ Node::lock(const boost::shared_ptr<Image> & image)
     ///Okay the image is not used by any other thread, claim that we want to use it
     assert( it == _imp->imagesBeingRendered.end() );
     _imp->imagesBeingRendered.push_back(image);
+    if (waitTimer) {
+        l.unlock();
+        RenderStatsThreadScope::reportWait( eRenderTraceEventTypeImageWait, waitTimer->getTimeSinceCreation() );
+    }
 }
 
 bool
@@ -0,0 +1,286 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "OfxBundleIndex.h"
+
+#include <algorithm> // sort
+#include <cstring> // memcmp, memcpy
+#include <map>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/bind.hpp>
+#endif
+
+#include "Engine/AppManager.h"
+#include "Engine/TaskPool.h"
+
+// Must be changed whenever the layout of the file changes
+#define NATRON_OFX_BUNDLE_INDEX_VERSION 1
+#define NATRON_OFX_BUNDLE_INDEX_MAGIC "NOFXBIDX"
+
+// The name of the directory holding the binaries in a bundle, as in the OpenFX host support library
+#if defined(__APPLE__)
+#define NATRON_OFX_BUNDLE_ARCH "MacOS"
+#elif defined(_WIN64)
+#define NATRON_OFX_BUNDLE_ARCH "Win64"
+#elif defined(_WIN32)
+#define NATRON_OFX_BUNDLE_ARCH "Win32"
+#elif defined(__linux__) && (defined(__x86_64__) || defined(__amd64__))
+#define NATRON_OFX_BUNDLE_ARCH "Linux-x86-64"
+#elif defined(__linux__) && defined(__i386__)
+#define NATRON_OFX_BUNDLE_ARCH "Linux-x86"
+#elif defined(__linux__)
+#define NATRON_OFX_BUNDLE_ARCH "Linux"
+#elif defined(__FreeBSD__) && (defined(__x86_64__) || defined(__amd64__))
+#define NATRON_OFX_BUNDLE_ARCH "FreeBSD-x86-64"
+#elif defined(__FreeBSD__)
+#define NATRON_OFX_BUNDLE_ARCH "FreeBSD-x86"
+#else
+#define NATRON_OFX_BUNDLE_ARCH "Unknown"
+#endif
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+struct BundleIndexHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 nEntries;
+};
+
+///Followed by pathLength bytes of the UTF-8 path of the binary
+struct BundleIndexEntryHeader
+{
+    qint64 size;
+    qint64 modificationTime;
+    quint32 pathLength;
+};
+
+bool
+entryPathLess(const OfxBundleIndex::Entry& a,
+              const OfxBundleIndex::Entry& b)
+{
+    return a.binaryPath < b.binaryPath;
+}
+
+void
+scanDirectory(const QString& dirPath,
+              int depth,
+              std::vector<OfxBundleIndex::Entry>* entries)
+{
+    ///Stop on symbolic link loops
+    if (depth > 16) {
+        return;
+    }
+    QDir dir(dirPath);
+    QStringList subDirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (QStringList::const_iterator it = subDirs.begin(); it != subDirs.end(); ++it) {
+        if ( it->endsWith( QString::fromUtf8(".ofx.bundle") ) ) {
+            QString binaryName = it->left(it->size() - 7); // remove ".bundle"
+            QFileInfo binary( dir.absoluteFilePath(*it) + QString::fromUtf8("/Contents/" NATRON_OFX_BUNDLE_ARCH "/") + binaryName );
+            if ( binary.exists() ) {
+                OfxBundleIndex::Entry e;
+                e.binaryPath = binary.absoluteFilePath().toStdString();
+                e.size = binary.size();
+                e.modificationTime = binary.lastModified().toMSecsSinceEpoch();
+                entries->push_back(e);
+            }
+        } else {
+            scanDirectory(dir.absoluteFilePath(*it), depth + 1, entries);
+        }
+    }
+}
+
+void
+prefetchBinary(const std::string& filePath)
+{
+    QFile file( QString::fromUtf8( filePath.c_str() ) );
+
+    if ( !file.open(QIODevice::ReadOnly) ) {
+        return;
+    }
+    char buf[1 << 16];
+    while (file.read(buf, sizeof(buf) ) > 0) {
+    }
+}
+} // anon namespace
+
+void
+OfxBundleIndex::scanBundles(const std::list<std::string>& searchPath,
+                            std::vector<Entry>* entries)
+{
+    entries->clear();
+    for (std::list<std::string>::const_iterator it = searchPath.begin(); it != searchPath.end(); ++it) {
+        scanDirectory(QString::fromUtf8( it->c_str() ), 0, entries);
+    }
+    std::sort(entries->begin(), entries->end(), entryPathLess);
+}
+
+bool
+OfxBundleIndex::read(const QString& filePath,
+                     std::vector<Entry>* entries)
+{
+    entries->clear();
+
+    QFile file(filePath);
+    if ( !file.open(QIODevice::ReadOnly) ) {
+        return false;
+    }
+    qint64 fileSize = file.size();
+    if ( fileSize < (qint64)sizeof(BundleIndexHeader) ) {
+        return false;
+    }
+    ///The file is small and read once: mapping it avoids a copy, fall back on reading it if it cannot be mapped
+    QByteArray buffer;
+    const uchar* data = file.map(0, fileSize);
+    if (!data) {
+        buffer = file.readAll();
+        if ( (qint64)buffer.size() != fileSize ) {
+            return false;
+        }
+        data = (const uchar*)buffer.constData();
+    }
+
+    BundleIndexHeader header;
+    std::memcpy( &header, data, sizeof(header) );
+    if ( (std::memcmp(header.magic, NATRON_OFX_BUNDLE_INDEX_MAGIC, sizeof(header.magic) ) != 0) ||
+         (header.version != NATRON_OFX_BUNDLE_INDEX_VERSION) ) {
+        return false;
+    }
+
+    qint64 offset = sizeof(header);
+    entries->reserve(header.nEntries);
+    for (quint32 i = 0; i < header.nEntries; ++i) {
+        BundleIndexEntryHeader entryHeader;
+        if ( offset + (qint64)sizeof(entryHeader) > fileSize ) {
+            entries->clear();
+
+            return false;
+        }
+        std::memcpy( &entryHeader, data + offset, sizeof(entryHeader) );
+        offset += sizeof(entryHeader);
+        if (offset + (qint64)entryHeader.pathLength > fileSize) {
+            entries->clear();
+
+            return false;
+        }
+        Entry e;
+        e.binaryPath.assign( (const char*)data + offset, entryHeader.pathLength );
+        e.size = entryHeader.size;
+        e.modificationTime = entryHeader.modificationTime;
+        entries->push_back(e);
+        offset += entryHeader.pathLength;
+    }
+
+    return true;
+}
+
+bool
+OfxBundleIndex::write(const QString& filePath,
+                      const std::vector<Entry>& entries)
+{
+    QByteArray buffer;
+    BundleIndexHeader header;
+
+    std::memcpy( header.magic, NATRON_OFX_BUNDLE_INDEX_MAGIC, sizeof(header.magic) );
+    header.version = NATRON_OFX_BUNDLE_INDEX_VERSION;
+    header.nEntries = (quint32)entries.size();
+    buffer.append( (const char*)&header, sizeof(header) );
+    for (std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        BundleIndexEntryHeader entryHeader;
+        entryHeader.size = it->size;
+        entryHeader.modificationTime = it->modificationTime;
+        entryHeader.pathLength = (quint32)it->binaryPath.size();
+        buffer.append( (const char*)&entryHeader, sizeof(entryHeader) );
+        buffer.append( it->binaryPath.c_str(), (int)it->binaryPath.size() );
+    }
+
+    ///Write to a temporary file first so that a concurrent launch never reads a partial index
+    QString tmpFilePath = filePath + QString::fromUtf8(".tmp");
+    {
+        QFile file(tmpFilePath);
+        if ( !file.open(QIODevice::WriteOnly | QIODevice::Truncate) ) {
+            return false;
+        }
+        if (file.write(buffer) != buffer.size()) {
+            file.close();
+            QFile::remove(tmpFilePath);
+
+            return false;
+        }
+    }
+    QFile::remove(filePath);
+
+    return QFile::rename(tmpFilePath, filePath);
+}
+
+void
+OfxBundleIndex::getChangedEntries(const std::vector<Entry>& previous,
+                                  const std::vector<Entry>& current,
+                                  std::vector<Entry>* changed)
+{
+    std::map<std::string, const Entry*> previousByPath;
+
+    for (std::vector<Entry>::const_iterator it = previous.begin(); it != previous.end(); ++it) {
+        previousByPath[it->binaryPath] = &*it;
+    }
+    changed->clear();
+    for (std::vector<Entry>::const_iterator it = current.begin(); it != current.end(); ++it) {
+        std::map<std::string, const Entry*>::const_iterator found = previousByPath.find(it->binaryPath);
+        if ( ( found == previousByPath.end() ) ||
+             (found->second->size != it->size) ||
+             (found->second->modificationTime != it->modificationTime) ) {
+            changed->push_back(*it);
+        }
+    }
+}
+
+void
+OfxBundleIndex::prefetchBinaries(const std::vector<Entry>& entries)
+{
+    if ( entries.empty() ) {
+        return;
+    }
+    std::vector<TaskPool::Task> tasks;
+    tasks.reserve( entries.size() );
+    for (std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        tasks.push_back( boost::bind(&prefetchBinary, it->binaryPath) );
+    }
+    TaskPool* pool = appPTR ? appPTR->getTaskPool() : 0;
+    if (pool) {
+        pool->run(tasks);
+    } else {
+        for (std::size_t i = 0; i < tasks.size(); ++i) {
+            tasks[i]();
+        }
+    }
+}
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,101 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_OfxBundleIndex_h
+#define Engine_OfxBundleIndex_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <QtCore/QString>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief The list of the OpenFX bundles found in the plug-in search path, with the size and modification time of
+ * their binary.
+ *
+ * The index of the previous launch is stored in a small versioned binary file next to the XML plug-in cache and is
+ * read through a memory mapping. Comparing it with the bundles found at startup tells:
+ * - which bundles are new or changed: the OpenFX host loads and describes them one after the other, their binaries
+ * are read in parallel beforehand so that this does not wait for the disk (or the network file-system of a farm);
+ * - whether the XML plug-in cache is still up to date, in which case it does not need to be written again.
+ *
+ * This index does not replace the XML plug-in cache: the descriptors of all the plug-ins are still parsed from it at
+ * each launch, and the changed bundles are still loaded and described one after the other. Both are done by the OpenFX
+ * host support library, whose descriptors cannot be restored from another format and whose describe path is not
+ * thread-safe, so a binary descriptor cache or a parallel load would have to be implemented there.
+ **/
+class OfxBundleIndex
+{
+public:
+
+    struct Entry
+    {
+        std::string binaryPath;
+        qint64 size;
+        qint64 modificationTime; // in ms since the epoch
+
+        Entry()
+            : binaryPath()
+            , size(0)
+            , modificationTime(0)
+        {
+        }
+    };
+
+    /**
+     * @brief Finds the bundles in the given directories and their sub-directories, the same way
+     * OFX::Host::PluginCache::scanPluginFiles() does. The entries are sorted by path.
+     **/
+    static void scanBundles(const std::list<std::string>& searchPath, std::vector<Entry>* entries);
+
+    /**
+     * @brief Returns false if the file does not exist, is corrupted or was written with another version of the format.
+     **/
+    static bool read(const QString& filePath, std::vector<Entry>* entries);
+
+    static bool write(const QString& filePath, const std::vector<Entry>& entries);
+
+    /**
+     * @brief Returns the entries of current that are not in previous with the same size and modification time.
+     **/
+    static void getChangedEntries(const std::vector<Entry>& previous, const std::vector<Entry>& current, std::vector<Entry>* changed);
+
+    /**
+     * @brief Reads the binaries in parallel on the task pool of appPTR so that they are in the file-system cache
+     * when they get loaded.
+     **/
+    static void prefetchBinaries(const std::vector<Entry>& entries);
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_OfxBundleIndex_h
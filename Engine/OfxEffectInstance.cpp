@@ -69,6 +69,7 @@ CLANG_DIAG_ON(unknown-pragmas)
 #include "Engine/OfxParamInstance.h"
 #include "Engine/Project.h"
 #include "Engine/RotoLayer.h"
+#include "Engine/Settings.h"
 #include "Engine/TimeLine.h"
 #include "Engine/Transform.h"
 #include "Engine/ViewerInstance.h"
@@ -200,6 +201,7 @@ struct OfxEffectInstancePrivate
     mutable RenderSafetyEnum renderSafety;
     mutable bool wasRenderSafetySet;
     ContextEnum context;
+    MultiThreadSuiteModeEnum multiThreadSuiteMode;
     
     struct ClipsInfo {
         bool optional;
@@ -227,6 +229,7 @@ struct OfxEffectInstancePrivate
     , renderSafety(eRenderSafetyUnsafe)
     , wasRenderSafetySet(false)
     , context(eContextNone)
+    , multiThreadSuiteMode(eMultiThreadSuiteModeDefault)
     , clipsInfos()
     , outputClip(0)
     , nbSourceClips(0)
@@ -299,6 +302,7 @@ OfxEffectInstance::createOfxImageEffectInstance(OFX::Host::ImageEffect::ImageEff
     *hasUsedFileDialog = false;
     
     _imp->context = context;
+    _imp->multiThreadSuiteMode = appPTR->getCurrentSettings()->getMultiThreadSuitePreference( getNode()->getPlugin() );
 
     
     if (disableRenderScaleSupport || context == eContextWriter) {
@@ -2903,6 +2907,22 @@ OfxEffectInstance::isFrameVarying() const
     return effectInstance()->isFrameVarying();
 }
 
+bool
+OfxEffectInstance::isRequestPassTimeInvariant() const
+{
+    ///OpenFX has no property for it: only the plug-ins known to compute the same RoD, identity and frames needed
+    ///at every frame when their parameters are not animated opt in
+    const std::string pluginID = getPluginID();
+
+    return pluginID == PLUGINID_OFX_GRADE ||
+           pluginID == PLUGINID_OFX_COLORCORRECT ||
+           pluginID == PLUGINID_OFX_SHUFFLE ||
+           pluginID == PLUGINID_OFX_MERGE ||
+           pluginID == PLUGINID_OFX_TRANSFORM ||
+           pluginID == PLUGINID_OFX_CORNERPIN ||
+           pluginID == PLUGINID_OFX_BLURCIMG;
+}
+
 bool
 OfxEffectInstance::doesTemporalClipAccess() const
 {
@@ -2959,6 +2979,12 @@ OfxEffectInstance::getClipInputNumber(const OfxClipInstance* clip) const
     return 0;
 }
 
+MultiThreadSuiteModeEnum
+OfxEffectInstance::getMultiThreadSuiteMode() const
+{
+    return _imp->multiThreadSuiteMode;
+}
+
 NATRON_NAMESPACE_EXIT;
 
 NATRON_NAMESPACE_USING;
@@ -272,6 +272,8 @@ public:
                                             Transform::Matrix3x3* transform) OVERRIDE FINAL WARN_UNUSED_RETURN;
 
     virtual bool isFrameVarying() const OVERRIDE FINAL WARN_UNUSED_RETURN;
+
+    virtual bool isRequestPassTimeInvariant() const OVERRIDE FINAL WARN_UNUSED_RETURN;
     
     virtual bool isHostMaskingEnabled() const OVERRIDE FINAL WARN_UNUSED_RETURN;
     virtual bool isHostMixingEnabled() const OVERRIDE FINAL WARN_UNUSED_RETURN;
@@ -289,6 +291,11 @@ public:
 
     int getClipInputNumber(const OfxClipInstance* clip) const;
     
+    /**
+     * @brief Returns the per-plugin "Multi-thread" preference, read when the instance was created.
+     **/
+    MultiThreadSuiteModeEnum getMultiThreadSuiteMode() const;
+    
 public Q_SLOTS:
 
     void onSyncPrivateDataRequested();
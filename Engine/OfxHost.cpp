@@ -37,14 +37,12 @@
 CLANG_DIAG_OFF(deprecated-register) //'register' storage class specifier is deprecated
 #include <QtCore/QDir>
 #include <QtCore/QMutex>
-#include <QtCore/QThreadPool>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
 CLANG_DIAG_ON(deprecated-register)
 #ifdef OFX_SUPPORTS_MULTITHREAD
 #include <QtCore/QThread>
 #include <QtCore/QThreadStorage>
-#include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt5
 GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
 // /usr/local/include/boost/bind/arg.hpp:37:9: warning: unused typedef 'boost_static_assert_typedef_37' [-Wunused-local-typedef]
 #include <boost/bind.hpp>
@@ -90,13 +88,17 @@ CLANG_DIAG_ON(unknown-pragmas)
 #include "Engine/KnobTypes.h"
 #include "Engine/LibraryBinary.h"
 #include "Engine/Node.h"
+#include "Engine/OfxBundleIndex.h"
 #include "Engine/OfxEffectInstance.h"
 #include "Engine/OfxImageEffectInstance.h"
 #include "Engine/OfxMemory.h"
+#include "Engine/OfxThreadPool.h"
 #include "Engine/Plugin.h"
 #include "Engine/Project.h"
 #include "Engine/Settings.h"
 #include "Engine/StandardPaths.h"
+#include "Engine/TaskPool.h"
+#include "Engine/Timer.h"
 #include "Engine/TLSHolder.h"
 
 NATRON_NAMESPACE_ENTER;
@@ -692,10 +694,28 @@ static QString getCacheFilePath()
     return ofxCacheFilePath;
 }
 
+///Return the index of the bundles the xml cache was written with, see OfxBundleIndex
+static QString getBundleIndexFilePath()
+{
+    QString ofxCachePath = getOFXCacheDirPath() + '/';
+    QString indexFilePath = ofxCachePath + "OFXBundles_" +
+    QString(NATRON_VERSION_STRING) + QString("_") +
+    QString(NATRON_DEVELOPMENT_STATUS) + QString("_") +
+    QString::number(NATRON_BUILD_NUMBER) + QString(".bin");
+    return indexFilePath;
+}
+
 void
 OfxHost::loadOFXPlugins(std::map<std::string,std::vector< std::pair<std::string,double> > >* readersMap,
-                                std::map<std::string,std::vector< std::pair<std::string,double> > >* writersMap)
+                                std::map<std::string,std::vector< std::pair<std::string,double> > >* writersMap,
+                                PluginsLoadReport* report)
 {
+    TimeLapse timer;
+    PluginsLoadReport localReport;
+    if (!report) {
+        report = &localReport;
+    }
+    
     assert( OFX::Host::PluginCache::getPluginCache() );
     /// set the version label in the global cache
     OFX::Host::PluginCache::getPluginCache()->setCacheVersion(NATRON_APPLICATION_NAME "OFXCachev1");
@@ -737,17 +757,38 @@ OfxHost::loadOFXPlugins(std::map<std::string,std::vector< std::pair<std::string,
     //on windows: C:\Users\<username>\App Data\Local\<organization>\<application>\Caches\OFXLoadCache
     QString ofxCacheFilePath = getCacheFilePath();
     
+    ///Find out which bundles changed since the cache was written: the OpenFX host loads them one after the other,
+    ///read their binaries in parallel first so that it does not wait for the disk
+    std::vector<OfxBundleIndex::Entry> bundles, previousBundles, changedBundles;
+    OfxBundleIndex::scanBundles(OFX::Host::PluginCache::getPluginCache()->getPluginPath(), &bundles);
+    bool hasIndex = OfxBundleIndex::read(getBundleIndexFilePath(), &previousBundles);
+    OfxBundleIndex::getChangedEntries(previousBundles, bundles, &changedBundles);
+    report->nBundles = (int)bundles.size();
+    report->nChangedBundles = (int)changedBundles.size();
+    
+    double startTime = timer.getTimeSinceCreation();
+    OfxBundleIndex::prefetchBinaries(changedBundles);
+    report->prefetchTime = timer.getTimeSinceCreation() - startTime;
+    
+    ///The descriptors are still parsed from the XML cache at every launch, see OfxBundleIndex
+    startTime = timer.getTimeSinceCreation();
     std::ifstream ifs(ofxCacheFilePath.toStdString().c_str());
-    if (ifs.is_open()) {
+    bool hasCache = ifs.is_open();
+    if (hasCache) {
         OFX::Host::PluginCache::getPluginCache()->readCache(ifs);
         ifs.close();
     }
     OFX::Host::PluginCache::getPluginCache()->scanPluginFiles();
     _imp->loadingPluginID.clear(); // finished loading plugins
+    report->scanTime = timer.getTimeSinceCreation() - startTime;
 
     // write the cache NOW (it won't change anyway)
-    /// flush out the current cache
-    writeOFXCache();
+    /// flush out the current cache, unless it was written from the same bundles
+    if ( !hasCache || !hasIndex || !changedBundles.empty() || (previousBundles.size() != bundles.size()) ) {
+        writeOFXCache();
+        OfxBundleIndex::write(getBundleIndexFilePath(), bundles);
+        report->cacheWritten = true;
+    }
 
     /*Filling node name list and plugin grouping*/
     typedef std::map<OFX::Host::ImageEffect::MajorPlugin,OFX::Host::ImageEffect::ImageEffectPlugin *> PMap;
@@ -885,6 +926,7 @@ OfxHost::loadOFXPlugins(std::map<std::string,std::vector< std::pair<std::string,
             }
         }
     }
+    report->totalTime = timer.getTimeSinceCreation();
 } // loadOFXPlugins
 
 void
@@ -1021,6 +1063,16 @@ threadFunctionWrapper(OfxThreadFunctionV1 func,
     return ret;
 }
 
+static void
+dedicatedThreadFunctionWrapper(OfxThreadFunctionV1 func,
+                               unsigned int threadIndex,
+                               unsigned int threadMax,
+                               QThread* spawnerThread,
+                               void *customArg,
+                               std::vector<OfxStatus>* status)
+{
+    (*status)[threadIndex] = threadFunctionWrapper(func, threadIndex, threadMax, spawnerThread, customArg);
+}
     
 
     
@@ -1120,29 +1172,66 @@ OfxHost::multiThread(OfxThreadFunctionV1 func,
     
     QThread* spawnerThread = QThread::currentThread();
 
-    bool useThreadPool = appPTR->getUseThreadPool();
+    ///The plug-in may override the preference, see the Plug-ins tab of the preferences
+    MultiThreadSuiteModeEnum mode = eMultiThreadSuiteModeDefault;
+    {
+        OfxHostDataTLSPtr tls = _imp->tlsData->getOrCreateTLSData();
+        OfxEffectInstance* effect = tls->lastEffectCallingMainEntry ? tls->lastEffectCallingMainEntry->getOfxEffectInstance() : 0;
+        if (effect) {
+            mode = effect->getMultiThreadSuiteMode();
+        }
+    }
+    if (mode == eMultiThreadSuiteModeDefault) {
+        mode = appPTR->getUseThreadPool() ? eMultiThreadSuiteModeTaskPool : eMultiThreadSuiteModeNewThreads;
+    }
+    
+    ///The spec forbids recursive calls, but a plug-in doing it from a dedicated thread would wait for itself
+    if ( (mode == eMultiThreadSuiteModeDedicatedThreads) && OfxThreadPool::isPoolThread() ) {
+        try {
+            for (unsigned int i = 0; i < nThreads; ++i) {
+                func(i, nThreads, customArg);
+            }
+
+            return kOfxStatOK;
+        } catch (...) {
+            return kOfxStatFailed;
+        }
+    }
     
-    if (useThreadPool) {
+    if (mode == eMultiThreadSuiteModeTaskPool) {
         
         std::vector<unsigned int> threadIndexes(nThreads);
         for (unsigned int i = 0; i < nThreads; ++i) {
             threadIndexes[i] = i;
         }
         
-        /// DON'T set the maximum thread count, this is a global application setting, and see the documentation excerpt above
-        //QThreadPool::globalInstance()->setMaxThreadCount(nThreads);
-        QFuture<OfxStatus> future = QtConcurrent::mapped( threadIndexes, boost::bind(threadFunctionWrapper,func, _1, nThreads, spawnerThread, customArg) );
-        future.waitForFinished();
-        ///DON'T reset back to the original value the maximum thread count
-        //QThreadPool::globalInstance()->setMaxThreadCount(QThread::idealThreadCount());
+        /// The spawner thread runs some of the indexes itself while waiting, see TaskPool.
+        /// threadFunctionWrapper catches all exceptions, hence the return value of mapped() can be ignored
+        std::vector<OfxStatus> status;
+        appPTR->getTaskPool()->mapped( threadIndexes, boost::bind(threadFunctionWrapper,func, _1, nThreads, spawnerThread, customArg), &status );
         
-        for (QFuture<OfxStatus>::const_iterator it = future.begin(); it != future.end(); ++it) {
+        for (std::vector<OfxStatus>::const_iterator it = status.begin(); it != status.end(); ++it) {
             OfxStatus stat = *it;
             if (stat != kOfxStatOK) {
                 return stat;
             }
         }
 
+    } else if (mode == eMultiThreadSuiteModeDedicatedThreads) {
+        
+        /// Each index runs on a thread of the pool and never on the spawner thread, as with new threads
+        std::vector<OfxStatus> status(nThreads, kOfxStatFailed);
+        appPTR->fetchAndAddNRunningThreads( (int)std::min(nThreads, maxConcurrentThread) );
+        appPTR->getOfxThreadPool()->run( boost::bind(&dedicatedThreadFunctionWrapper, func, _1, nThreads, spawnerThread, customArg, &status), nThreads, maxConcurrentThread );
+        appPTR->fetchAndAddNRunningThreads( -(int)std::min(nThreads, maxConcurrentThread) );
+        
+        for (std::vector<OfxStatus>::const_iterator it = status.begin(); it != status.end(); ++it) {
+            OfxStatus stat = *it;
+            if (stat != kOfxStatOK) {
+                return stat;
+            }
+        }
+        
     } else {
         QVector<OfxStatus> status(nThreads); // vector for the return status of each thread
         status.fill(kOfxStatFailed); // by default, a thread fails
@@ -1188,7 +1277,7 @@ OfxHost::multiThread(OfxThreadFunctionV1 func,
                 return stat;
             }
         }
-    } // useThreadPool
+    } // mode
 
     return kOfxStatOK;
 } // multiThread
@@ -1209,8 +1298,10 @@ OfxHost::multiThreadNumCPUS(unsigned int *nCPUs) const
     if (nThreadsToRender == -1) {
         *nCPUs = 1;
     } else {
-        // activeThreadCount may be negative (for example if releaseThread() is called)
-        int activeThreadsCount = QThreadPool::globalInstance()->activeThreadCount();
+        // Only count the threads that are computing: the threads of the global QThreadPool mostly wait for renders
+        // (e.g the writers rendered in parallel or the viewer), counting them left 1 CPU to the effects.
+        // The tiled renders and the multi-thread suite both run on the threads of the task pool.
+        int activeThreadsCount = appPTR->getTaskPool()->getActiveThreadCount();
         
         // Add the number of threads already running by the multiThreadSuite + parallel renders
         activeThreadsCount += appPTR->getNRunningThreads();
@@ -1220,8 +1311,8 @@ OfxHost::multiThreadNumCPUS(unsigned int *nCPUs) const
         
         assert(activeThreadsCount >= 0);
         
-        // better than QThread::idealThreadCount();, because it can be set by a global preference:
-        int maxThreadsCount = QThreadPool::globalInstance()->maxThreadCount();
+        // better than QThread::idealThreadCount();, because it follows the number of render threads preference:
+        int maxThreadsCount = appPTR->getTaskPool()->getMaxThreadCount();
         assert(maxThreadsCount >= 0);
         
         if (nThreadsPerEffect == 0) {
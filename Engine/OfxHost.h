@@ -53,6 +53,29 @@ class OfxHost
 {
 public:
 
+    /**
+     * @brief What loadOFXPlugins did and how long it took, for the startup timing report
+     **/
+    struct PluginsLoadReport
+    {
+        int nBundles; // bundles found in the search path
+        int nChangedBundles; // bundles that were not in the cache or changed since it was written
+        double prefetchTime; // time spent reading the binaries of the changed bundles in parallel, in seconds
+        double scanTime; // time spent reading the cache and loading the changed bundles, in seconds
+        double totalTime; // in seconds
+        bool cacheWritten; // false if the cache was up to date
+
+        PluginsLoadReport()
+            : nBundles(0)
+            , nChangedBundles(0)
+            , prefetchTime(0)
+            , scanTime(0)
+            , totalTime(0)
+            , cacheWritten(false)
+        {
+        }
+    };
+
     OfxHost();
 
     virtual ~OfxHost();
@@ -145,7 +168,8 @@ public:
     /*Reads OFX plugin cache and scan plugins directories
        to load them all.*/
     void loadOFXPlugins(std::map<std::string,std::vector< std::pair<std::string,double> > >* readersMap,
-                        std::map<std::string,std::vector< std::pair<std::string,double> > >* writersMap);
+                        std::map<std::string,std::vector< std::pair<std::string,double> > >* writersMap,
+                        PluginsLoadReport* report = 0);
 
     void clearPluginsLoadedCache();
 
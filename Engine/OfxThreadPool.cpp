@@ -0,0 +1,231 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "OfxThreadPool.h"
+
+#include <algorithm> // min, max
+#include <list>
+#include <vector>
+
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+struct OfxThreadPoolJob
+{
+    OfxThreadPool::IndexFunction func;
+    unsigned int nIndexes;
+    unsigned int nextIndex; // next index to run
+    unsigned int nFinished; // number of indexes done
+    unsigned int nSlots; // number of threads that may still join the job
+    QWaitCondition finished;
+
+    OfxThreadPoolJob()
+        : func()
+        , nIndexes(0)
+        , nextIndex(0)
+        , nFinished(0)
+        , nSlots(0)
+        , finished()
+    {
+    }
+};
+} // anon namespace
+
+class OfxThreadPoolThread
+    : public QThread
+{
+public:
+
+    OfxThreadPoolThread(OfxThreadPoolPrivate* pool,
+                        int index)
+        : QThread()
+        , pool(pool)
+    {
+        setObjectName( QString::fromUtf8("Multi-thread suite %1").arg(index) );
+    }
+
+    virtual ~OfxThreadPoolThread()
+    {
+    }
+
+    OfxThreadPoolPrivate* pool;
+
+private:
+
+    virtual void run() OVERRIDE FINAL;
+};
+
+struct OfxThreadPoolPrivate
+{
+    mutable QMutex lock;
+    QWaitCondition workAvailable;
+    std::list<OfxThreadPoolJob*> queue; // jobs that threads may still join
+    std::vector<OfxThreadPoolThread*> threads;
+    int maxThreads;
+    int nIdleThreads;
+    int nActiveThreads;
+    bool quit;
+
+    OfxThreadPoolPrivate(int maxThreads)
+        : lock()
+        , workAvailable()
+        , queue()
+        , threads()
+        , maxThreads( std::max(1, maxThreads) )
+        , nIdleThreads(0)
+        , nActiveThreads(0)
+        , quit(false)
+    {
+    }
+};
+
+void
+OfxThreadPoolThread::run()
+{
+    QMutexLocker k(&pool->lock);
+
+    for (;;) {
+        ++pool->nIdleThreads;
+        while ( !pool->quit && pool->queue.empty() ) {
+            pool->workAvailable.wait(&pool->lock);
+        }
+        --pool->nIdleThreads;
+        if (pool->quit) {
+            return;
+        }
+
+        OfxThreadPoolJob* job = pool->queue.front();
+        assert(job->nSlots > 0);
+        if (--job->nSlots == 0) {
+            pool->queue.pop_front();
+        }
+
+        ++pool->nActiveThreads;
+        while (job->nextIndex < job->nIndexes) {
+            unsigned int index = job->nextIndex++;
+            k.unlock();
+            job->func(index);
+            k.relock();
+            ///The job may be destroyed as soon as the lock is released after the last index
+            if (++job->nFinished == job->nIndexes) {
+                job->finished.wakeAll();
+            }
+        }
+        --pool->nActiveThreads;
+    }
+}
+
+OfxThreadPool::OfxThreadPool(int maxThreads)
+    : _imp( new OfxThreadPoolPrivate(maxThreads) )
+{
+}
+
+OfxThreadPool::~OfxThreadPool()
+{
+    std::vector<OfxThreadPoolThread*> threads;
+    {
+        QMutexLocker k(&_imp->lock);
+        _imp->quit = true;
+        _imp->workAvailable.wakeAll();
+        threads = _imp->threads;
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i) {
+        threads[i]->wait();
+        delete threads[i];
+    }
+}
+
+int
+OfxThreadPool::getMaxThreadCount() const
+{
+    QMutexLocker k(&_imp->lock);
+
+    return _imp->maxThreads;
+}
+
+int
+OfxThreadPool::getActiveThreadCount() const
+{
+    QMutexLocker k(&_imp->lock);
+
+    return _imp->nActiveThreads;
+}
+
+bool
+OfxThreadPool::isPoolThread()
+{
+    return dynamic_cast<OfxThreadPoolThread*>( QThread::currentThread() ) != 0;
+}
+
+void
+OfxThreadPool::run(const IndexFunction& func,
+                   unsigned int nIndexes,
+                   unsigned int maxConcurrency)
+{
+    if (nIndexes == 0) {
+        return;
+    }
+    ///A thread of the pool waiting for other threads of the pool could wait for itself
+    if ( isPoolThread() ) {
+        for (unsigned int i = 0; i < nIndexes; ++i) {
+            func(i);
+        }
+
+        return;
+    }
+
+    OfxThreadPoolJob job;
+    job.func = func;
+    job.nIndexes = nIndexes;
+    job.nSlots = std::max( 1U, std::min(nIndexes, maxConcurrency) );
+
+    QMutexLocker k(&_imp->lock);
+    _imp->queue.push_back(&job);
+
+    ///Start the threads missing to take all the slots of the queued jobs
+    int nSlots = 0;
+    for (std::list<OfxThreadPoolJob*>::const_iterator it = _imp->queue.begin(); it != _imp->queue.end(); ++it) {
+        nSlots += (int)(*it)->nSlots;
+    }
+    int nToStart = std::min( nSlots - _imp->nIdleThreads, _imp->maxThreads - (int)_imp->threads.size() );
+    for (int i = 0; i < nToStart; ++i) {
+        OfxThreadPoolThread* thread = new OfxThreadPoolThread( _imp.get(), (int)_imp->threads.size() );
+        _imp->threads.push_back(thread);
+        thread->start();
+    }
+    _imp->workAvailable.wakeAll();
+
+    while (job.nFinished < job.nIndexes) {
+        job.finished.wait(&_imp->lock);
+    }
+
+    ///All the indexes are done but the job may still have free slots
+    _imp->queue.remove(&job);
+}
+
+NATRON_NAMESPACE_EXIT;
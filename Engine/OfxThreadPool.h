@@ -0,0 +1,92 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_OfxThreadPool_h
+#define Engine_OfxThreadPool_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief The persistent threads of the OpenFX multi-thread suite, for the plug-ins that cannot run on the TaskPool.
+ *
+ * Some plug-ins (e.g The Foundry's Furnace) crash when their thread function runs on a thread that also runs other
+ * work: the TaskPool executes tasks of a batch on the thread waiting for it and its workers run tiles of renders
+ * in-between. They used to get brand new threads for each multiThread() call instead, which costs a thread creation
+ * per call and per index.
+ * The threads of this pool are only ever used for one thread function at a time: they run nothing else, and the
+ * thread calling run() only waits. A nested call made from a thread of the pool runs on that thread.
+ * The thread-local storage of Natron is copied from the calling thread before each index and cleaned up after it by
+ * the caller's function (see OfxHost::multiThread). The thread-local storage of the plug-ins is not handled: the
+ * threads are re-used by all the plug-ins, so what a plug-in leaves in it is still there on the next call. Plug-ins
+ * expecting brand new threads must use eMultiThreadSuiteModeNewThreads.
+ * Threads are started on demand and stay alive until the pool is destroyed.
+ **/
+struct OfxThreadPoolPrivate;
+class OfxThreadPool
+{
+public:
+
+    typedef boost::function<void (unsigned int)> IndexFunction;
+
+    explicit OfxThreadPool(int maxThreads);
+
+    ~OfxThreadPool();
+
+    int getMaxThreadCount() const;
+
+    /**
+     * @brief Returns the number of threads currently executing a thread function.
+     **/
+    int getActiveThreadCount() const;
+
+    /**
+     * @brief Returns true if the calling thread is a thread of an OfxThreadPool.
+     **/
+    static bool isPoolThread();
+
+    /**
+     * @brief Calls func with each index in [0, nIndexes) on at most maxConcurrency threads of the pool and returns
+     * when they are all done. If the calling thread is a thread of the pool, the indexes are run on it, in order.
+     * func must not throw.
+     **/
+    void run(const IndexFunction& func, unsigned int nIndexes, unsigned int maxConcurrency);
+
+private:
+
+    boost::scoped_ptr<OfxThreadPoolPrivate> _imp;
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_OfxThreadPool_h
@@ -86,6 +86,7 @@ OutputEffectInstance::OutputEffectInstance(boost::shared_ptr<Node> node)
     , _writerCurrentFrame(0)
     , _writerFirstFrame(0)
     , _writerLastFrame(0)
+    , _renderPlan()
 {
 }
 
@@ -392,6 +393,22 @@ OutputEffectInstance::isDoingSequentialRender() const
     return _engine ? _engine->isDoingSequentialRender() : false;
 }
 
+void
+OutputEffectInstance::setRenderPlan(const boost::shared_ptr<RenderPlan>& plan)
+{
+    QMutexLocker k(&_outputEffectDataLock);
+
+    _renderPlan = plan;
+}
+
+boost::shared_ptr<RenderPlan>
+OutputEffectInstance::getRenderPlan() const
+{
+    QMutexLocker k(&_outputEffectDataLock);
+
+    return _renderPlan;
+}
+
 void
 OutputEffectInstance::setFirstFrame(int f)
 {
@@ -455,13 +472,11 @@ OutputEffectInstance::resetTimeSpentRenderingInfos()
     _timeSpentPerFrameRendered.clear();
 }
 
-void
-OutputEffectInstance::reportStats(int time,
-                                  int view,
-                                  double wallTime,
-                                  const std::map<boost::shared_ptr<Node>, NodeRenderStats > & stats)
+std::string
+OutputEffectInstance::getStatsFilePath(int time,
+                                       int view,
+                                       const char* suffix) const
 {
-    std::string filename;
     boost::shared_ptr<KnobI> fileKnob = getKnobByName(kOfxImageEffectFileParamName);
 
     if (fileKnob) {
@@ -469,11 +484,23 @@ OutputEffectInstance::reportStats(int time,
         if  (strKnob) {
             QString qfileName( SequenceParsing::generateFileNameFromPattern(strKnob->getValue(0), time, view).c_str() );
             QtCompat::removeFileExtension(qfileName);
-            qfileName.append("-stats.txt");
-            filename = qfileName.toStdString();
+            qfileName.append(suffix);
+
+            return qfileName.toStdString();
         }
     }
 
+    return std::string();
+}
+
+void
+OutputEffectInstance::reportStats(int time,
+                                  int view,
+                                  double wallTime,
+                                  const std::map<boost::shared_ptr<Node>, NodeRenderStats > & stats)
+{
+    std::string filename = getStatsFilePath(time, view, "-stats.txt");
+
     //If there's no filename knob, do not write anything
     if ( filename.empty() ) {
         std::cout << QObject::tr("Cannot write render statistics file: ").toStdString() << getScriptName_mt_safe() <<
@@ -566,6 +593,19 @@ OutputEffectInstance::reportStats(int time,
         ofile << "Nb cache hit: " << nbCacheMiss << std::endl;
         ofile << "Nb cache miss: " << nbCacheMiss << std::endl;
         ofile << "Nb cache hit requiring mipmap downscaling: " << nbCacheHitButDownscaled << std::endl;
+        int nbConversions, nbSharedConversions;
+        it->second.getImageConversionInfos(&nbConversions, &nbSharedConversions);
+        ofile << "Nb input image conversions: " << nbConversions << std::endl;
+        ofile << "Nb input image conversions shared with other fetches: " << nbSharedConversions << std::endl;
+        int nbArenaAllocations, nbReusedArenaBuffers;
+        std::size_t peakArenaMemory;
+        double averageArenaMemory;
+        it->second.getArenaAllocationInfos(&nbArenaAllocations, &nbReusedArenaBuffers, &peakArenaMemory, &averageArenaMemory);
+        ofile << "Nb temporary image buffers: " << nbArenaAllocations << " (" << nbReusedArenaBuffers << " recycled)" << std::endl;
+        ofile << "Memory of the temporary image buffers in use: peak " << printAsRAM(peakArenaMemory).toStdString()
+              << ", average " << printAsRAM( (U64)averageArenaMemory ).toStdString() << std::endl;
+        ofile << "Time spent waiting for images rendered by other threads: " << Timer::printAsTime(it->second.getTimeSpentWaitingForImages(), false).toStdString() << std::endl;
+        ofile << "Time spent waiting for the Python GIL: " << Timer::printAsTime(it->second.getTimeSpentWaitingForPython(), false).toStdString() << std::endl;
 
         const std::set<std::string> & planes = it->second.getPlanesRendered();
         ofile << "Plane(s) rendered: ";
@@ -590,4 +630,24 @@ OutputEffectInstance::reportStats(int time,
     }
 } // OutputEffectInstance::reportStats
 
+void
+OutputEffectInstance::reportTrace(int time,
+                                  int view,
+                                  const RenderStats& stats)
+{
+    //reportStats already warned if there is no filename knob
+    std::string filename = getStatsFilePath(time, view, "-stats.json");
+    if ( filename.empty() ) {
+        return;
+    }
+
+    std::ofstream ofile(filename.c_str(), std::ofstream::out);
+    if ( !ofile.good() ) {
+        std::cout << QObject::tr("Failure to write render trace file: ").toStdString() << filename << std::endl;
+
+        return;
+    }
+    stats.writeTrace(ofile, time, view);
+}
+
 NATRON_NAMESPACE_EXIT;
@@ -68,6 +68,7 @@ class OutputEffectInstance
                                        It avoids snchronizing all viewers in the app to the render*/
     SequenceTime _writerFirstFrame;
     SequenceTime _writerLastFrame;
+    boost::shared_ptr<RenderPlan> _renderPlan;
 
 
 public:
@@ -96,6 +97,14 @@ public:
      **/
     bool isDoingSequentialRender() const;
 
+    /**
+     * @brief Set by AppInstance::startWritersRendering when this writer is rendered along with other writers sharing
+     * upstream nodes, so that they render the same frames at the same time. Pass NULL once the render is finished.
+     **/
+    void setRenderPlan(const boost::shared_ptr<RenderPlan>& plan);
+
+    boost::shared_ptr<RenderPlan> getRenderPlan() const;
+
 
     /**
      * @brief Starts rendering of all the sequence available, from start to end.
@@ -137,10 +146,19 @@ public:
 
     virtual void reportStats(int time, int view, double wallTime, const std::map<boost::shared_ptr<Node>, NodeRenderStats > & stats);
 
+    /**
+     * @brief Writes the trace of the render of a frame (see RenderStats::writeTrace) next to the image produced,
+     * with the same name and a -stats.json extension.
+     **/
+    void reportTrace(int time, int view, const RenderStats& stats);
+
 protected:
     
     void createWriterPath();
 
+    /// Returns the path of the image produced for the frame with its extension replaced by suffix, or an empty string
+    std::string getStatsFilePath(int time, int view, const char* suffix) const;
+
     void launchRenderSequence(const RenderSequenceArgs& args);
     
     /**
@@ -29,6 +29,7 @@
 #include <list>
 #include <algorithm> // min, max
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QMetaType>
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
@@ -51,7 +52,11 @@
 #include "Engine/KnobFile.h"
 #include "Engine/Node.h"
 #include "Engine/OpenGLViewerI.h"
+#include "Engine/ParallelRenderArgs.h"
+#include "Engine/ParallelRenderController.h"
 #include "Engine/Project.h"
+#include "Engine/RenderMetrics.h"
+#include "Engine/RenderPlan.h"
 #include "Engine/RenderStats.h"
 #include "Engine/RotoContext.h"
 #include "Engine/Settings.h"
@@ -159,6 +164,16 @@ static bool isBufferFull(int nbBufferedElement, int hardwardIdealThreadCount)
     return nbBufferedElement >= hardwardIdealThreadCount * 3;
 }
 
+///Fills the memory state of the process that ParallelRenderController needs to admit new parallel renders
+static void fillMemorySample(ParallelRenderController::Sample* sample)
+{
+    boost::shared_ptr<Settings> settings = appPTR->getCurrentSettings();
+    sample->imageMemoryAllocated = appPTR->getImageMemoryAllocated();
+    sample->memoryBudget = settings->getRamMaximumPercent() * getSystemTotalRAM_conditionnally();
+    sample->freeMemory = (double)getAmountAvailablePhysicalRAM() - settings->getUnreachableRamPercent() * getSystemTotalRAM();
+    sample->cacheMemory = (double)appPTR->getNodeCacheMemorySize();
+}
+
 struct OutputSchedulerThreadPrivate
 {
     
@@ -240,7 +255,15 @@ struct OutputSchedulerThreadPrivate
     
     OutputEffectInstance* outputEffect; //< The effect used as output device
     RenderEngine* engine;
-
+    
+    ///Chooses the number of render threads when the number of parallel renders is automatic
+    QMutex parallelRendersMutex; // protects parallelRendersController
+    ParallelRenderController parallelRendersController;
+    TimeLapse parallelRendersTimer; // wall-clock time of the samples of parallelRendersController
+    QAtomicInt nFramesFinished; // frames finished by the render threads, read by parallelRendersController
+    
+    ///The request pass of the nodes whose parameters are static is shared by all the frames of a render
+    boost::scoped_ptr<RequestPassCache> requestPassCache;
     
     OutputSchedulerThreadPrivate(RenderEngine* engine,OutputEffectInstance* effect,OutputSchedulerThread::ProcessFrameModeEnum mode)
     : buf()
@@ -284,6 +307,11 @@ struct OutputSchedulerThreadPrivate
     , framesToRenderNotEmptyCond()
     , outputEffect(effect)
     , engine(engine)
+    , parallelRendersMutex()
+    , parallelRendersController()
+    , parallelRendersTimer()
+    , nFramesFinished(0)
+    , requestPassCache(new RequestPassCache)
     {
        
     }
@@ -750,6 +778,24 @@ OutputSchedulerThread::pickFrameToRender(RenderThreadTask* thread,bool* enableRe
         
         int ret = _imp->framesToRender.front();
         _imp->framesToRender.pop_front();
+        
+        ///When other writers share upstream nodes with this one, wait until they caught up so that the shared
+        ///images are still in the cache when they need them
+        boost::shared_ptr<RenderPlan> plan = _imp->outputEffect->getRenderPlan();
+        if (plan) {
+            l.unlock();
+            if ( !plan->waitForFrameTurn(_imp->outputEffect, ret, thread) ) {
+                ///The thread is quitting: leave the frame to another thread
+                l.relock();
+                _imp->framesToRender.push_front(ret);
+                _imp->framesToRenderNotEmptyCond.wakeOne();
+                thread->notifyIsRunning(false);
+                *enableRenderStats = false;
+                
+                return -1;
+            }
+        }
+        
         ///Flag the thread as active
         {
             QMutexLocker l(&_imp->renderThreadsMutex);
@@ -836,6 +882,15 @@ OutputSchedulerThread::startRender()
         nThreads = (int)_imp->renderThreads.size();
     }
     
+    ///Measurements of the previous render are not relevant to this one: the graph may have changed
+    {
+        QMutexLocker l(&_imp->parallelRendersMutex);
+        int nCores = appPTR->getHardwareIdealThreadCount();
+        int userSettingParallelThreads = appPTR->getCurrentSettings()->getNumberOfParallelRenders();
+        _imp->parallelRendersController.reset(std::max(nCores, userSettingParallelThreads), nCores);
+    }
+    _imp->requestPassCache->clear();
+    
     ///Start with one thread if it doesn't exist
     if (nThreads == 0) {
         int lastNThreads;
@@ -1224,51 +1279,96 @@ OutputSchedulerThread::run()
 void
 OutputSchedulerThread::adjustNumberOfThreads(int* newNThreads, int *lastNThreads)
 {
-    ///////////
-    /////If we were analysing the CPU activity, now set the appropriate number of threads to render.
-    int optimalNThreads;
-    
     ///How many parallel renders the user wants
     int userSettingParallelThreads = appPTR->getCurrentSettings()->getNumberOfParallelRenders();
     
-    ///How many threads are running in the application
-    int runningThreads = appPTR->getNRunningThreads() + QThreadPool::globalInstance()->activeThreadCount();
-    
     ///How many current threads are used by THIS renderer
     int currentParallelRenders = getNRenderThreads();
     *lastNThreads = currentParallelRenders;
     
-    if (userSettingParallelThreads == 0) {
-        ///User wants it to be automatically computed, do a simple heuristic: launch as many parallel renders
-        ///as there are cores
-        optimalNThreads = appPTR->getHardwareIdealThreadCount();
-    } else {
-        optimalNThreads = userSettingParallelThreads;
-    }
-    optimalNThreads = std::max(1,optimalNThreads);
-
-
-    if ((runningThreads < optimalNThreads && currentParallelRenders < optimalNThreads) || currentParallelRenders == 0) {
-     
-        ////////
-        ///Launch 1 thread
-        QMutexLocker l(&_imp->renderThreadsMutex);
+    if (userSettingParallelThreads != 0) {
         
-        _imp->appendRunnable(createRunnable());
-        *newNThreads = currentParallelRenders +  1;
+        ///How many threads are running in the application
+        int runningThreads = appPTR->getNRunningThreads() + QThreadPool::globalInstance()->activeThreadCount();
+        int optimalNThreads = std::max(1,userSettingParallelThreads);
         
-    } else if (runningThreads > optimalNThreads && currentParallelRenders > optimalNThreads) {
-        ////////
-        ///Stop 1 thread
-        stopRenderThreads(1);
-        *newNThreads = currentParallelRenders - 1;
+        ///Even if the user asked for it, do not start frames that would not fit in memory
+        ParallelRenderController::Sample sample;
+        sample.framesRendered = (U64)(int)_imp->nFramesFinished;
+        fillMemorySample(&sample);
+        int memoryLimit;
+        {
+            QMutexLocker l(&_imp->parallelRendersMutex);
+            memoryLimit = _imp->parallelRendersController.updateMemoryLimit(sample, currentParallelRenders);
+        }
         
-    } else {
-        /////////
-        ///Keep the current count
-        *newNThreads = std::max(1,currentParallelRenders);
+        if ((runningThreads < optimalNThreads && currentParallelRenders < optimalNThreads && currentParallelRenders < memoryLimit) || currentParallelRenders == 0) {
+            
+            ////////
+            ///Launch 1 thread
+            QMutexLocker l(&_imp->renderThreadsMutex);
+            
+            _imp->appendRunnable(createRunnable());
+            *newNThreads = currentParallelRenders +  1;
+            
+        } else if ((runningThreads > optimalNThreads && currentParallelRenders > optimalNThreads) || currentParallelRenders > memoryLimit) {
+            ////////
+            ///Stop 1 thread
+            stopRenderThreads(1);
+            *newNThreads = currentParallelRenders - 1;
+            
+        } else {
+            /////////
+            ///Keep the current count
+            *newNThreads = std::max(1,currentParallelRenders);
+        }
+        return;
     }
-}
+    
+    ///The user wants it to be automatically computed: threads scheduled for removal no longer count, they are
+    ///just finishing their frame
+    int nonQuittingThreads = 0;
+    {
+        QMutexLocker l(&_imp->renderThreadsMutex);
+        for (RenderThreads::iterator it = _imp->renderThreads.begin(); it != _imp->renderThreads.end(); ++it) {
+            if (!it->thread->mustQuit()) {
+                ++nonQuittingThreads;
+            }
+        }
+    }
+    
+    ParallelRenderController::Sample sample;
+    sample.time = _imp->parallelRendersTimer.getTimeSinceCreation();
+    sample.cpuTime = getProcessCPUTime();
+    sample.framesRendered = (U64)(int)_imp->nFramesFinished;
+    sample.cacheOccupancy = appPTR->getNodeCacheMemoryOccupancy();
+    sample.cacheEvictions = appPTR->getNodeCacheNumEvictions();
+    fillMemorySample(&sample);
+    
+    ParallelRenderController::Decision decision;
+    int target;
+    {
+        QMutexLocker l(&_imp->parallelRendersMutex);
+        target = _imp->parallelRendersController.update(sample, nonQuittingThreads, &decision);
+    }
+    
+    if (target > nonQuittingThreads) {
+        QMutexLocker l(&_imp->renderThreadsMutex);
+        for (int i = nonQuittingThreads; i < target; ++i) {
+            _imp->appendRunnable(createRunnable());
+        }
+    } else if (target < nonQuittingThreads) {
+        stopRenderThreads(nonQuittingThreads - target);
+    }
+    if (target != nonQuittingThreads && nonQuittingThreads > 0) {
+        ///Log the decisions so that the thresholds of ParallelRenderController can be tuned
+        qDebug() << _imp->outputEffect->getScriptName_mt_safe().c_str() << ": parallel renders" << nonQuittingThreads
+        << "->" << target << "(" << decision.reason << "), fps:" << decision.framesPerSecond
+        << "CPU:" << decision.cpuUtilization << "node cache:" << decision.cacheOccupancy
+        << "frame memory:" << printAsRAM( (U64)decision.frameMemory ) << "memory limit:" << decision.memoryLimit;
+    }
+    *newNThreads = target;
+} // adjustNumberOfThreads
 
 void
 OutputSchedulerThread::notifyFrameRendered(int frame,
@@ -1286,6 +1386,9 @@ OutputSchedulerThread::notifyFrameRendered(int frame,
         std::map<boost::shared_ptr<Node>,NodeRenderStats > statResults = stats->getStats(&timeSpent);
         if (!statResults.empty()) {
             _imp->outputEffect->reportStats(frame, viewIndex, timeSpent, statResults);
+            if ( stats->isInDepthProfilingEnabled() ) {
+                _imp->outputEffect->reportTrace(frame, viewIndex, *stats);
+            }
         }
     }
     //U64 nbFramesLeftToRender;
@@ -1937,6 +2040,23 @@ RenderThreadTask::~RenderThreadTask()
     
 }
 
+void
+OutputSchedulerThread::notifyRenderThreadFrameFinished(int time)
+{
+    _imp->nFramesFinished.ref();
+    
+    boost::shared_ptr<RenderPlan> plan = _imp->outputEffect->getRenderPlan();
+    if (plan) {
+        plan->notifyFrameFinished(_imp->outputEffect, time);
+    }
+}
+
+RequestPassCache*
+OutputSchedulerThread::getRequestPassCache() const
+{
+    return _imp->requestPassCache.get();
+}
+
 void
 RenderThreadTask::run()
 {
@@ -1953,7 +2073,13 @@ RenderThreadTask::run()
             break;
         }
         
-        renderFrame(time, viewsToRender, enableRenderStats);
+        {
+            RenderMetrics::GaugeIncrementer framesInFlight(eRenderMetricFramesInFlight);
+            RenderMetrics::TimeSampler frameTime(eRenderHistogramFrameTime);
+            renderFrame(time, viewsToRender, enableRenderStats);
+        }
+        RenderMetrics::add(eRenderMetricFramesRendered);
+        _imp->scheduler->notifyRenderThreadFrameFinished(time);
         
         appPTR->getAppTLS()->cleanupTLSForThread();
         
@@ -2167,7 +2293,7 @@ private:
                 rod.toPixelEnclosing(scale, par, &renderWindow);
                 
                 FrameRequestMap request;
-                stat = EffectInstance::computeRequestPass(time, viewsToRender[view], mipMapLevel, rod, outputNode, request);
+                stat = EffectInstance::computeRequestPass(time, viewsToRender[view], mipMapLevel, rod, outputNode, request, _imp->scheduler->getRequestPassCache());
                 if (stat == eStatusFailed) {
                     _imp->scheduler->notifyRenderFailure("Error caught while rendering");
                     return;
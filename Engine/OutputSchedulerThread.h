@@ -279,6 +279,17 @@ public:
      **/
     void notifyThreadAboutToQuit(RenderThreadTask* thread);
     
+    /**
+     * @brief Called by the render-threads each time they finished rendering a frame, to measure the throughput
+     * and let the writers following the same RenderPlan go on
+     **/
+    void notifyRenderThreadFrameFinished(int time);
+    
+    /**
+     * @brief The results of the request pass shared by the frames of the current render, see RequestPassCache
+     **/
+    RequestPassCache* getRequestPassCache() const;
+    
     /**
      *@brief The slot called by the GUI to set the requested fps.
      **/
@@ -434,7 +445,8 @@ private:
     void pushAllFrameRange();
     
     /**
-     * @brief Starts/stops more threads according to CPU activity and user preferences 
+     * @brief Starts/stops more threads according to user preferences, or if the number of parallel renders is
+     * automatic according to the throughput, the CPU activity and the node cache occupancy (see ParallelRenderController)
      * @param optimalNThreads[out] Will be set to the new number of threads
      **/
     void adjustNumberOfThreads(int* newNThreads, int *lastNThreads);
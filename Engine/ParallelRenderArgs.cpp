@@ -24,17 +24,54 @@
 
 #include "ParallelRenderArgs.h"
 
+#include <QtCore/QMutex>
+
 #include "Engine/AppManager.h"
 #include "Engine/Settings.h"
 #include "Engine/EffectInstance.h"
 #include "Engine/Image.h"
+#include "Engine/Knob.h"
 #include "Engine/Node.h"
 #include "Engine/NodeGroup.h"
 #include "Engine/RotoContext.h"
 #include "Engine/RotoDrawableItem.h"
 
+//Number of render windows for which the RequestPassCache remembers the regions of interest of a node
+#define NATRON_REQUEST_PASS_CACHE_MAX_WINDOWS 4
+
 NATRON_NAMESPACE_ENTER;
 
+namespace {
+
+/**
+ * @brief Returns the RoD of each input of the effect at the given time, a null rectangle for disconnected inputs.
+ **/
+void
+getInputsRoD(EffectInstance* effect,
+             double time,
+             int view,
+             unsigned int mipMapLevel,
+             std::vector<RectD>* inputsRod)
+{
+    int maxInputs = effect->getMaxInputCount();
+
+    inputsRod->resize(maxInputs);
+    for (int i = 0; i < maxInputs; ++i) {
+        EffectInstance* input = effect->getInput(i);
+        if (!input) {
+            continue;
+        }
+        RenderScale scale( Image::getScaleFromMipMapLevel(input->supportsRenderScaleMaybe() == EffectInstance::eSupportsYes ? mipMapLevel : 0) );
+        bool isProjectFormat;
+        StatusEnum stat = input->getRegionOfDefinition_public(input->getNode()->getHashValue(), time, scale, view, &(*inputsRod)[i], &isProjectFormat);
+        if (stat == eStatusFailed) {
+            (*inputsRod)[i] = RectD();
+        }
+    }
+}
+
+} // anon namespace
+
 EffectInstance::RenderRoIRetCode EffectInstance::treeRecurseFunctor(bool isRenderFunctor,
                                                                             const boost::shared_ptr<Node>& node,
                                                                             const FramesNeededMap& framesNeeded,
@@ -49,7 +86,8 @@ EffectInstance::RenderRoIRetCode EffectInstance::treeRecurseFunctor(bool isRende
                                                                            EffectInstance::InputImagesMap* inputImages, // render functor specific
                                                                             const EffectInstance::ComponentsNeededMap* neededComps, // render functor specific
                                                                             bool useScaleOneInputs, // render functor specific
-                                                                            bool byPassCache) // render functor specific
+                                                                            bool byPassCache, // render functor specific
+                                                                            RequestPassCache* requestPassCache) // roi functor specific
 {
     ///For all frames/views needed, call recursively on inputs with the appropriate RoI
 
@@ -231,7 +269,8 @@ EffectInstance::RenderRoIRetCode EffectInstance::treeRecurseFunctor(bool isRende
                                                                                                inputNode,
                                                                                                treeRoot,
                                                                                                roi,
-                                                                                               *requests);
+                                                                                               *requests,
+                                                                                               requestPassCache);
                                 
                                 if (stat == eStatusFailed) {
                                     return EffectInstance::eRenderRoIRetCodeFailed;
@@ -328,7 +367,8 @@ StatusEnum EffectInstance::getInputsRoIsFunctor(bool useTransforms,
                                                                 const boost::shared_ptr<Node>& node,
                                                                 const boost::shared_ptr<Node>& treeRoot,
                                                                 const RectD& canonicalRenderWindow,
-                                                                FrameRequestMap& requests)
+                                                                FrameRequestMap& requests,
+                                                                RequestPassCache* cache)
 {
     
     boost::shared_ptr<NodeFrameRequest> nodeRequest;
@@ -388,46 +428,57 @@ StatusEnum EffectInstance::getInputsRoIsFunctor(bool useTransforms,
         
         fvRequest = &nodeRequest->frames[frameView];
         
-        ///Get the RoD
-        StatusEnum stat = effect->getRegionOfDefinition_public(nodeRequest->nodeHash, time, nodeRequest->mappedScale, view, &fvRequest->globalData.rod, &fvRequest->globalData.isProjectFormat);
-        //If failed it should have failed earlier
-        if (stat == eStatusFailed && !fvRequest->globalData.rod.isNull()) {
-            return stat;
+        ///If the parameters of the node are static, the datas may be deduced from the ones of another frame
+        std::vector<RectD> inputsRod;
+        bool useCache = cache && RequestPassCache::isEffectStatic(effect) && cache->isCacheable(effect, nodeRequest->nodeHash, mappedLevel, view);
+        if (useCache) {
+            getInputsRoD(effect, time, view, originalMipMapLevel, &inputsRod);
+            cache->getGlobalData(effect, nodeRequest->nodeHash, mappedLevel, view, time, inputsRod, &fvRequest->globalData, &fvRequest->cachedGlobalDataVersion);
         }
         
-        
-        ///Check identity
-        fvRequest->globalData.identityInputNb = -1;
-        fvRequest->globalData.inputIdentityTime = 0.;
-        
-        RectI pixelRod;
-        fvRequest->globalData.rod.toPixelEnclosing(mappedLevel, par, &pixelRod);
-        
-        
-        if (view != 0 && viewInvariance == eViewInvarianceAllViewsInvariant) {
-            fvRequest->globalData.isIdentity = true;
-            fvRequest->globalData.identityInputNb = -2;
-            fvRequest->globalData.inputIdentityTime = time;
-        } else {
-            try {
-                fvRequest->globalData.isIdentity = effect->isIdentity_public(true, nodeRequest->nodeHash, time, nodeRequest->mappedScale, pixelRod, view, &fvRequest->globalData.inputIdentityTime, &fvRequest->globalData.identityInputNb);
-            } catch (...) {
-                return eStatusFailed;
+        if (!fvRequest->cachedGlobalDataVersion) {
+            ///Get the RoD
+            StatusEnum stat = effect->getRegionOfDefinition_public(nodeRequest->nodeHash, time, nodeRequest->mappedScale, view, &fvRequest->globalData.rod, &fvRequest->globalData.isProjectFormat);
+            //If failed it should have failed earlier
+            if (stat == eStatusFailed && !fvRequest->globalData.rod.isNull()) {
+                return stat;
+            }
+            
+            
+            ///Check identity
+            fvRequest->globalData.identityInputNb = -1;
+            fvRequest->globalData.inputIdentityTime = 0.;
+            
+            RectI pixelRod;
+            fvRequest->globalData.rod.toPixelEnclosing(mappedLevel, par, &pixelRod);
+            
+            
+            if (view != 0 && viewInvariance == eViewInvarianceAllViewsInvariant) {
+                fvRequest->globalData.isIdentity = true;
+                fvRequest->globalData.identityInputNb = -2;
+                fvRequest->globalData.inputIdentityTime = time;
+            } else {
+                try {
+                    fvRequest->globalData.isIdentity = effect->isIdentity_public(true, nodeRequest->nodeHash, time, nodeRequest->mappedScale, pixelRod, view, &fvRequest->globalData.inputIdentityTime, &fvRequest->globalData.identityInputNb);
+                } catch (...) {
+                    return eStatusFailed;
+                }
+            }
+            
+            ///Get the frame/views needed for this frame/view
+            fvRequest->globalData.frameViewsNeeded = effect->getFramesNeeded_public(nodeRequest->nodeHash, time, view, mappedLevel);
+            
+            if (useCache) {
+                cache->setGlobalData(effect, nodeRequest->nodeHash, mappedLevel, view, time, inputsRod, fvRequest->globalData);
             }
         }
         
-        
         ///Concatenate transforms if needed
         if (useTransforms) {
             fvRequest->globalData.transforms.reset(new InputMatrixMap);
             effect->tryConcatenateTransforms(time, view, nodeRequest->mappedScale, fvRequest->globalData.transforms.get());
         }
         
-        ///Get the frame/views needed for this frame/view
-        fvRequest->globalData.frameViewsNeeded = effect->getFramesNeeded_public(nodeRequest->nodeHash, time, view, mappedLevel);
-        
-        
-        
         
     } // if (foundFrameView != nodeRequest->frames.end()) {
     
@@ -449,7 +500,8 @@ StatusEnum EffectInstance::getInputsRoIsFunctor(bool useTransforms,
                                                    node,
                                                    treeRoot,
                                                    canonicalRenderWindow,
-                                                   requests);
+                                                   requests,
+                                                   cache);
             return stat;
         }
         //Should fail on the assert above
@@ -467,7 +519,8 @@ StatusEnum EffectInstance::getInputsRoIsFunctor(bool useTransforms,
                                                    inputEffectIdentity->getNode(),
                                                    treeRoot,
                                                    canonicalRenderWindow,
-                                                   requests);
+                                                   requests,
+                                                   cache);
             return stat;
         }
         
@@ -477,7 +530,13 @@ StatusEnum EffectInstance::getInputsRoIsFunctor(bool useTransforms,
     
     ///Compute the regions of interest in input for this RoI
     FrameViewPerRequestData fvPerRequestData;
-    effect->getRegionsOfInterest_public(time, nodeRequest->mappedScale, fvRequest->globalData.rod, canonicalRenderWindow, view, &fvPerRequestData.inputsRoi);
+    if (!fvRequest->cachedGlobalDataVersion ||
+        !cache->getInputsRoI(effect, nodeRequest->nodeHash, mappedLevel, view, fvRequest->cachedGlobalDataVersion, canonicalRenderWindow, &fvPerRequestData.inputsRoi)) {
+        effect->getRegionsOfInterest_public(time, nodeRequest->mappedScale, fvRequest->globalData.rod, canonicalRenderWindow, view, &fvPerRequestData.inputsRoi);
+        if (fvRequest->cachedGlobalDataVersion) {
+            cache->setInputsRoI(effect, nodeRequest->nodeHash, mappedLevel, view, fvRequest->cachedGlobalDataVersion, canonicalRenderWindow, fvPerRequestData.inputsRoi);
+        }
+    }
     
     
     
@@ -511,7 +570,8 @@ StatusEnum EffectInstance::getInputsRoIsFunctor(bool useTransforms,
                                                               0,
                                                               0,
                                                               false,
-                                                              false);
+                                                              false,
+                                                              cache);
     if (ret == EffectInstance::eRenderRoIRetCodeFailed) {
         return eStatusFailed;
     }
@@ -525,7 +585,8 @@ EffectInstance::computeRequestPass(double time,
                                    unsigned int mipMapLevel,
                                    const RectD& renderWindow,
                                    const boost::shared_ptr<Node>& treeRoot,
-                                   FrameRequestMap& request)
+                                   FrameRequestMap& request,
+                                   RequestPassCache* cache)
 {
     bool doTransforms = appPTR->getCurrentSettings()->isTransformConcatenationEnabled();
     StatusEnum stat = getInputsRoIsFunctor(doTransforms,
@@ -535,7 +596,8 @@ EffectInstance::computeRequestPass(double time,
                                                    treeRoot,
                                                    treeRoot,
                                                    renderWindow,
-                                                   request);
+                                                   request,
+                                                   cache);
     
     if (stat == eStatusFailed) {
         return stat;
@@ -846,4 +908,359 @@ ParallelRenderArgsSetter::~ParallelRenderArgsSetter()
     }
 }
 
+namespace {
+
+struct RequestPassCacheKey
+{
+    EffectInstance* effect;
+    U64 nodeHash;
+    unsigned int mappedLevel;
+    int view;
+
+    bool operator<(const RequestPassCacheKey& other) const
+    {
+        if (effect != other.effect) {
+            return effect < other.effect;
+        }
+        if (nodeHash != other.nodeHash) {
+            return nodeHash < other.nodeHash;
+        }
+        if (mappedLevel != other.mappedLevel) {
+            return mappedLevel < other.mappedLevel;
+        }
+
+        return view < other.view;
+    }
+};
+
+enum RequestPassCacheStateEnum
+{
+    eRequestPassCacheStateProbing = 0, // a single frame was recorded so far
+    eRequestPassCacheStateRelative, // the times in the datas are relative to the frame being rendered
+    eRequestPassCacheStateAbsolute, // the datas are the same for all frames
+    eRequestPassCacheStateUncacheable // the datas depend on the frame in another way
+};
+
+struct RequestPassCacheEntry
+{
+    RequestPassCacheStateEnum state;
+
+    ///Changes each time the datas below are replaced, so that the regions of interest are never mixed up
+    int version;
+
+    ///The frame at which the datas were computed and the RoDs of the inputs at that frame
+    double time;
+    std::vector<RectD> inputsRod;
+    FrameViewRequestGlobalData globalData;
+
+    ///The regions of interest of the inputs per render window, the most recently used first
+    std::list<std::pair<RectD, RoIMap> > rois;
+
+    RequestPassCacheEntry()
+    : state(eRequestPassCacheStateProbing)
+    , version(0)
+    , time(0)
+    , inputsRod()
+    , globalData()
+    , rois()
+    {
+    }
+};
+
+typedef std::map<RequestPassCacheKey, RequestPassCacheEntry> RequestPassCacheEntries;
+
+RequestPassCacheKey
+makeRequestPassCacheKey(EffectInstance* effect,
+                        U64 nodeHash,
+                        unsigned int mappedLevel,
+                        int view)
+{
+    RequestPassCacheKey key;
+
+    key.effect = effect;
+    key.nodeHash = nodeHash;
+    key.mappedLevel = mappedLevel;
+    key.view = view;
+
+    return key;
+}
+
+void
+shiftGlobalData(double offset,
+                FrameViewRequestGlobalData* data)
+{
+    if (data->identityInputNb != -1) {
+        data->inputIdentityTime += offset;
+    }
+    for (FramesNeededMap::iterator it = data->frameViewsNeeded.begin(); it != data->frameViewsNeeded.end(); ++it) {
+        for (std::map<int, std::vector<OfxRangeD> >::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+            for (std::size_t i = 0; i < it2->second.size(); ++i) {
+                it2->second[i].min += offset;
+                it2->second[i].max += offset;
+            }
+        }
+    }
+}
+
+bool
+isSameFramesNeeded(const FramesNeededMap& a,
+                   const FramesNeededMap& b)
+{
+    if ( a.size() != b.size() ) {
+        return false;
+    }
+    for (FramesNeededMap::const_iterator it = a.begin(), itB = b.begin(); it != a.end(); ++it, ++itB) {
+        if ( (it->first != itB->first) || (it->second.size() != itB->second.size()) ) {
+            return false;
+        }
+        for (std::map<int, std::vector<OfxRangeD> >::const_iterator it2 = it->second.begin(), it2B = itB->second.begin(); it2 != it->second.end(); ++it2, ++it2B) {
+            if ( (it2->first != it2B->first) || (it2->second.size() != it2B->second.size()) ) {
+                return false;
+            }
+            for (std::size_t i = 0; i < it2->second.size(); ++i) {
+                if ( (it2->second[i].min != it2B->second[i].min) || (it2->second[i].max != it2B->second[i].max) ) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool
+isSameGlobalData(const FrameViewRequestGlobalData& a,
+                 const FrameViewRequestGlobalData& b)
+{
+    return a.rod == b.rod &&
+           a.isProjectFormat == b.isProjectFormat &&
+           a.isIdentity == b.isIdentity &&
+           a.identityInputNb == b.identityInputNb &&
+           (a.identityInputNb == -1 || a.inputIdentityTime == b.inputIdentityTime) &&
+           isSameFramesNeeded(a.frameViewsNeeded, b.frameViewsNeeded);
+}
+} // anon namespace
+
+struct RequestPassCachePrivate
+{
+    QMutex lock;
+    RequestPassCacheEntries entries;
+    int lastVersion;
+
+    RequestPassCachePrivate()
+    : lock()
+    , entries()
+    , lastVersion(0)
+    {
+    }
+
+    void setReference(double time,
+                      const std::vector<RectD>& inputsRod,
+                      const FrameViewRequestGlobalData& globalData,
+                      RequestPassCacheEntry* entry)
+    {
+        entry->version = ++lastVersion;
+        entry->time = time;
+        entry->inputsRod = inputsRod;
+        entry->globalData = globalData;
+        ///Transforms depend on the parameters of the nodes upstream, they are computed for each frame
+        entry->globalData.transforms.reset();
+        entry->globalData.reroutesMap.reset();
+        entry->rois.clear();
+    }
+};
+
+RequestPassCache::RequestPassCache()
+    : _imp( new RequestPassCachePrivate() )
+{
+}
+
+RequestPassCache::~RequestPassCache()
+{
+}
+
+bool
+RequestPassCache::getGlobalData(EffectInstance* effect,
+                                U64 nodeHash,
+                                unsigned int mappedLevel,
+                                int view,
+                                double time,
+                                const std::vector<RectD>& inputsRod,
+                                FrameViewRequestGlobalData* globalData,
+                                int* version)
+{
+    QMutexLocker k(&_imp->lock);
+    RequestPassCacheEntries::const_iterator found = _imp->entries.find( makeRequestPassCacheKey(effect, nodeHash, mappedLevel, view) );
+
+    if ( found == _imp->entries.end() ) {
+        return false;
+    }
+    const RequestPassCacheEntry& entry = found->second;
+    if ( ( (entry.state != eRequestPassCacheStateRelative) && (entry.state != eRequestPassCacheStateAbsolute) ) ||
+         (entry.inputsRod != inputsRod) ) {
+        return false;
+    }
+    *globalData = entry.globalData;
+    if (entry.state == eRequestPassCacheStateRelative) {
+        shiftGlobalData(time - entry.time, globalData);
+    }
+    *version = entry.version;
+
+    return true;
+}
+
+void
+RequestPassCache::setGlobalData(EffectInstance* effect,
+                                U64 nodeHash,
+                                unsigned int mappedLevel,
+                                int view,
+                                double time,
+                                const std::vector<RectD>& inputsRod,
+                                const FrameViewRequestGlobalData& globalData)
+{
+    QMutexLocker k(&_imp->lock);
+    std::pair<RequestPassCacheEntries::iterator, bool> ret = _imp->entries.insert( std::make_pair( makeRequestPassCacheKey(effect, nodeHash, mappedLevel, view), RequestPassCacheEntry() ) );
+    RequestPassCacheEntry& entry = ret.first->second;
+
+    if (ret.second) {
+        _imp->setReference(time, inputsRod, globalData, &entry);
+
+        return;
+    }
+    if (entry.state == eRequestPassCacheStateUncacheable) {
+        return;
+    }
+    if (entry.inputsRod != inputsRod) {
+        ///The inputs changed, the datas cannot be compared: start over from this frame
+        _imp->setReference(time, inputsRod, globalData, &entry);
+
+        return;
+    }
+    if (time == entry.time) {
+        return;
+    }
+
+    FrameViewRequestGlobalData shifted = entry.globalData;
+    shiftGlobalData(time - entry.time, &shifted);
+    bool isRelative = isSameGlobalData(shifted, globalData);
+    bool isAbsolute = isSameGlobalData(entry.globalData, globalData);
+
+    switch (entry.state) {
+    case eRequestPassCacheStateProbing:
+        if (isRelative) {
+            entry.state = eRequestPassCacheStateRelative;
+        } else if (isAbsolute) {
+            entry.state = eRequestPassCacheStateAbsolute;
+        } else {
+            entry.state = eRequestPassCacheStateUncacheable;
+        }
+        break;
+    case eRequestPassCacheStateRelative:
+        if (!isRelative) {
+            entry.state = eRequestPassCacheStateUncacheable;
+        }
+        break;
+    case eRequestPassCacheStateAbsolute:
+        if (!isAbsolute) {
+            entry.state = eRequestPassCacheStateUncacheable;
+        }
+        break;
+    case eRequestPassCacheStateUncacheable:
+        break;
+    }
+}
+
+bool
+RequestPassCache::isCacheable(EffectInstance* effect,
+                              U64 nodeHash,
+                              unsigned int mappedLevel,
+                              int view) const
+{
+    QMutexLocker k(&_imp->lock);
+    RequestPassCacheEntries::const_iterator found = _imp->entries.find( makeRequestPassCacheKey(effect, nodeHash, mappedLevel, view) );
+
+    return found == _imp->entries.end() || found->second.state != eRequestPassCacheStateUncacheable;
+}
+
+bool
+RequestPassCache::getInputsRoI(EffectInstance* effect,
+                               U64 nodeHash,
+                               unsigned int mappedLevel,
+                               int view,
+                               int version,
+                               const RectD& renderWindow,
+                               RoIMap* inputsRoi)
+{
+    QMutexLocker k(&_imp->lock);
+    RequestPassCacheEntries::iterator found = _imp->entries.find( makeRequestPassCacheKey(effect, nodeHash, mappedLevel, view) );
+
+    if ( ( found == _imp->entries.end() ) || (found->second.version != version) ) {
+        return false;
+    }
+    std::list<std::pair<RectD, RoIMap> >& rois = found->second.rois;
+    for (std::list<std::pair<RectD, RoIMap> >::iterator it = rois.begin(); it != rois.end(); ++it) {
+        if (it->first == renderWindow) {
+            *inputsRoi = it->second;
+            rois.splice(rois.begin(), rois, it);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+RequestPassCache::setInputsRoI(EffectInstance* effect,
+                               U64 nodeHash,
+                               unsigned int mappedLevel,
+                               int view,
+                               int version,
+                               const RectD& renderWindow,
+                               const RoIMap& inputsRoi)
+{
+    QMutexLocker k(&_imp->lock);
+    RequestPassCacheEntries::iterator found = _imp->entries.find( makeRequestPassCacheKey(effect, nodeHash, mappedLevel, view) );
+
+    if ( ( found == _imp->entries.end() ) || (found->second.version != version) ) {
+        return;
+    }
+    std::list<std::pair<RectD, RoIMap> >& rois = found->second.rois;
+    for (std::list<std::pair<RectD, RoIMap> >::iterator it = rois.begin(); it != rois.end(); ++it) {
+        if (it->first == renderWindow) {
+            return;
+        }
+    }
+    rois.push_front( std::make_pair(renderWindow, inputsRoi) );
+    if (rois.size() > NATRON_REQUEST_PASS_CACHE_MAX_WINDOWS) {
+        rois.pop_back();
+    }
+}
+
+void
+RequestPassCache::clear()
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->entries.clear();
+}
+
+bool
+RequestPassCache::isEffectStatic(EffectInstance* effect)
+{
+    if ( !effect->isRequestPassTimeInvariant() || effect->isFrameVarying() || effect->getHasAnimation() || effect->getNode()->getRotoContext() ) {
+        return false;
+    }
+    const std::vector<boost::shared_ptr<KnobI> >& knobs = effect->getKnobs();
+    for (std::vector<boost::shared_ptr<KnobI> >::const_iterator it = knobs.begin(); it != knobs.end(); ++it) {
+        for (int i = 0; i < (*it)->getDimension(); ++i) {
+            if ( !(*it)->getExpression(i).empty() || (*it)->getMaster(i).second ) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 NATRON_NAMESPACE_EXIT;
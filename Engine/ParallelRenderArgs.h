@@ -28,6 +28,7 @@
 #include <set>
 #include <map>
 #include <list>
+#include <vector>
 
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/shared_ptr.hpp>
@@ -217,6 +218,18 @@ struct FrameViewRequest
     
     ///Global datas for this frame/view set upon first request
     FrameViewRequestGlobalData globalData;
+
+    ///If the global datas were deduced from another frame by a RequestPassCache, the version of the cached datas they
+    ///come from so that the regions of interest can be taken from the cache as well, 0 otherwise
+    int cachedGlobalDataVersion;
+
+    FrameViewRequest()
+    : requests()
+    , finalData()
+    , globalData()
+    , cachedGlobalDataVersion(0)
+    {
+    }
     
 };
 
@@ -259,6 +272,97 @@ struct NodeFrameRequest
 
 typedef std::map<boost::shared_ptr<Node>,boost::shared_ptr<NodeFrameRequest> > FrameRequestMap;
 
+struct RequestPassCachePrivate;
+
+/**
+ * @brief Remembers the results of the request pass across the frames of a sequence render, so that they are not
+ * asked again to the plug-ins for each frame.
+ * Only the nodes that declare their request pass time invariant (see EffectInstance::isRequestPassTimeInvariant) and
+ * whose own parameters are static (no animation, no expression, no link, not frame varying) are cached.
+ * For each of them the RoD, identity and frames needed computed at a first frame are compared with the ones computed
+ * at a second frame to find out whether they are expressed relatively to the frame being rendered (e.g: a TimeOffset
+ * node) or are the same for all frames (e.g: a FrameHold node). Once known, the datas of the other frames are deduced
+ * from the ones of the first frame, as long as the RoDs of the inputs of the node do not change.
+ * The regions of interest requested to the inputs are remembered for the render windows that were requested.
+ * Transforms concatenation depends on the parameters of the nodes upstream and is never cached.
+ * This class is thread-safe.
+ **/
+class RequestPassCache
+{
+public:
+
+    RequestPassCache();
+
+    ~RequestPassCache();
+
+    /**
+     * @brief Returns true if globalData was filled with the RoD, identity and frames needed of the effect at the given
+     * time deduced from another frame. The transforms are not filled.
+     * inputsRod are the RoDs of the inputs of the effect at the given time.
+     * version is set to the version of the cached datas, to pass to getInputsRoI.
+     **/
+    bool getGlobalData(EffectInstance* effect,
+                       U64 nodeHash,
+                       unsigned int mappedLevel,
+                       int view,
+                       double time,
+                       const std::vector<RectD>& inputsRod,
+                       FrameViewRequestGlobalData* globalData,
+                       int* version);
+
+    /**
+     * @brief Records globalData computed by the effect at the given time.
+     **/
+    void setGlobalData(EffectInstance* effect,
+                       U64 nodeHash,
+                       unsigned int mappedLevel,
+                       int view,
+                       double time,
+                       const std::vector<RectD>& inputsRod,
+                       const FrameViewRequestGlobalData& globalData);
+
+    /**
+     * @brief Returns false if the datas recorded for the effect were found to depend on the frame, in which case
+     * the RoDs of its inputs need not be computed to look it up.
+     **/
+    bool isCacheable(EffectInstance* effect,
+                     U64 nodeHash,
+                     unsigned int mappedLevel,
+                     int view) const;
+
+    /**
+     * @brief Returns true if inputsRoi was filled with the regions of interest of the effect for the given render window,
+     * version being the one returned by getGlobalData.
+     **/
+    bool getInputsRoI(EffectInstance* effect,
+                      U64 nodeHash,
+                      unsigned int mappedLevel,
+                      int view,
+                      int version,
+                      const RectD& renderWindow,
+                      RoIMap* inputsRoi);
+
+    void setInputsRoI(EffectInstance* effect,
+                      U64 nodeHash,
+                      unsigned int mappedLevel,
+                      int view,
+                      int version,
+                      const RectD& renderWindow,
+                      const RoIMap& inputsRoi);
+
+    void clear();
+
+    /**
+     * @brief Returns true if the effect declares its request pass time invariant and its parameters are static, i.e
+     * its request pass only depends on the frame through its inputs.
+     **/
+    static bool isEffectStatic(EffectInstance* effect);
+
+private:
+
+    boost::scoped_ptr<RequestPassCachePrivate> _imp;
+};
+
 
 class ParallelRenderArgsSetter
 {
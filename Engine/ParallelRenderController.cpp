@@ -0,0 +1,291 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "ParallelRenderController.h"
+
+#include <algorithm> // min, max
+
+///A window lasts at least this long and renders at least max(2, number of parallel renders) frames
+#define NATRON_PARALLEL_RENDERS_MIN_WINDOW_SECONDS 0.5
+
+///Relative throughput difference under which two windows are considered equivalent
+#define NATRON_PARALLEL_RENDERS_THROUGHPUT_TOLERANCE 0.05
+
+///Above this CPU utilization, more parallel renders cannot make the render faster
+#define NATRON_PARALLEL_RENDERS_CPU_SATURATION 0.9
+
+///Node cache occupancies above which the number of parallel renders is decreased and under which it may grow again
+#define NATRON_PARALLEL_RENDERS_CACHE_HIGH_WATER 0.9
+#define NATRON_PARALLEL_RENDERS_CACHE_LOW_WATER 0.7
+
+///Number of windows without a change after which a neighbour is probed
+#define NATRON_PARALLEL_RENDERS_PROBE_INTERVAL 8
+
+///Weight of a new measurement when the peak memory of a frame decreases: it increases immediately
+#define NATRON_PARALLEL_RENDERS_FRAME_MEMORY_DECAY 0.25
+
+NATRON_NAMESPACE_ENTER;
+
+ParallelRenderController::ParallelRenderController()
+    : _maxParallelRenders(1)
+    , _nCores(1)
+    , _hasWindow(false)
+    , _windowParallelRenders(0)
+    , _windowStart()
+    , _previousParallelRenders(0)
+    , _previousFramesPerSecond(0)
+    , _direction(1)
+    , _ceiling(1)
+    , _stableWindows(0)
+    , _returning(false)
+    , _lastFramesPerSecond(0)
+    , _lastCPUUtilization(0)
+    , _hasMemorySample(false)
+    , _lastMemorySample()
+    , _frameMemory(0)
+    , _memoryLimit(1)
+{
+}
+
+void
+ParallelRenderController::reset(int maxParallelRenders,
+                                int nCores)
+{
+    _maxParallelRenders = std::max(1, maxParallelRenders);
+    _nCores = std::max(1, nCores);
+    _hasWindow = false;
+    _windowParallelRenders = 0;
+    _previousParallelRenders = 0;
+    _previousFramesPerSecond = 0;
+    _direction = 1;
+    _ceiling = _maxParallelRenders;
+    _stableWindows = 0;
+    _returning = false;
+    _lastFramesPerSecond = 0;
+    _lastCPUUtilization = 0;
+    _hasMemorySample = false;
+    _frameMemory = 0;
+    _memoryLimit = _maxParallelRenders;
+}
+
+int
+ParallelRenderController::finishDecision(const Sample& sample,
+                                         int currentParallelRenders,
+                                         int newParallelRenders,
+                                         const char* reason,
+                                         Decision* decision)
+{
+    if (newParallelRenders != _windowParallelRenders) {
+        ///A new window starts with the new number of parallel renders
+        _hasWindow = true;
+        _windowParallelRenders = newParallelRenders;
+        _windowStart = sample;
+    }
+    if (decision) {
+        decision->time = sample.time;
+        decision->previousParallelRenders = currentParallelRenders;
+        decision->parallelRenders = newParallelRenders;
+        decision->framesPerSecond = _lastFramesPerSecond;
+        decision->cpuUtilization = _lastCPUUtilization;
+        decision->cacheOccupancy = sample.cacheOccupancy;
+        decision->frameMemory = _frameMemory;
+        decision->memoryLimit = _memoryLimit;
+        decision->reason = reason;
+    }
+
+    return newParallelRenders;
+}
+
+int
+ParallelRenderController::updateMemoryLimit(const Sample& sample,
+                                            int currentParallelRenders)
+{
+    if (!_hasMemorySample) {
+        _hasMemorySample = true;
+        _lastMemorySample = sample;
+    }
+    U64 frames = sample.framesRendered >= _lastMemorySample.framesRendered ? sample.framesRendered - _lastMemorySample.framesRendered : 0;
+    double allocated = sample.imageMemoryAllocated >= _lastMemorySample.imageMemoryAllocated ?
+                       (double)(sample.imageMemoryAllocated - _lastMemorySample.imageMemoryAllocated) : 0.;
+
+    ///A frame holds at most what was allocated while rendering it: the images it releases are not deduced, so that
+    ///the estimation errs on the safe side
+    if (frames > 0) {
+        double frameMemory = allocated / frames;
+        if (frameMemory > _frameMemory) {
+            _frameMemory = frameMemory;
+        } else {
+            _frameMemory += (frameMemory - _frameMemory) * NATRON_PARALLEL_RENDERS_FRAME_MEMORY_DECAY;
+        }
+        _lastMemorySample = sample;
+    } else if (currentParallelRenders > 0) {
+        ///No frame finished yet, but the frames being rendered already allocated that much
+        _frameMemory = std::max(_frameMemory, allocated / currentParallelRenders);
+    }
+
+    int limit = _maxParallelRenders;
+    if (sample.memoryBudget > 0) {
+        if (_frameMemory > 0) {
+            limit = std::min( limit, (int)(sample.memoryBudget / _frameMemory) );
+        }
+
+        ///The node cache may evict the images it holds, except the ones of the frames being rendered
+        double reclaimable = std::max(0., sample.cacheMemory - std::max(0, currentParallelRenders) * _frameMemory);
+        double available = sample.freeMemory + reclaimable;
+        if (available < 0) {
+            ///The system is already short of RAM
+            limit = std::min(limit, currentParallelRenders - 1);
+        } else if (available < _frameMemory) {
+            ///One more frame would not fit
+            limit = std::min(limit, currentParallelRenders);
+        }
+    }
+    _memoryLimit = std::max(1, limit);
+
+    return _memoryLimit;
+} // updateMemoryLimit
+
+int
+ParallelRenderController::update(const Sample& sample,
+                                 int currentParallelRenders,
+                                 Decision* decision)
+{
+    _lastFramesPerSecond = 0;
+    _lastCPUUtilization = 0;
+
+    int memoryLimit = updateMemoryLimit(sample, currentParallelRenders);
+
+    if (currentParallelRenders <= 0) {
+        _hasWindow = false;
+
+        return finishDecision(sample, currentParallelRenders, 1, "start", decision);
+    }
+    if (currentParallelRenders > memoryLimit) {
+        ///The frames would not fit in memory anymore: go down to what fits without waiting for the end of the window
+        _direction = -1;
+        _previousParallelRenders = 0;
+        _stableWindows = 0;
+        _returning = false;
+
+        return finishDecision(sample, currentParallelRenders, memoryLimit, "memory budget", decision);
+    }
+
+    if ( !_hasWindow || (_windowParallelRenders != currentParallelRenders) ) {
+        ///The number of parallel renders changed behind our back (e.g: a thread is still quitting): measure again
+        _hasWindow = true;
+        _windowParallelRenders = currentParallelRenders;
+        _windowStart = sample;
+
+        return finishDecision(sample, currentParallelRenders, currentParallelRenders, "measuring", decision);
+    }
+
+    U64 frames = sample.framesRendered >= _windowStart.framesRendered ? sample.framesRendered - _windowStart.framesRendered : 0;
+    int evictions = sample.cacheEvictions - _windowStart.cacheEvictions;
+    double elapsed = sample.time - _windowStart.time;
+
+    ///React to cache pressure without waiting for the end of the window: every parallel render keeps its images in RAM
+    bool cachePressure = evictions > 0 || sample.cacheOccupancy >= NATRON_PARALLEL_RENDERS_CACHE_HIGH_WATER;
+    if ( cachePressure && (currentParallelRenders > 1) && (frames > 0) ) {
+        _ceiling = currentParallelRenders - 1;
+        _direction = -1;
+        _previousParallelRenders = 0;
+        _stableWindows = 0;
+        _returning = false;
+
+        return finishDecision(sample, currentParallelRenders, currentParallelRenders - 1, "node cache pressure", decision);
+    }
+
+    if ( ( frames < (U64)std::max(2, currentParallelRenders) ) || (elapsed < NATRON_PARALLEL_RENDERS_MIN_WINDOW_SECONDS) ) {
+        return finishDecision(sample, currentParallelRenders, currentParallelRenders, "measuring", decision);
+    }
+
+    double fps = frames / elapsed;
+    double cpu = (sample.cpuTime - _windowStart.cpuTime) / (elapsed * _nCores);
+    _lastFramesPerSecond = fps;
+    _lastCPUUtilization = cpu;
+
+    if (!cachePressure && sample.cacheOccupancy < NATRON_PARALLEL_RENDERS_CACHE_LOW_WATER) {
+        _ceiling = _maxParallelRenders;
+    }
+    int limit = std::min( memoryLimit, std::min(_maxParallelRenders, _ceiling) );
+    int next = currentParallelRenders;
+    const char* reason = "stable";
+
+    if (_returning) {
+        ///We came back to a number that was already judged better: do not judge it against the worse one again,
+        ///otherwise the controller would keep oscillating around it
+        _returning = false;
+        _stableWindows = 0;
+        reason = "back to the best";
+    } else if ( (_previousParallelRenders > 0) && (_previousParallelRenders != currentParallelRenders) ) {
+        ///Judge the last change
+        int lastStep = currentParallelRenders > _previousParallelRenders ? 1 : -1;
+        if ( fps > _previousFramesPerSecond * (1. + NATRON_PARALLEL_RENDERS_THROUGHPUT_TOLERANCE) ) {
+            _direction = lastStep;
+            next = currentParallelRenders + _direction;
+            reason = "throughput improved, going on";
+        } else if ( fps < _previousFramesPerSecond * (1. - NATRON_PARALLEL_RENDERS_THROUGHPUT_TOLERANCE) ) {
+            _direction = -lastStep;
+            next = _previousParallelRenders;
+            _returning = true;
+            reason = "throughput dropped, going back";
+        } else {
+            next = std::min(currentParallelRenders, _previousParallelRenders);
+            reason = "no throughput gain, keeping the fewest";
+        }
+        _stableWindows = 0;
+    } else if ( (_previousParallelRenders == 0) || (++_stableWindows >= NATRON_PARALLEL_RENDERS_PROBE_INTERVAL) ) {
+        ///First complete window or converged for a while: probe a neighbour
+        _stableWindows = 0;
+        if ( (cpu < NATRON_PARALLEL_RENDERS_CPU_SATURATION) && (currentParallelRenders < limit) ) {
+            next = currentParallelRenders + 1;
+            reason = "probing up";
+        } else if ( (_direction < 0) && (currentParallelRenders > 1) ) {
+            next = currentParallelRenders - 1;
+            reason = "probing down";
+        }
+        _direction = next >= currentParallelRenders ? 1 : -1;
+    }
+
+    if ( (next > currentParallelRenders) && (cpu >= NATRON_PARALLEL_RENDERS_CPU_SATURATION) ) {
+        next = currentParallelRenders;
+        reason = "CPU saturated";
+        _direction = -1;
+    }
+    if ( (next > memoryLimit) && (next > currentParallelRenders) ) {
+        reason = "memory budget";
+    }
+    next = std::max( 1, std::min(next, limit) );
+
+    _previousParallelRenders = currentParallelRenders;
+    _previousFramesPerSecond = fps;
+    if (next == currentParallelRenders) {
+        ///Measure a new window with the same number of parallel renders
+        _windowStart = sample;
+    }
+
+    return finishDecision(sample, currentParallelRenders, next, reason, decision);
+} // update
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,181 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_ParallelRenderController_h
+#define Engine_ParallelRenderController_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief Chooses how many frames an OutputSchedulerThread renders concurrently.
+ *
+ * The controller is fed with samples of the state of the process each time the scheduler reconsiders its number of
+ * render threads. The samples are grouped in measurement windows during which the number of parallel renders does not
+ * change. At the end of each window the throughput (frames per second) is compared to the one of the previous
+ * window and the controller climbs towards the number of parallel renders with the best throughput:
+ * - if the last change improved the throughput, it goes on in the same direction;
+ * - if it made it worse, it goes back and turns around;
+ * - if it made no difference, it keeps the smallest of the two, since each parallel render holds images in RAM.
+ * It does not add parallel renders when the CPU is already saturated, and removes one as soon as the node cache
+ * starts evicting images or gets close to its maximum size, in which case it will not grow back above that number
+ * until the cache has room again.
+ * Once converged it probes a neighbour every few windows, in case the load changed.
+ *
+ * Cache pressure is only seen once the images are allocated, and a burst of parallel frames on big images may make the
+ * system swap before that. The controller also estimates the peak memory of a frame from the memory allocated for the
+ * images by the previous frames, and never renders more frames in parallel than what fits in the memory budget.
+ * A new parallel render is only started if the free RAM, plus what the node cache may evict, can hold one more frame,
+ * and parallel renders are stopped as soon as the system runs out of free RAM.
+ *
+ * This class has no locking and no dependency on the rest of the engine, the caller serializes the calls.
+ **/
+class ParallelRenderController
+{
+public:
+
+    struct Sample
+    {
+        double time; // wall-clock time in seconds
+        double cpuTime; // CPU time used by the process in seconds
+        U64 framesRendered; // number of frames rendered since an arbitrary origin
+        double cacheOccupancy; // in-memory size of the node cache divided by its maximum in-memory size
+        int cacheEvictions; // number of entries evicted from the node cache since an arbitrary origin, may wrap
+        U64 imageMemoryAllocated; // bytes of RAM allocated for images since an arbitrary origin
+        double memoryBudget; // bytes of RAM the images of all the parallel renders may use, 0 if unlimited
+        double freeMemory; // RAM available without swapping (free and reclaimable) in bytes minus the RAM that must be kept free, may be negative
+        double cacheMemory; // in-memory size of the node cache in bytes
+
+        Sample()
+            : time(0)
+            , cpuTime(0)
+            , framesRendered(0)
+            , cacheOccupancy(0)
+            , cacheEvictions(0)
+            , imageMemoryAllocated(0)
+            , memoryBudget(0)
+            , freeMemory(0)
+            , cacheMemory(0)
+        {
+        }
+    };
+
+    struct Decision
+    {
+        double time;
+        int previousParallelRenders;
+        int parallelRenders;
+        double framesPerSecond; // throughput of the window that just ended, 0 if no window ended
+        double cpuUtilization; // CPU time / (wall-clock time * number of cores) over that window
+        double cacheOccupancy;
+        double frameMemory; // estimated peak memory of a frame in bytes, 0 if unknown
+        int memoryLimit; // maximum number of parallel renders allowed by the memory
+        const char* reason;
+
+        Decision()
+            : time(0)
+            , previousParallelRenders(0)
+            , parallelRenders(0)
+            , framesPerSecond(0)
+            , cpuUtilization(0)
+            , cacheOccupancy(0)
+            , frameMemory(0)
+            , memoryLimit(0)
+            , reason("")
+        {
+        }
+    };
+
+    ParallelRenderController();
+
+    /**
+     * @brief Forgets all the measurements, e.g when a new render starts.
+     * @param maxParallelRenders The number of parallel renders will stay in [1, maxParallelRenders]
+     * @param nCores The number of cores used to compute the CPU utilization
+     **/
+    void reset(int maxParallelRenders, int nCores);
+
+    /**
+     * @brief Returns the number of parallel renders to use given the current one and a new sample.
+     * If decision is not NULL it is filled with the reason of the choice.
+     **/
+    int update(const Sample& sample, int currentParallelRenders, Decision* decision = 0);
+
+    /**
+     * @brief Returns the maximum number of parallel renders the memory allows given the current one and a new sample,
+     * without changing the number of parallel renders. This is used when the number of parallel renders is set by the
+     * user: update() already applies it.
+     **/
+    int updateMemoryLimit(const Sample& sample, int currentParallelRenders);
+
+    int getMaxParallelRenders() const
+    {
+        return _maxParallelRenders;
+    }
+
+    /**
+     * @brief Returns the estimated peak memory of a frame in bytes, 0 if no frame was rendered yet.
+     **/
+    double getFrameMemory() const
+    {
+        return _frameMemory;
+    }
+
+private:
+
+    int finishDecision(const Sample& sample, int currentParallelRenders, int newParallelRenders, const char* reason, Decision* decision);
+
+    int _maxParallelRenders;
+    int _nCores;
+
+    ///The current measurement window
+    bool _hasWindow;
+    int _windowParallelRenders;
+    Sample _windowStart;
+
+    ///The result of the previous complete window
+    int _previousParallelRenders;
+    double _previousFramesPerSecond;
+
+    int _direction; // +1 or -1: the direction of the next probe
+    int _ceiling; // lowered when the node cache is under pressure
+    int _stableWindows; // number of consecutive windows without a change
+    bool _returning; // true while measuring the number of parallel renders we went back to
+    double _lastFramesPerSecond;
+    double _lastCPUUtilization;
+
+    ///The memory estimation, independent of the measurement windows
+    bool _hasMemorySample;
+    Sample _lastMemorySample;
+    double _frameMemory;
+    int _memoryLimit;
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_ParallelRenderController_h
@@ -30,6 +30,7 @@
 #include <cstdlib> // strtoul
 #include <cerrno> // errno
 #include <stdexcept>
+#include <vector>
 
 #include "Global/Macros.h"
 
@@ -82,6 +83,25 @@ NATRON_NAMESPACE_ENTER;
 using std::cout; using std::endl;
 using std::make_pair;
 
+///The first bytes of a project saved in binary format. XML projects start with the XML declaration.
+#define NATRON_PROJECT_BINARY_MAGIC "NatronBinaryProject\n"
+
+///Size of the stream buffers used to read and write the project files
+#define NATRON_PROJECT_STREAM_BUFFER_SIZE (1024 * 1024)
+
+static bool
+isBinaryProjectFile(const QString & filePath)
+{
+    QFile f(filePath);
+
+    if ( !f.open(QIODevice::ReadOnly) ) {
+        return false;
+    }
+    const qint64 magicLength = sizeof(NATRON_PROJECT_BINARY_MAGIC) - 1;
+
+    return f.read(magicLength) == QByteArray(NATRON_PROJECT_BINARY_MAGIC, magicLength);
+}
+
 
 static std::string getUserName()
 {
@@ -251,6 +271,32 @@ Project::loadProject(const QString & path,
     return true;
 } // loadProject
 
+template <class Archive>
+bool
+Project::loadProjectArchive(Archive & iArchive,
+                            const QString & path,
+                            const QString & name,
+                            bool* mustSave)
+{
+    bool ret;
+    bool bgProject;
+    {
+        FlagSetter __raii_loadingProjectInternal__(true,&_imp->isLoadingProjectInternal,&_imp->isLoadingProjectMutex);
+
+        iArchive >> boost::serialization::make_nvp("Background_project", bgProject);
+        ProjectSerialization projectSerializationObj( getApp() );
+        iArchive >> boost::serialization::make_nvp("Project", projectSerializationObj);
+
+        ret = load(projectSerializationObj,name,path, mustSave);
+    } // __raii_loadingProjectInternal__
+
+    if (!bgProject) {
+        getApp()->loadProjectGui(iArchive);
+    }
+
+    return ret;
+}
+
 bool
 Project::loadProjectInternal(const QString & path,
                              const QString & name,
@@ -268,15 +314,24 @@ Project::loadProjectInternal(const QString & path,
     }
     
     bool ret = false;
+    bool isBinary = isBinaryProjectFile(filePath);
+    std::vector<char> streamBuffer(NATRON_PROJECT_STREAM_BUFFER_SIZE);
     std::ifstream ifile;
     try {
         ifile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        ifile.open(filePath.toStdString().c_str(),std::ifstream::in);
+        ///The buffer must be set before opening the file
+        ifile.rdbuf()->pubsetbuf( &streamBuffer.front(), streamBuffer.size() );
+        if (isBinary) {
+            ifile.open(filePath.toStdString().c_str(),std::ifstream::in | std::ifstream::binary);
+            ifile.seekg(sizeof(NATRON_PROJECT_BINARY_MAGIC) - 1);
+        } else {
+            ifile.open(filePath.toStdString().c_str(),std::ifstream::in);
+        }
     } catch (const std::ifstream::failure & e) {
         throw std::runtime_error( std::string("Exception occured when opening file ") + filePath.toStdString() + ": " + e.what() );
     }
     
-    if (NATRON_VERSION_MAJOR == 1 && NATRON_VERSION_MINOR == 0 && NATRON_VERSION_REVISION == 0) {
+    if (!isBinary && NATRON_VERSION_MAJOR == 1 && NATRON_VERSION_MINOR == 0 && NATRON_VERSION_REVISION == 0) {
         
         ///Try to determine if the project was made during Natron v1.0.0 - RC2 or RC3 to detect a bug we introduced at that time
         ///in the BezierCP class serialisation
@@ -302,20 +357,12 @@ Project::loadProjectInternal(const QString & path,
     LoadProjectSplashScreen_RAII __raii_splashscreen__(getApp(),name);
     
     try {
-        bool bgProject;
-        boost::archive::xml_iarchive iArchive(ifile);
-        {
-            FlagSetter __raii_loadingProjectInternal__(true,&_imp->isLoadingProjectInternal,&_imp->isLoadingProjectMutex);
-            
-            iArchive >> boost::serialization::make_nvp("Background_project", bgProject);
-            ProjectSerialization projectSerializationObj( getApp() );
-            iArchive >> boost::serialization::make_nvp("Project", projectSerializationObj);
-            
-            ret = load(projectSerializationObj,name,path, mustSave);
-        } // __raii_loadingProjectInternal__
-        
-        if (!bgProject) {
-            getApp()->loadProjectGui(iArchive);
+        if (isBinary) {
+            boost::archive::binary_iarchive iArchive(ifile);
+            ret = loadProjectArchive(iArchive, path, name, mustSave);
+        } else {
+            boost::archive::xml_iarchive iArchive(ifile);
+            ret = loadProjectArchive(iArchive, path, name, mustSave);
         }
     } catch (const boost::archive::archive_exception & e) {
         ifile.close();
@@ -474,6 +521,21 @@ fileCopy(const QString & source,
     return success;
 }
 
+template <class Archive>
+void
+Project::saveProjectArchive(Archive & oArchive)
+{
+    bool bgProject = getApp()->isBackground();
+
+    oArchive << boost::serialization::make_nvp("Background_project",bgProject);
+    ProjectSerialization projectSerializationObj( getApp() );
+    save(&projectSerializationObj);
+    oArchive << boost::serialization::make_nvp("Project",projectSerializationObj);
+    if (!bgProject) {
+        getApp()->saveProjectGui(oArchive);
+    }
+}
+
 QString
 Project::saveProjectInternal(const QString & path,
                              const QString & name,
@@ -532,10 +594,18 @@ Project::saveProjectInternal(const QString & path,
     tmpFilename.append( QDir::separator() );
     tmpFilename.append( QString::number( time.toMSecsSinceEpoch() ) );
 
+    bool isBinary = appPTR->getCurrentSettings()->isSaveProjectsInBinaryFormatEnabled();
+    std::vector<char> streamBuffer(NATRON_PROJECT_STREAM_BUFFER_SIZE);
     std::ofstream ofile;
     try {
         ofile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        ofile.open(tmpFilename.toStdString().c_str(),std::ofstream::out);
+        ///The buffer must be set before opening the file
+        ofile.rdbuf()->pubsetbuf( &streamBuffer.front(), streamBuffer.size() );
+        if (isBinary) {
+            ofile.open(tmpFilename.toStdString().c_str(),std::ofstream::out | std::ofstream::binary);
+        } else {
+            ofile.open(tmpFilename.toStdString().c_str(),std::ofstream::out);
+        }
     } catch (const std::ofstream::failure & e) {
         throw std::runtime_error( std::string("Exception occured when opening file ") + tmpFilename.toStdString() + ": " + e.what() );
     }
@@ -556,14 +626,13 @@ Project::saveProjectInternal(const QString & path,
     }
     
     try {
-        boost::archive::xml_oarchive oArchive(ofile);
-        bool bgProject = getApp()->isBackground();
-        oArchive << boost::serialization::make_nvp("Background_project",bgProject);
-        ProjectSerialization projectSerializationObj( getApp() );
-        save(&projectSerializationObj);
-        oArchive << boost::serialization::make_nvp("Project",projectSerializationObj);
-        if (!bgProject) {
-            getApp()->saveProjectGui(oArchive);
+        if (isBinary) {
+            ofile << NATRON_PROJECT_BINARY_MAGIC;
+            boost::archive::binary_oarchive oArchive(ofile);
+            saveProjectArchive(oArchive);
+        } else {
+            boost::archive::xml_oarchive oArchive(ofile);
+            saveProjectArchive(oArchive);
         }
     } catch (...) {
         ofile.close();
@@ -349,6 +349,15 @@ private:
 
     QString saveProjectInternal(const QString & path,const QString & name,bool autosave, bool updateProjectProperties);
 
+    /**
+     * @brief Reads the project and its layout from an XML or binary archive. Returns the result of load().
+     **/
+    template <class Archive>
+    bool loadProjectArchive(Archive & archive,const QString & path,const QString & name, bool* mustSave);
+
+    template <class Archive>
+    void saveProjectArchive(Archive & archive);
+
     
     
 
@@ -0,0 +1,309 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "RenderDaemon.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include "Engine/AppInstance.h"
+#include "Engine/AppManager.h"
+#include "Engine/CLArgs.h"
+#include "Engine/Project.h"
+#include "Engine/Timer.h"
+
+// Replies of the daemon, followed by a new line
+#define kRenderDaemonJobSucceeded "--job_succeeded"
+#define kRenderDaemonJobFailed "--job_failed "
+
+// A job is larger than that only if the message is corrupted
+#define NATRON_RENDER_DAEMON_MAX_JOB_SIZE (1 << 20)
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+/**
+ * @brief What the daemon knows about the project currently loaded in its AppInstance
+ **/
+struct LoadedProject
+{
+    bool loaded; // false if nothing was loaded or the last load failed
+    QString filePath;
+    QDateTime lastModified;
+    qint64 size;
+    bool modified; // the previous jobs modified the project after loading it
+
+    LoadedProject()
+        : loaded(false)
+        , filePath()
+        , lastModified()
+        , size(0)
+        , modified(false)
+    {
+    }
+};
+
+bool
+waitForBytes(QIODevice* device,
+             qint64 nBytes)
+{
+    while (device->bytesAvailable() < nBytes) {
+        if ( !device->waitForReadyRead(5000) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+writeReply(QLocalSocket* socket,
+           const QString& reply)
+{
+    socket->write( (reply + QLatin1Char('\n')).toUtf8() );
+    socket->flush();
+    socket->waitForBytesWritten(5000);
+}
+
+/**
+ * @brief Makes the working directory of the client the current directory of the daemon while its job is rendered,
+ * so that the relative paths of the job (project, scripts, output files of -w and -o...) are resolved as they would
+ * be by the client.
+ **/
+class WorkingDirectorySetter
+{
+    QString _previousDirectory;
+
+public:
+
+    WorkingDirectorySetter(const QString& directory)
+        : _previousDirectory( QDir::currentPath() )
+    {
+        if ( directory.isEmpty() || !QDir::setCurrent(directory) ) {
+            throw std::invalid_argument( QObject::tr("The working directory %1 of the job does not exist").arg(directory).toStdString() );
+        }
+    }
+
+    ~WorkingDirectorySetter()
+    {
+        QDir::setCurrent(_previousDirectory);
+    }
+};
+
+/**
+ * @brief Renders a job, throws an exception if it fails
+ **/
+void
+renderJob(AppInstance* app,
+          const QString& workingDirectory,
+          const QStringList& args,
+          LoadedProject* project)
+{
+    WorkingDirectorySetter workingDirectorySetter(workingDirectory);
+    CLArgs cl(QStringList( QString::fromUtf8(NATRON_APPLICATION_NAME "Renderer") ) + args, true);
+
+    if ( (cl.getError() > 0) || cl.getScriptFilename().isEmpty() ) {
+        throw std::invalid_argument( QObject::tr("Invalid job command line").toStdString() );
+    }
+
+    QFileInfo info( cl.getScriptFilename() );
+    bool reuseProject = project->loaded && !project->modified && info.exists() &&
+                        info.absoluteFilePath() == project->filePath &&
+                        info.lastModified() == project->lastModified &&
+                        info.size() == project->size;
+
+    if (!reuseProject) {
+        if (project->loaded) {
+            app->getProject()->closeProject(false);
+        }
+        ///Until it is loaded, the project must be closed before the next job
+        project->loaded = true;
+        project->modified = true;
+        project->filePath = info.absoluteFilePath();
+        project->lastModified = info.lastModified();
+        project->size = info.size();
+    }
+
+    ///Python scripts and --onload scripts may do anything to the project, writers created by the command line are
+    ///added to the project
+    bool modifiesProject = cl.isPythonScript() || !cl.getDefaultOnProjectLoadedScript().isEmpty();
+    const std::list<CLArgs::WriterArg>& writers = cl.getWriterArgs();
+    for (std::list<CLArgs::WriterArg>::const_iterator it = writers.begin(); it != writers.end(); ++it) {
+        if (it->mustCreate) {
+            modifiesProject = true;
+        }
+    }
+
+    app->renderFromCL(cl, !reuseProject);
+
+    if (!reuseProject) {
+        project->modified = modifiesProject;
+    } else if (modifiesProject) {
+        project->modified = true;
+    }
+}
+} // anon namespace
+
+bool
+RenderDaemon::exec(AppInstance* app,
+                   const QString& serverName)
+{
+    QLocalServer server;
+
+    ///A daemon that crashed may have left its socket behind
+    QLocalServer::removeServer(serverName);
+    if ( !server.listen(serverName) ) {
+        std::cerr << QObject::tr("Error: the render daemon cannot listen on %1: %2").arg(serverName).arg( server.errorString() ).toStdString() << std::endl;
+
+        return false;
+    }
+    std::cout << QObject::tr("Render daemon waiting for jobs on %1").arg( server.fullServerName() ).toStdString() << std::endl;
+
+    int appID = app->getAppID();
+    LoadedProject project;
+    for (;;) {
+        ///The application is closed when the process receives a termination signal
+        if ( !appPTR->getAppInstance(appID) ) {
+            return true;
+        }
+        if ( !server.waitForNewConnection(500) ) {
+            continue;
+        }
+        QLocalSocket* socket = server.nextPendingConnection();
+        if (!socket) {
+            continue;
+        }
+
+        QString workingDirectory;
+        QStringList args;
+        if ( readJob(socket, &workingDirectory, &args) ) {
+            std::cout << QObject::tr("Render daemon: starting job %1").arg( args.join( QString::fromUtf8(" ") ) ).toStdString() << std::endl;
+            TimeLapse timer;
+            QString reply;
+            try {
+                renderJob(app, workingDirectory, args, &project);
+                reply = QString::fromUtf8(kRenderDaemonJobSucceeded);
+            } catch (const std::exception& e) {
+                reply = QString::fromUtf8(kRenderDaemonJobFailed) + QString::fromUtf8( e.what() ).simplified();
+            } catch (...) {
+                reply = QString::fromUtf8(kRenderDaemonJobFailed) + QObject::tr("Unknown error");
+            }
+            std::cout << QObject::tr("Render daemon: job finished in %1 s: %2").arg( timer.getTimeSinceCreation() ).arg(reply).toStdString() << std::endl;
+            writeReply(socket, reply);
+        }
+        socket->disconnectFromServer();
+        delete socket;
+
+        ///No event loop is running while the daemon waits for jobs, process the events posted by the render
+        QCoreApplication::processEvents();
+    }
+}
+
+int
+RenderDaemon::submitJob(const QString& serverName,
+                        const QStringList& args)
+{
+    QLocalSocket socket;
+
+    socket.connectToServer(serverName);
+    if ( !socket.waitForConnected(5000) ) {
+        std::cerr << QObject::tr("Error: cannot connect to the render daemon %1: %2").arg(serverName).arg( socket.errorString() ).toStdString() << std::endl;
+
+        return 1;
+    }
+
+    ///The daemon may run in another directory, send ours to resolve the relative paths of the job
+    socket.write( encodeJob(QDir::currentPath(), args) );
+    if ( !socket.waitForBytesWritten(5000) ) {
+        std::cerr << QObject::tr("Error: cannot send the job to the render daemon %1").arg(serverName).toStdString() << std::endl;
+
+        return 1;
+    }
+
+    ///The render may take hours: wait for the reply without a time-out, until the daemon closes the connection
+    while ( !socket.canReadLine() ) {
+        if ( !socket.waitForReadyRead(-1) ) {
+            std::cerr << QObject::tr("Error: the render daemon %1 closed the connection").arg(serverName).toStdString() << std::endl;
+
+            return 1;
+        }
+    }
+    QString reply = QString::fromUtf8( socket.readLine() ).trimmed();
+    if ( reply == QString::fromUtf8(kRenderDaemonJobSucceeded) ) {
+        return 0;
+    }
+    if ( reply.startsWith( QString::fromUtf8(kRenderDaemonJobFailed).trimmed() ) ) {
+        std::cerr << QObject::tr("Error: the job failed: %1").arg( reply.mid( QString::fromUtf8(kRenderDaemonJobFailed).size() ) ).toStdString() << std::endl;
+    } else {
+        std::cerr << QObject::tr("Error: unexpected reply from the render daemon: %1").arg(reply).toStdString() << std::endl;
+    }
+
+    return 1;
+}
+
+QByteArray
+RenderDaemon::encodeJob(const QString& workingDirectory,
+                        const QStringList& args)
+{
+    QByteArray block;
+    QDataStream ds(&block, QIODevice::WriteOnly);
+
+    ds.setVersion(QDataStream::Qt_4_8);
+    ds << (quint32)0 << workingDirectory << args;
+    ds.device()->seek(0);
+    ds << (quint32)( block.size() - sizeof(quint32) );
+
+    return block;
+}
+
+bool
+RenderDaemon::readJob(QIODevice* device,
+                      QString* workingDirectory,
+                      QStringList* args)
+{
+    QDataStream ds(device);
+
+    ds.setVersion(QDataStream::Qt_4_8);
+    if ( !waitForBytes( device, sizeof(quint32) ) ) {
+        return false;
+    }
+    quint32 size;
+    ds >> size;
+    if ( (size > NATRON_RENDER_DAEMON_MAX_JOB_SIZE) || !waitForBytes(device, size) ) {
+        return false;
+    }
+    ds >> *workingDirectory >> *args;
+
+    return ds.status() == QDataStream::Ok;
+}
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,83 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_RenderDaemon_h
+#define Engine_RenderDaemon_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief NatronRenderer --daemon: a render process that stays resident between the jobs of a farm, so that Python,
+ * the plug-ins, the PyPlugs and the caches are only initialized once.
+ *
+ * A job is the command line that would have been given to NatronRenderer (project, writers, frame range...) along with
+ * the working directory of the client, against which its relative paths are resolved. It is sent by
+ * NatronRenderer --submit to the local socket of the daemon, which renders the jobs one after the other and replies
+ * with a single line telling whether the job succeeded.
+ * The project of the previous job is kept loaded, and thus the images of its nodes in the node cache stay valid,
+ * when the next job renders the same project file and it did not change on disk. It is loaded again if the previous
+ * job modified it: Python script instead of a project, --onload script or writers created by the command line.
+ **/
+class RenderDaemon
+{
+public:
+
+    /**
+     * @brief Listens on the local socket serverName and renders the jobs it receives with app, until app is closed
+     * (e.g: the process received a termination signal), in which case it returns true.
+     * Returns false if the socket cannot be created.
+     **/
+    static bool exec(AppInstance* app, const QString& serverName);
+
+    /**
+     * @brief Sends a job to the daemon listening on serverName and waits for it to be rendered.
+     * Returns the exit code of the process: 0 if the job succeeded, 1 otherwise.
+     **/
+    static int submitJob(const QString& serverName, const QStringList& args);
+
+    /**
+     * @brief Serializes a job as it is sent to the daemon: its size on 32 bits followed by the working directory
+     * of the client and the command line.
+     **/
+    static QByteArray encodeJob(const QString& workingDirectory, const QStringList& args);
+
+    /**
+     * @brief Reads from device a job encoded by encodeJob(), waiting for its bytes if needed.
+     * Returns false if the job is incomplete or corrupted.
+     **/
+    static bool readJob(QIODevice* device, QString* workingDirectory, QStringList* args);
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_RenderDaemon_h
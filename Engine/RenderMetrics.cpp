@@ -0,0 +1,263 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "RenderMetrics.h"
+
+#include <fstream>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+#include "Engine/AppManager.h"
+#include "Engine/TaskPool.h"
+#include "Engine/Timer.h"
+
+#define NATRON_RENDER_METRICS_STRIPES_LOG2 4
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+/**
+ * @brief The counters updated by a group of threads. Each counter only has to fit the part of the total counted by
+ * its stripe.
+ **/
+struct MetricsStripe
+{
+    QAtomicInt values[eRenderMetricCount];
+    QAtomicInt histograms[eRenderHistogramCount][NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS];
+    char padding[64]; // keeps the counters of different stripes on different cache lines
+};
+
+MetricsStripe metricsStripes[1 << NATRON_RENDER_METRICS_STRIPES_LOG2];
+
+inline MetricsStripe&
+getCurrentThreadStripe()
+{
+    ///Thread ids are often aligned on large boundaries: mix their bits before picking the stripe
+    U64 h = (U64)(quintptr)QThread::currentThreadId() * 0x9E3779B97F4A7C15ULL;
+
+    return metricsStripes[h >> (64 - NATRON_RENDER_METRICS_STRIPES_LOG2)];
+}
+
+const char* metricNames[eRenderMetricCount] = {
+    "cacheHits",
+    "cacheMisses",
+    "cacheEvictions",
+    "renderRoICalls",
+    "tilesRendered",
+    "tilesInFlight",
+    "framesRendered",
+    "framesInFlight",
+    "imageMemoryAllocated64KiB",
+};
+
+const char* histogramNames[eRenderHistogramCount] = {
+    "tileTimeHistogram",
+    "frameTimeHistogram",
+};
+
+class RenderMetricsWriterThread
+    : public QThread
+{
+public:
+
+    RenderMetricsWriterThread(const QString& filePath,
+                              int intervalMs)
+        : QThread()
+        , _file(filePath.toStdString().c_str(), std::ofstream::out | std::ofstream::app)
+        , _intervalMs(intervalMs)
+        , _mutex()
+        , _cond()
+        , _mustQuit(false)
+    {
+        setObjectName( QString::fromUtf8("RenderMetricsWriter") );
+    }
+
+    bool isFileOpened() const
+    {
+        return _file.good();
+    }
+
+    void quitThread()
+    {
+        {
+            QMutexLocker k(&_mutex);
+            _mustQuit = true;
+            _cond.wakeAll();
+        }
+        wait();
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        TimeLapse timer;
+        QMutexLocker k(&_mutex);
+
+        while (!_mustQuit) {
+            _cond.wait(&_mutex, _intervalMs);
+            RenderMetrics::writeJSONLine( _file, RenderMetrics::getSnapshot(), timer.getTimeSinceCreation() );
+            _file.flush();
+        }
+    }
+
+    std::ofstream _file;
+    int _intervalMs;
+    QMutex _mutex;
+    QWaitCondition _cond;
+    bool _mustQuit;
+};
+
+QMutex writerMutex;
+RenderMetricsWriterThread* writer = 0;
+
+const TimeLapse processTimer;
+} // anon namespace
+
+RenderMetrics::Snapshot::Snapshot()
+{
+    for (int i = 0; i < eRenderMetricCount; ++i) {
+        values[i] = 0;
+    }
+    for (int i = 0; i < eRenderHistogramCount; ++i) {
+        for (int j = 0; j < NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS; ++j) {
+            histograms[i][j] = 0;
+        }
+    }
+}
+
+void
+RenderMetrics::add(RenderMetricEnum metric,
+                   int delta)
+{
+    getCurrentThreadStripe().values[metric].fetchAndAddRelaxed(delta);
+}
+
+void
+RenderMetrics::addTimeSample(RenderHistogramEnum histogram,
+                             double seconds)
+{
+    double us = seconds * 1e6;
+    int bucket = 0;
+
+    while ( bucket < NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS - 1 && us >= (double)(1 << (bucket + 1)) ) {
+        ++bucket;
+    }
+    getCurrentThreadStripe().histograms[histogram][bucket].fetchAndAddRelaxed(1);
+}
+
+double
+RenderMetrics::getCurrentTime()
+{
+    return processTimer.getTimeSinceCreation();
+}
+
+RenderMetrics::Snapshot
+RenderMetrics::getSnapshot()
+{
+    Snapshot ret;
+
+    for (int s = 0; s < (1 << NATRON_RENDER_METRICS_STRIPES_LOG2); ++s) {
+        const MetricsStripe& stripe = metricsStripes[s];
+        for (int i = 0; i < eRenderMetricCount; ++i) {
+            ret.values[i] += (int)stripe.values[i];
+        }
+        for (int i = 0; i < eRenderHistogramCount; ++i) {
+            for (int j = 0; j < NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS; ++j) {
+                ret.histograms[i][j] += (int)stripe.histograms[i][j];
+            }
+        }
+    }
+
+    return ret;
+}
+
+void
+RenderMetrics::writeJSONLine(std::ostream& os,
+                             const Snapshot& snapshot,
+                             double timeSinceStart)
+{
+    os << "{\"time\":" << timeSinceStart;
+    for (int i = 0; i < eRenderMetricCount; ++i) {
+        os << ",\"" << metricNames[i] << "\":" << snapshot.values[i];
+    }
+    for (int i = 0; i < eRenderHistogramCount; ++i) {
+        os << ",\"" << histogramNames[i] << "\":[";
+        for (int j = 0; j < NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS; ++j) {
+            os << (j == 0 ? "" : ",") << snapshot.histograms[i][j];
+        }
+        os << ']';
+    }
+    if (appPTR) {
+        os << ",\"runningThreads\":" << appPTR->getNRunningThreads();
+        os << ",\"cacheFilesOpened\":" << appPTR->getNCacheFilesOpened();
+        os << ",\"cachesMemorySize\":" << appPTR->getCachesTotalMemorySize();
+        TaskPool* pool = appPTR->getTaskPool();
+        if (pool) {
+            TaskPool::Stats stats = pool->getStats();
+            os << ",\"taskPool\":{\"maxThreads\":" << stats.maxThreads << ",\"activeThreads\":" << stats.activeThreads
+               << ",\"peakActiveThreads\":" << stats.peakActiveThreads << ",\"tasks\":" << stats.nTasks
+               << ",\"occupancy\":" << stats.getOccupancy() << '}';
+        }
+    }
+    os << "}\n";
+}
+
+bool
+RenderMetrics::startWriter(const QString& filePath,
+                           int intervalMs)
+{
+    QMutexLocker k(&writerMutex);
+
+    if (writer) {
+        return false;
+    }
+    RenderMetricsWriterThread* thread = new RenderMetricsWriterThread(filePath, intervalMs);
+    if ( !thread->isFileOpened() ) {
+        delete thread;
+
+        return false;
+    }
+    writer = thread;
+    writer->start();
+
+    return true;
+}
+
+void
+RenderMetrics::stopWriter()
+{
+    QMutexLocker k(&writerMutex);
+
+    if (writer) {
+        writer->quitThread();
+        delete writer;
+        writer = 0;
+    }
+}
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,159 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_RenderMetrics_h
+#define Engine_RenderMetrics_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <ostream>
+
+#include <QtCore/QString>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+#define NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS 24
+
+///The unit of eRenderMetricImageMemoryAllocated in bytes: with 64KiB, the counter of a thread overflows after 128TiB
+#define NATRON_RENDER_METRICS_MEMORY_UNIT (64 * 1024)
+
+NATRON_NAMESPACE_ENTER;
+
+enum RenderMetricEnum
+{
+    eRenderMetricCacheHits = 0,
+    eRenderMetricCacheMisses,
+    eRenderMetricCacheEvictions, // entries evicted from the in-memory portion of the caches
+    eRenderMetricRenderRoICalls,
+    eRenderMetricTilesRendered, // tiles whose render succeeded
+    eRenderMetricTilesInFlight, // tiles being rendered
+    eRenderMetricFramesRendered, // frames whose render finished
+    eRenderMetricFramesInFlight, // frames being rendered by the render threads of the writers
+    eRenderMetricImageMemoryAllocated, // RAM allocated for images since startup, in NATRON_RENDER_METRICS_MEMORY_UNIT, rounded up
+    eRenderMetricCount
+};
+
+enum RenderHistogramEnum
+{
+    eRenderHistogramTileTime = 0,
+    eRenderHistogramFrameTime,
+    eRenderHistogramCount
+};
+
+/**
+ * @brief Process-wide counters of the render engine, cheap enough to be updated from the render threads: each thread
+ * increments its own stripe of atomic counters, the stripes are only summed when the metrics are read.
+ * Histograms count durations in buckets of powers of 2 microseconds: bucket i holds the samples in [2^i, 2^(i+1)) us,
+ * the first and last buckets also hold the samples below and above.
+ *
+ * With NatronRenderer --metrics <file>, a snapshot of the metrics and of the state of the caches and threads is
+ * appended every second to the file as a line of JSON, which can be watched while a long render runs.
+ **/
+class RenderMetrics
+{
+public:
+
+    struct Snapshot
+    {
+        qint64 values[eRenderMetricCount];
+        qint64 histograms[eRenderHistogramCount][NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS];
+
+        Snapshot();
+    };
+
+    static void add(RenderMetricEnum metric, int delta = 1);
+
+    static void addTimeSample(RenderHistogramEnum histogram, double seconds);
+
+    static Snapshot getSnapshot();
+
+    /**
+     * @brief Writes the snapshot, the state of the caches and of the threads of appPTR as one line of JSON.
+     **/
+    static void writeJSONLine(std::ostream& os, const Snapshot& snapshot, double timeSinceStart);
+
+    /**
+     * @brief Starts a thread appending a line to the file every intervalMs milliseconds, until stopWriter() is called.
+     * Returns false if the file cannot be opened.
+     **/
+    static bool startWriter(const QString& filePath, int intervalMs);
+
+    static void stopWriter();
+
+    /**
+     * @brief Adds delta to a metric on construction and removes it on destruction, e.g for the number of tiles in flight
+     **/
+    class GaugeIncrementer
+    {
+        RenderMetricEnum _metric;
+        int _delta;
+
+public:
+
+        GaugeIncrementer(RenderMetricEnum metric,
+                         int delta = 1)
+            : _metric(metric)
+            , _delta(delta)
+        {
+            add(_metric, _delta);
+        }
+
+        ~GaugeIncrementer()
+        {
+            add(_metric, -_delta);
+        }
+    };
+
+    /**
+     * @brief Adds the time elapsed between its construction and its destruction to a histogram
+     **/
+    class TimeSampler
+    {
+        RenderHistogramEnum _histogram;
+        double _start;
+
+public:
+
+        explicit TimeSampler(RenderHistogramEnum histogram)
+            : _histogram(histogram)
+            , _start( getCurrentTime() )
+        {
+        }
+
+        ~TimeSampler()
+        {
+            addTimeSample( _histogram, getCurrentTime() - _start );
+        }
+    };
+
+private:
+
+    /// Returns the time in seconds since an arbitrary origin, the same for all threads
+    static double getCurrentTime();
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_RenderMetrics_h
@@ -0,0 +1,148 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "RenderPlan.h"
+
+#include <climits>
+#include <algorithm> // min, max
+
+#include "Engine/OutputEffectInstance.h"
+#include "Engine/OutputSchedulerThread.h"
+
+///How often a waiting render thread checks whether it was aborted
+#define NATRON_RENDER_PLAN_ABORT_CHECK_MS 100
+
+NATRON_NAMESPACE_ENTER;
+
+RenderPlan::RenderPlan(int maxFramesAhead)
+    : _maxFramesAhead( std::max(1, maxFramesAhead) )
+    , _lock()
+    , _progressCond()
+    , _writers()
+{
+}
+
+void
+RenderPlan::notifyWriterStarted(OutputEffectInstance* writer,
+                                int firstFrame,
+                                int lastFrame)
+{
+    QMutexLocker k(&_lock);
+    WriterProgress& progress = _writers[writer];
+
+    progress.framesInFlight.clear();
+    progress.framesWaiting.clear();
+    progress.nextFrame = firstFrame;
+    progress.firstFrame = firstFrame;
+    progress.lastFrame = lastFrame;
+}
+
+void
+RenderPlan::notifyWriterFinished(OutputEffectInstance* writer)
+{
+    QMutexLocker k(&_lock);
+
+    _writers.erase(writer);
+    _progressCond.wakeAll();
+}
+
+int
+RenderPlan::getEarliestPendingFrame(int frame) const
+{
+    assert( !_lock.tryLock() );
+    int ret = INT_MAX;
+    for (WritersProgress::const_iterator it = _writers.begin(); it != _writers.end(); ++it) {
+        ///A writer that does not render the frame does not need its images
+        if ( (frame < it->second.firstFrame) || (frame > it->second.lastFrame) ) {
+            continue;
+        }
+        ///A writer with neither frames in flight nor waiting is between two frames: its next one is nextFrame
+        int pending = it->second.nextFrame;
+        if ( !it->second.framesInFlight.empty() ) {
+            pending = std::min(pending, *it->second.framesInFlight.begin());
+        }
+        if ( !it->second.framesWaiting.empty() ) {
+            pending = std::min(pending, *it->second.framesWaiting.begin());
+        }
+        ret = std::min(ret, pending);
+    }
+
+    return ret;
+}
+
+bool
+RenderPlan::waitForFrameTurn(OutputEffectInstance* writer,
+                             int frame,
+                             RenderThreadTask* thread)
+{
+    QMutexLocker k(&_lock);
+    WritersProgress::iterator found = _writers.find(writer);
+
+    if ( found == _writers.end() ) {
+        ///The writer is not part of the plan (anymore)
+        return true;
+    }
+    found->second.framesWaiting.insert(frame);
+
+    ///The writer holding the earliest pending frame of all writers can always start it, hence this cannot deadlock
+    while ( (frame - _maxFramesAhead > getEarliestPendingFrame(frame)) && ( !thread || !thread->mustQuit() ) && !writer->isSequentialRenderBeingAborted() ) {
+        _progressCond.wait(&_lock, NATRON_RENDER_PLAN_ABORT_CHECK_MS);
+    }
+
+    ///The map may have been modified while waiting
+    found = _writers.find(writer);
+    if ( found == _writers.end() ) {
+        return true;
+    }
+    found->second.framesWaiting.erase( found->second.framesWaiting.find(frame) );
+    if ( thread && thread->mustQuit() ) {
+        _progressCond.wakeAll();
+
+        return false;
+    }
+    ///If the render was aborted, let the frame start: it will abort right away
+    found->second.framesInFlight.insert(frame);
+    found->second.nextFrame = std::max(found->second.nextFrame, frame + 1);
+
+    return true;
+}
+
+void
+RenderPlan::notifyFrameFinished(OutputEffectInstance* writer,
+                                int frame)
+{
+    QMutexLocker k(&_lock);
+    WritersProgress::iterator found = _writers.find(writer);
+
+    if ( found == _writers.end() ) {
+        return;
+    }
+    std::multiset<int>::iterator foundFrame = found->second.framesInFlight.find(frame);
+    if ( foundFrame != found->second.framesInFlight.end() ) {
+        found->second.framesInFlight.erase(foundFrame);
+    }
+    _progressCond.wakeAll();
+}
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,102 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_RenderPlan_h
+#define Engine_RenderPlan_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <map>
+#include <set>
+
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief Keeps the writers of a group rendering the same frames at the same time.
+ *
+ * When several writers rendered by the same process share upstream nodes, the images of these nodes are computed
+ * once and found in the cache by the other writers, but only if the writers render the same frames at about the same
+ * time: otherwise they may have been evicted when the slowest writer needs them.
+ * Each render thread of a writer of the group asks the plan before starting a frame, and may only start it if it is
+ * at most maxFramesAhead frames after the earliest frame not yet rendered by the writers of the group whose frame range
+ * contains it: the writers never hold back the frames they do not render themselves.
+ *
+ * Only the writers currently rendering (between notifyWriterStarted and notifyWriterFinished) hold the others back,
+ * so that a writer waiting for a thread to start cannot block the group.
+ **/
+class RenderPlan
+{
+public:
+
+    explicit RenderPlan(int maxFramesAhead);
+
+    /**
+     * @brief Called before the writer starts rendering its frame range [firstFrame, lastFrame]
+     **/
+    void notifyWriterStarted(OutputEffectInstance* writer, int firstFrame, int lastFrame);
+
+    /**
+     * @brief Called once the writer has finished or aborted its render
+     **/
+    void notifyWriterFinished(OutputEffectInstance* writer);
+
+    /**
+     * @brief Blocks the calling render thread until the writer may start rendering the frame, or the render is aborted.
+     * Returns false without waiting further if the thread must quit: the frame must then be rendered by another thread
+     * and notifyFrameFinished must not be called. thread may be NULL if the caller never quits.
+     **/
+    bool waitForFrameTurn(OutputEffectInstance* writer, int frame, RenderThreadTask* thread);
+
+    void notifyFrameFinished(OutputEffectInstance* writer, int frame);
+
+private:
+
+    struct WriterProgress
+    {
+        std::multiset<int> framesInFlight; // frames being rendered
+        std::multiset<int> framesWaiting; // frames waiting in waitForFrameTurn
+        int nextFrame; // frame following the last one started
+        int firstFrame, lastFrame; // frame range of the writer
+    };
+
+    typedef std::map<OutputEffectInstance*, WriterProgress> WritersProgress;
+
+    /// Returns the earliest frame not rendered yet by the writers of the group that render the given frame.
+    /// The mutex must be locked.
+    int getEarliestPendingFrame(int frame) const;
+
+    const int _maxFramesAhead;
+    mutable QMutex _lock; // protects _writers
+    QWaitCondition _progressCond; // woken each time a frame is finished or a writer leaves
+    WritersProgress _writers;
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_RenderPlan_h
@@ -26,12 +26,17 @@
 
 #include "RenderStats.h"
 
+#include <algorithm> // max
+#include <cstdio>
+
 #include <QMutex>
+#include <QThread>
 
 #include "Engine/Node.h"
 #include "Engine/Timer.h"
 #include "Engine/RectI.h"
 #include "Engine/RectD.h"
+#include "Engine/ThreadStorage.h"
 
 NATRON_NAMESPACE_ENTER;
 
@@ -63,6 +68,18 @@ struct NodeRenderStatsPrivate
     int nbCacheHit;
     int nbCacheHitButDownscaledImages;
     
+    //Number of input images converted to another bit depth, components or mipmap level, and how many of these conversions
+    //were shared with another fetch of the same image
+    int nbImageConversions;
+    int nbSharedImageConversions;
+    
+    //Temporary image buffers allocated from the ImageArena, how many were recycled, and the memory used by the buffers
+    //of the arena at these allocations
+    int nbArenaAllocations;
+    int nbReusedArenaBuffers;
+    std::size_t peakArenaMemoryInUse;
+    double totalArenaMemoryInUse;
+    
     //Is tile support enabled for this render
     bool tileSupportEnabled;
     
@@ -74,6 +91,10 @@ struct NodeRenderStatsPrivate
     
     //Premultiplication of the output imge
     ImagePremultiplicationEnum outputPremult;
+
+    //Time spent waiting for images being rendered by other threads and for the Python GIL
+    double timeSpentWaitingForImages;
+    double timeSpentWaitingForPython;
     
     NodeRenderStatsPrivate()
     : totalTimeSpentRendering(0)
@@ -86,10 +107,18 @@ struct NodeRenderStatsPrivate
     , nbCacheMisses(0)
     , nbCacheHit(0)
     , nbCacheHitButDownscaledImages(0)
+    , nbImageConversions(0)
+    , nbSharedImageConversions(0)
+    , nbArenaAllocations(0)
+    , nbReusedArenaBuffers(0)
+    , peakArenaMemoryInUse(0)
+    , totalArenaMemoryInUse(0)
     , tileSupportEnabled(false)
     , renderScaleSupportEnabled(false)
     , channelsEnabled()
     , outputPremult(eImagePremultiplicationOpaque)
+    , timeSpentWaitingForImages(0)
+    , timeSpentWaitingForPython(0)
     {
         for (int i = 0; i < 4; ++i) {
             channelsEnabled[i] = false;
@@ -127,12 +156,20 @@ NodeRenderStats::operator=(const NodeRenderStats& other)
     _imp->nbCacheMisses = other._imp->nbCacheMisses;
     _imp->nbCacheHit = other._imp->nbCacheHit;
     _imp->nbCacheHitButDownscaledImages = other._imp->nbCacheHitButDownscaledImages;
+    _imp->nbImageConversions = other._imp->nbImageConversions;
+    _imp->nbSharedImageConversions = other._imp->nbSharedImageConversions;
+    _imp->nbArenaAllocations = other._imp->nbArenaAllocations;
+    _imp->nbReusedArenaBuffers = other._imp->nbReusedArenaBuffers;
+    _imp->peakArenaMemoryInUse = other._imp->peakArenaMemoryInUse;
+    _imp->totalArenaMemoryInUse = other._imp->totalArenaMemoryInUse;
     _imp->tileSupportEnabled = other._imp->tileSupportEnabled;
     _imp->renderScaleSupportEnabled = other._imp->renderScaleSupportEnabled;
     for (int i = 0; i < 4; ++i) {
         _imp->channelsEnabled[i] = other._imp->channelsEnabled[i];
     }
     _imp->outputPremult = other._imp->outputPremult;
+    _imp->timeSpentWaitingForImages = other._imp->timeSpentWaitingForImages;
+    _imp->timeSpentWaitingForPython = other._imp->timeSpentWaitingForPython;
 }
 
 void
@@ -248,6 +285,42 @@ NodeRenderStats::getCacheAccessInfos(int* nbCacheMisses, int* nbCacheHits, int*
     *nbCacheHitButDownscaledImages = _imp->nbCacheHitButDownscaledImages;
 }
 
+void
+NodeRenderStats::addImageConversionInfo(bool isShared)
+{
+    ++_imp->nbImageConversions;
+    if (isShared) {
+        ++_imp->nbSharedImageConversions;
+    }
+}
+
+void
+NodeRenderStats::getImageConversionInfos(int* nbConversions, int* nbSharedConversions) const
+{
+    *nbConversions = _imp->nbImageConversions;
+    *nbSharedConversions = _imp->nbSharedImageConversions;
+}
+
+void
+NodeRenderStats::addArenaAllocationInfo(bool reused, std::size_t arenaMemoryInUse)
+{
+    ++_imp->nbArenaAllocations;
+    if (reused) {
+        ++_imp->nbReusedArenaBuffers;
+    }
+    _imp->peakArenaMemoryInUse = std::max(_imp->peakArenaMemoryInUse, arenaMemoryInUse);
+    _imp->totalArenaMemoryInUse += arenaMemoryInUse;
+}
+
+void
+NodeRenderStats::getArenaAllocationInfos(int* nbAllocations, int* nbReusedBuffers, std::size_t* peakArenaMemoryInUse, double* averageArenaMemoryInUse) const
+{
+    *nbAllocations = _imp->nbArenaAllocations;
+    *nbReusedBuffers = _imp->nbReusedArenaBuffers;
+    *peakArenaMemoryInUse = _imp->peakArenaMemoryInUse;
+    *averageArenaMemoryInUse = _imp->nbArenaAllocations == 0 ? 0. : _imp->totalArenaMemoryInUse / _imp->nbArenaAllocations;
+}
+
 void
 NodeRenderStats::setTilesSupported(bool tilesSupported)
 {
@@ -296,6 +369,30 @@ NodeRenderStats::getOutputPremult() const
     return _imp->outputPremult;
 }
 
+void
+NodeRenderStats::addTimeSpentWaitingForImages(double time)
+{
+    _imp->timeSpentWaitingForImages += time;
+}
+
+double
+NodeRenderStats::getTimeSpentWaitingForImages() const
+{
+    return _imp->timeSpentWaitingForImages;
+}
+
+void
+NodeRenderStats::addTimeSpentWaitingForPython(double time)
+{
+    _imp->timeSpentWaitingForPython += time;
+}
+
+double
+NodeRenderStats::getTimeSpentWaitingForPython() const
+{
+    return _imp->timeSpentWaitingForPython;
+}
+
 struct RenderStatsPrivate
 {
     mutable QMutex lock;
@@ -309,15 +406,46 @@ struct RenderStatsPrivate
     typedef std::map<boost::weak_ptr<Node>,NodeRenderStats > NodeInfosMap;
     NodeInfosMap nodeInfos;
     
+    //The events of the trace, in order of completion
+    std::list<RenderTraceEvent> traceEvents;
     
+    //The index of each thread that took part in the render, in order of appearance
+    std::map<QThread*, int> threadIndexes;
     
     RenderStatsPrivate()
     : lock()
     , totalTimeSpentForFrameTimer()
     , doNodesProfiling(false)
     , nodeInfos()
+    , traceEvents()
+    , threadIndexes()
+    {
+        
+    }
+    
+    ///Records an event of the current thread that ends now
+    void addTraceEvent(RenderTraceEventTypeEnum type,
+                       const boost::shared_ptr<Node>& node,
+                       double duration,
+                       const std::string& plane = std::string(),
+                       const RectI& rectangle = RectI())
     {
+        //Private, shouldn't lock
+        assert(!lock.tryLock());
         
+        RenderTraceEvent e;
+        e.type = type;
+        e.node = node;
+        std::map<QThread*, int>::iterator found = threadIndexes.find( QThread::currentThread() );
+        if ( found == threadIndexes.end() ) {
+            found = threadIndexes.insert( std::make_pair( QThread::currentThread(), (int)threadIndexes.size() ) ).first;
+        }
+        e.thread = found->second;
+        e.duration = duration;
+        e.start = totalTimeSpentForFrameTimer.getTimeSinceCreation() - duration;
+        e.plane = plane;
+        e.rectangle = rectangle;
+        traceEvents.push_back(e);
     }
     
     NodeInfosMap::iterator findNode(const boost::shared_ptr<Node>& node)
@@ -406,6 +534,31 @@ RenderStats::addCacheInfosForNode(const boost::shared_ptr<Node>& node,
     
     NodeRenderStats& stats = _imp->findOrCreateNodeStats(node);
     stats.addCacheAccessInfo(isCacheMiss, hasDownscaled);
+    _imp->addTraceEvent(isCacheMiss ? eRenderTraceEventTypeCacheMiss :
+                        (hasDownscaled ? eRenderTraceEventTypeCacheHitDownscaled : eRenderTraceEventTypeCacheHit), node, 0.);
+}
+
+void
+RenderStats::addImageConversionInfosForNode(const boost::shared_ptr<Node>& node,
+                                            bool isShared)
+{
+    QMutexLocker k(&_imp->lock);
+    assert(_imp->doNodesProfiling);
+    
+    NodeRenderStats& stats = _imp->findOrCreateNodeStats(node);
+    stats.addImageConversionInfo(isShared);
+}
+
+void
+RenderStats::addArenaAllocationInfosForNode(const boost::shared_ptr<Node>& node,
+                                            bool reused,
+                                            std::size_t arenaMemoryInUse)
+{
+    QMutexLocker k(&_imp->lock);
+    assert(_imp->doNodesProfiling);
+    
+    NodeRenderStats& stats = _imp->findOrCreateNodeStats(node);
+    stats.addArenaAllocationInfo(reused, arenaMemoryInUse);
 }
 
 void
@@ -426,6 +579,25 @@ RenderStats::addRenderInfosForNode(const boost::shared_ptr<Node>& node,
     }
     stats.addTimeSpentRendering(timeSpent);
     stats.addPlaneRendered(plane);
+    _imp->addTraceEvent(identity ? eRenderTraceEventTypeIdentity : eRenderTraceEventTypeRender, node, timeSpent, plane, rectangle);
+}
+
+void
+RenderStats::addWaitInfosForNode(const boost::shared_ptr<Node>& node,
+                                 RenderTraceEventTypeEnum type,
+                                 double timeSpent)
+{
+    QMutexLocker k(&_imp->lock);
+    assert(_imp->doNodesProfiling);
+    assert(type == eRenderTraceEventTypeImageWait || type == eRenderTraceEventTypePythonWait);
+    
+    NodeRenderStats& stats = _imp->findOrCreateNodeStats(node);
+    if (type == eRenderTraceEventTypeImageWait) {
+        stats.addTimeSpentWaitingForImages(timeSpent);
+    } else {
+        stats.addTimeSpentWaitingForPython(timeSpent);
+    }
+    _imp->addTraceEvent(type, node, timeSpent);
 }
 
 std::map<boost::shared_ptr<Node>,NodeRenderStats >
@@ -446,4 +618,175 @@ RenderStats::getStats(double *totalTimeSpent) const
     return ret;
 }
 
+std::list<RenderTraceEvent>
+RenderStats::getTraceEvents() const
+{
+    QMutexLocker k(&_imp->lock);
+    
+    return _imp->traceEvents;
+}
+
+static const char*
+getTraceEventTypeName(RenderTraceEventTypeEnum type)
+{
+    switch (type) {
+    case eRenderTraceEventTypeRender:
+        return "render";
+    case eRenderTraceEventTypeIdentity:
+        return "identity";
+    case eRenderTraceEventTypeCacheHit:
+        return "cacheHit";
+    case eRenderTraceEventTypeCacheHitDownscaled:
+        return "cacheHitDownscaled";
+    case eRenderTraceEventTypeCacheMiss:
+        return "cacheMiss";
+    case eRenderTraceEventTypeImageWait:
+        return "imageWait";
+    case eRenderTraceEventTypePythonWait:
+        return "pythonWait";
+    }
+    
+    return "";
+}
+
+static std::string
+escapeJSONString(const std::string& str)
+{
+    std::string ret;
+    for (std::size_t i = 0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            ret.push_back('\\');
+            ret.push_back(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            ret.append(buf);
+        } else {
+            ret.push_back(c);
+        }
+    }
+    
+    return ret;
+}
+
+void
+RenderStats::writeTrace(std::ostream& os,
+                        int time,
+                        int view) const
+{
+    std::list<RenderTraceEvent> events;
+    int nThreads;
+    {
+        QMutexLocker k(&_imp->lock);
+        events = _imp->traceEvents;
+        nThreads = (int)_imp->threadIndexes.size();
+    }
+    
+    //The names are fetched once per node, the events only hold a weak reference
+    std::map<boost::weak_ptr<Node>, std::string> nodeNames;
+    
+    os << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"frame\":" << time << ",\"view\":" << view << "},\"traceEvents\":[";
+    for (int i = 0; i < nThreads; ++i) {
+        os << (i == 0 ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << i
+           << ",\"args\":{\"name\":\"Render thread " << i << "\"}}";
+    }
+    bool first = nThreads == 0;
+    for (std::list<RenderTraceEvent>::const_iterator it = events.begin(); it != events.end(); ++it) {
+        std::map<boost::weak_ptr<Node>, std::string>::iterator foundName = nodeNames.find(it->node);
+        if ( foundName == nodeNames.end() ) {
+            boost::shared_ptr<Node> node = it->node.lock();
+            std::string name;
+            if (node) {
+                //The label is the name shown in the node graph, it may contain any character
+                name = node->getLabel_mt_safe();
+                if ( name.empty() ) {
+                    name = node->getScriptName_mt_safe();
+                }
+            }
+            foundName = nodeNames.insert( std::make_pair( it->node, escapeJSONString(name) ) ).first;
+        }
+        if ( foundName->second.empty() ) {
+            //The node was removed
+            continue;
+        }
+        
+        //Timestamps are in microseconds
+        os << (first ? "" : ",") << "\n{\"name\":\"" << foundName->second << "\",\"cat\":\"" << getTraceEventTypeName(it->type) << "\"";
+        first = false;
+        if (it->duration > 0.) {
+            os << ",\"ph\":\"X\",\"dur\":" << (U64)(it->duration * 1e6);
+        } else {
+            os << ",\"ph\":\"i\",\"s\":\"t\"";
+        }
+        os << ",\"ts\":" << (U64)(std::max(0., it->start) * 1e6) << ",\"pid\":0,\"tid\":" << it->thread;
+        if ( (it->type == eRenderTraceEventTypeRender) || (it->type == eRenderTraceEventTypeIdentity) ) {
+            os << ",\"args\":{\"plane\":\"" << escapeJSONString(it->plane) << "\",\"rect\":[" << it->rectangle.x1 << ',' << it->rectangle.y1
+               << ',' << it->rectangle.x2 << ',' << it->rectangle.y2 << "]}";
+        }
+        os << '}';
+    }
+    os << "\n]}\n";
+}
+
+namespace {
+struct RenderStatsThreadContext
+{
+    boost::shared_ptr<RenderStats> stats;
+    boost::shared_ptr<Node> node;
+};
+
+ThreadStorage<RenderStatsThreadContext> currentThreadContext;
+}
+
+RenderStatsThreadScope::RenderStatsThreadScope(const boost::shared_ptr<RenderStats>& stats,
+                                               const boost::shared_ptr<Node>& node)
+{
+    assert(stats && stats->isInDepthProfilingEnabled());
+    RenderStatsThreadContext& context = currentThreadContext.localData();
+    _previousStats = context.stats;
+    _previousNode = context.node;
+    context.stats = stats;
+    context.node = node;
+}
+
+RenderStatsThreadScope::~RenderStatsThreadScope()
+{
+    RenderStatsThreadContext& context = currentThreadContext.localData();
+    context.stats = _previousStats;
+    context.node = _previousNode;
+}
+
+bool
+RenderStatsThreadScope::isActiveForCurrentThread()
+{
+    return currentThreadContext.hasLocalData() && currentThreadContext.localData().stats;
+}
+
+void
+RenderStatsThreadScope::reportWait(RenderTraceEventTypeEnum type,
+                                   double timeSpent)
+{
+    if ( !currentThreadContext.hasLocalData() ) {
+        return;
+    }
+    RenderStatsThreadContext& context = currentThreadContext.localData();
+    if (context.stats) {
+        context.stats->addWaitInfosForNode(context.node, type, timeSpent);
+    }
+}
+
+void
+RenderStatsThreadScope::reportArenaAllocation(bool reused,
+                                              std::size_t arenaMemoryInUse)
+{
+    if ( !currentThreadContext.hasLocalData() ) {
+        return;
+    }
+    RenderStatsThreadContext& context = currentThreadContext.localData();
+    if (context.stats) {
+        context.stats->addArenaAllocationInfosForNode(context.node, reused, arenaMemoryInUse);
+    }
+}
+
 NATRON_NAMESPACE_EXIT;
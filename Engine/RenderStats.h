@@ -30,6 +30,7 @@
 #include <set>
 #include <string>
 #include <bitset>
+#include <ostream>
 
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/shared_ptr.hpp>
@@ -85,6 +86,12 @@ public:
     void addCacheAccessInfo(bool isCacheMiss, bool hasDownscaled);
     void getCacheAccessInfos(int* nbCacheMisses, int* nbCacheHits, int* nbCacheHitButDownscaledImages) const;
     
+    void addImageConversionInfo(bool isShared);
+    void getImageConversionInfos(int* nbConversions, int* nbSharedConversions) const;
+    
+    void addArenaAllocationInfo(bool reused, std::size_t arenaMemoryInUse);
+    void getArenaAllocationInfos(int* nbAllocations, int* nbReusedBuffers, std::size_t* peakArenaMemoryInUse, double* averageArenaMemoryInUse) const;
+    
     void setTilesSupported(bool tilesSupported);
     bool isTilesSupportEnabled() const;
     
@@ -96,12 +103,44 @@ public:
     
     void setOutputPremult(ImagePremultiplicationEnum premult);
     ImagePremultiplicationEnum getOutputPremult() const;
+
+    void addTimeSpentWaitingForImages(double time);
+    double getTimeSpentWaitingForImages() const;
+
+    void addTimeSpentWaitingForPython(double time);
+    double getTimeSpentWaitingForPython() const;
     
 private:
     
     boost::scoped_ptr<NodeRenderStatsPrivate> _imp;
 };
 
+enum RenderTraceEventTypeEnum
+{
+    eRenderTraceEventTypeRender = 0, // a rectangle rendered by the render action
+    eRenderTraceEventTypeIdentity, // a rectangle for which the node is an identity
+    eRenderTraceEventTypeCacheHit,
+    eRenderTraceEventTypeCacheHitDownscaled, // a cache hit at a lower mipmap level, the image was downscaled
+    eRenderTraceEventTypeCacheMiss,
+    eRenderTraceEventTypeImageWait, // waiting for an image being rendered by another thread
+    eRenderTraceEventTypePythonWait // waiting for the Python GIL
+};
+
+/**
+ * @brief An event of the trace of a frame render. Events with a duration are spans of time spent by a thread for a node,
+ * the others are instants.
+ **/
+struct RenderTraceEvent
+{
+    RenderTraceEventTypeEnum type;
+    boost::weak_ptr<Node> node;
+    int thread; // index of the thread in the render, in order of appearance
+    double start; // in seconds since the start of the render of the frame
+    double duration; // in seconds
+    std::string plane; // for render and identity events
+    RectI rectangle; // for render and identity events
+};
+
 /**
  * @brief Holds render infos for all nodes in a compositing tree for a frame.
  **/
@@ -134,19 +173,91 @@ public:
                               bool isCacheMiss,
                               bool hasDownscaled);
     
+    /**
+     * @brief Reports that an input image fetched by the node had to be converted to another bit depth, components or
+     * mipmap level. isShared is true if the converted image was taken from the ImageConversionCache.
+     **/
+    void addImageConversionInfosForNode(const boost::shared_ptr<Node>& node,
+                                        bool isShared);
+    
+    /**
+     * @brief Reports that the node allocated a temporary image buffer from the ImageArena. reused is true if the buffer
+     * was recycled, arenaMemoryInUse is the memory of the buffers used by all the images right after the allocation.
+     **/
+    void addArenaAllocationInfosForNode(const boost::shared_ptr<Node>& node,
+                                        bool reused,
+                                        std::size_t arenaMemoryInUse);
+    
     void addRenderInfosForNode(const boost::shared_ptr<Node>& node,
                         const boost::shared_ptr<Node>& identity,
                         const std::string& plane,
                         const RectI& rectangle,
                         double timeSpent);
     
+    /**
+     * @brief Reports the time the current thread spent waiting for a resource (see RenderStatsThreadScope).
+     * type is eRenderTraceEventTypeImageWait or eRenderTraceEventTypePythonWait.
+     **/
+    void addWaitInfosForNode(const boost::shared_ptr<Node>& node,
+                             RenderTraceEventTypeEnum type,
+                             double timeSpent);
+    
     std::map<boost::shared_ptr<Node>,NodeRenderStats > getStats(double *totalTimeSpent) const;
+
+    /**
+     * @brief Returns the events recorded for the trace, in order of completion.
+     * Events are recorded only if in-depth profiling is enabled.
+     **/
+    std::list<RenderTraceEvent> getTraceEvents() const;
+
+    /**
+     * @brief Writes the trace events in the Chrome trace event format (JSON), which can be loaded by chrome://tracing
+     * or Perfetto. Each thread of the render is a track, frame and view are added to the metadata. The events are named
+     * after the label of their node.
+     **/
+    void writeTrace(std::ostream& os, int time, int view) const;
     
 private:
     
     boost::scoped_ptr<RenderStatsPrivate> _imp;
 };
 
+/**
+ * @brief While an instance is alive, the time the current thread spends waiting for images rendered by other threads
+ * and for the Python GIL is reported to the stats of the given node. Scopes can be nested, e.g when a node renders its
+ * inputs, the time is then reported to the innermost scope.
+ **/
+class RenderStatsThreadScope
+{
+public:
+
+    RenderStatsThreadScope(const boost::shared_ptr<RenderStats>& stats,
+                           const boost::shared_ptr<Node>& node);
+
+    ~RenderStatsThreadScope();
+
+    /**
+     * @brief Returns true if the current thread is in a scope: callers only need to measure the time spent waiting
+     * in that case.
+     **/
+    static bool isActiveForCurrentThread();
+
+    /**
+     * @brief Reports the time spent waiting to the innermost scope of the current thread, if any.
+     **/
+    static void reportWait(RenderTraceEventTypeEnum type, double timeSpent);
+
+    /**
+     * @brief Reports an allocation of the ImageArena to the innermost scope of the current thread, if any.
+     **/
+    static void reportArenaAllocation(bool reused, std::size_t arenaMemoryInUse);
+
+private:
+
+    boost::shared_ptr<RenderStats> _previousStats;
+    boost::shared_ptr<Node> _previousNode;
+};
+
 NATRON_NAMESPACE_EXIT;
 
 
@@ -25,6 +25,7 @@
 #include "Settings.h"
 
 #include <stdexcept>
+#include <algorithm> // min, max
 
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
@@ -41,6 +42,7 @@
 
 #include "Engine/AppManager.h"
 #include "Engine/AppInstance.h"
+#include "Engine/ImageAllocator.h"
 #include "Engine/KnobFactory.h"
 #include "Engine/KnobFile.h"
 #include "Engine/KnobTypes.h"
@@ -213,9 +215,11 @@ Settings::initializeKnobsGeneral()
                                    "This suppresses the overhead created by the operating system creating new threads on demand for "
                                    "each rendering of a special effect. As a result of this, the rendering might be faster on systems "
                                    "with a lot of cores (>= 8). \n"
-                                   "WARNING: This is known not to work when using The Foundry's Furnace plug-ins (and potentially "
-                                   "some other plug-ins that the dev team hasn't not tested against it). When using these plug-ins, "
-                                   "make sure to uncheck this option first otherwise it will crash " NATRON_APPLICATION_NAME);
+                                   "When unchecked, effects launch new threads each time they process an image.\n"
+                                   "WARNING: The thread-pool is known not to work with The Foundry's Furnace plug-ins (and potentially "
+                                   "some other plug-ins that the dev team hasn't not tested against it). These plug-ins can be "
+                                   "given their own threads in the \"Multi-thread\" parameter of the Plug-ins tab, without unchecking this option "
+                                   "for all the other effects.");
     _useThreadPool->setAnimationEnabled(false);
     _generalTab->addKnob(_useThreadPool);
 
@@ -298,6 +302,17 @@ Settings::initializeKnobsGeneral()
     _loadProjectsWorkspace->setAnimationEnabled(false);
     _generalTab->addKnob(_loadProjectsWorkspace);
 
+    _saveProjectsInBinaryFormat = AppManager::createKnob<KnobBool>(this, "Save projects in binary format");
+    _saveProjectsInBinaryFormat->setName("saveProjectsInBinaryFormat");
+    _saveProjectsInBinaryFormat->setHintToolTip("When checked, projects are saved in a compact binary format instead of XML. "
+                                                "Large projects (many nodes, animated parameters or roto shapes) are much faster "
+                                                "to load and save in this format.\n"
+                                                "Binary projects can only be opened by the same version of " NATRON_APPLICATION_NAME
+                                                " on the same kind of computer: keep this unchecked to exchange projects. "
+                                                "Both formats are recognized automatically when loading a project.");
+    _saveProjectsInBinaryFormat->setAnimationEnabled(false);
+    _generalTab->addKnob(_saveProjectsInBinaryFormat);
+
     _renderOnEditingFinished = AppManager::createKnob<KnobBool>(this, "Refresh viewer only when editing is finished");
     _renderOnEditingFinished->setName("renderOnEditingFinished");
     _renderOnEditingFinished->setHintToolTip("When checked, the viewer triggers a new render only when mouse is released when editing parameters, curves "
@@ -1147,6 +1162,54 @@ Settings::initializeKnobsCaching()
     _maxDiskCacheNodeGB->setHintToolTip("The maximum size that may be used by the DiskCache node on disk (in GiB)");
     _cachingTab->addKnob(_maxDiskCacheNodeGB);
 
+    _cacheShards = AppManager::createKnob<KnobInt>(this, "Number of cache shards (0=\"guess\")");
+    _cacheShards->setName("cacheShards");
+    _cacheShards->setAnimationEnabled(false);
+    _cacheShards->setMinimum(0);
+    _cacheShards->setMaximum(256);
+    _cacheShards->disableSlider();
+    _cacheShards->setHintToolTip("WARNING: Changing this parameter requires a restart of the application. \n"
+                                 "The node cache and the playback cache are split in this number of independently locked "
+                                 "parts so that render threads looking-up different images do not wait for each other. "
+                                 "1 means the caches have a single lock, which is enough for machines with few cores. "
+                                 "0 means the number of shards is guessed from the number of cores.");
+    _cachingTab->addKnob(_cacheShards);
+
+    _hugePagesForImages = AppManager::createKnob<KnobBool>(this, "Use huge pages for large images");
+    _hugePagesForImages->setName("hugePagesForImages");
+    _hugePagesForImages->setAnimationEnabled(false);
+    _hugePagesForImages->setHintToolTip("When checked, the images of at least 2 MiB are allocated on their own and backed by "
+                                        "transparent huge pages, which reduces the TLB misses when processing large float images. "
+                                        "The system must have transparent huge pages enabled in \"madvise\" or \"always\" mode. "
+                                        "This is only available on Linux. Only the images allocated after the change are affected.");
+    if ( !ImageAllocator::isHugePagesSupported() ) {
+        _hugePagesForImages->setAllDimensionsEnabled(false);
+    }
+    _cachingTab->addKnob(_hugePagesForImages);
+
+    _firstTouchImages = AppManager::createKnob<KnobBool>(this, "Allocate images in the memory of the rendering CPU");
+    _firstTouchImages->setName("firstTouchImages");
+    _firstTouchImages->setAnimationEnabled(false);
+    _firstTouchImages->setHintToolTip("When checked, the memory of an image is touched by the render thread creating it, so that "
+                                      "the system places the whole image in the memory of the CPU running that thread. "
+                                      "On machines with several CPU sockets (NUMA), this avoids images scattered between the "
+                                      "memories of the CPUs, at the cost of touching the memory of each image once when it is "
+                                      "allocated. This is useless on machines with a single CPU socket.");
+    _cachingTab->addKnob(_firstTouchImages);
+
+    _contentAddressedHashes = AppManager::createKnob<KnobBool>(this, "Derive the node hashes from the parameter values");
+    _contentAddressedHashes->setName("contentAddressedHashes");
+    _contentAddressedHashes->setAnimationEnabled(false);
+    _contentAddressedHashes->setHintToolTip("When checked, the hash identifying the images of a node in the cache is computed from the "
+                                            "values and animation curves of its parameters instead of the number of times they were "
+                                            "edited. Setting a parameter back to a previous value, undoing a change or opening the "
+                                            "same project again then finds the images rendered before in the cache.\n"
+                                            "The images of the previous values of a node are not removed from the cache any longer "
+                                            "when it changes: they stay until the cache needs their memory.\n"
+                                            "Nodes whose parameters are driven by expressions, readers and the nodes reading a file "
+                                            "keep the previous behaviour.");
+    _cachingTab->addKnob(_contentAddressedHashes);
+
 
     _diskCachePath = AppManager::createKnob<KnobPath>(this, "Disk cache path (empty = default)");
     _diskCachePath->setName("diskCachePath");
@@ -1353,6 +1416,7 @@ Settings::setDefaultValues()
     _snapNodesToConnections->setDefaultValue(true);
     _useBWIcons->setDefaultValue(false);
     _loadProjectsWorkspace->setDefaultValue(false);
+    _saveProjectsInBinaryFormat->setDefaultValue(false);
     _useNodeGraphHints->setDefaultValue(true);
     _numberOfThreads->setDefaultValue(0,0);
     _numberOfParallelRenders->setDefaultValue(0,0);
@@ -1395,6 +1459,10 @@ Settings::setDefaultValues()
     _unreachableRAMPercent->setDefaultValue(5);
     _maxViewerDiskCacheGB->setDefaultValue(5,0);
     _maxDiskCacheNodeGB->setDefaultValue(10,0);
+    _cacheShards->setDefaultValue(0,0);
+    _hugePagesForImages->setDefaultValue(false);
+    _firstTouchImages->setDefaultValue(false);
+    _contentAddressedHashes->setDefaultValue(false);
     setCachingLabels();
     _autoTurbo->setDefaultValue(false);
     _usePluginIconsInNodeGraph->setDefaultValue(true);
@@ -1976,6 +2044,20 @@ Settings::onKnobValueChanged(KnobI* k,
             appPTR->setPlaybackCacheMaximumSize( getRamPlaybackMaximumPercent() );
         }
         setCachingLabels();
+    } else if ( k == _hugePagesForImages.get() ) {
+        ImageAllocator::setHugePagesEnabled( _hugePagesForImages->getValue() );
+    } else if ( k == _firstTouchImages.get() ) {
+        ImageAllocator::setFirstTouchEnabled( _firstTouchImages->getValue() );
+    } else if ( k == _contentAddressedHashes.get() ) {
+        ///Recompute the hash of all nodes with the new mode
+        const std::map<int,AppInstanceRef>& apps = appPTR->getAppInstances();
+        for (std::map<int,AppInstanceRef>::const_iterator it = apps.begin(); it != apps.end(); ++it) {
+            NodeList nodes;
+            it->second.app->getProject()->getNodes_recursive(nodes, false);
+            for (NodeList::iterator it2 = nodes.begin(); it2 != nodes.end(); ++it2) {
+                (*it2)->computeHash();
+            }
+        }
     } else if ( k == _diskCachePath.get() ) {
         appPTR->setDiskCacheLocation(_diskCachePath->getValue().c_str());
     } else if ( k == _wipeDiskCache.get() ) {
@@ -2118,6 +2200,42 @@ Settings::getMaximumDiskCacheNodeSize() const
     return (U64)( _maxDiskCacheNodeGB->getValue() ) * std::pow(1024.,3.);
 }
 
+bool
+Settings::isHugePagesForImagesEnabled() const
+{
+    return _hugePagesForImages->getValue();
+}
+
+bool
+Settings::isFirstTouchForImagesEnabled() const
+{
+    return _firstTouchImages->getValue();
+}
+
+bool
+Settings::isContentAddressedHashEnabled() const
+{
+    return _contentAddressedHashes->getValue();
+}
+
+int
+Settings::getNumberOfCacheShards() const
+{
+    int nShards = _cacheShards->getValue();
+
+    if (nShards == 0) {
+        ///Use the next power of 2 of the number of cores, there's no point in going above that
+        ///since at most that many threads will look-up the caches at once
+        int idealThreadCount = std::max(1, QThread::idealThreadCount());
+        nShards = 1;
+        while (nShards < idealThreadCount) {
+            nShards *= 2;
+        }
+    }
+
+    return nShards;
+}
+
 double
 Settings::getUnreachableRamPercent() const
 {
@@ -2329,6 +2447,15 @@ static int filterDefaultRenderScaleSupportPlugin(const QString& ofxPluginID)
     return 0;
 }
 
+static MultiThreadSuiteModeEnum filterDefaultMultiThreadSuitePlugin(const QString& ofxPluginID)
+{
+    // Furnace crashes when its thread functions run on recycled threads
+    if ( ofxPluginID.startsWith("uk.co.thefoundry.furnace") ) {
+        return eMultiThreadSuiteModeNewThreads;
+    }
+    return eMultiThreadSuiteModeDefault;
+}
+
 
 void
 Settings::populatePluginsTab()
@@ -2368,6 +2495,12 @@ Settings::populatePluginsTab()
     zoomSupportEntries.push_back("Plugin default");
     zoomSupportEntries.push_back("Deactivated");
     
+    std::vector<std::string> multiThreadEntries;
+    multiThreadEntries.push_back("Preference");
+    multiThreadEntries.push_back("Thread-pool");
+    multiThreadEntries.push_back("Dedicated threads");
+    multiThreadEntries.push_back("New threads");
+    
     ///Create per-plugin knobs and add them to groups
     for (PluginsMap::const_iterator it = plugins.begin(); it != plugins.end(); ++it) {
         
@@ -2437,14 +2570,36 @@ Settings::populatePluginsTab()
                                         "Changes to this parameter will not be applied to existing instances of the plug-in (nodes) unless you "
                                         "restart the application.");
             zoomSupport->setAnimationEnabled(false);
+            zoomSupport->setAddNewLine(false);
             if (group) {
                 group->addKnob(zoomSupport);
             }
             
             knobsToRestore.push_back(zoomSupport);
             
+            boost::shared_ptr<KnobChoice> multiThreadSuite = AppManager::createKnob<KnobChoice>(this, "Multi-thread");
+            multiThreadSuite->populateChoices(multiThreadEntries);
+            multiThreadSuite->setName(it->first + ".multiThread");
+            multiThreadSuite->setDefaultValue( (int)filterDefaultMultiThreadSuitePlugin( plugin->getPluginID() ) );
+            multiThreadSuite->setHintToolTip("Controls on which threads the plug-in does its multi-threaded processing.\n"
+                                             "Preference: as set by the \"Effects use thread-pool\" preference.\n"
+                                             "Thread-pool: the threads shared with the renders, which is the fastest.\n"
+                                             "Dedicated threads: threads created once that only run the processing of effects, "
+                                             "for plug-ins that crash with the thread-pool. The threads are re-used: data that the "
+                                             "plug-in keeps in its own thread-local storage stays from one processing to the next.\n"
+                                             "New threads: new threads are created each time, for plug-ins that expect brand new threads "
+                                             "(slowest).\n"
+                                             "Changes to this parameter will not be applied to existing instances of the plug-in (nodes) unless you "
+                                             "restart the application.");
+            multiThreadSuite->setAnimationEnabled(false);
+            if (group) {
+                group->addKnob(multiThreadSuite);
+            }
+            
+            knobsToRestore.push_back(multiThreadSuite);
+            
             
-            _pluginsMap.insert(std::make_pair(plugin, PerPluginKnobs(pluginActivation,zoomSupport)));
+            _pluginsMap.insert(std::make_pair(plugin, PerPluginKnobs(pluginActivation,zoomSupport,multiThreadSuite)));
 
         }
         
@@ -2482,6 +2637,20 @@ Settings::getRenderScaleSupportPreference(const Plugin* p) const
     return found->second.renderScaleSupport->getValue();
 }
 
+MultiThreadSuiteModeEnum
+Settings::getMultiThreadSuitePreference(const Plugin* p) const
+{
+    if (p->getIsForInternalUseOnly()) {
+        return eMultiThreadSuiteModeDefault;
+    }
+    std::map<const Plugin*,PerPluginKnobs>::const_iterator found = _pluginsMap.find(p);
+    if (found == _pluginsMap.end()) {
+        qDebug() << "Settings::getMultiThreadSuitePreference: Plugin not found";
+        return eMultiThreadSuiteModeDefault;
+    }
+    return (MultiThreadSuiteModeEnum)found->second.multiThreadSuite->getValue();
+}
+
 
 void
 Settings::populateSystemFonts(const QSettings& settings,const std::vector<std::string>& fonts)
@@ -2854,6 +3023,12 @@ Settings::getLoadProjectWorkspce() const
     return _loadProjectsWorkspace->getValue();
 }
 
+bool
+Settings::isSaveProjectsInBinaryFormatEnabled() const
+{
+    return _saveProjectsInBinaryFormat->getValue();
+}
+
 bool
 Settings::useCursorPositionIncrements() const
 {
@@ -104,6 +104,14 @@ public:
     
     U64 getMaximumDiskCacheNodeSize() const;
 
+    int getNumberOfCacheShards() const;
+
+    bool isHugePagesForImagesEnabled() const;
+
+    bool isFirstTouchForImagesEnabled() const;
+
+    bool isContentAddressedHashEnabled() const;
+
     double getUnreachableRamPercent() const;
 
     bool getColorPickerLinear() const;
@@ -219,6 +227,8 @@ public:
     
     bool getLoadProjectWorkspce() const;
 
+    bool isSaveProjectsInBinaryFormatEnabled() const;
+
     bool useCursorPositionIncrements() const;
 
     bool isAutoProjectFormatEnabled() const;
@@ -256,6 +266,8 @@ public:
      **/
     int getRenderScaleSupportPreference(const Plugin* p) const;
     
+    MultiThreadSuiteModeEnum getMultiThreadSuitePreference(const Plugin* p) const;
+    
     
     bool notifyOnFileChange() const;
     
@@ -390,6 +402,7 @@ private:
     boost::shared_ptr<KnobBool> _useCursorPositionIncrements;
     boost::shared_ptr<KnobFile> _defaultLayoutFile;
     boost::shared_ptr<KnobBool> _loadProjectsWorkspace;
+    boost::shared_ptr<KnobBool> _saveProjectsInBinaryFormat;
     boost::shared_ptr<KnobBool> _renderOnEditingFinished;
     boost::shared_ptr<KnobBool> _activateRGBSupport;
     boost::shared_ptr<KnobBool> _activateTransformConcatenationSupport;
@@ -425,6 +438,13 @@ private:
     ///The total disk space allowed for all Natron's caches
     boost::shared_ptr<KnobInt> _maxViewerDiskCacheGB;
     boost::shared_ptr<KnobInt> _maxDiskCacheNodeGB;
+    ///The number of independently locked shards of the node and viewer caches
+    boost::shared_ptr<KnobInt> _cacheShards;
+    ///The allocation policies of ImageAllocator
+    boost::shared_ptr<KnobBool> _hugePagesForImages;
+    boost::shared_ptr<KnobBool> _firstTouchImages;
+    ///If checked, the hash of a node is derived from the content of its knobs instead of their age
+    boost::shared_ptr<KnobBool> _contentAddressedHashes;
     boost::shared_ptr<KnobPath> _diskCachePath;
     boost::shared_ptr<KnobButton> _wipeDiskCache;
     
@@ -538,17 +558,20 @@ private:
     {
         boost::shared_ptr<KnobBool> enabled;
         boost::shared_ptr<KnobChoice> renderScaleSupport;
+        boost::shared_ptr<KnobChoice> multiThreadSuite;
         
         PerPluginKnobs(const boost::shared_ptr<KnobBool>& enabled,
-                       const boost::shared_ptr<KnobChoice>& renderScaleSupport)
+                       const boost::shared_ptr<KnobChoice>& renderScaleSupport,
+                       const boost::shared_ptr<KnobChoice>& multiThreadSuite)
         : enabled(enabled)
         , renderScaleSupport(renderScaleSupport)
+        , multiThreadSuite(multiThreadSuite)
         {
             
         }
         
         PerPluginKnobs()
-        : enabled() , renderScaleSupport()
+        : enabled() , renderScaleSupport(), multiThreadSuite()
         {
             
         }
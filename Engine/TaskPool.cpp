@@ -0,0 +1,439 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "TaskPool.h"
+
+#include <algorithm> // min, max
+#include <cassert>
+#include <deque>
+
+#include <boost/shared_ptr.hpp>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+#include "Engine/Timer.h"
+
+NATRON_NAMESPACE_ENTER;
+
+namespace {
+/**
+ * @brief A batch of tasks started by TaskPool::run(). Tasks are claimed in order by incrementing nextTask,
+ * by the thread that started the batch and by the worker threads that took the batch from a queue.
+ **/
+struct TaskBatch
+{
+    std::vector<TaskPool::Task> tasks; // cleared when the batch is finished, the batch may still be referenced by the queues
+    const int nTasks;
+    QAtomicInt nextTask; // index of the next task to execute
+    QAtomicInt remainingTasks; // number of tasks not finished yet
+    QAtomicInt failed; // 1 if a task threw an exception
+    QMutex finishedMutex;
+    QWaitCondition finishedCond; // signaled when remainingTasks reaches 0
+
+    explicit TaskBatch(const std::vector<TaskPool::Task>& tasks)
+        : tasks(tasks)
+        , nTasks( (int)tasks.size() )
+        , nextTask(0)
+        , remainingTasks( (int)tasks.size() )
+        , failed(0)
+        , finishedMutex()
+        , finishedCond()
+    {
+    }
+
+    /**
+     * @brief Claims the next task of the batch, returns false if all tasks have already been claimed.
+     **/
+    bool claimNextTask(int* index)
+    {
+        *index = nextTask.fetchAndAddOrdered(1);
+
+        return *index < nTasks;
+    }
+
+    void setTaskFinished()
+    {
+        if (remainingTasks.fetchAndAddOrdered(-1) == 1) {
+            QMutexLocker k(&finishedMutex);
+            finishedCond.wakeAll();
+        }
+    }
+
+    void waitForFinished()
+    {
+        QMutexLocker k(&finishedMutex);
+
+        while ( (int)remainingTasks > 0 ) {
+            finishedCond.wait(&finishedMutex);
+        }
+    }
+};
+
+typedef boost::shared_ptr<TaskBatch> TaskBatchPtr;
+} // anon namespace
+
+class TaskPoolThread
+    : public QThread
+{
+public:
+
+    TaskPoolThread(TaskPoolPrivate* pool,
+                   int index)
+        : QThread()
+        , pool(pool)
+        , index(index)
+        , queueMutex()
+        , queue()
+        , stopped(true)
+    {
+        setObjectName( QString::fromUtf8("TaskPool thread %1").arg(index) );
+    }
+
+    virtual ~TaskPoolThread()
+    {
+    }
+
+    TaskPoolPrivate* pool;
+    const int index;
+
+    // batches started by tasks running on this thread: this thread takes the most recent one,
+    // the other threads steal the oldest ones
+    QMutex queueMutex;
+    std::deque<TaskBatchPtr> queue;
+
+    // true when the thread is not running or about to exit, protected by TaskPoolPrivate::poolMutex
+    bool stopped;
+
+private:
+
+    virtual void run() OVERRIDE FINAL;
+};
+
+struct TaskPoolPrivate
+{
+    mutable QMutex poolMutex; // protects everything below except the queues of the threads
+    QWaitCondition workAvailable;
+    int maxThreads;
+    U64 epoch; // incremented each time batches are queued, so that idle threads do not miss them
+    bool quit;
+    std::vector<TaskPoolThread*> threads; // threads with an index >= maxThreads stop when they are idle
+    std::deque<TaskBatchPtr> globalQueue; // batches started by threads that are not part of the pool
+    QAtomicInt activeThreads;
+
+    // statistics
+    mutable QMutex statsMutex;
+    TaskPool::Stats stats;
+    boost::scoped_ptr<TimeLapse> statsTimer;
+
+    TaskPoolPrivate(int maxThreads)
+        : poolMutex()
+        , workAvailable()
+        , maxThreads( std::max(0, maxThreads) )
+        , epoch(0)
+        , quit(false)
+        , threads()
+        , globalQueue()
+        , activeThreads(0)
+        , statsMutex()
+        , stats()
+        , statsTimer( new TimeLapse() )
+    {
+    }
+
+    TaskPoolThread* getCurrentWorker()
+    {
+        TaskPoolThread* thread = dynamic_cast<TaskPoolThread*>( QThread::currentThread() );
+
+        return (thread && thread->pool == this) ? thread : 0;
+    }
+
+    /// Must be called with poolMutex locked
+    void startThreads()
+    {
+        for (int i = 0; i < maxThreads; ++i) {
+            if ( i >= (int)threads.size() ) {
+                threads.push_back( new TaskPoolThread(this, i) );
+            }
+            TaskPoolThread* thread = threads[i];
+            if (thread->stopped) {
+                // it may still be exiting, this does not need poolMutex
+                thread->wait();
+                thread->stopped = false;
+                thread->start();
+            }
+        }
+    }
+
+    /**
+     * @brief Takes a batch from the queue of the given thread, then from the global queue, then from the queues of the other threads.
+     **/
+    TaskBatchPtr takeBatch(TaskPoolThread* self,
+                           bool* stolen)
+    {
+        *stolen = false;
+        {
+            QMutexLocker k(&self->queueMutex);
+            if ( !self->queue.empty() ) {
+                TaskBatchPtr batch = self->queue.back();
+                self->queue.pop_back();
+
+                return batch;
+            }
+        }
+
+        QMutexLocker k(&poolMutex);
+        if ( !globalQueue.empty() ) {
+            TaskBatchPtr batch = globalQueue.front();
+            globalQueue.pop_front();
+
+            return batch;
+        }
+        // start stealing from the next thread so that the victims are spread
+        int nThreads = (int)threads.size();
+        for (int i = 1; i < nThreads; ++i) {
+            TaskPoolThread* victim = threads[(self->index + i) % nThreads];
+            QMutexLocker q(&victim->queueMutex);
+            if ( !victim->queue.empty() ) {
+                TaskBatchPtr batch = victim->queue.front();
+                victim->queue.pop_front();
+                *stolen = true;
+
+                return batch;
+            }
+        }
+
+        return TaskBatchPtr();
+    }
+
+    enum TaskOriginEnum
+    {
+        eTaskOriginOwnQueue, // executed by a worker thread, from its own queue or the global queue
+        eTaskOriginStolen, // executed by a worker thread, from the queue of another worker thread
+        eTaskOriginHelped // executed by the thread waiting for the batch
+    };
+
+    /**
+     * @brief Executes the next task of the batch, returns false if all tasks have already been claimed.
+     * The statistics are updated before the batch can finish, so that they are exact once TaskPool::run() returns.
+     **/
+    bool executeNextTask(TaskBatch& batch,
+                         TaskOriginEnum origin)
+    {
+        int i;
+
+        if ( !batch.claimNextTask(&i) ) {
+            return false;
+        }
+
+        int nActive = 0;
+        if (origin != eTaskOriginHelped) {
+            nActive = activeThreads.fetchAndAddOrdered(1) + 1;
+        }
+        TimeLapse timer;
+        try {
+            batch.tasks[i]();
+        } catch (...) {
+            batch.failed.fetchAndStoreOrdered(1);
+        }
+        double elapsed = timer.getTimeSinceCreation();
+        if (origin != eTaskOriginHelped) {
+            activeThreads.fetchAndAddOrdered(-1);
+        }
+        {
+            QMutexLocker k(&statsMutex);
+            ++stats.nTasks;
+            if (origin == eTaskOriginHelped) {
+                ++stats.nTasksHelped;
+            } else {
+                stats.peakActiveThreads = std::max(stats.peakActiveThreads, nActive);
+                stats.busyTime += elapsed;
+                if (origin == eTaskOriginStolen) {
+                    ++stats.nTasksStolen;
+                }
+            }
+        }
+        batch.setTaskFinished();
+
+        return true;
+    }
+};
+
+void
+TaskPoolThread::run()
+{
+    for (;;) {
+        U64 epoch;
+        {
+            QMutexLocker k(&pool->poolMutex);
+            if ( pool->quit || (index >= pool->maxThreads) ) {
+                // hand over the batches that were not started yet to the other threads
+                bool handedOver = false;
+                {
+                    QMutexLocker q(&queueMutex);
+                    handedOver = !queue.empty();
+                    pool->globalQueue.insert( pool->globalQueue.end(), queue.begin(), queue.end() );
+                    queue.clear();
+                }
+                if (handedOver) {
+                    ++pool->epoch;
+                    pool->workAvailable.wakeAll();
+                }
+                stopped = true;
+
+                return;
+            }
+            epoch = pool->epoch;
+        }
+
+        bool stolen;
+        TaskBatchPtr batch = pool->takeBatch(this, &stolen);
+        if (batch) {
+            while ( pool->executeNextTask(*batch, stolen ? TaskPoolPrivate::eTaskOriginStolen : TaskPoolPrivate::eTaskOriginOwnQueue) ) {
+            }
+            continue;
+        }
+
+        QMutexLocker k(&pool->poolMutex);
+        while ( !pool->quit && (index < pool->maxThreads) && (epoch == pool->epoch) ) {
+            pool->workAvailable.wait(&pool->poolMutex);
+        }
+    }
+}
+
+TaskPool::TaskPool(int maxThreads)
+    : _imp( new TaskPoolPrivate(maxThreads) )
+{
+}
+
+TaskPool::~TaskPool()
+{
+    std::vector<TaskPoolThread*> threads;
+    {
+        QMutexLocker k(&_imp->poolMutex);
+        _imp->quit = true;
+        _imp->workAvailable.wakeAll();
+        threads = _imp->threads;
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i) {
+        threads[i]->wait();
+        delete threads[i];
+    }
+}
+
+void
+TaskPool::setMaxThreadCount(int maxThreads)
+{
+    QMutexLocker k(&_imp->poolMutex);
+
+    _imp->maxThreads = std::max(0, maxThreads);
+    // wake-up the threads that have to stop, the others are started on demand
+    _imp->workAvailable.wakeAll();
+}
+
+int
+TaskPool::getMaxThreadCount() const
+{
+    QMutexLocker k(&_imp->poolMutex);
+
+    return _imp->maxThreads;
+}
+
+int
+TaskPool::getActiveThreadCount() const
+{
+    return (int)_imp->activeThreads;
+}
+
+bool
+TaskPool::run(const std::vector<Task>& tasks)
+{
+    if ( tasks.empty() ) {
+        return true;
+    }
+
+    TaskBatchPtr batch( new TaskBatch(tasks) );
+    {
+        QMutexLocker k(&_imp->statsMutex);
+        ++_imp->stats.nBatches;
+    }
+
+    // the calling thread executes tasks too, queue the batch once per additional thread that may help
+    int nHelpers;
+    {
+        QMutexLocker k(&_imp->poolMutex);
+        nHelpers = std::min( (int)tasks.size() - 1, _imp->maxThreads );
+    }
+    if (nHelpers > 0) {
+        TaskPoolThread* self = _imp->getCurrentWorker();
+        if (self) {
+            QMutexLocker k(&self->queueMutex);
+            self->queue.insert(self->queue.end(), nHelpers, batch);
+        }
+        QMutexLocker k(&_imp->poolMutex);
+        if (!self) {
+            _imp->globalQueue.insert(_imp->globalQueue.end(), nHelpers, batch);
+        }
+        _imp->startThreads();
+        ++_imp->epoch;
+        _imp->workAvailable.wakeAll();
+    }
+
+    while ( _imp->executeNextTask(*batch, TaskPoolPrivate::eTaskOriginHelped) ) {
+    }
+    batch->waitForFinished();
+    // all the tasks have been claimed: no thread accesses them anymore.
+    // Release what they hold now rather than when the last queue entry of the batch is dropped.
+    batch->tasks.clear();
+
+    return (int)batch->failed == 0;
+}
+
+TaskPool::Stats
+TaskPool::getStats() const
+{
+    Stats ret;
+    {
+        QMutexLocker k(&_imp->statsMutex);
+        ret = _imp->stats;
+        ret.elapsedTime = _imp->statsTimer->getTimeSinceCreation();
+    }
+    ret.maxThreads = getMaxThreadCount();
+    ret.activeThreads = getActiveThreadCount();
+
+    return ret;
+}
+
+void
+TaskPool::resetStats()
+{
+    QMutexLocker k(&_imp->statsMutex);
+
+    _imp->stats = Stats();
+    _imp->statsTimer.reset( new TimeLapse() );
+}
+
+NATRON_NAMESPACE_EXIT;
@@ -0,0 +1,174 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef Engine_TaskPool_h
+#define Engine_TaskPool_h
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+#include <vector>
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+NATRON_NAMESPACE_ENTER;
+
+/**
+ * @brief A pool of worker threads executing batches of tasks, used by the tiled renders (EffectInstance::renderRoI),
+ * the OpenFX multi-thread suite and the viewer.
+ *
+ * Each worker thread has its own queue of batches: a batch started from a worker thread is pushed on its queue and
+ * idle workers steal batches from the queues of the others. The thread that starts a batch executes tasks of that
+ * batch while waiting for it to finish, hence a batch always makes progress even when all the workers are busy and
+ * nested batches (e.g. a tile that renders its inputs with tiles) neither serialize nor need more threads.
+ *
+ * The waiting thread only executes tasks of its own batch: tasks of other batches may need the thread-local storage
+ * of the render they belong to, or locks held by the render of the waiting thread.
+ **/
+struct TaskPoolPrivate;
+class TaskPool
+{
+public:
+
+    typedef boost::function<void ()> Task;
+
+    /**
+     * @brief Occupancy statistics of the pool, since its creation or the last call to resetStats()
+     **/
+    struct Stats
+    {
+        int maxThreads; // current maximum number of worker threads
+        int activeThreads; // worker threads currently executing tasks
+        int peakActiveThreads; // maximum of activeThreads
+        U64 nBatches; // number of batches started
+        U64 nTasks; // number of tasks executed
+        U64 nTasksStolen; // tasks executed by a worker that took their batch from the queue of another worker
+        U64 nTasksHelped; // tasks executed by the thread waiting for their batch
+        double busyTime; // total time spent by the worker threads executing tasks, in seconds
+        double elapsedTime; // wall-clock time covered by the statistics, in seconds
+
+        Stats()
+            : maxThreads(0)
+            , activeThreads(0)
+            , peakActiveThreads(0)
+            , nBatches(0)
+            , nTasks(0)
+            , nTasksStolen(0)
+            , nTasksHelped(0)
+            , busyTime(0.)
+            , elapsedTime(0.)
+        {
+        }
+
+        /// Average fraction of the worker threads that were executing tasks, between 0 and 1
+        double getOccupancy() const
+        {
+            return (maxThreads > 0 && elapsedTime > 0.) ? busyTime / (elapsedTime * maxThreads) : 0.;
+        }
+    };
+
+    explicit TaskPool(int maxThreads);
+
+    ~TaskPool();
+
+    /**
+     * @brief Sets the number of worker threads. Threads are started on demand and stopped when they are idle.
+     * With 0 threads, all tasks are executed by the thread that starts the batch.
+     **/
+    void setMaxThreadCount(int maxThreads);
+
+    int getMaxThreadCount() const;
+
+    /**
+     * @brief Returns the number of worker threads currently executing tasks.
+     **/
+    int getActiveThreadCount() const;
+
+    /**
+     * @brief Executes all the tasks and returns when they are all finished. The calling thread executes tasks while waiting.
+     * Returns false if any of the tasks threw an exception, the other tasks are still executed.
+     **/
+    bool run(const std::vector<Task>& tasks);
+
+    /**
+     * @brief Same as QtConcurrent::mapped(sequence, functor).waitForFinished(): calls functor on each element of the sequence
+     * and stores the results in the order of the sequence.
+     * Returns false if functor threw an exception, in which case the corresponding results are default-constructed.
+     **/
+    template <typename RESULT, typename SEQUENCE, typename FUNCTOR>
+    bool mapped(const SEQUENCE& sequence,
+                FUNCTOR functor,
+                std::vector<RESULT>* results)
+    {
+        results->clear();
+        results->resize( sequence.size() );
+        std::vector<Task> tasks;
+        tasks.reserve( sequence.size() );
+        std::size_t i = 0;
+        for (typename SEQUENCE::const_iterator it = sequence.begin(); it != sequence.end(); ++it, ++i) {
+            tasks.push_back( MapTask<RESULT, FUNCTOR, typename SEQUENCE::value_type>(functor, &*it, &(*results)[i]) );
+        }
+
+        return run(tasks);
+    }
+
+    Stats getStats() const;
+
+    void resetStats();
+
+private:
+
+    template <typename RESULT, typename FUNCTOR, typename ARG>
+    struct MapTask
+    {
+        FUNCTOR functor;
+        const ARG* arg;
+        RESULT* result;
+
+        MapTask(FUNCTOR functor,
+                const ARG* arg,
+                RESULT* result)
+            : functor(functor)
+            , arg(arg)
+            , result(result)
+        {
+        }
+
+        void operator()()
+        {
+            *result = functor(*arg);
+        }
+    };
+
+    boost::scoped_ptr<TaskPoolPrivate> _imp;
+};
+
+NATRON_NAMESPACE_EXIT;
+
+#endif // Engine_TaskPool_h
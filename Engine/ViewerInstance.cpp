@@ -27,8 +27,10 @@
 
 #include <algorithm> // min, max
 #include <stdexcept>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
 // /usr/local/include/boost/bind/arg.hpp:37:9: warning: unused typedef 'boost_static_assert_typedef_37' [-Wunused-local-typedef]
 #include <boost/bind.hpp>
@@ -36,18 +38,17 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 
 CLANG_DIAG_OFF(deprecated)
 #include <QtCore/QtGlobal>
-#include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt5
 #include <QtCore/QFutureWatcher>
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QCoreApplication>
-#include <QtCore/QThreadPool>
 CLANG_DIAG_ON(deprecated)
 
 #include "Global/MemoryInfo.h"
 #include "Engine/AppInstance.h"
 #include "Engine/AppManager.h"
 #include "Engine/Cache.h"
+#include "Engine/ColorSIMD.h"
 #include "Engine/Image.h"
 #include "Engine/ImageInfo.h"
 #include "Engine/ImageInfo.h"
@@ -64,6 +65,7 @@ CLANG_DIAG_ON(deprecated)
 #include "Engine/RotoPaint.h"
 #include "Engine/RotoStrokeItem.h"
 #include "Engine/Settings.h"
+#include "Engine/TaskPool.h"
 #include "Engine/TimeLine.h"
 #include "Engine/Timer.h"
 
@@ -1615,11 +1617,9 @@ ViewerInstance::renderViewer_internal(int view,
                           inArgs.params->ramBuffer);
         } else {
             
-            bool runInCurrentThread = QThreadPool::globalInstance()->activeThreadCount() >= QThreadPool::globalInstance()->maxThreadCount();
+            ///No need to check whether threads are available: this thread renders parts while waiting for the others, see TaskPool
+            bool runInCurrentThread = splitRoi.size() > 1;
             std::vector<RectI> splitRects;
-            if (!runInCurrentThread && splitRoi.size() > 1) {
-                runInCurrentThread = true;
-            }
             if (!runInCurrentThread) {
                 splitRects = viewerRenderRoI.splitIntoSmallerRects(appPTR->getHardwareIdealThreadCount());
             }
@@ -1632,15 +1632,16 @@ ViewerInstance::renderViewer_internal(int view,
                 
                 if (!runInCurrentThread) {
                     
-                    QFuture<std::pair<double,double> > future = QtConcurrent::mapped( splitRects,
-                                                                                     boost::bind(findAutoContrastVminVmax,
-                                                                                                 colorImage,
-                                                                                                 inArgs.channels,
-                                                                                                 _1) );
-                    future.waitForFinished();
+                    std::vector<std::pair<double,double> > results;
+                    appPTR->getTaskPool()->mapped( splitRects,
+                                                   boost::bind(findAutoContrastVminVmax,
+                                                               colorImage,
+                                                               inArgs.channels,
+                                                               _1),
+                                                   &results );
                     
                     std::pair<double,double> vMinMax;
-                    Q_FOREACH ( vMinMax, future.results() ) {
+                    Q_FOREACH ( vMinMax, results ) {
                         if (vMinMax.first < vmin) {
                             vmin = vMinMax.first;
                         }
@@ -1684,13 +1685,16 @@ ViewerInstance::renderViewer_internal(int view,
                 renderFunctor(viewerRenderRoI,
                               args, this, inArgs.params->ramBuffer);
             } else {
+                std::vector<TaskPool::Task> tasks;
+                for (std::size_t i = 0; i < splitRects.size(); ++i) {
+                    tasks.push_back( boost::bind(&renderFunctor,
+                                                 splitRects[i],
+                                                 args,
+                                                 this,
+                                                 inArgs.params->ramBuffer) );
+                }
                 QReadLocker k(&_imp->gammaLookupMutex);
-                QtConcurrent::map( splitRects,
-                                  boost::bind(&renderFunctor,
-                                              _1,
-                                              args,
-                                              this,
-                                              inArgs.params->ramBuffer) ).waitForFinished();
+                appPTR->getTaskPool()->run(tasks);
             }
             
             if (splitRoi.size() > 1 && rectIndex < (splitRoi.size() -1)) {
@@ -1906,6 +1910,129 @@ findAutoContrastVminVmax(boost::shared_ptr<const Image> inputImage,
     
 } // findAutoContrastVminVmax
 
+namespace {
+/**
+ * @brief Vectorized path of scaleToTexture8bits_generic() for float images without input color-space, luminance or matte:
+ * the gain, offset, gamma and output color-space of the viewer are applied to whole rows with the kernels of ColorSIMD.h,
+ * only the error diffusion is done pixel per pixel. The output is the same as the per-pixel code.
+ **/
+class TextureRow8bitsConverter
+{
+    const RenderViewerArgs & _args;
+    ViewerInstance* _viewer;
+    int _nComps;
+    int _width;
+    bool _opaque;
+
+    // index of the r,g,b channels in the source pixels, or -1 if the channel is 0
+    int _channelIndex[3];
+    std::vector<float> _tmpRow;
+    std::vector<unsigned short> _lutRow; // if the viewer has a color-space
+    std::vector<unsigned char> _byteRow; // otherwise
+    unsigned short _lutZero;
+    unsigned char _byteZero;
+
+public:
+
+    static bool canConvert(const RenderViewerArgs & args,
+                           std::size_t pixelSize,
+                           bool applyMatte)
+    {
+        //args.gamma is in fact 1. / gamma at this point
+        return pixelSize == sizeof(float) && !args.srcColorSpace && !applyMatte && args.channels != eDisplayChannelsY && args.gamma != 0.;
+    }
+
+    TextureRow8bitsConverter(const RenderViewerArgs & args,
+                             ViewerInstance* viewer,
+                             int nComps,
+                             int rOffset,
+                             int gOffset,
+                             int bOffset,
+                             int width,
+                             bool opaque)
+        : _args(args)
+        , _viewer(viewer)
+        , _nComps(nComps)
+        , _width(width)
+        , _opaque(opaque)
+        , _tmpRow(width * nComps)
+        , _lutRow()
+        , _byteRow()
+        , _lutZero(0)
+        , _byteZero(0)
+    {
+        if (args.colorSpace) {
+            _lutRow.resize(width * nComps);
+        } else {
+            _byteRow.resize(width * nComps);
+        }
+        _channelIndex[0] = rOffset < nComps ? rOffset : -1;
+        if (nComps == 1) {
+            _channelIndex[1] = _channelIndex[2] = _channelIndex[0];
+        } else {
+            _channelIndex[1] = gOffset < nComps ? gOffset : -1;
+            _channelIndex[2] = (bOffset < nComps && nComps != 2) ? bOffset : -1;
+        }
+
+        // the channels that are not in the image are 0 before the gain, offset and gamma
+        const float zero = 0.f;
+        processRow(&zero, 1, &_lutZero, &_byteZero);
+    }
+
+    void convertRow(const float* src_pixels,
+                    int start,
+                    U32* dst_pixels)
+    {
+        processRow(src_pixels, _width * _nComps, _lutRow.empty() ? 0 : &_lutRow[0], _byteRow.empty() ? 0 : &_byteRow[0]);
+
+        for (int backward = 0; backward < 2; ++backward) {
+            unsigned error[3] = { 0x80, 0x80, 0x80 };
+
+            for (int index = backward ? start - 1 : start;
+                 index < _width && index >= 0;
+                 index += backward ? -1 : 1) {
+                int uA = 255;
+                if (_nComps >= 4 && !_opaque) {
+                    uA = Color::floatToInt<256>(src_pixels[index * _nComps + 3]);
+                }
+                U8 u[3];
+                for (int c = 0; c < 3; ++c) {
+                    int i = _channelIndex[c];
+                    if (!_args.colorSpace) {
+                        u[c] = i >= 0 ? _byteRow[index * _nComps + i] : _byteZero;
+                    } else {
+                        error[c] = (error[c] & 0xff) + (i >= 0 ? _lutRow[index * _nComps + i] : _lutZero);
+                        assert(error[c] < 0x10000);
+                        u[c] = (U8)(error[c] >> 8);
+                    }
+                }
+                dst_pixels[index] = toBGRA(u[0], u[1], u[2], uA);
+            }
+        }
+    }
+
+private:
+
+    void processRow(const float* from,
+                    int n,
+                    unsigned short* lutTo,
+                    unsigned char* byteTo)
+    {
+        float* tmp = &_tmpRow[0];
+
+        Color::gainOffsetRow(from, tmp, n, _args.gain, _args.offset);
+        if (_args.gamma != 1.) {
+            _viewer->interpolateGammaLutRow(tmp, tmp, n);
+        }
+        if (_args.colorSpace) {
+            _args.colorSpace->toColorSpaceUint8xxFromLinearFloatFastRow(tmp, lutTo, n, false);
+        } else {
+            Color::floatToByteRow(tmp, byteTo, n);
+        }
+    }
+};
+} // anon namespace
+
 template <typename PIX,int maxValue,bool opaque, bool applyMatte,int rOffset,int gOffset,int bOffset>
 void
 scaleToTexture8bits_generic(const RectI& roi,
@@ -1935,6 +2062,11 @@ scaleToTexture8bits_generic(const RectI& roi,
         matteAcc.reset(new Image::ReadAccess(args.matteImage.get()));
     }
     
+    boost::scoped_ptr<TextureRow8bitsConverter> rowConverter;
+    if ( TextureRow8bitsConverter::canConvert(args, pixelSize, applyMatte) ) {
+        rowConverter.reset( new TextureRow8bitsConverter(args, viewer, nComps, rOffset, gOffset, bOffset, roi.x2 - roi.x1, opaque) );
+    }
+    
     for (int y = roi.y1; y < roi.y2;
          ++y,
          dst_pixels += args.texRect.w) {
@@ -1942,6 +2074,12 @@ scaleToTexture8bits_generic(const RectI& roi,
         // coverity[dont_call]
         int start = (int)(rand() % (roi.x2 - roi.x1));
         
+        if (rowConverter && src_pixels) {
+            rowConverter->convertRow( (const float*)src_pixels, start, dst_pixels );
+            src_pixels += srcRowElements;
+            continue;
+        }
+
 
         for (int backward = 0; backward < 2; ++backward) {
             
@@ -2300,6 +2438,15 @@ ViewerInstance::interpolateGammaLut(float value)
     return _imp->lookupGammaLut(value);
 }
 
+void
+ViewerInstance::interpolateGammaLutRow(const float* from,
+                                       float* to,
+                                       int n)
+{
+    assert( (int)_imp->gammaLookup.size() == GAMMA_LUT_NB_VALUES + 1 );
+    Color::interpolateLutRow(&_imp->gammaLookup[0], GAMMA_LUT_NB_VALUES, from, to, n);
+}
+
 void
 ViewerInstance::markAllOnRendersAsAborted()
 {
@@ -2346,10 +2493,25 @@ scaleToTexture32bitsGeneric(const RectI& roi,
     
     const int srcRowElements = (const int)args.inputImage->getRowElements();
     
+    ///RGBA float images displayed as is only need to be clamped, which is done a row at a time with the vectorized kernel
+    const bool clampRows = pixelSize == sizeof(float) && !args.srcColorSpace && !luminance && !applyMatte &&
+                           nComps == 4 && rOffset == 0 && gOffset == 1 && bOffset == 2;
+    
     for (int y = roi.y1; y < roi.y2;
          ++y,
          dst_pixels += dstRowElements) {
 
+        if (clampRows && src_pixels) {
+            Color::clampRow(src_pixels, dst_pixels, roi.width() * 4);
+            if (opaque) {
+                for (int x = 0; x < roi.width(); ++x) {
+                    dst_pixels[x * 4 + 3] = 1.f;
+                }
+            }
+            src_pixels += srcRowElements;
+            continue;
+        }
+
         for (int x = 0; x < roi.width();
              ++x) {
             
@@ -253,6 +253,12 @@ public:
     struct ViewerInstancePrivate;
     
     float interpolateGammaLut(float value);
+
+    /**
+     * @brief Same as interpolateGammaLut() on n contiguous values, vectorized if the CPU allows it.
+     * The caller must hold the gamma look-up table lock for reading.
+     **/
+    void interpolateGammaLutRow(const float* from, float* to, int n);
     
     void markAllOnRendersAsAborted();
     
@@ -497,6 +497,15 @@ enum RenderSafetyEnum
     eRenderSafetyFullySafeFrame = 3,
 };
     
+///How the OpenFX multi-thread suite runs the thread functions of a plug-in, see OfxHost::multiThread
+enum MultiThreadSuiteModeEnum
+{
+    eMultiThreadSuiteModeDefault = 0, // the "Effects use thread-pool" preference chooses
+    eMultiThreadSuiteModeTaskPool, // the TaskPool shared with the renders
+    eMultiThreadSuiteModeDedicatedThreads, // the persistent threads of the OfxThreadPool
+    eMultiThreadSuiteModeNewThreads // a new thread for each index of each call
+};
+
 enum PenType
 {
     ePenTypePen,
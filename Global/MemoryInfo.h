@@ -257,6 +257,44 @@ getCurrentRSS( )
 #endif
 } // getCurrentRSS
 
+/**
+ * Returns the CPU time (user + system) used by all the threads of the process
+ * in seconds, or zero if the value cannot be determined on this OS.
+ */
+inline double
+getProcessCPUTime()
+{
+#if defined(_WIN32)
+    /* Windows -------------------------------------------------- */
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if ( !GetProcessTimes( GetCurrentProcess( ), &creationTime, &exitTime, &kernelTime, &userTime ) ) {
+        return 0.;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+
+    return (double)(kernel.QuadPart + user.QuadPart) * 1e-7; // 100ns units
+
+#elif defined(__unix__) || defined(__unix) || defined(unix) || (defined(__APPLE__) && defined(__MACH__ ) )
+    /* BSD, Linux, and OSX -------------------------------------- */
+    struct rusage rusage;
+    if (getrusage( RUSAGE_SELF, &rusage ) != 0) {
+        return 0.;
+    }
+
+    return (double)(rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec) +
+           (double)(rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec) * 1e-6;
+
+#else
+
+    /* Unknown OS ----------------------------------------------- */
+    return 0.;          /* Unsupported. */
+#endif
+}
+
 inline size_t
 getAmountFreePhysicalRAM()
 {
@@ -305,4 +343,40 @@ getAmountFreePhysicalRAM()
 #endif
 }
 
+/**
+ * @brief Returns the RAM that can be allocated without swapping: unlike getAmountFreePhysicalRAM() on Linux, this
+ * includes the page cache and the buffers that the system reclaims on demand. Reading image sequences quickly fills the
+ * page cache, after which the free RAM stays close to zero while most of the memory is still available.
+ **/
+inline size_t
+getAmountAvailablePhysicalRAM()
+{
+#if defined(__linux__) || defined(__linux) || defined(linux) || defined(__gnu_linux__)
+    ///MemAvailable is the estimate of the kernel (since Linux 3.14)
+    FILE* meminfo = fopen("/proc/meminfo", "r");
+    if (meminfo) {
+        char line[256];
+        unsigned long long availableKiB = 0;
+        bool found = false;
+        while ( !found && fgets(line, sizeof(line), meminfo) ) {
+            found = sscanf(line, "MemAvailable: %llu kB", &availableKiB) == 1;
+        }
+        fclose(meminfo);
+        if (found) {
+            return (size_t)(availableKiB * 1024ULL);
+        }
+    }
+    ///Older kernels: the free RAM and the buffers, sysinfo does not report the page cache
+    struct sysinfo memInfo;
+    sysinfo (&memInfo);
+    unsigned long long totalAvailableRAM = (unsigned long long)memInfo.freeram + memInfo.bufferram;
+    totalAvailableRAM *= memInfo.mem_unit;
+
+    return (size_t)totalAvailableRAM;
+#else
+    ///The other systems already count the memory they can reclaim
+    return getAmountFreePhysicalRAM();
+#endif
+}
+
 #endif // ifndef NATRON_GLOBAL_MEMORYINFO_H
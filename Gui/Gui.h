@@ -314,6 +314,10 @@ public:
 
     void saveProjectGui(boost::archive::xml_oarchive & archive);
 
+    void loadProjectGui(boost::archive::binary_iarchive & obj) const;
+
+    void saveProjectGui(boost::archive::binary_oarchive & archive);
+
     void setColorPickersColor(double r,double g, double b,double a);
 
     void registerNewColorPicker(boost::shared_ptr<KnobColor> knob);
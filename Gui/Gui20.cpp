@@ -1389,6 +1389,20 @@ Gui::saveProjectGui(boost::archive::xml_oarchive & archive)
     _imp->_projectGui->save(archive/*, version*/);
 }
 
+void
+Gui::loadProjectGui(boost::archive::binary_iarchive & obj) const
+{
+    assert(_imp->_projectGui);
+    _imp->_projectGui->load(obj/*, version*/);
+}
+
+void
+Gui::saveProjectGui(boost::archive::binary_oarchive & archive)
+{
+    assert(_imp->_projectGui);
+    _imp->_projectGui->save(archive/*, version*/);
+}
+
 bool
 Gui::isAboutToClose() const
 {
@@ -788,6 +788,18 @@ GuiAppInstance::saveProjectGui(boost::archive::xml_oarchive & archive)
     _imp->_gui->saveProjectGui(archive);
 }
 
+void
+GuiAppInstance::loadProjectGui(boost::archive::binary_iarchive & archive) const
+{
+    _imp->_gui->loadProjectGui(archive);
+}
+
+void
+GuiAppInstance::saveProjectGui(boost::archive::binary_oarchive & archive)
+{
+    _imp->_gui->saveProjectGui(archive);
+}
+
 void
 GuiAppInstance::setupViewersForViews(const std::vector<std::string>& viewNames)
 {
@@ -123,6 +123,8 @@ public:
     
     virtual void loadProjectGui(boost::archive::xml_iarchive & archive) const OVERRIDE FINAL;
     virtual void saveProjectGui(boost::archive::xml_oarchive & archive) OVERRIDE FINAL;
+    virtual void loadProjectGui(boost::archive::binary_iarchive & archive) const OVERRIDE FINAL;
+    virtual void saveProjectGui(boost::archive::binary_oarchive & archive) OVERRIDE FINAL;
     virtual void notifyRenderProcessHandlerStarted(const QString & sequenceName,
                                                    int firstFrame,int lastFrame,
                                                    int frameStep,
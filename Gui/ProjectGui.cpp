@@ -280,6 +280,17 @@ ProjectGui::save<boost::archive::xml_oarchive>(boost::archive::xml_oarchive & ar
     archive << boost::serialization::make_nvp("ProjectGui",projectGuiSerializationObj);
 }
 
+template<>
+void
+ProjectGui::save<boost::archive::binary_oarchive>(boost::archive::binary_oarchive & archive/*,
+                                                  const unsigned int version*/) const
+{
+    ProjectGuiSerialization projectGuiSerializationObj;
+
+    projectGuiSerializationObj.initialize(this);
+    archive << boost::serialization::make_nvp("ProjectGui",projectGuiSerializationObj);
+}
+
 
 static
 void loadNodeGuiSerialization(Gui* gui,
@@ -436,7 +447,23 @@ ProjectGui::load<boost::archive::xml_iarchive>(boost::archive::xml_iarchive & ar
     ProjectGuiSerialization obj;
 
     archive >> boost::serialization::make_nvp("ProjectGui",obj);
+    loadSerialization(obj);
+}
+
+template<>
+void
+ProjectGui::load<boost::archive::binary_iarchive>(boost::archive::binary_iarchive & archive/*,
+                                                  const unsigned int version*/)
+{
+    ProjectGuiSerialization obj;
+
+    archive >> boost::serialization::make_nvp("ProjectGui",obj);
+    loadSerialization(obj);
+}
 
+void
+ProjectGui::loadSerialization(const ProjectGuiSerialization& obj)
+{
     const std::map<std::string, ViewerData > & viewersProjections = obj.getViewersProjections();
 
     double leftBound,rightBound;
@@ -591,7 +618,7 @@ ProjectGui::load<boost::archive::xml_iarchive>(boost::archive::xml_iarchive & ar
     
     _gui->getScriptEditor()->setInputScript(obj.getInputScript().c_str());
     _gui->centerAllNodeGraphsWithTimer();
-} // load
+} // loadSerialization
 
 std::list<boost::shared_ptr<NodeGui> > ProjectGui::getVisibleNodes() const
 {
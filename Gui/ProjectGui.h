@@ -112,7 +112,7 @@ public Q_SLOTS:
 
 private:
     
-
+    void loadSerialization(const ProjectGuiSerialization& obj);
 
     Gui* _gui;
     boost::weak_ptr<Project> _project;
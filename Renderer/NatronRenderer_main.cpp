@@ -30,6 +30,7 @@
 
 #include "Engine/AppManager.h"
 #include "Engine/CLArgs.h"
+#include "Engine/RenderDaemon.h"
 
 NATRON_NAMESPACE_USING
 
@@ -42,6 +43,12 @@ main(int argc,
         return 1;
     }
 
+    ///Send the job to a resident NatronRenderer --daemon instead of rendering it
+    if ( !args.getSubmitServerName().isEmpty() ) {
+        QCoreApplication app(argc,argv);
+        return RenderDaemon::submitJob(args.getSubmitServerName(), args.getSubmitArguments());
+    }
+
     AppManager manager;
 
     // coverity[tainted_data]
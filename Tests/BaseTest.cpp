@@ -26,15 +26,20 @@
 #include "BaseTest.h"
 
 #include <QFile>
+#include <QDir>
+#include <QDateTime>
+#include <QCoreApplication>
 #include "Engine/Node.h"
 #include "Engine/Project.h"
 #include "Engine/AppManager.h"
 #include "Engine/AppInstance.h"
+#include "Engine/KnobFile.h"
 #include "Engine/KnobTypes.h"
 #include "Engine/EffectInstance.h"
 #include "Engine/Plugin.h"
 #include "Engine/Curve.h"
 #include "Engine/CLArgs.h"
+#include "Engine/Settings.h"
 
 NATRON_NAMESPACE_USING
 
@@ -279,6 +284,194 @@ TEST_F(BaseTest,SetValues)
     
 }
 
+// With content-addressed hashes, setting a value back gives back the previous hash so that the cached images are reused.
+TEST_F(BaseTest,ContentAddressedHash)
+{
+    boost::shared_ptr<KnobI> settingKnob = appPTR->getCurrentSettings()->getKnobByName("contentAddressedHashes");
+    KnobBool* setting = dynamic_cast<KnobBool*>(settingKnob.get());
+    ASSERT_TRUE(setting);
+    setting->setValue(true, 0);
+
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    ASSERT_TRUE(generator);
+    boost::shared_ptr<KnobI> knob = generator->getKnobByName("radius");
+    KnobDouble* radius = dynamic_cast<KnobDouble*>(knob.get());
+    ASSERT_TRUE(radius);
+
+    double initialRadius = radius->getValue();
+    U64 initialHash = generator->getHashValue();
+    radius->setValue(initialRadius + 10., 0);
+    EXPECT_NE( initialHash, generator->getHashValue() );
+    radius->setValue(initialRadius, 0);
+    EXPECT_EQ( initialHash, generator->getHashValue() );
+
+    // Animation curves are part of the content
+    radius->setValueAtTime(0, initialRadius, 0);
+    radius->setValueAtTime(10, initialRadius + 10., 0);
+    U64 animatedHash = generator->getHashValue();
+    EXPECT_NE(initialHash, animatedHash);
+    radius->setValueAtTime(10, initialRadius + 20., 0);
+    EXPECT_NE( animatedHash, generator->getHashValue() );
+    radius->setValueAtTime(10, initialRadius + 10., 0);
+    EXPECT_EQ( animatedHash, generator->getHashValue() );
+
+    // The age-based hash changes on every edit
+    setting->setValue(false, 0);
+    U64 ageHash = generator->getHashValue();
+    radius->setValueAtTime(10, initialRadius + 20., 0);
+    radius->setValueAtTime(10, initialRadius + 10., 0);
+    EXPECT_NE( ageHash, generator->getHashValue() );
+
+    // A reader depends on the content of its file, which may change on disk while the knobs stay the same:
+    // it keeps the age-based hash
+    setting->setValue(true, 0);
+    EXPECT_TRUE( generator->getLiveInstance()->isOutputDerivedFromKnobs() );
+    boost::shared_ptr<Node> reader = createNode(_readOIIOPluginID);
+    ASSERT_TRUE(reader);
+    EXPECT_FALSE( reader->getLiveInstance()->isOutputDerivedFromKnobs() );
+    KnobFile* file = 0;
+    const std::vector<boost::shared_ptr<KnobI> > & readerKnobs = reader->getKnobs();
+    for (std::size_t i = 0; i < readerKnobs.size() && !file; ++i) {
+        file = dynamic_cast<KnobFile*>( readerKnobs[i].get() );
+    }
+    ASSERT_TRUE(file);
+    std::string initialFile = file->getValue();
+    U64 readerHash = reader->getHashValue();
+    file->setValue(QDir::temp().absoluteFilePath( QString::fromUtf8("ContentAddressedHash.exr") ).toStdString(), 0);
+    file->setValue(initialFile, 0);
+    EXPECT_NE( readerHash, reader->getHashValue() );
+    setting->setValue(false, 0);
+}
+
+// The function of an expression is resolved once: changing the expression must give the new results.
+// The expressions call Python builtins so that they are not evaluated natively.
+TEST_F(BaseTest,ExpressionFunctionCache)
+{
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    ASSERT_TRUE(generator);
+    boost::shared_ptr<KnobI> knob = generator->getKnobByName("radius");
+    KnobDouble* radius = dynamic_cast<KnobDouble*>(knob.get());
+    ASSERT_TRUE(radius);
+
+    radius->setExpression(0, "sum([frame, frame])", false);
+    EXPECT_EQ( 6., radius->getValueAtTime(3) );
+    EXPECT_EQ( 5., radius->getValueAtTime(2.5) );
+    EXPECT_EQ( 6., radius->getValueAtTime(3) );
+
+    radius->setExpression(0, "sum([frame, 1])", false);
+    EXPECT_EQ( 4., radius->getValueAtTime(3) );
+
+    // Attribute calls are not evaluated natively either
+    radius->setExpression(0, "float(frame).__add__(2)", false);
+    EXPECT_EQ( 5., radius->getValueAtTime(3) );
+
+    // Integer frames are passed as integers
+    radius->setExpression(0, "len(str(frame))", false);
+    EXPECT_EQ( 2., radius->getValueAtTime(10) );
+
+    radius->clearExpression(0, true);
+    EXPECT_TRUE( radius->getExpression(0).empty() );
+}
+
+// A project with many animated parameters must load back the same from both formats,
+// and a truncated or corrupt binary project must fail to load without throwing.
+TEST_F(BaseTest,BinaryProjectFormat)
+{
+    boost::shared_ptr<KnobI> settingKnob = appPTR->getCurrentSettings()->getKnobByName("saveProjectsInBinaryFormat");
+    KnobBool* setting = dynamic_cast<KnobBool*>(settingKnob.get());
+    ASSERT_TRUE(setting);
+
+    const int nNodes = 50;
+    const int nKeys = 500;
+    std::vector<std::string> nodeNames;
+    for (int i = 0; i < nNodes; ++i) {
+        boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+        ASSERT_TRUE(generator);
+        boost::shared_ptr<KnobI> knob = generator->getKnobByName("radius");
+        KnobDouble* radius = dynamic_cast<KnobDouble*>(knob.get());
+        ASSERT_TRUE(radius);
+        for (int k = 0; k < nKeys; ++k) {
+            radius->setValueAtTime(k, i + k * 0.5, 0);
+        }
+        nodeNames.push_back( generator->getScriptName() );
+    }
+
+    ///Use a directory of our own so that concurrent runs do not overwrite each other's files
+    QString dirName = QString("BinaryProjectFormat_%1_%2").arg( QCoreApplication::applicationPid() ).arg( QDateTime::currentMSecsSinceEpoch() );
+    QDir tempDir = QDir::temp();
+    ASSERT_TRUE( tempDir.mkdir(dirName) );
+    QString path = tempDir.absoluteFilePath(dirName) + '/';
+    const QString binaryName = "binary." NATRON_PROJECT_FILE_EXT;
+    const QString xmlName = "xml." NATRON_PROJECT_FILE_EXT;
+
+    for (int binary = 0; binary < 2; ++binary) {
+        setting->setValue(binary != 0, 0);
+        EXPECT_TRUE( _app->getProject()->saveProject(path, binary ? binaryName : xmlName, 0) );
+    }
+    setting->setValue(false, 0);
+
+    for (int binary = 0; binary < 2; ++binary) {
+        _app->getProject()->resetProject();
+        EXPECT_TRUE( _app->getProject()->loadProject(path, binary ? binaryName : xmlName) );
+
+        for (int i = 0; i < nNodes; ++i) {
+            boost::shared_ptr<Node> generator = _app->getProject()->getNodeByName(nodeNames[i]);
+            ASSERT_TRUE(generator);
+            boost::shared_ptr<KnobI> knob = generator->getKnobByName("radius");
+            KnobDouble* radius = dynamic_cast<KnobDouble*>(knob.get());
+            ASSERT_TRUE(radius);
+            for (int k = 0; k < nKeys; k += 50) {
+                EXPECT_EQ( i + k * 0.5, radius->getValueAtTime(k) );
+            }
+        }
+    }
+
+    QFile binaryFile(path + binaryName);
+    ASSERT_TRUE( binaryFile.open(QIODevice::ReadOnly) );
+    QByteArray content = binaryFile.readAll();
+    binaryFile.close();
+    const int magicLength = sizeof("NatronBinaryProject\n") - 1;
+    ASSERT_GT(content.size(), magicLength);
+    ASSERT_TRUE( content.startsWith("NatronBinaryProject\n") );
+
+    ///A file cut in the middle of the archive
+    const QString truncatedName = "truncated." NATRON_PROJECT_FILE_EXT;
+    {
+        QFile f(path + truncatedName);
+        ASSERT_TRUE( f.open(QIODevice::WriteOnly) );
+        f.write( content.left(content.size() / 2) );
+    }
+
+    ///A file with the binary magic followed by garbage
+    const QString corruptName = "corrupt." NATRON_PROJECT_FILE_EXT;
+    {
+        QByteArray garbage = content.left(magicLength);
+        unsigned int seed = 12345;
+        for (int i = 0; i < 4096; ++i) {
+            seed = seed * 1103515245 + 12345;
+            garbage.push_back( (char)(seed >> 16) );
+        }
+        QFile f(path + corruptName);
+        ASSERT_TRUE( f.open(QIODevice::WriteOnly) );
+        f.write(garbage);
+    }
+
+    const QString badNames[2] = { truncatedName, corruptName };
+    for (int i = 0; i < 2; ++i) {
+        _app->getProject()->resetProject();
+        bool loaded = true;
+        EXPECT_NO_THROW( loaded = _app->getProject()->loadProject(path, badNames[i]) );
+        EXPECT_FALSE(loaded);
+    }
+    _app->getProject()->resetProject();
+
+    QStringList files = QDir(path).entryList(QDir::Files | QDir::Hidden);
+    for (int i = 0; i < files.size(); ++i) {
+        QFile::remove(path + files[i]);
+    }
+    EXPECT_TRUE( tempDir.rmdir(dirName) );
+}
+
 ///High level test: simple node connections test
 TEST_F(BaseTest,SimpleNodeConnections) {
     ///create the generator
@@ -0,0 +1,230 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <cstdio>
+#include <algorithm> // min, max
+#include <vector>
+#include <list>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QThread>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+#include "BaseTest.h"
+
+#include "Engine/Cache.h"
+#include "Engine/CacheJournal.h"
+#include "Engine/Image.h"
+#include "Engine/ImageParams.h"
+#include "Engine/Timer.h"
+
+NATRON_NAMESPACE_USING
+
+// number of distinct images that can be found in the cache
+#define CACHE_BENCH_N_KEYS 1024
+// number of look-ups done by each thread
+#define CACHE_BENCH_N_LOOKUPS 20000
+
+namespace {
+class CacheBenchThread
+    : public QThread
+{
+    Cache<Image>* _cache;
+    unsigned int _seed;
+
+public:
+
+    int nHits;
+    int nMisses;
+
+    CacheBenchThread(Cache<Image>* cache,
+                     unsigned int seed)
+        : QThread()
+        , _cache(cache)
+        , _seed(seed)
+        , nHits(0)
+        , nMisses(0)
+    {
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        RectD rod(0, 0, 16, 16);
+        std::map<int, std::map<int, std::vector<RangeD> > > framesNeeded;
+        boost::shared_ptr<ImageParams> params = Image::makeParams(0, rod, 1., 0, false, ImageComponents::getRGBAComponents(), eImageBitDepthByte, framesNeeded);
+        unsigned int state = _seed;
+
+        for (int i = 0; i < CACHE_BENCH_N_LOOKUPS; ++i) {
+            // simple LCG, rand() is not thread-safe
+            state = state * 1103515245 + 12345;
+            int k = (state >> 16) % (2 * CACHE_BENCH_N_KEYS);
+            ImageKey key = Image::makeKey(0, k, false, 0, 0, false, false);
+            if (k < CACHE_BENCH_N_KEYS) {
+                // half of the look-ups hit (after the first time) an image that can be created
+                boost::shared_ptr<Image> image;
+                if ( _cache->getOrCreate(key, params, &image) ) {
+                    ++nHits;
+                } else {
+                    ++nMisses;
+                    if (image) {
+                        image->allocateMemory();
+                    }
+                }
+            } else {
+                // the other half only looks-up images that are never created
+                std::list<boost::shared_ptr<Image> > images;
+                if ( _cache->get(key, &images) ) {
+                    ++nHits;
+                } else {
+                    ++nMisses;
+                }
+            }
+        }
+    }
+};
+
+double
+runCacheBench(unsigned int nShards,
+              int nThreads,
+              int* nHits,
+              int* nMisses)
+{
+    // large enough so that nothing gets evicted
+    Cache<Image> cache("CacheBenchmark", NATRON_CACHE_VERSION, 1024 * 1024 * 1024, 1., nShards);
+    std::vector<CacheBenchThread*> threads;
+
+    for (int i = 0; i < nThreads; ++i) {
+        threads.push_back( new CacheBenchThread(&cache, i + 1) );
+    }
+    TimeLapse timer;
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->start();
+    }
+    *nHits = 0;
+    *nMisses = 0;
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->wait();
+        *nHits += threads[i]->nHits;
+        *nMisses += threads[i]->nMisses;
+        delete threads[i];
+    }
+    double elapsed = timer.getTimeSinceCreation();
+
+    cache.clear();
+    cache.waitForDeleterThread();
+
+    return elapsed;
+}
+} // anon namespace
+
+
+// Reports the look-up throughput of the node cache with a single lock and with shards
+// for an increasing number of threads.
+TEST_F(BaseTest, CacheShardingThroughput) {
+    int maxThreads = std::max(2, QThread::idealThreadCount() * 2);
+    unsigned int nShards = 1;
+
+    while ( (int)nShards < QThread::idealThreadCount() ) {
+        nShards *= 2;
+    }
+    nShards = std::max(nShards, 2U);
+
+    for (int nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+        int nHits1, nMisses1, nHitsN, nMissesN;
+        double t1 = runCacheBench(1, nThreads, &nHits1, &nMisses1);
+        double tN = runCacheBench(nShards, nThreads, &nHitsN, &nMissesN);
+        int nLookups = nThreads * CACHE_BENCH_N_LOOKUPS;
+
+        printf("CacheShardingThroughput: %2d threads: 1 shard: %10.0f lookups/s (%d hits, %d misses), %u shards: %10.0f lookups/s (%d hits, %d misses)\n",
+               nThreads,
+               (double)nLookups / std::max(t1, 1e-6), nHits1, nMisses1,
+               nShards,
+               (double)nLookups / std::max(tN, 1e-6), nHitsN, nMissesN);
+
+        EXPECT_EQ(nLookups, nHits1 + nMisses1);
+        EXPECT_EQ(nLookups, nHitsN + nMissesN);
+    }
+}
+
+
+// A journal killed in the middle of a record must replay the records written before it
+TEST(CacheJournal, ReplayAfterTornRecord) {
+    std::string filePath = QDir::temp().absoluteFilePath("CacheJournal_Test." NATRON_CACHE_FILE_EXT).toStdString();
+
+    QFile::remove( filePath.c_str() );
+
+    {
+        CacheJournal journal(filePath, NATRON_CACHE_VERSION);
+        CacheJournal::RecordList records;
+        EXPECT_FALSE( journal.replay(&records) );
+
+        journal.appendAddition("a", "dataA");
+        journal.appendAddition("b", "dataB");
+        journal.appendAddition("c", "dataC");
+        journal.appendRemoval("b");
+        journal.appendAddition("a", "dataA2");
+    }
+
+    // simulate the application being killed while writing a record
+    {
+        FILE* f = fopen(filePath.c_str(), "ab");
+        ASSERT_TRUE(f != NULL);
+        const char garbage[] = "torn record";
+        fwrite(garbage, sizeof(garbage), 1, f);
+        fclose(f);
+    }
+
+    {
+        CacheJournal journal(filePath, NATRON_CACHE_VERSION);
+        CacheJournal::RecordList records;
+        ASSERT_TRUE( journal.replay(&records) );
+        ASSERT_EQ(2, (int)records.size());
+        EXPECT_EQ("a", records.front().filePath);
+        EXPECT_EQ("dataA2", records.front().data);
+        EXPECT_EQ("c", records.back().filePath);
+
+        // the torn record was dropped so the journal can be appended to again
+        journal.appendAddition("d", "dataD");
+    }
+
+    {
+        CacheJournal journal(filePath, NATRON_CACHE_VERSION);
+        CacheJournal::RecordList records;
+        ASSERT_TRUE( journal.replay(&records) );
+        EXPECT_EQ(3, (int)records.size());
+    }
+
+    // a journal written by another version of the cache is not replayed
+    {
+        CacheJournal journal(filePath, NATRON_CACHE_VERSION + 1);
+        CacheJournal::RecordList records;
+        EXPECT_FALSE( journal.replay(&records) );
+    }
+
+    QFile::remove( filePath.c_str() );
+}
@@ -22,15 +22,150 @@
 #include <Python.h>
 // ***** END PYTHON BLOCK *****
 
+#include <algorithm> // max
+#include <vector>
 #include <gtest/gtest.h>
 
 #include <QString>
 #include <QDir>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QThread>
 
 #include "Engine/Curve.h"
+#include "Engine/Interpolation.h"
 
 NATRON_NAMESPACE_USING
 
+namespace {
+///The value of the curve as computed from its keyframes before the snapshots
+double
+interpolateKeyFrames(const KeyFrameSet& keys,
+                     double t)
+{
+    KeyFrameSet::const_iterator itup = keys.upper_bound( KeyFrame(t, 0.) );
+
+    if ( itup == keys.begin() ) {
+        return Interpolation::interpolate(itup->getTime() - 1., itup->getValue(), 0., itup->getLeftDerivative(),
+                                          itup->getTime(), itup->getValue(), t, eKeyframeTypeNone, itup->getInterpolation() );
+    }
+    KeyFrameSet::const_iterator itcur = itup;
+    --itcur;
+    if ( itup == keys.end() ) {
+        return Interpolation::interpolate(itcur->getTime(), itcur->getValue(), itcur->getRightDerivative(), 0.,
+                                          itcur->getTime() + 1., itcur->getValue(), t, itcur->getInterpolation(), eKeyframeTypeNone);
+    }
+
+    return Interpolation::interpolate(itcur->getTime(), itcur->getValue(), itcur->getRightDerivative(), itup->getLeftDerivative(),
+                                      itup->getTime(), itup->getValue(), t, itcur->getInterpolation(), itup->getInterpolation() );
+}
+
+///Evaluates a curve at sub-frames, as motion blur does
+class CurveReaderThread
+    : public QThread
+{
+public:
+
+    CurveReaderThread(const Curve* curve,
+                      int nFrames)
+        : QThread()
+        , curve(curve)
+        , nFrames(nFrames)
+        , sum(0.)
+    {
+    }
+
+    const Curve* curve;
+    int nFrames;
+    double sum;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        for (int f = 0; f < nFrames; ++f) {
+            for (int s = 0; s < 10; ++s) {
+                sum += curve->getValueAt(f + s / 10.);
+            }
+        }
+    }
+};
+
+///Evaluates a curve between its first and last keyframes until told to stop, and counts the values outside of the
+///range of the values of the keyframes
+class CurveRangeReaderThread
+    : public QThread
+{
+public:
+
+    CurveRangeReaderThread(const Curve* curve,
+                           const QAtomicInt* stop,
+                           double minValue,
+                           double maxValue)
+        : QThread()
+        , curve(curve)
+        , stop(stop)
+        , minValue(minValue)
+        , maxValue(maxValue)
+        , nEvaluations(0)
+        , nOutOfRange(0)
+    {
+    }
+
+    const Curve* curve;
+    const QAtomicInt* stop;
+    double minValue, maxValue;
+    int nEvaluations;
+    int nOutOfRange;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        while ( !(int)*stop ) {
+            for (double t = 0.; t <= 100.; t += 0.7) {
+                double v = curve->getValueAt(t);
+                if ( (v < minValue - 1e-9) || (v > maxValue + 1e-9) ) {
+                    ++nOutOfRange;
+                }
+                ++nEvaluations;
+            }
+        }
+    }
+};
+
+///Adds and removes keyframes between the first and last keyframes of a curve
+class CurveWriterThread
+    : public QThread
+{
+public:
+
+    CurveWriterThread(Curve* curve,
+                      int nEdits)
+        : QThread()
+        , curve(curve)
+        , nEdits(nEdits)
+    {
+    }
+
+    Curve* curve;
+    int nEdits;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        for (int i = 0; i < nEdits; ++i) {
+            double time = 5. + 10. * (i % 10);
+            curve->addKeyFrame( KeyFrame(time, (double)( (i * 5) % 13 ), 0., 0., eKeyframeTypeLinear) );
+            if (i % 3 == 0) {
+                QThread::yieldCurrentThread();
+            }
+            curve->removeKeyFrameWithTime(time);
+        }
+    }
+};
+}
+
 TEST(KeyFrame,Basic)
 {
     KeyFrame k;
@@ -120,4 +255,90 @@ TEST(Curve,Basic)
     KeyFrame k2(1., 20.);
 }
 
+TEST(Curve,SnapshotMatchesKeyFrames)
+{
+    Curve c;
+
+    c.addKeyFrame( KeyFrame(0., 1.) );
+    c.addKeyFrame( KeyFrame(10., 5., 0., 0., eKeyframeTypeConstant) );
+    c.addKeyFrame( KeyFrame(13., -2., 0., 0., eKeyframeTypeCatmullRom) );
+    c.addKeyFrame( KeyFrame(20., 3., 0., 0., eKeyframeTypeCubic) );
+    c.addKeyFrame( KeyFrame(500., 4., 0., 0., eKeyframeTypeSmooth) );
+
+    for (int pass = 0; pass < 2; ++pass) {
+        KeyFrameSet keys = c.getKeyFrames_mt_safe();
+        ///Sampled frames, sub-frames, frames after the sampled range and before/after the keyframes
+        for (double t = -5.; t < 520.; t += (t < 30. ? 0.25 : 3.)) {
+            EXPECT_EQ( interpolateKeyFrames(keys, t), c.getValueAt(t, false) ) << t;
+        }
+        ///The snapshot must follow the changes of the keyframes
+        EXPECT_TRUE( c.addKeyFrame( KeyFrame(5., 100.) ) );
+        EXPECT_EQ( 100., c.getValueAt(5.) );
+    }
 
+    c.clearKeyFrames();
+    EXPECT_THROW( (void)c.getValueAt(0.), std::runtime_error );
+    c.addKeyFrame( KeyFrame(0., 1.) );
+    c.setYRange(0., 0.5);
+    EXPECT_EQ( 0.5, c.getValueAt(0.) );
+    EXPECT_EQ( 1., c.getValueAt(0., false) );
+}
+
+TEST(Curve,ConcurrentGetValueAt)
+{
+    Curve c;
+
+    for (int i = 0; i <= 100; i += 10) {
+        c.addKeyFrame( KeyFrame( i, (double)( (i * 7) % 13 ) ) );
+    }
+    const int nFrames = 20000;
+    CurveReaderThread reference(&c, nFrames);
+    reference.start();
+    reference.wait();
+
+    int maxThreads = std::max(1, QThread::idealThreadCount() );
+    for (int nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+        std::vector<CurveReaderThread*> threads;
+        for (int i = 0; i < nThreads; ++i) {
+            threads.push_back( new CurveReaderThread(&c, nFrames) );
+            threads.back()->start();
+        }
+        for (int i = 0; i < nThreads; ++i) {
+            threads[i]->wait();
+            EXPECT_EQ(reference.sum, threads[i]->sum);
+            delete threads[i];
+        }
+    }
+}
+
+// The readers must only ever see a consistent set of keyframes while another thread edits them: with linear
+// keyframes, the values stay within the range of the values of the keyframes.
+TEST(Curve,ConcurrentGetValueAtWhileEditing)
+{
+    Curve c;
+
+    c.addKeyFrame( KeyFrame(0., 0., 0., 0., eKeyframeTypeLinear) );
+    c.addKeyFrame( KeyFrame(100., 12., 0., 0., eKeyframeTypeLinear) );
+
+    QAtomicInt stop(0);
+    std::vector<CurveRangeReaderThread*> readers;
+    int nReaders = std::max(2, QThread::idealThreadCount() - 1);
+    for (int i = 0; i < nReaders; ++i) {
+        readers.push_back( new CurveRangeReaderThread(&c, &stop, 0., 12.) );
+        readers.back()->start();
+    }
+    CurveWriterThread writer(&c, 20000);
+    writer.start();
+    writer.wait();
+    stop.fetchAndStoreOrdered(1);
+    for (int i = 0; i < nReaders; ++i) {
+        readers[i]->wait();
+        EXPECT_GT(readers[i]->nEvaluations, 0);
+        EXPECT_EQ(0, readers[i]->nOutOfRange);
+        delete readers[i];
+    }
+
+    ///All the keyframes added by the writer were removed
+    EXPECT_EQ( 2, c.getKeyFramesCount() );
+    EXPECT_EQ( 6., c.getValueAt(50.) );
+}
@@ -0,0 +1,201 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QThread>
+
+#include "Engine/ImageArena.h"
+
+#define kArenaBlockSize (512 * 1024)
+
+NATRON_NAMESPACE_USING
+
+namespace {
+// a render thread that fills its free list and then stays idle until told to quit
+class IdleThread
+    : public QThread
+{
+public:
+
+    IdleThread()
+        : QThread()
+        , ready(0)
+        , quit(0)
+    {
+    }
+
+    QAtomicInt ready;
+    QAtomicInt quit;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        void* a = ImageArena::allocate(kArenaBlockSize);
+        void* b = ImageArena::allocate(kArenaBlockSize);
+        ImageArena::deallocate(a, kArenaBlockSize);
+        ImageArena::deallocate(b, kArenaBlockSize);
+        ready.fetchAndStoreOrdered(1);
+        while ( !(int)quit ) {
+            QThread::yieldCurrentThread();
+        }
+    }
+};
+
+std::size_t
+getThreadsFreeMemory()
+{
+    std::size_t threadsMemory, sharedMemory;
+
+    ImageArena::getFreeMemory(&threadsMemory, &sharedMemory);
+
+    return threadsMemory;
+}
+
+std::size_t
+getSharedFreeMemory()
+{
+    std::size_t threadsMemory, sharedMemory;
+
+    ImageArena::getFreeMemory(&threadsMemory, &sharedMemory);
+
+    return sharedMemory;
+}
+} // anon namespace
+
+// A freed buffer is handed back to the next allocation of the same size class, and only to it.
+TEST(ImageArena, SizeClassReuse) {
+    ImageArena::setMaximumMemory(64 * 1024 * 1024, 4);
+    std::size_t inUse = ImageArena::getMemoryInUse();
+
+    void* block = ImageArena::allocate(kArenaBlockSize);
+    ASSERT_TRUE(block != 0);
+    EXPECT_EQ( inUse + kArenaBlockSize, ImageArena::getMemoryInUse() );
+    EXPECT_GE( ImageArena::getPeakMemoryInUse(), inUse + kArenaBlockSize );
+    ImageArena::deallocate(block, kArenaBlockSize);
+    EXPECT_EQ( inUse, ImageArena::getMemoryInUse() );
+
+    ///520000 bytes are rounded up to the class of 512k
+    void* sameClass = ImageArena::allocate(520000);
+    EXPECT_EQ(block, sameClass);
+    EXPECT_EQ( inUse + kArenaBlockSize, ImageArena::getMemoryInUse() );
+
+    ///The only recycled block is in use, another class cannot get it
+    void* otherClass = ImageArena::allocate(300 * 1024);
+    EXPECT_NE(block, otherClass);
+    ImageArena::deallocate(otherClass, 300 * 1024);
+    ImageArena::deallocate(sameClass, 520000);
+    EXPECT_EQ( inUse, ImageArena::getMemoryInUse() );
+
+    void* again = ImageArena::allocate(300 * 1024);
+    EXPECT_EQ(otherClass, again);
+    ImageArena::deallocate(again, 300 * 1024);
+
+    ///Small buffers are not recycled nor counted
+    void* small = ImageArena::allocate(1000);
+    ASSERT_TRUE(small != 0);
+    EXPECT_EQ( inUse, ImageArena::getMemoryInUse() );
+    ImageArena::deallocate(small, 1000);
+
+    ImageArena::clear();
+    EXPECT_EQ( (std::size_t)0, getThreadsFreeMemory() );
+    EXPECT_EQ( (std::size_t)0, getSharedFreeMemory() );
+}
+
+// Half of the maximum memory is shared between the free lists of the threads, the rest goes to the shared free list
+// and the buffers that do not fit are freed.
+TEST(ImageArena, MaximumMemory) {
+    ///1 MB for each of the 4 threads, 4 MB shared
+    ImageArena::setMaximumMemory(8 * 1024 * 1024, 4);
+    std::size_t inUse = ImageArena::getMemoryInUse();
+
+    std::vector<void*> blocks;
+    for (int i = 0; i < 12; ++i) {
+        blocks.push_back( ImageArena::allocate(kArenaBlockSize) );
+    }
+    EXPECT_EQ( inUse + 12 * kArenaBlockSize, ImageArena::getMemoryInUse() );
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        ImageArena::deallocate(blocks[i], kArenaBlockSize);
+    }
+    EXPECT_EQ( inUse, ImageArena::getMemoryInUse() );
+    EXPECT_EQ( (std::size_t)1024 * 1024, getThreadsFreeMemory() );
+    EXPECT_EQ( (std::size_t)4 * 1024 * 1024, getSharedFreeMemory() );
+
+    ///The recycled blocks are reused before allocating new ones
+    std::set<void*> allocated( blocks.begin(), blocks.end() );
+    blocks.clear();
+    for (int i = 0; i < 10; ++i) {
+        blocks.push_back( ImageArena::allocate(kArenaBlockSize) );
+        EXPECT_EQ( 1u, allocated.count( blocks.back() ) );
+    }
+    EXPECT_EQ( (std::size_t)0, getThreadsFreeMemory() );
+    EXPECT_EQ( (std::size_t)0, getSharedFreeMemory() );
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        ImageArena::deallocate(blocks[i], kArenaBlockSize);
+    }
+    EXPECT_EQ( inUse, ImageArena::getMemoryInUse() );
+
+    ///Lowering the maximum frees what no longer fits
+    ImageArena::setMaximumMemory(0, 4);
+    EXPECT_EQ( (std::size_t)0, getThreadsFreeMemory() );
+    EXPECT_EQ( (std::size_t)0, getSharedFreeMemory() );
+    void* block = ImageArena::allocate(kArenaBlockSize);
+    ImageArena::deallocate(block, kArenaBlockSize);
+    EXPECT_EQ( (std::size_t)0, getThreadsFreeMemory() );
+    EXPECT_EQ( (std::size_t)0, getSharedFreeMemory() );
+}
+
+// clear() also frees the free lists of the threads that are idle, and a thread that exits gives its free list back.
+TEST(ImageArena, ClearIdleThreads) {
+    ImageArena::setMaximumMemory(8 * 1024 * 1024, 4);
+    std::size_t inUse = ImageArena::getMemoryInUse();
+
+    IdleThread idle;
+    idle.start();
+    while ( !(int)idle.ready ) {
+        QThread::yieldCurrentThread();
+    }
+    EXPECT_EQ( (std::size_t)1024 * 1024, getThreadsFreeMemory() );
+    ImageArena::clear();
+    EXPECT_EQ( (std::size_t)0, getThreadsFreeMemory() );
+    EXPECT_EQ( (std::size_t)0, getSharedFreeMemory() );
+    idle.quit.fetchAndStoreOrdered(1);
+    idle.wait();
+    EXPECT_EQ( (std::size_t)0, getSharedFreeMemory() );
+
+    IdleThread exiting;
+    exiting.quit.fetchAndStoreOrdered(1);
+    exiting.start();
+    exiting.wait();
+    EXPECT_EQ( (std::size_t)0, getThreadsFreeMemory() );
+    EXPECT_EQ( (std::size_t)1024 * 1024, getSharedFreeMemory() );
+    EXPECT_EQ( inUse, ImageArena::getMemoryInUse() );
+
+    ImageArena::clear();
+}
@@ -0,0 +1,317 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+#include "Engine/Image.h"
+#include "Engine/ImageConversionCache.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+ImagePtr
+createSourceImage()
+{
+    return ImagePtr( new Image(ImageComponents::getRGBAComponents(), RectD(0, 0, 64, 64), RectI(0, 0, 64, 64), 0, 1., eImageBitDepthFloat) );
+}
+
+ImageConversionCache::Key
+createFloatToByteKey()
+{
+    ImageConversionCache::Key key;
+
+    key.components = ImageComponents::getRGBAComponents();
+    key.bitdepth = eImageBitDepthByte;
+
+    return key;
+}
+
+///Counts its calls and records the last rectangle it was asked to convert
+struct CountingConverter
+{
+    QAtomicInt* nCalls;
+    RectI* lastRect;
+
+    ImagePtr operator()(const RectI& rect) const
+    {
+        nCalls->ref();
+        if (lastRect) {
+            *lastRect = rect;
+        }
+
+        return ImagePtr( new Image(ImageComponents::getRGBAComponents(), RectD(0, 0, 64, 64), RectI(0, 0, 64, 64), 0, 1., eImageBitDepthByte) );
+    }
+};
+
+struct ThrowingConverter
+{
+    ImagePtr operator()(const RectI& /*rect*/) const
+    {
+        throw std::runtime_error("conversion failed");
+    }
+};
+
+///Invalidates its source while converting, as a paint stroke clearing the bitmap of the source would
+struct InvalidatingConverter
+{
+    ImageConversionCache* cache;
+    const Image* source;
+    CountingConverter converter;
+
+    ImagePtr operator()(const RectI& rect) const
+    {
+        cache->invalidate(source);
+
+        return converter(rect);
+    }
+};
+
+///Blocks in the conversion until open() is called
+struct Gate
+{
+    QMutex lock;
+    QWaitCondition cond;
+    bool entered;
+    bool opened;
+
+    Gate()
+        : lock()
+        , cond()
+        , entered(false)
+        , opened(false)
+    {
+    }
+
+    void waitEntered()
+    {
+        QMutexLocker k(&lock);
+
+        while (!entered) {
+            cond.wait(&lock);
+        }
+    }
+
+    void open()
+    {
+        QMutexLocker k(&lock);
+
+        opened = true;
+        cond.wakeAll();
+    }
+};
+
+struct GatedConverter
+{
+    Gate* gate;
+    CountingConverter converter;
+
+    ImagePtr operator()(const RectI& rect) const
+    {
+        {
+            QMutexLocker k(&gate->lock);
+            gate->entered = true;
+            gate->cond.wakeAll();
+            while (!gate->opened) {
+                gate->cond.wait(&gate->lock);
+            }
+        }
+
+        return converter(rect);
+    }
+};
+
+class ConversionThread
+    : public QThread
+{
+public:
+
+    ConversionThread(ImageConversionCache* cache,
+                     const ImagePtr& source,
+                     const ImageConversionCache::ConvertFunctor& convert)
+        : QThread()
+        , result()
+        , isShared(false)
+        , _cache(cache)
+        , _source(source)
+        , _convert(convert)
+    {
+    }
+
+    ImagePtr result;
+    bool isShared;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        result = _cache->getOrConvert(_source, createFloatToByteKey(), RectI(0, 0, 64, 64), _convert, &isShared);
+    }
+
+    ImageConversionCache* _cache;
+    ImagePtr _source;
+    ImageConversionCache::ConvertFunctor _convert;
+};
+} // anon namespace
+
+// A rectangle contained in a previous conversion is not converted again
+TEST(ImageConversionCache, Hit) {
+    ImageConversionCache cache(1024 * 1024 * 1024);
+    ImagePtr source = createSourceImage();
+    QAtomicInt nCalls(0);
+    CountingConverter convert = { &nCalls, 0 };
+    bool isShared = true;
+
+    ImagePtr first = cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 32, 32), convert, &isShared);
+    EXPECT_FALSE(isShared);
+    ImagePtr second = cache.getOrConvert(source, createFloatToByteKey(), RectI(8, 8, 16, 16), convert, &isShared);
+    EXPECT_TRUE(isShared);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ( 1, (int)nCalls );
+
+    // Another conversion of the same source is a miss
+    ImageConversionCache::Key otherKey = createFloatToByteKey();
+    otherKey.bitdepth = eImageBitDepthShort;
+    cache.getOrConvert(source, otherKey, RectI(0, 0, 32, 32), convert, &isShared);
+    EXPECT_FALSE(isShared);
+    EXPECT_EQ( 2, (int)nCalls );
+}
+
+// A rectangle that is not contained in the previous conversion converts the union of both
+TEST(ImageConversionCache, UnionReconvert) {
+    ImageConversionCache cache(1024 * 1024 * 1024);
+    ImagePtr source = createSourceImage();
+    QAtomicInt nCalls(0);
+    RectI lastRect;
+    CountingConverter convert = { &nCalls, &lastRect };
+    bool isShared = true;
+
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+    EXPECT_EQ( RectI(0, 0, 16, 16), lastRect );
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(32, 32, 48, 48), convert, &isShared);
+    EXPECT_FALSE(isShared);
+    EXPECT_EQ( RectI(0, 0, 48, 48), lastRect );
+    EXPECT_EQ( 2, (int)nCalls );
+
+    // Both requests are now covered
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+    EXPECT_TRUE(isShared);
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(32, 32, 48, 48), convert, &isShared);
+    EXPECT_TRUE(isShared);
+    EXPECT_EQ( 2, (int)nCalls );
+}
+
+// Threads fetching a conversion that is in progress wait for it instead of converting again
+TEST(ImageConversionCache, ConcurrentWaiters) {
+    const int nWaiters = 8;
+    ImageConversionCache cache(1024 * 1024 * 1024);
+    ImagePtr source = createSourceImage();
+    QAtomicInt nCalls(0);
+    CountingConverter convert = { &nCalls, 0 };
+    Gate gate;
+    GatedConverter gatedConvert = { &gate, convert };
+
+    ConversionThread converting(&cache, source, gatedConvert);
+    converting.start();
+    gate.waitEntered();
+
+    std::vector<ConversionThread*> waiters;
+    for (int i = 0; i < nWaiters; ++i) {
+        waiters.push_back( new ConversionThread(&cache, source, convert) );
+        waiters.back()->start();
+    }
+    gate.open();
+    converting.wait();
+    EXPECT_FALSE(converting.isShared);
+    ASSERT_TRUE(converting.result.get() != 0);
+    for (int i = 0; i < nWaiters; ++i) {
+        waiters[i]->wait();
+        EXPECT_TRUE(waiters[i]->isShared);
+        EXPECT_EQ(converting.result, waiters[i]->result);
+        delete waiters[i];
+    }
+    EXPECT_EQ( 1, (int)nCalls );
+}
+
+// A failed conversion is not kept and does not block the next calls
+TEST(ImageConversionCache, ExceptionPath) {
+    ImageConversionCache cache(1024 * 1024 * 1024);
+    ImagePtr source = createSourceImage();
+    QAtomicInt nCalls(0);
+    CountingConverter convert = { &nCalls, 0 };
+    bool isShared = true;
+
+    EXPECT_THROW( cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), ThrowingConverter(), &isShared), std::runtime_error );
+    ImagePtr converted = cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+    EXPECT_TRUE(converted.get() != 0);
+    EXPECT_FALSE(isShared);
+    EXPECT_EQ( 1, (int)nCalls );
+}
+
+// The conversions of a released source are never returned for another image, even at the same address
+TEST(ImageConversionCache, ExpiredSource) {
+    ImageConversionCache cache(1024 * 1024 * 1024);
+    QAtomicInt nCalls(0);
+    CountingConverter convert = { &nCalls, 0 };
+    bool isShared = true;
+
+    ImagePtr source = createSourceImage();
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+    source.reset();
+    for (int i = 0; i < 10; ++i) {
+        ImagePtr newSource = createSourceImage();
+        cache.getOrConvert(newSource, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+        EXPECT_FALSE(isShared);
+    }
+    EXPECT_EQ( 11, (int)nCalls );
+}
+
+// An invalidated source is converted again, even if it was invalidated during its conversion
+TEST(ImageConversionCache, Invalidate) {
+    ImageConversionCache cache(1024 * 1024 * 1024);
+    ImagePtr source = createSourceImage();
+    QAtomicInt nCalls(0);
+    CountingConverter convert = { &nCalls, 0 };
+    bool isShared = true;
+
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+    cache.invalidate( source.get() );
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+    EXPECT_FALSE(isShared);
+    EXPECT_EQ( 2, (int)nCalls );
+
+    cache.invalidate( source.get() );
+    InvalidatingConverter invalidatingConvert = { &cache, source.get(), convert };
+    EXPECT_TRUE( cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), invalidatingConvert, &isShared).get() != 0 );
+    cache.getOrConvert(source, createFloatToByteKey(), RectI(0, 0, 16, 16), convert, &isShared);
+    EXPECT_FALSE(isShared);
+    EXPECT_EQ( 4, (int)nCalls );
+}
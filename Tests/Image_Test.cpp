@@ -22,13 +22,124 @@
 #include <Python.h>
 // ***** END PYTHON BLOCK *****
 
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm> // max
 #include <cstring>
+#include <vector>
 #include <gtest/gtest.h>
 
+#include <QtCore/QThread>
+
+#include "Engine/ColorSIMD.h"
 #include "Engine/Image.h"
+#include "Engine/ImageAllocator.h"
+#include "Engine/Timer.h"
 
 NATRON_NAMESPACE_USING
 
+namespace {
+///Returns true if the bitmap contains the given state in rect
+bool
+bitmapContains(const Bitmap& bm,
+               const RectI& rect,
+               int state)
+{
+    for (int y = rect.y1; y < rect.y2; ++y) {
+        for (int x = rect.x1; x < rect.x2; ++x) {
+            if (bm.get(x, y) == state) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+RectI
+randomRectIn(const RectI& bounds)
+{
+    // coverity[dont_call]
+    int x1 = bounds.x1 + rand() % bounds.width();
+    // coverity[dont_call]
+    int y1 = bounds.y1 + rand() % bounds.height();
+
+    // coverity[dont_call]
+    return RectI( x1, y1, x1 + 1 + rand() % (bounds.x2 - x1), y1 + 1 + rand() % (bounds.y2 - y1) );
+}
+
+///Downscales img by 3 levels with the given instruction set, returns the time spent and the pixels in out
+double
+downscaleWithSIMDLevel(const ImagePtr& img,
+                       Color::SIMDLevelEnum level,
+                       std::vector<unsigned char>* out)
+{
+    const unsigned int levels = 3;
+    RectI dstBounds = img->getBounds().downscalePowerOfTwoSmallestEnclosing(levels);
+    ImagePtr dst( new Image(img->getComponents(), img->getRoD(), dstBounds, levels, 1., img->getBitDepth(), true) );
+    Color::SIMDLevelEnum previousLevel = Color::getSIMDLevel();
+
+    Color::setSIMDLevel(level);
+    TimeLapse timer;
+    img->downscaleMipMap(img->getRoD(), img->getBounds(), 0, levels, true, dst.get());
+    double elapsed = timer.getTimeSinceCreation();
+    Color::setSIMDLevel(previousLevel);
+
+    Image::ReadAccess acc( dst.get() );
+    const unsigned char* pixels = acc.pixelAt(dstBounds.x1, dstBounds.y1);
+    out->assign(pixels, pixels + (std::size_t)dstBounds.area() * img->getComponentsCount() * getSizeOfForBitDepth( img->getBitDepth() ));
+
+    return elapsed;
+}
+
+///Allocates an image buffer through ImageAllocator, then writes it and reads it back several times, as a render
+///thread processing a large float image
+class ImageBandwidthThread
+    : public QThread
+{
+public:
+
+    ImageBandwidthThread(std::size_t size)
+        : QThread()
+        , size(size)
+        , checksumOk(false)
+    {
+    }
+
+    std::size_t size;
+    bool checksumOk;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        const int nPasses = 8;
+        std::size_t n = size / sizeof(float);
+        float* data = (float*)ImageAllocator::allocate(size);
+
+        checksumOk = true;
+        for (int pass = 0; pass < nPasses; ++pass) {
+            for (std::size_t i = 0; i < n; ++i) {
+                data[i] = (float)( (i + pass) & 0xff );
+            }
+            double sum = 0.;
+            for (std::size_t i = 0; i < n; i += 4) {
+                sum += data[i] + data[i + 1] + data[i + 2] + data[i + 3];
+            }
+            double expected = 0.;
+            for (std::size_t i = 0; i < 256; ++i) {
+                expected += (double)( (i + pass) & 0xff );
+            }
+            expected *= (double)(n / 256);
+            if (sum != expected) {
+                checksumOk = false;
+            }
+        }
+        ImageAllocator::deallocate(data, size);
+    }
+};
+} // anon namespace
+
 TEST(BitmapTest,SimpleRect) {
     RectI rod(0,0,100,100);
     Bitmap bm(rod);
@@ -45,8 +156,7 @@ TEST(BitmapTest,SimpleRect) {
     ASSERT_TRUE(rod == nonRenderedRectsUnion);
 
     ///assert that the "underlying" bitmap is clean
-    const char* map = bm.getBitmap();
-    ASSERT_TRUE( !memchr( map,1,rod.area() ) );
+    ASSERT_TRUE( !bitmapContains(bm, rod, 1) );
 
     RectI halfRoD(0,0,100,50);
     bm.markForRendered(halfRoD);
@@ -60,14 +170,12 @@ TEST(BitmapTest,SimpleRect) {
 
 
     ///assert that the underlying bitmap is marked as expected
-    const char* start = map;
 
     ///check that there are only ones in the rendered half
-    ASSERT_TRUE( !memchr( start,0,halfRoD.area() ) );
+    ASSERT_TRUE( !bitmapContains(bm, halfRoD, 0) );
 
     ///check that there are only 0s in the non rendered half
-    start = map + halfRoD.area();
-    ASSERT_TRUE( !memchr( start,1,halfRoD.area() ) );
+    ASSERT_TRUE( !bitmapContains(bm, nonRenderedHalf, 1) );
 
     ///mark for renderer the other half of the rod
     bm.markForRendered(nonRenderedHalf);
@@ -76,7 +184,7 @@ TEST(BitmapTest,SimpleRect) {
     nonRenderedRects.clear();
     bm.minimalNonMarkedRects(rod, nonRenderedRects);
     ASSERT_TRUE( nonRenderedRects.empty() );
-    ASSERT_TRUE( !memchr( map,0,rod.area() ) );
+    ASSERT_TRUE( !bitmapContains(bm, rod, 0) );
     
     ///More complex example where A,B,C,D are not rendered check that both trimap & bitmap yield the same result
     // BBBBBBBBBBBBBB
@@ -108,6 +216,85 @@ TEST(BitmapTest,SimpleRect) {
     EXPECT_TRUE(nonRenderedRects.size() == 3);
 }
 
+///The packed bitmap must give the same results as a plain array of states, whatever the alignment of the rectangles
+///with the 64x64 tiles of the bitmap
+TEST(BitmapTest,PackedStates) {
+    srand(2016);
+    for (int i = 0; i < 200; ++i) {
+        // coverity[dont_call]
+        int x1 = rand() % 100 - 50;
+        // coverity[dont_call]
+        int y1 = rand() % 100 - 50;
+        // coverity[dont_call]
+        RectI bounds( x1, y1, x1 + 1 + rand() % 300, y1 + 1 + rand() % 200 );
+        Bitmap bm(bounds);
+        std::vector<char> states(bounds.area(), 0);
+
+        for (int j = 0; j < 8; ++j) {
+            RectI rect = randomRectIn(bounds);
+            // coverity[dont_call]
+            int state = rand() % 3;
+            if (state == 0) {
+                bm.clear(rect);
+            } else if (state == 1) {
+                bm.markForRendered(rect);
+            } else {
+                bm.markForRendering(rect);
+            }
+            for (int y = rect.y1; y < rect.y2; ++y) {
+                for (int x = rect.x1; x < rect.x2; ++x) {
+                    states[(y - bounds.y1) * bounds.width() + x - bounds.x1] = (char)state;
+                }
+            }
+        }
+
+        for (int y = bounds.y1; y < bounds.y2; ++y) {
+            for (int x = bounds.x1; x < bounds.x2; ++x) {
+                ASSERT_EQ(states[(y - bounds.y1) * bounds.width() + x - bounds.x1], bm.get(x, y));
+            }
+        }
+
+        ///the bounding box of the pixels that are not rendered
+        RectI roi = randomRectIn(bounds);
+        RectI expected;
+        bool empty = true;
+        for (int y = roi.y1; y < roi.y2; ++y) {
+            for (int x = roi.x1; x < roi.x2; ++x) {
+                if (bm.get(x, y) != 1) {
+                    if (empty) {
+                        expected.set(x, y, x + 1, y + 1);
+                        empty = false;
+                    } else {
+                        expected.merge(x, y, x + 1, y + 1);
+                    }
+                }
+            }
+        }
+        RectI bbox = bm.minimalNonMarkedBbox(roi);
+        EXPECT_EQ( empty, bbox.isNull() );
+        if (!empty) {
+            EXPECT_TRUE(bbox == expected);
+        }
+
+        ///the rectangles to render cover all the pixels that are not rendered
+        std::list<RectI> rects;
+        bm.minimalNonMarkedRects(roi, rects);
+        for (int y = roi.y1; y < roi.y2; ++y) {
+            for (int x = roi.x1; x < roi.x2; ++x) {
+                bool covered = false;
+                for (std::list<RectI>::iterator it = rects.begin(); it != rects.end(); ++it) {
+                    covered |= (x >= it->x1 && x < it->x2 && y >= it->y1 && y < it->y2);
+                }
+                ASSERT_TRUE( covered || bm.get(x, y) == 1 );
+            }
+        }
+    }
+
+    ///2 bits per pixel instead of a byte
+    Bitmap bm( RectI(0, 0, 4096, 2160) );
+    EXPECT_LT( bm.getSizeInBytes(), (std::size_t)4096 * 2160 / 3 );
+}
+
 TEST(ImageKeyTest,Equality) {
     srand(2000);
     // coverity[dont_call]
@@ -151,3 +338,156 @@ TEST(ImageKeyTest,Difference) {
     ASSERT_TRUE(keyHash1 != keyHash2);
 }
 
+
+TEST(ImageTest,EnsureBoundsGrowsInPlace) {
+    RectD rod(0, 0, 1000, 1000);
+    ImagePtr img( new Image(ImageComponents::getRGBAComponents(), rod, RectI(0, 0, 100, 100), 0, 1., eImageBitDepthFloat, true) );
+
+    img->fill(RectI(0, 0, 100, 100), 1., 0.5, 0.25, 1.);
+    img->markForRendered( RectI(0, 0, 100, 100) );
+
+    ///only rows are added: the width is kept and the buffer grows in place
+    EXPECT_TRUE( img->ensureBounds(RectI(0, 10, 100, 150), true, false) );
+    EXPECT_TRUE( img->getBounds() == RectI(0, 0, 100, 150) );
+    {
+        Image::ReadAccess acc( img.get() );
+        const float* pix = (const float*)acc.pixelAt(50, 50);
+        EXPECT_EQ(0.5f, pix[1]);
+        pix = (const float*)acc.pixelAt(50, 140);
+        EXPECT_EQ(0.f, pix[1]);
+    }
+    std::list<RectI> rest;
+    img->getRestToRender(RectI(0, 0, 100, 150), rest);
+    ASSERT_EQ( (std::size_t)1, rest.size() );
+    EXPECT_TRUE( rest.front() == RectI(0, 100, 100, 150) );
+
+    ///a RoI within the bounds does not resize the image
+    EXPECT_FALSE( img->ensureBounds( RectI(0, 0, 100, 120) ) );
+
+    ///rows added below move the existing ones
+    EXPECT_TRUE( img->ensureBounds( RectI(0, -20, 100, 150) ) );
+    EXPECT_TRUE( img->getBounds() == RectI(0, -20, 100, 150) );
+    {
+        Image::ReadAccess acc( img.get() );
+        const float* pix = (const float*)acc.pixelAt(50, 0);
+        EXPECT_EQ(0.5f, pix[1]);
+        pix = (const float*)acc.pixelAt(50, 99);
+        EXPECT_EQ(0.25f, pix[2]);
+    }
+}
+
+// Without filling, the image only grows to the requested bounds: no pixel outside of them is left unrendered
+// while being counted in the bounds.
+TEST(ImageTest,EnsureBoundsWithoutFill) {
+    RectD rod(0, 0, 1000, 1000);
+    ImagePtr img( new Image(ImageComponents::getRGBAComponents(), rod, RectI(0, 0, 100, 100), 0, 1., eImageBitDepthFloat) );
+
+    img->fill(RectI(0, 0, 100, 100), 1., 0.5, 0.25, 1.);
+
+    EXPECT_TRUE( img->ensureBounds( RectI(90, 0, 110, 100) ) );
+    EXPECT_TRUE( img->getBounds() == RectI(0, 0, 110, 100) );
+    EXPECT_TRUE( img->ensureBounds( RectI(0, 95, 110, 103) ) );
+    EXPECT_TRUE( img->getBounds() == RectI(0, 0, 110, 103) );
+
+    ImagePtr copy;
+    EXPECT_TRUE( img->copyAndResizeIfNeeded(RectI(-3, 0, 10, 10), false, false, &copy) );
+    ASSERT_TRUE(copy.get() != 0);
+    EXPECT_TRUE( copy->getBounds() == RectI(-3, 0, 110, 103) );
+    {
+        Image::ReadAccess acc( copy.get() );
+        const float* pix = (const float*)acc.pixelAt(50, 50);
+        EXPECT_EQ(0.5f, pix[1]);
+    }
+    {
+        Image::ReadAccess acc( img.get() );
+        const float* pix = (const float*)acc.pixelAt(99, 99);
+        EXPECT_EQ(0.25f, pix[2]);
+    }
+}
+
+// The vectorized mipmap downscaling must give exactly the same pixels as the scalar one,
+// including on the odd borders that are not averaged on 2x2 pixels.
+// Also reports the speed-up of each instruction set.
+TEST(ImageTest,DownscaleMipMapIsBitExact) {
+    const ImageBitDepthEnum depths[3] = { eImageBitDepthByte, eImageBitDepthShort, eImageBitDepthFloat };
+    const char* depthNames[3] = { "8-bit", "16-bit", "float" };
+    RectI bounds(1, -3, 1921, 1077);
+    RectD rod(bounds.x1, bounds.y1, bounds.x2, bounds.y2);
+
+    for (int d = 0; d < 3; ++d) {
+        for (int c = 0; c < 2; ++c) {
+            const ImageComponents& comps = c == 0 ? ImageComponents::getRGBAComponents() : ImageComponents::getAlphaComponents();
+            ImagePtr img( new Image(comps, rod, bounds, 0, 1., depths[d], true) );
+            {
+                Image::WriteAccess acc( img.get() );
+                unsigned char* pixels = acc.pixelAt(bounds.x1, bounds.y1);
+                std::size_t nBytes = (std::size_t)bounds.area() * comps.getNumComponents() * getSizeOfForBitDepth(depths[d]);
+                if (depths[d] == eImageBitDepthFloat) {
+                    float* p = (float*)pixels;
+                    for (std::size_t i = 0; i < nBytes / sizeof(float); ++i) {
+                        // coverity[dont_call]
+                        p[i] = rand() / (float)RAND_MAX;
+                    }
+                } else {
+                    for (std::size_t i = 0; i < nBytes; ++i) {
+                        // coverity[dont_call]
+                        pixels[i] = (unsigned char)rand();
+                    }
+                }
+            }
+            img->markForRendered(bounds);
+
+            std::vector<unsigned char> scalar;
+            double scalarTime = downscaleWithSIMDLevel(img, Color::eSIMDLevelNone, &scalar);
+            printf("DownscaleMipMapIsBitExact: %s %s: scalar: %.3f s\n", depthNames[d], c == 0 ? "RGBA" : "Alpha", scalarTime);
+            for (int l = Color::eSIMDLevelSSE41; l <= Color::getSupportedSIMDLevel(); ++l) {
+                std::vector<unsigned char> vectorized;
+                double t = downscaleWithSIMDLevel(img, (Color::SIMDLevelEnum)l, &vectorized);
+                ASSERT_EQ( scalar.size(), vectorized.size() );
+                EXPECT_EQ( 0, std::memcmp(&scalar[0], &vectorized[0], scalar.size()) );
+                printf( "DownscaleMipMapIsBitExact: %s %s: %s: %.3f s (x%.2f)\n", depthNames[d], c == 0 ? "RGBA" : "Alpha",
+                        l == Color::eSIMDLevelAVX2 ? "AVX2" : "SSE4.1", t, scalarTime / std::max(t, 1e-9) );
+            }
+        }
+    }
+}
+
+// Each render thread processes its own float image, allocated with each of the policies of ImageAllocator.
+// The content must be the same whatever the policy. Reports the bandwidth of each policy.
+// The images are kept small (a few huge pages) and the threads few so that this fits in the memory of any test machine.
+TEST(ImageTest,AllocatorPoliciesBandwidth) {
+    const std::size_t size = 8 * 1024 * 1024;
+    const int nThreads = std::min( 4, std::max(1, QThread::idealThreadCount() ) );
+    const char* policyNames[4] = { "malloc", "huge pages", "first touch", "huge pages + first touch" };
+    bool hugePagesWereEnabled = ImageAllocator::isHugePagesEnabled();
+    bool firstTouchWasEnabled = ImageAllocator::isFirstTouchEnabled();
+
+    for (int policy = 0; policy < 4; ++policy) {
+        bool hugePages = (policy & 1) != 0;
+        if ( hugePages && !ImageAllocator::isHugePagesSupported() ) {
+            continue;
+        }
+        ImageAllocator::setHugePagesEnabled(hugePages);
+        ImageAllocator::setFirstTouchEnabled( (policy & 2) != 0 );
+
+        std::vector<ImageBandwidthThread*> threads;
+        TimeLapse timer;
+        for (int i = 0; i < nThreads; ++i) {
+            threads.push_back( new ImageBandwidthThread(size) );
+            threads.back()->start();
+        }
+        for (int i = 0; i < nThreads; ++i) {
+            threads[i]->wait();
+            EXPECT_TRUE(threads[i]->checksumOk);
+            delete threads[i];
+        }
+        double elapsed = timer.getTimeSinceCreation();
+        // 8 passes of one write and one read per thread
+        double bytes = 2. * 8. * (double)size * nThreads;
+        printf( "AllocatorPoliciesBandwidth: %s: %d threads: %.3f s: %.2f GB/s\n", policyNames[policy], nThreads, elapsed,
+                bytes / std::max(elapsed, 1e-9) / 1e9 );
+    }
+
+    ImageAllocator::setHugePagesEnabled(hugePagesWereEnabled);
+    ImageAllocator::setFirstTouchEnabled(firstTouchWasEnabled);
+}
@@ -23,8 +23,16 @@
 // ***** END PYTHON BLOCK *****
 
 #include <cstdlib>
+#include <cstdio>
+#include <algorithm> // min, max
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
 #include <gtest/gtest.h>
+#include "Engine/ColorSIMD.h"
 #include "Engine/Lut.h"
+#include "Engine/Timer.h"
 
 NATRON_NAMESPACE_USING
 using namespace NATRON_NAMESPACE::Color;
@@ -49,3 +57,181 @@ TEST(Lut,IntConversions) {
         EXPECT_EQ( i, uint8xxToChar( charToUint8xx(i) ) );
     }
 }
+
+namespace {
+// number of values converted by each kernel
+#define SIMD_BENCH_N_VALUES (1024 * 1024 + 13) // not a multiple of the vector width, to exercise the ends of rows
+#define SIMD_BENCH_N_RUNS 20
+
+struct SIMDKernelsOutput
+{
+    std::vector<unsigned char> floatToByte;
+    std::vector<unsigned short> floatToShort;
+    std::vector<float> byteToFloat;
+    std::vector<float> shortToFloat;
+    std::vector<float> linearize;
+    std::vector<unsigned short> delinearize;
+    std::vector<unsigned short> delinearizePremult;
+    std::vector<float> unpremult;
+};
+
+double
+runSIMDKernels(SIMDLevelEnum level,
+               const std::vector<float> & floats,
+               const std::vector<unsigned char> & bytes,
+               const std::vector<unsigned short> & shorts,
+               SIMDKernelsOutput* out)
+{
+    const Lut* lut = LutManager::sRGBLut();
+
+    lut->validate();
+    int n = (int)floats.size();
+    int nPixels = n / 4;
+    out->floatToByte.resize(n);
+    out->floatToShort.resize(n);
+    out->byteToFloat.resize(n);
+    out->shortToFloat.resize(n);
+    out->linearize.resize(n);
+    out->delinearize.resize(n);
+    out->delinearizePremult.resize(nPixels * 4);
+    out->unpremult.resize(nPixels * 4);
+
+    SIMDLevelEnum previousLevel = getSIMDLevel();
+    setSIMDLevel(level);
+    TimeLapse timer;
+    for (int i = 0; i < SIMD_BENCH_N_RUNS; ++i) {
+        floatToByteRow(&floats[0], &out->floatToByte[0], n);
+        floatToShortRow(&floats[0], &out->floatToShort[0], n);
+        byteToFloatRow(&bytes[0], &out->byteToFloat[0], n);
+        shortToFloatRow(&shorts[0], &out->shortToFloat[0], n);
+        lut->fromColorSpaceUint8ToLinearFloatFastRow(&bytes[0], &out->linearize[0], n);
+        lut->toColorSpaceUint8xxFromLinearFloatFastRow(&floats[0], &out->delinearize[0], n, false);
+        lut->toColorSpaceUint8xxFromLinearFloatFastRow(&floats[0], &out->delinearizePremult[0], nPixels * 4, true);
+        unpremultRGBARow(&floats[0], &out->unpremult[0], nPixels);
+    }
+    double elapsed = timer.getTimeSinceCreation();
+    setSIMDLevel(previousLevel);
+
+    return elapsed;
+}
+} // anon namespace
+
+// The vectorized conversions must give exactly the same results as the scalar ones.
+// Also reports the speed-up of each instruction set.
+TEST(Lut,SIMDKernelsAreBitExact) {
+    std::vector<float> floats(SIMD_BENCH_N_VALUES);
+    std::vector<unsigned char> bytes(SIMD_BENCH_N_VALUES);
+    std::vector<unsigned short> shorts(SIMD_BENCH_N_VALUES);
+
+    srand(2016);
+    for (int i = 0; i < SIMD_BENCH_N_VALUES; ++i) {
+        switch (i % 4) {
+        case 0:
+            // mostly in [0,1]
+            floats[i] = rand() / (float)RAND_MAX * 1.2f - 0.1f;
+            break;
+        case 1: {
+            // any bit pattern, including NaNs and infinities
+            unsigned int bits = ( (unsigned int)rand() << 16 ) ^ (unsigned int)rand();
+            std::memcpy( &floats[i], &bits, sizeof(bits) );
+            break;
+        }
+        case 2:
+            // values that round exactly half-way
+            floats[i] = ( (rand() % 511) * 0.5f ) / 255.f;
+            break;
+        default:
+            floats[i] = intToFloat<65536>(rand() % 65536);
+            break;
+        }
+        bytes[i] = (unsigned char)rand();
+        shorts[i] = (unsigned short)rand();
+    }
+    floats[0] = std::numeric_limits<float>::quiet_NaN();
+    floats[1] = std::numeric_limits<float>::infinity();
+    floats[2] = -std::numeric_limits<float>::infinity();
+    floats[3] = -0.f;
+
+    SIMDKernelsOutput scalar;
+    double scalarTime = runSIMDKernels(eSIMDLevelNone, floats, bytes, shorts, &scalar);
+    printf("SIMDKernelsAreBitExact: scalar: %.3f s\n", scalarTime);
+
+    for (int level = eSIMDLevelSSE41; level <= (int)getSupportedSIMDLevel(); ++level) {
+        SIMDKernelsOutput vectorized;
+        double t = runSIMDKernels( (SIMDLevelEnum)level, floats, bytes, shorts, &vectorized );
+        printf( "SIMDKernelsAreBitExact: %s: %.3f s (x%.2f)\n", level == eSIMDLevelAVX2 ? "AVX2" : "SSE4.1", t, scalarTime / std::max(t, 1e-9) );
+
+        EXPECT_TRUE(scalar.floatToByte == vectorized.floatToByte);
+        EXPECT_TRUE(scalar.floatToShort == vectorized.floatToShort);
+        EXPECT_TRUE(scalar.delinearize == vectorized.delinearize);
+        EXPECT_TRUE(scalar.delinearizePremult == vectorized.delinearizePremult);
+        // compare the bits, NaNs are not equal to themselves
+        EXPECT_EQ( 0, std::memcmp(&scalar.byteToFloat[0], &vectorized.byteToFloat[0], scalar.byteToFloat.size() * sizeof(float)) );
+        EXPECT_EQ( 0, std::memcmp(&scalar.shortToFloat[0], &vectorized.shortToFloat[0], scalar.shortToFloat.size() * sizeof(float)) );
+        EXPECT_EQ( 0, std::memcmp(&scalar.linearize[0], &vectorized.linearize[0], scalar.linearize.size() * sizeof(float)) );
+        EXPECT_EQ( 0, std::memcmp(&scalar.unpremult[0], &vectorized.unpremult[0], scalar.unpremult.size() * sizeof(float)) );
+    }
+}
+
+namespace {
+// applies the gain, offset, gamma and sRGB look-up of the viewer to a whole frame, the way scaleToTexture8bits does
+double
+runViewerTextureKernels(SIMDLevelEnum level,
+                        int width,
+                        int height,
+                        const std::vector<float> & srcRows, // a few source rows, used in turn
+                        const std::vector<float> & gammaTable,
+                        std::vector<unsigned short>* lastRows) // output of the last rows
+{
+    const Lut* lut = LutManager::sRGBLut();
+
+    lut->validate();
+    int n = width * 4;
+    int nSrcRows = (int)srcRows.size() / n;
+    std::vector<float> tmp(n);
+    lastRows->resize(srcRows.size());
+
+    SIMDLevelEnum previousLevel = getSIMDLevel();
+    setSIMDLevel(level);
+    TimeLapse timer;
+    for (int y = 0; y < height; ++y) {
+        const float* src = &srcRows[(y % nSrcRows) * n];
+        gainOffsetRow(src, &tmp[0], n, 1.5, 0.01);
+        interpolateLutRow(&gammaTable[0], (int)gammaTable.size() - 1, &tmp[0], &tmp[0], n);
+        lut->toColorSpaceUint8xxFromLinearFloatFastRow(&tmp[0], &(*lastRows)[(y % nSrcRows) * n], n, false);
+    }
+    double elapsed = timer.getTimeSinceCreation();
+    setSIMDLevel(previousLevel);
+
+    return elapsed;
+}
+} // anon namespace
+
+// The viewer texture conversion at 2K, 4K and 8K, vectorized versions must give the same result as the scalar one.
+TEST(Lut,ViewerTextureKernels) {
+    const int sizes[3][2] = { {2048, 1080}, {3840, 2160}, {7680, 4320} };
+    const int nSrcRows = 8;
+
+    std::vector<float> gammaTable(1024);
+    for (std::size_t i = 0; i < gammaTable.size(); ++i) {
+        gammaTable[i] = (float)std::pow(i / 1023., 1. / 2.2);
+    }
+    srand(2016);
+    for (int s = 0; s < 3; ++s) {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        std::vector<float> srcRows(nSrcRows * width * 4);
+        for (std::size_t i = 0; i < srcRows.size(); ++i) {
+            srcRows[i] = rand() / (float)RAND_MAX * 1.2f - 0.1f;
+        }
+        std::vector<unsigned short> scalar;
+        double scalarTime = runViewerTextureKernels(eSIMDLevelNone, width, height, srcRows, gammaTable, &scalar);
+        printf("ViewerTextureKernels: %dx%d: scalar: %.3f s (%.1f fps)\n", width, height, scalarTime, 1. / std::max(scalarTime, 1e-9) );
+        for (int level = eSIMDLevelSSE41; level <= (int)getSupportedSIMDLevel(); ++level) {
+            std::vector<unsigned short> vectorized;
+            double t = runViewerTextureKernels( (SIMDLevelEnum)level, width, height, srcRows, gammaTable, &vectorized );
+            printf( "ViewerTextureKernels: %dx%d: %s: %.3f s (%.1f fps)\n", width, height, level == eSIMDLevelAVX2 ? "AVX2" : "SSE4.1", t, 1. / std::max(t, 1e-9) );
+            EXPECT_TRUE(scalar == vectorized);
+        }
+    }
+}
@@ -0,0 +1,182 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <cmath>
+#include <climits> // INT_MIN, INT_MAX
+#include <string>
+#include <gtest/gtest.h>
+#include <boost/math/special_functions/sign.hpp> // signbit
+#include "BaseTest.h"
+#include "Engine/AppManager.h"
+#include "Engine/EffectInstance.h"
+#include "Engine/KnobTypes.h"
+#include "Engine/NativeExpression.h"
+#include "Engine/Node.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+///Compiles expr without a knob and evaluates it at the given frame, returns false if Python must be used
+bool
+evaluate(const std::string& expr,
+         double frame,
+         double* ret)
+{
+    boost::shared_ptr<NativeExpression> native = NativeExpression::compile(expr, 0, 1);
+
+    return native && native->evaluate(frame, ret);
+}
+
+double
+evaluate(const std::string& expr,
+         double frame = 0.)
+{
+    double ret = 0.;
+
+    EXPECT_TRUE( evaluate(expr, frame, &ret) ) << expr;
+
+    return ret;
+}
+}
+
+TEST(NativeExpression,Arithmetic) {
+    EXPECT_EQ( 7., evaluate("1 + 2 * 3") );
+    EXPECT_EQ( 9., evaluate("(1 + 2) * 3") );
+    EXPECT_EQ( -8., evaluate("-2 ** 3") );
+    EXPECT_EQ( 512., evaluate("2 ** 3 ** 2") );
+    EXPECT_EQ( 0.25, evaluate("2 ** -2") );
+    EXPECT_EQ( 1500., evaluate("1.5e3") );
+    EXPECT_EQ( 0.5, evaluate(".5") );
+    EXPECT_EQ( 21., evaluate("frame * 2 + 1", 10.) );
+    EXPECT_EQ( 1., evaluate("dimension") );
+    EXPECT_DOUBLE_EQ( M_PI / 2., evaluate("pi / 2") );
+}
+
+TEST(NativeExpression,PythonSemantics) {
+    ///Division of ints
+#ifdef IS_PYTHON_2
+    EXPECT_EQ( 3., evaluate("7 / 2") );
+    EXPECT_EQ( -4., evaluate("-7 / 2") );
+    EXPECT_EQ( 12., evaluate("frame / 2", 25.) );
+#else
+    EXPECT_EQ( 3.5, evaluate("7 / 2") );
+    EXPECT_EQ( 12.5, evaluate("frame / 2", 25.) );
+#endif
+    EXPECT_EQ( 3.5, evaluate("7. / 2") );
+    EXPECT_EQ( 12.75, evaluate("frame / 2", 25.5) );
+    EXPECT_EQ( -4., evaluate("-7 // 2") );
+    EXPECT_EQ( 3., evaluate("7.5 // 2") );
+    EXPECT_EQ( -4., evaluate("7.5 // -2") );
+    ///1 / 0.1 rounds to 10 but the floor division is computed from the remainder, as in Python
+    EXPECT_EQ( 9., evaluate("1 // 0.1") );
+    EXPECT_EQ( -10., evaluate("-1 // 0.1") );
+    EXPECT_TRUE( (boost::math::signbit)( evaluate("0. // -5") ) );
+    EXPECT_FALSE( (boost::math::signbit)( evaluate("0 // -5") ) );
+
+    ///The remainder has the sign of the divisor
+    EXPECT_EQ( 1., evaluate("-3 % 2") );
+    EXPECT_EQ( -1., evaluate("3 % -2") );
+    EXPECT_EQ( -1., evaluate("fmod(-3, 2)") );
+    EXPECT_EQ( 0.19999999999999996, evaluate("-1. % 0.3") );
+
+    EXPECT_EQ( -2., evaluate("int(-2.7)") );
+    EXPECT_EQ( -3., evaluate("floor(-2.7)") );
+    EXPECT_EQ( 3., evaluate("ceil(2.2)") );
+    EXPECT_EQ( 1., evaluate("min(3, 1, 2)") );
+    EXPECT_EQ( 5., evaluate("max(abs(-5), 2.5)") );
+    EXPECT_EQ( 5., evaluate("hypot(3, 4)") );
+    ///No underflow of the squares
+    EXPECT_EQ( 5e-200, evaluate("hypot(3e-200, 4e-200)") );
+    EXPECT_EQ( 3., evaluate("log(8, 2)") );
+    EXPECT_DOUBLE_EQ( 180., evaluate("degrees(pi)") );
+    EXPECT_DOUBLE_EQ( 1., evaluate("sin(radians(90))") );
+    ///Bit-exact with the constants of Python
+    EXPECT_EQ( 5.729577951308233, evaluate("degrees(0.1)") );
+    EXPECT_EQ( 0.08726646259971647, evaluate("radians(5.)") );
+    EXPECT_DOUBLE_EQ( 2., evaluate("sqrt(frame)", 4.) );
+}
+
+TEST(NativeExpression,FallbackToPython) {
+    double ret;
+
+    ///Not in the grammar
+    EXPECT_FALSE( NativeExpression::compile("random()", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("frame if frame > 1 else 0", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("curve(frame)", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("thisParam.get()", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("unknown + 1", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("ret = 1", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("\"1\"", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("1 +", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("(1", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("sqrt(1, 2)", 0, 0) );
+    ///Python 2 octal and long literals
+    EXPECT_FALSE( NativeExpression::compile("010", 0, 0) );
+    EXPECT_FALSE( NativeExpression::compile("10L", 0, 0) );
+
+    ///Errors raised by Python
+    EXPECT_FALSE( evaluate("1 / 0", 0., &ret) );
+    EXPECT_FALSE( evaluate("1 % (frame - 1)", 1., &ret) );
+    EXPECT_FALSE( evaluate("sqrt(-1)", 0., &ret) );
+    EXPECT_FALSE( evaluate("log(0)", 0., &ret) );
+    EXPECT_FALSE( evaluate("(-8) ** (1. / 3)", 0., &ret) );
+    EXPECT_FALSE( evaluate("0 ** -1", 0., &ret) );
+    EXPECT_TRUE( evaluate("1 / frame", 2., &ret) );
+}
+
+// A deleted node is kept to be restored by an undo: the expressions referring to it must not find it any longer
+TEST_F(BaseTest,NativeExpressionDeletedNode)
+{
+    boost::shared_ptr<Node> referred = createNode(_dotGeneratorPluginID);
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    ASSERT_TRUE(referred && generator);
+    boost::shared_ptr<KnobI> knob = generator->getKnobByName("radius");
+    ASSERT_TRUE(knob);
+
+    std::string expr = "thisGroup." + referred->getScriptName() + ".radius.get() * 2";
+    boost::shared_ptr<NativeExpression> native = NativeExpression::compile(expr, knob.get(), 0);
+    ASSERT_TRUE(native);
+    double ret = 0.;
+    EXPECT_TRUE( native->evaluate(0., &ret) );
+
+    referred->deactivate();
+    EXPECT_FALSE( native->evaluate(0., &ret) );
+    referred->activate();
+    EXPECT_TRUE( native->evaluate(0., &ret) );
+}
+
+// Results that do not fit in an int parameter are clamped
+TEST_F(BaseTest,NativeExpressionIntRange)
+{
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    ASSERT_TRUE(generator);
+    boost::shared_ptr<KnobInt> knob = AppManager::createKnob<KnobInt>(generator->getLiveInstance(), "Test int");
+
+    knob->setExpression(0, "2 ** 40", false);
+    EXPECT_EQ( INT_MAX, knob->getValue() );
+    knob->setExpression(0, "-2. ** 40", false);
+    EXPECT_EQ( INT_MIN, knob->getValue() );
+    knob->setExpression(0, "-2.7", false);
+    EXPECT_EQ( -2, knob->getValue() );
+}
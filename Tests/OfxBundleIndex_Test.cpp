@@ -0,0 +1,172 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+#include "Engine/OfxBundleIndex.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+OfxBundleIndex::Entry
+makeEntry(const std::string& binaryPath,
+          qint64 size,
+          qint64 modificationTime)
+{
+    OfxBundleIndex::Entry e;
+
+    e.binaryPath = binaryPath;
+    e.size = size;
+    e.modificationTime = modificationTime;
+
+    return e;
+}
+
+std::vector<OfxBundleIndex::Entry>
+makeEntries()
+{
+    std::vector<OfxBundleIndex::Entry> entries;
+
+    entries.push_back( makeEntry("/usr/OFX/Plugins/Misc.ofx.bundle/Contents/Linux-x86-64/Misc.ofx", 12345678, 1450000000000LL) );
+    entries.push_back( makeEntry("/usr/OFX/Plugins/IO.ofx.bundle/Contents/Linux-x86-64/IO.ofx", 1, 0) );
+    // UTF-8 path
+    entries.push_back( makeEntry("/home/r\xc3\xa9mi/OFX/A.ofx.bundle/Contents/Linux-x86-64/A.ofx", 0, -1) );
+
+    return entries;
+}
+
+void
+expectSameEntries(const std::vector<OfxBundleIndex::Entry>& a,
+                  const std::vector<OfxBundleIndex::Entry>& b)
+{
+    ASSERT_EQ( a.size(), b.size() );
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        EXPECT_EQ(a[i].binaryPath, b[i].binaryPath);
+        EXPECT_EQ(a[i].size, b[i].size);
+        EXPECT_EQ(a[i].modificationTime, b[i].modificationTime);
+    }
+}
+} // anon namespace
+
+TEST(OfxBundleIndex, RoundTrip) {
+    QString filePath = QDir::temp().absoluteFilePath( QString::fromUtf8("OfxBundleIndex_Test.bin") );
+    std::vector<OfxBundleIndex::Entry> entries = makeEntries();
+    std::vector<OfxBundleIndex::Entry> readEntries;
+
+    QFile::remove(filePath);
+    EXPECT_FALSE( OfxBundleIndex::read(filePath, &readEntries) );
+
+    ASSERT_TRUE( OfxBundleIndex::write(filePath, entries) );
+    ASSERT_TRUE( OfxBundleIndex::read(filePath, &readEntries) );
+    expectSameEntries(entries, readEntries);
+
+    // Writing again replaces the previous index
+    entries.pop_back();
+    ASSERT_TRUE( OfxBundleIndex::write(filePath, entries) );
+    ASSERT_TRUE( OfxBundleIndex::read(filePath, &readEntries) );
+    expectSameEntries(entries, readEntries);
+
+    // An empty index is valid
+    ASSERT_TRUE( OfxBundleIndex::write( filePath, std::vector<OfxBundleIndex::Entry>() ) );
+    EXPECT_TRUE( OfxBundleIndex::read(filePath, &readEntries) );
+    EXPECT_TRUE( readEntries.empty() );
+
+    QFile::remove(filePath);
+}
+
+// A truncated file, a file of another format or version is not read
+TEST(OfxBundleIndex, CorruptedFile) {
+    QString filePath = QDir::temp().absoluteFilePath( QString::fromUtf8("OfxBundleIndex_Test.bin") );
+    std::vector<OfxBundleIndex::Entry> readEntries;
+
+    ASSERT_TRUE( OfxBundleIndex::write( filePath, makeEntries() ) );
+    QByteArray content;
+    {
+        QFile file(filePath);
+        ASSERT_TRUE( file.open(QIODevice::ReadOnly) );
+        content = file.readAll();
+    }
+
+    {
+        QFile file(filePath);
+        ASSERT_TRUE( file.open(QIODevice::WriteOnly | QIODevice::Truncate) );
+        file.write( content.left(content.size() - 1) );
+    }
+    EXPECT_FALSE( OfxBundleIndex::read(filePath, &readEntries) );
+    EXPECT_TRUE( readEntries.empty() );
+
+    QByteArray otherMagic = content;
+    otherMagic[0] = 'X';
+    {
+        QFile file(filePath);
+        ASSERT_TRUE( file.open(QIODevice::WriteOnly | QIODevice::Truncate) );
+        file.write(otherMagic);
+    }
+    EXPECT_FALSE( OfxBundleIndex::read(filePath, &readEntries) );
+
+    // The version follows the 8 bytes of the magic
+    QByteArray otherVersion = content;
+    otherVersion[8] = otherVersion[8] + 1;
+    {
+        QFile file(filePath);
+        ASSERT_TRUE( file.open(QIODevice::WriteOnly | QIODevice::Truncate) );
+        file.write(otherVersion);
+    }
+    EXPECT_FALSE( OfxBundleIndex::read(filePath, &readEntries) );
+
+    QFile::remove(filePath);
+}
+
+TEST(OfxBundleIndex, ChangedEntries) {
+    std::vector<OfxBundleIndex::Entry> previous = makeEntries();
+    std::vector<OfxBundleIndex::Entry> current = previous;
+    std::vector<OfxBundleIndex::Entry> changed;
+
+    OfxBundleIndex::getChangedEntries(previous, current, &changed);
+    EXPECT_TRUE( changed.empty() );
+
+    // Everything changed without a previous index
+    OfxBundleIndex::getChangedEntries(std::vector<OfxBundleIndex::Entry>(), current, &changed);
+    expectSameEntries(current, changed);
+
+    current[0].size += 1; // rebuilt
+    current[1].modificationTime += 1000; // touched
+    current.push_back( makeEntry("/usr/OFX/Plugins/New.ofx.bundle/Contents/Linux-x86-64/New.ofx", 10, 10) ); // installed
+    current.erase(current.begin() + 2); // removed: nothing to load
+    OfxBundleIndex::getChangedEntries(previous, current, &changed);
+    ASSERT_EQ(3u, changed.size());
+    EXPECT_EQ(current[0].binaryPath, changed[0].binaryPath);
+    EXPECT_EQ(current[1].binaryPath, changed[1].binaryPath);
+    EXPECT_EQ(current[2].binaryPath, changed[2].binaryPath);
+
+    // The order of the entries does not matter
+    std::vector<OfxBundleIndex::Entry> reversed( previous.rbegin(), previous.rend() );
+    OfxBundleIndex::getChangedEntries(reversed, previous, &changed);
+    EXPECT_TRUE( changed.empty() );
+}
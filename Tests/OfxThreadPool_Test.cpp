@@ -0,0 +1,203 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <set>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+
+#include "Engine/OfxThreadPool.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+// what the indexes of a multiThread() call saw
+struct Recorder
+{
+    QMutex lock;
+    std::set<QThread*> threads;
+    QAtomicInt nIndexes;
+    QAtomicInt nRunning;
+    QAtomicInt maxRunning;
+    QAtomicInt nNotOnPoolThread;
+
+    Recorder()
+        : lock()
+        , threads()
+        , nIndexes(0)
+        , nRunning(0)
+        , maxRunning(0)
+        , nNotOnPoolThread(0)
+    {
+    }
+
+    void record()
+    {
+        if ( !OfxThreadPool::isPoolThread() ) {
+            nNotOnPoolThread.fetchAndAddOrdered(1);
+        }
+        QMutexLocker k(&lock);
+        threads.insert( QThread::currentThread() );
+    }
+};
+
+void
+recordIndex(Recorder* recorder,
+            unsigned int /*index*/)
+{
+    recorder->record();
+    int nRunning = recorder->nRunning.fetchAndAddOrdered(1) + 1;
+    for (;;) {
+        int maxRunning = (int)recorder->maxRunning;
+        if ( (nRunning <= maxRunning) || recorder->maxRunning.testAndSetOrdered(maxRunning, nRunning) ) {
+            break;
+        }
+    }
+    QThread::yieldCurrentThread();
+    recorder->nRunning.fetchAndAddOrdered(-1);
+    recorder->nIndexes.fetchAndAddOrdered(1);
+}
+
+// an index that makes a nested call, as a plug-in calling multiThread() from its thread function
+void
+nestedIndex(OfxThreadPool* pool,
+            Recorder* outer,
+            Recorder* inner,
+            QAtomicInt* nMovedThreads,
+            unsigned int /*index*/)
+{
+    outer->record();
+    Recorder nested;
+    pool->run(boost::bind(&recordIndex, &nested, _1), 3, 2);
+    ///The nested indexes run on the thread making the call
+    if ( (nested.threads.size() != 1) || ( *nested.threads.begin() != QThread::currentThread() ) ) {
+        nMovedThreads->fetchAndAddOrdered(1);
+    }
+    inner->nIndexes.fetchAndAddOrdered( (int)nested.nIndexes );
+    outer->nIndexes.fetchAndAddOrdered(1);
+}
+
+class SpawnerThread
+    : public QThread
+{
+public:
+
+    SpawnerThread(OfxThreadPool* pool)
+        : QThread()
+        , pool(pool)
+        , recorder()
+    {
+    }
+
+    OfxThreadPool* pool;
+    Recorder recorder;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        for (int i = 0; i < 10; ++i) {
+            pool->run(boost::bind(&recordIndex, &recorder, _1), 8, 2);
+        }
+    }
+};
+} // anon namespace
+
+// The indexes run on the threads of the pool, never on the calling thread, and on at most maxConcurrency of them.
+// The threads are kept and re-used by the next calls.
+TEST(OfxThreadPool, ThreadReuse) {
+    OfxThreadPool pool(4);
+    Recorder first;
+
+    EXPECT_FALSE( OfxThreadPool::isPoolThread() );
+    pool.run(boost::bind(&recordIndex, &first, _1), 64, 4);
+    EXPECT_EQ(64, (int)first.nIndexes);
+    EXPECT_EQ(0, (int)first.nNotOnPoolThread);
+    EXPECT_LE( (int)first.maxRunning, 4 );
+    EXPECT_LE( first.threads.size(), (std::size_t)4 );
+    EXPECT_EQ( 0u, first.threads.count( QThread::currentThread() ) );
+    EXPECT_EQ(0, pool.getActiveThreadCount() );
+
+    for (int i = 0; i < 10; ++i) {
+        Recorder next;
+        pool.run(boost::bind(&recordIndex, &next, _1), 16, 2);
+        EXPECT_EQ(16, (int)next.nIndexes);
+        EXPECT_LE( (int)next.maxRunning, 2 );
+        ///No thread was created: the threads of the first call were re-used
+        for (std::set<QThread*>::const_iterator it = next.threads.begin(); it != next.threads.end(); ++it) {
+            EXPECT_EQ( 1u, first.threads.count(*it) );
+        }
+    }
+
+    ///No index
+    Recorder none;
+    pool.run(boost::bind(&recordIndex, &none, _1), 0, 4);
+    EXPECT_EQ(0, (int)none.nIndexes);
+}
+
+// A nested call from a thread of the pool must not wait for the other threads of the pool, which may all be busy.
+TEST(OfxThreadPool, NestedCalls) {
+    for (int nThreads = 1; nThreads <= 4; ++nThreads) {
+        OfxThreadPool pool(nThreads);
+        Recorder outer;
+        Recorder inner;
+        QAtomicInt nMovedThreads(0);
+        pool.run(boost::bind(&nestedIndex, &pool, &outer, &inner, &nMovedThreads, _1), 8, 4);
+        EXPECT_EQ(8, (int)outer.nIndexes);
+        EXPECT_EQ(8 * 3, (int)inner.nIndexes);
+        EXPECT_EQ(0, (int)outer.nNotOnPoolThread);
+        EXPECT_EQ(0, (int)nMovedThreads);
+        EXPECT_LE( outer.threads.size(), (std::size_t)nThreads );
+    }
+}
+
+// Several threads may call run() at the same time: each call gets its own threads, up to the size of the pool.
+TEST(OfxThreadPool, ConcurrentCalls) {
+    OfxThreadPool pool(3);
+    std::vector<SpawnerThread*> spawners;
+
+    for (int i = 0; i < 4; ++i) {
+        spawners.push_back( new SpawnerThread(&pool) );
+    }
+    for (std::size_t i = 0; i < spawners.size(); ++i) {
+        spawners[i]->start();
+    }
+    std::set<QThread*> threads;
+    for (std::size_t i = 0; i < spawners.size(); ++i) {
+        spawners[i]->wait();
+        EXPECT_EQ(10 * 8, (int)spawners[i]->recorder.nIndexes);
+        EXPECT_EQ(0, (int)spawners[i]->recorder.nNotOnPoolThread);
+        EXPECT_LE( (int)spawners[i]->recorder.maxRunning, 2 );
+        threads.insert( spawners[i]->recorder.threads.begin(), spawners[i]->recorder.threads.end() );
+        delete spawners[i];
+    }
+    EXPECT_LE( threads.size(), (std::size_t)pool.getMaxThreadCount() );
+    EXPECT_EQ(0, pool.getActiveThreadCount() );
+}
@@ -0,0 +1,137 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "Engine/ParallelRenderController.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+/**
+ * @brief A simulated render: each parallel render adds 2 fps until the 4 cores are busy, after which
+ * each extra parallel render costs 1 fps. Each parallel render holds cachePerRender of the node cache and each frame
+ * allocates memoryPerFrame bytes of images.
+ * Returns the number of parallel renders after the given duration.
+ **/
+int
+simulate(ParallelRenderController& controller,
+         double duration,
+         double cachePerRender,
+         int* maxReached,
+         double memoryPerFrame = 0,
+         double memoryBudget = 0)
+{
+    ParallelRenderController::Sample sample;
+    double frames = 0;
+    int n = 0;
+
+    *maxReached = 0;
+    sample.memoryBudget = memoryBudget;
+    sample.freeMemory = memoryBudget;
+    for (double t = 0; t < duration; t += 0.1) {
+        double fps = n <= 4 ? 2. * n : 8. - (n - 4);
+        frames += fps * 0.1;
+        sample.time = t;
+        sample.framesRendered = (U64)frames;
+        sample.imageMemoryAllocated = (U64)(sample.framesRendered * memoryPerFrame);
+        sample.cpuTime += std::min(n / 4., 1.) * 4 * 0.1;
+        sample.cacheOccupancy = n * cachePerRender;
+        n = controller.update(sample, n);
+        *maxReached = std::max(*maxReached, n);
+    }
+
+    return n;
+}
+}
+
+TEST(ParallelRenderController, ConvergesToTheBestThroughput)
+{
+    ParallelRenderController controller;
+    controller.reset(8, 4);
+    int maxReached;
+    int n = simulate(controller, 60, 0, &maxReached);
+
+    ///The CPU is saturated with 4 parallel renders: the controller probes around it but never goes further than 5
+    EXPECT_GE(n, 3);
+    EXPECT_LE(n, 5);
+    EXPECT_LE(maxReached, 5);
+}
+
+TEST(ParallelRenderController, BacksOffUnderCachePressure)
+{
+    ParallelRenderController controller;
+    controller.reset(8, 4);
+    int maxReached;
+    ///Each render fills 40% of the node cache: 3 renders would make it evict images
+    int n = simulate(controller, 60, 0.4, &maxReached);
+
+    EXPECT_LE(n, 2);
+    EXPECT_GE(n, 1);
+    EXPECT_LE(maxReached, 3);
+}
+
+TEST(ParallelRenderController, FitsTheFramesInTheMemoryBudget)
+{
+    ParallelRenderController controller;
+    controller.reset(8, 4);
+    int maxReached;
+    ///Each frame needs 1GB and the budget is 2.5GB: the CPU would allow 4 parallel renders but only 2 fit
+    int n = simulate(controller, 60, 0, &maxReached, 1e9, 2.5e9);
+
+    EXPECT_EQ(n, 2);
+    EXPECT_LE(maxReached, 2);
+    EXPECT_DOUBLE_EQ(controller.getFrameMemory(), 1e9);
+}
+
+TEST(ParallelRenderController, StopsRendersWhenTheSystemRunsOutOfMemory)
+{
+    ParallelRenderController controller;
+    controller.reset(8, 4);
+
+    ParallelRenderController::Sample sample;
+    sample.memoryBudget = 8e9;
+    sample.freeMemory = 8e9;
+    sample.imageMemoryAllocated = 0;
+    controller.update(sample, 4);
+
+    ///4 frames rendered, 1GB each: 8 would fit in the budget but there is not enough free RAM for one more
+    sample.time = 1;
+    sample.framesRendered = 4;
+    sample.imageMemoryAllocated = 4e9;
+    sample.freeMemory = 0.5e9;
+    EXPECT_EQ(controller.updateMemoryLimit(sample, 4), 4);
+
+    ///Unless the node cache can evict the images of the frames that are done
+    sample.cacheMemory = 6e9;
+    EXPECT_EQ(controller.updateMemoryLimit(sample, 4), 8);
+    sample.cacheMemory = 0;
+
+    ///The system is below the RAM that must be kept free and the node cache has nothing to evict
+    sample.freeMemory = -1e9;
+    EXPECT_EQ(controller.update(sample, 4), 3);
+    EXPECT_EQ(controller.update(sample, 1), 1);
+}
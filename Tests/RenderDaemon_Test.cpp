@@ -0,0 +1,128 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include "Engine/CLArgs.h"
+#include "Engine/RenderDaemon.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+QStringList
+rendererCommandLine()
+{
+    return QStringList( QString::fromUtf8(NATRON_APPLICATION_NAME "Renderer") );
+}
+}
+
+TEST(RenderDaemon,ParseDaemon)
+{
+    CLArgs cl(rendererCommandLine() << QString::fromUtf8("--daemon") << QString::fromUtf8("MyDaemon"), true);
+
+    EXPECT_EQ(0, cl.getError());
+    EXPECT_EQ( QString::fromUtf8("MyDaemon"), cl.getDaemonServerName() );
+    EXPECT_TRUE( cl.getSubmitServerName().isEmpty() );
+
+    ///A server name is required
+    CLArgs noName(rendererCommandLine() << QString::fromUtf8("--daemon"), true);
+    EXPECT_GT(noName.getError(), 0);
+
+    ///The daemon does not render in a GUI
+    CLArgs gui(QStringList( QString::fromUtf8(NATRON_APPLICATION_NAME) ) << QString::fromUtf8("--daemon") << QString::fromUtf8("MyDaemon"), false);
+    EXPECT_GT(gui.getError(), 0);
+}
+
+TEST(RenderDaemon,ParseSubmit)
+{
+    QStringList job;
+
+    job << QString::fromUtf8("-w") << QString::fromUtf8("MyWriter") << QString::fromUtf8("1-10") << QString::fromUtf8("MyProject.ntp");
+    CLArgs cl(rendererCommandLine() << QString::fromUtf8("--submit") << QString::fromUtf8("MyDaemon") << job, true);
+
+    EXPECT_EQ(0, cl.getError());
+    EXPECT_EQ( QString::fromUtf8("MyDaemon"), cl.getSubmitServerName() );
+    ///The job is forwarded as is, it is only parsed by the daemon
+    EXPECT_EQ( job, cl.getSubmitArguments() );
+    EXPECT_TRUE( cl.getScriptFilename().isEmpty() );
+    EXPECT_TRUE( cl.getDaemonServerName().isEmpty() );
+
+    CLArgs noName(rendererCommandLine() << QString::fromUtf8("--submit"), true);
+    EXPECT_GT(noName.getError(), 0);
+}
+
+TEST(RenderDaemon,JobRoundTrip)
+{
+    QStringList args;
+
+    args << QString::fromUtf8("-w") << QString::fromUtf8("MyWriter") << QString::fromUtf8("renders/out###.exr")
+         << QString::fromUtf8("projects/My Project \xc3\xa9.ntp");
+    const QString workingDirectory = QString::fromUtf8("/home/me/shots");
+    QByteArray job = RenderDaemon::encodeJob(workingDirectory, args);
+
+    ///Two jobs one after the other on the same device are read one at a time
+    QByteArray bytes = job + RenderDaemon::encodeJob( QString::fromUtf8("/tmp"), QStringList() );
+    QBuffer buffer(&bytes);
+    ASSERT_TRUE( buffer.open(QIODevice::ReadOnly) );
+
+    QString readDirectory;
+    QStringList readArgs;
+    EXPECT_TRUE( RenderDaemon::readJob(&buffer, &readDirectory, &readArgs) );
+    EXPECT_EQ(workingDirectory, readDirectory);
+    EXPECT_EQ(args, readArgs);
+    EXPECT_EQ( (qint64)job.size(), buffer.pos() );
+
+    EXPECT_TRUE( RenderDaemon::readJob(&buffer, &readDirectory, &readArgs) );
+    EXPECT_EQ(QString::fromUtf8("/tmp"), readDirectory);
+    EXPECT_TRUE( readArgs.isEmpty() );
+}
+
+TEST(RenderDaemon,TruncatedOrCorruptedJob)
+{
+    QByteArray job = RenderDaemon::encodeJob( QString::fromUtf8("/home/me"), QStringList( QString::fromUtf8("MyProject.ntp") ) );
+
+    ///The rest of the job never comes
+    for (int size = 0; size < job.size(); size += 3) {
+        QByteArray truncated = job.left(size);
+        QBuffer buffer(&truncated);
+        ASSERT_TRUE( buffer.open(QIODevice::ReadOnly) );
+        QString workingDirectory;
+        QStringList args;
+        EXPECT_FALSE( RenderDaemon::readJob(&buffer, &workingDirectory, &args) );
+    }
+
+    ///A size larger than any job
+    QByteArray corrupted = job;
+    corrupted[0] = (char)0xff;
+    QBuffer buffer(&corrupted);
+    ASSERT_TRUE( buffer.open(QIODevice::ReadOnly) );
+    QString workingDirectory;
+    QStringList args;
+    EXPECT_FALSE( RenderDaemon::readJob(&buffer, &workingDirectory, &args) );
+}
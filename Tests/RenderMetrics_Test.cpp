@@ -0,0 +1,135 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QThread>
+
+#include "Engine/RenderMetrics.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+// adds to a counter and to a histogram from its own thread, i.e from its own stripe
+class MetricsThread
+    : public QThread
+{
+public:
+
+    MetricsThread(int nAdds)
+        : QThread()
+        , _nAdds(nAdds)
+    {
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        for (int i = 0; i < _nAdds; ++i) {
+            RenderMetrics::add(eRenderMetricCacheHits);
+            RenderMetrics::add(eRenderMetricCacheMisses, 3);
+            RenderMetrics::addTimeSample(eRenderHistogramTileTime, 5e-6);
+        }
+    }
+
+    int _nAdds;
+};
+
+// The counters are process-wide: the tests only look at what they add
+qint64
+getHistogramDelta(const RenderMetrics::Snapshot& before,
+                  const RenderMetrics::Snapshot& after,
+                  int bucket)
+{
+    return after.histograms[eRenderHistogramFrameTime][bucket] - before.histograms[eRenderHistogramFrameTime][bucket];
+}
+} // anon namespace
+
+// The snapshot sums the stripes of all the threads.
+TEST(RenderMetrics, SnapshotSumsStripes) {
+    const int nThreads = 8;
+    const int nAdds = 10000;
+    RenderMetrics::Snapshot before = RenderMetrics::getSnapshot();
+
+    std::vector<MetricsThread*> threads;
+    for (int i = 0; i < nThreads; ++i) {
+        threads.push_back( new MetricsThread(nAdds) );
+        threads.back()->start();
+    }
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->wait();
+        delete threads[i];
+    }
+    RenderMetrics::add(eRenderMetricCacheHits, -5);
+
+    RenderMetrics::Snapshot after = RenderMetrics::getSnapshot();
+    EXPECT_EQ( (qint64)nThreads * nAdds - 5, after.values[eRenderMetricCacheHits] - before.values[eRenderMetricCacheHits] );
+    EXPECT_EQ( (qint64)nThreads * nAdds * 3, after.values[eRenderMetricCacheMisses] - before.values[eRenderMetricCacheMisses] );
+    // 5us is in [4, 8)
+    EXPECT_EQ( (qint64)nThreads * nAdds, after.histograms[eRenderHistogramTileTime][2] - before.histograms[eRenderHistogramTileTime][2] );
+
+    // Gauges are removed when they go out of scope
+    {
+        RenderMetrics::GaugeIncrementer gauge(eRenderMetricFramesInFlight, 2);
+        EXPECT_EQ( before.values[eRenderMetricFramesInFlight] + 2, RenderMetrics::getSnapshot().values[eRenderMetricFramesInFlight] );
+    }
+    EXPECT_EQ( before.values[eRenderMetricFramesInFlight], RenderMetrics::getSnapshot().values[eRenderMetricFramesInFlight] );
+}
+
+// Bucket i holds the samples in [2^i, 2^(i+1)) microseconds, the first and last buckets also hold the ones below and above.
+TEST(RenderMetrics, HistogramBuckets) {
+    const int lastBucket = NATRON_RENDER_METRICS_HISTOGRAM_BUCKETS - 1;
+    const double samples[] = { 0., 0.5e-6, 1.5e-6, 2e-6, 3.9e-6, 1e-3, 1., 1e9 };
+    const int buckets[] = { 0, 0, 0, 1, 1, 9, 19, lastBucket };
+
+    for (std::size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); ++i) {
+        RenderMetrics::Snapshot before = RenderMetrics::getSnapshot();
+        RenderMetrics::addTimeSample(eRenderHistogramFrameTime, samples[i]);
+        RenderMetrics::Snapshot after = RenderMetrics::getSnapshot();
+        for (int j = 0; j <= lastBucket; ++j) {
+            EXPECT_EQ( j == buckets[i] ? 1 : 0, getHistogramDelta(before, after, j) ) << samples[i] << " s, bucket " << j;
+        }
+    }
+}
+
+TEST(RenderMetrics, JSONLine) {
+    RenderMetrics::Snapshot snapshot;
+
+    snapshot.values[eRenderMetricTilesRendered] = 42;
+    snapshot.histograms[eRenderHistogramFrameTime][3] = 7;
+    std::stringstream ss;
+    RenderMetrics::writeJSONLine(ss, snapshot, 1.5);
+    std::string line = ss.str();
+
+    EXPECT_EQ( 0u, line.find("{\"time\":1.5,") );
+    EXPECT_NE( std::string::npos, line.find("\"tilesRendered\":42,") );
+    EXPECT_NE( std::string::npos, line.find("\"frameTimeHistogram\":[0,0,0,7,0,") );
+    // One line per snapshot
+    EXPECT_EQ( line.size() - 1, line.find('\n') );
+}
@@ -0,0 +1,170 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <list>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QThread>
+
+#include "BaseTest.h"
+
+#include "Engine/AppInstance.h"
+#include "Engine/Node.h"
+#include "Engine/OutputEffectInstance.h"
+#include "Engine/RenderPlan.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+OutputEffectInstance*
+getWriter(const boost::shared_ptr<Node>& writer)
+{
+    return dynamic_cast<OutputEffectInstance*>( writer->getLiveInstance() );
+}
+
+AppInstance::RenderWork
+makeRenderWork(const boost::shared_ptr<Node>& writer,
+               int firstFrame,
+               int lastFrame)
+{
+    AppInstance::RenderWork w;
+
+    w.writer = getWriter(writer);
+    w.firstFrame = firstFrame;
+    w.lastFrame = lastFrame;
+    w.frameStep = 1;
+
+    return w;
+}
+
+// asks the plan for a frame from its own thread, as a render thread of the writer would
+class FrameTurnThread
+    : public QThread
+{
+public:
+
+    FrameTurnThread(RenderPlan* plan,
+                    OutputEffectInstance* writer,
+                    int frame)
+        : QThread()
+        , _plan(plan)
+        , _writer(writer)
+        , _frame(frame)
+    {
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        _plan->waitForFrameTurn(_writer, _frame, 0);
+    }
+
+    RenderPlan* _plan;
+    OutputEffectInstance* _writer;
+    int _frame;
+};
+} // anon namespace
+
+// Only the writers sharing nodes and frames are rendered in lockstep, the costliest groups and writers first
+TEST_F(BaseTest, RenderPlanOrdering) {
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    boost::shared_ptr<Node> otherGenerator = createNode(_dotGeneratorPluginID);
+    std::vector<boost::shared_ptr<Node> > writers;
+
+    for (int i = 0; i < 4; ++i) {
+        writers.push_back( createNode(_writeOIIOPluginID) );
+        connectNodes(i < 3 ? generator : otherGenerator, writers.back(), 0, true);
+    }
+
+    std::list<AppInstance::RenderWork> works;
+    works.push_back( makeRenderWork(writers[1], 1, 10) );
+    works.push_back( makeRenderWork(writers[2], 1001, 1100) ); // shares the generator but no frame
+    works.push_back( makeRenderWork(writers[3], 1, 100) ); // shares nothing
+    works.push_back( makeRenderWork(writers[0], 1, 100) );
+    std::list<AppInstance::RenderWork> planned = AppInstance::planWritersRendering(works);
+
+    ASSERT_EQ( 4u, planned.size() );
+    std::list<AppInstance::RenderWork>::iterator it = planned.begin();
+    EXPECT_EQ( getWriter(writers[0]), (it++)->writer );
+    EXPECT_EQ( getWriter(writers[1]), (it++)->writer );
+    EXPECT_EQ( getWriter(writers[2]), (it++)->writer );
+    EXPECT_EQ( getWriter(writers[3]), (it++)->writer );
+
+    boost::shared_ptr<RenderPlan> plan = planned.front().writer->getRenderPlan();
+    EXPECT_TRUE(plan.get() != 0);
+    EXPECT_EQ( plan, getWriter(writers[1])->getRenderPlan() );
+    EXPECT_TRUE( getWriter(writers[2])->getRenderPlan().get() == 0 );
+    EXPECT_TRUE( getWriter(writers[3])->getRenderPlan().get() == 0 );
+
+    for (it = planned.begin(); it != planned.end(); ++it) {
+        it->writer->setRenderPlan( boost::shared_ptr<RenderPlan>() );
+    }
+}
+
+// A writer waits for the other writers rendering the same frames, but not for the ones rendering other frames
+TEST_F(BaseTest, RenderPlanWaiting) {
+    OutputEffectInstance* a = getWriter( createNode(_writeOIIOPluginID) );
+    OutputEffectInstance* b = getWriter( createNode(_writeOIIOPluginID) );
+    OutputEffectInstance* c = getWriter( createNode(_writeOIIOPluginID) );
+    RenderPlan plan(2);
+
+    plan.notifyWriterStarted(a, 1, 100);
+    plan.notifyWriterStarted(b, 1, 100);
+    plan.notifyWriterStarted(c, 1001, 1100);
+
+    // a may start up to 2 frames after the earliest frame of b
+    for (int frame = 1; frame <= 3; ++frame) {
+        EXPECT_TRUE( plan.waitForFrameTurn(a, frame, 0) );
+        plan.notifyFrameFinished(a, frame);
+    }
+    FrameTurnThread waiting(&plan, a, 4);
+    waiting.start();
+    EXPECT_FALSE( waiting.wait(200) );
+
+    // c renders other frames: it never waits for a and b
+    for (int frame = 1001; frame <= 1010; ++frame) {
+        EXPECT_TRUE( plan.waitForFrameTurn(c, frame, 0) );
+        plan.notifyFrameFinished(c, frame);
+    }
+    EXPECT_FALSE( waiting.wait(50) );
+
+    // Once b finished its first frame, a may go on
+    EXPECT_TRUE( plan.waitForFrameTurn(b, 1, 0) );
+    plan.notifyFrameFinished(b, 1);
+    EXPECT_TRUE( waiting.wait(10000) );
+
+    // A frame started but not finished holds the others back too, until its writer leaves the plan
+    EXPECT_TRUE( plan.waitForFrameTurn(b, 2, 0) );
+    FrameTurnThread waitingFinish(&plan, a, 5);
+    waitingFinish.start();
+    EXPECT_FALSE( waitingFinish.wait(200) );
+    plan.notifyWriterFinished(b);
+    EXPECT_TRUE( waitingFinish.wait(10000) );
+
+    plan.notifyWriterFinished(a);
+    plan.notifyWriterFinished(c);
+}
@@ -0,0 +1,175 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QThread>
+
+#include "BaseTest.h"
+#include "Engine/Node.h"
+#include "Engine/RenderStats.h"
+#include "Engine/Timer.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+///Renders a node whose render waits for an image, as EffectInstance::renderRoI does, a few times
+class TracedRenderThread
+    : public QThread
+{
+public:
+
+    TracedRenderThread(const boost::shared_ptr<RenderStats>& stats,
+                       const boost::shared_ptr<Node>& node,
+                       const std::string& plane)
+        : QThread()
+        , stats(stats)
+        , node(node)
+        , plane(plane)
+    {
+    }
+
+    boost::shared_ptr<RenderStats> stats;
+    boost::shared_ptr<Node> node;
+    std::string plane;
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        for (int i = 0; i < 3; ++i) {
+            RenderStatsThreadScope scope(stats, node);
+            TimeLapse render;
+            msleep(2);
+            {
+                TimeLapse wait;
+                msleep(2);
+                RenderStatsThreadScope::reportWait( eRenderTraceEventTypeImageWait, wait.getTimeSinceCreation() );
+            }
+            msleep(2);
+            stats->addRenderInfosForNode( node, boost::shared_ptr<Node>(), plane, RectI(0, 0, 10, 10), render.getTimeSinceCreation() );
+        }
+    }
+};
+
+struct TracedSpan
+{
+    double start, end; // in microseconds
+};
+}
+
+// The trace of a render on several threads must be valid JSON, whatever the names of the nodes and planes, and the
+// spans of each thread must nest.
+TEST_F(BaseTest,RenderStatsTrace)
+{
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    ASSERT_TRUE(generator);
+    const std::string label = "Dot \"quoted\" \\back\\slash\ttab\nnew line\x01";
+    generator->setLabel(label);
+    const std::string plane = "My\"Plane\\\x1f";
+
+    boost::shared_ptr<RenderStats> stats( new RenderStats(true) );
+    TracedRenderThread first(stats, generator, plane);
+    TracedRenderThread second(stats, generator, plane);
+    first.start();
+    second.start();
+    first.wait();
+    second.wait();
+
+    std::stringstream ss;
+    stats->writeTrace(ss, 12, 1);
+    std::string json = ss.str();
+    ///Control characters are escaped, the only ones left are the new lines between the events
+    for (std::size_t i = 0; i < json.size(); ++i) {
+        EXPECT_TRUE( ( (unsigned char)json[i] >= 0x20 ) || (json[i] == '\n') ) << i;
+    }
+    EXPECT_NE( std::string::npos, json.find("\\u0001") );
+    EXPECT_NE( std::string::npos, json.find("\\u001f") );
+
+    boost::property_tree::ptree trace;
+    try {
+        std::stringstream is(json);
+        boost::property_tree::read_json(is, trace);
+    } catch (const boost::property_tree::json_parser_error& e) {
+        FAIL() << e.what() << '\n' << json;
+    }
+    EXPECT_EQ( 12, trace.get<int>("otherData.frame") );
+    EXPECT_EQ( 1, trace.get<int>("otherData.view") );
+
+    int nThreadNames = 0;
+    int nRenders = 0;
+    int nWaits = 0;
+    std::map<int, std::vector<TracedSpan> > spansPerThread;
+    const boost::property_tree::ptree& events = trace.get_child("traceEvents");
+    for (boost::property_tree::ptree::const_iterator it = events.begin(); it != events.end(); ++it) {
+        const boost::property_tree::ptree& e = it->second;
+        std::string ph = e.get<std::string>("ph");
+        int tid = e.get<int>("tid");
+        if (ph == "M") {
+            ++nThreadNames;
+            continue;
+        }
+        ///The names are given back unchanged by the parser
+        EXPECT_EQ( label, e.get<std::string>("name") );
+        ASSERT_EQ( std::string("X"), ph );
+        TracedSpan span;
+        span.start = e.get<double>("ts");
+        span.end = span.start + e.get<double>("dur");
+        spansPerThread[tid].push_back(span);
+        if ( e.get_child_optional("args.plane") ) {
+            EXPECT_EQ( plane, e.get<std::string>("args.plane") );
+            ++nRenders;
+        } else {
+            ++nWaits;
+        }
+    }
+    EXPECT_EQ(2, nThreadNames);
+    EXPECT_EQ(2 * 3, nRenders);
+    EXPECT_EQ(2 * 3, nWaits);
+    ASSERT_EQ( (std::size_t)2, spansPerThread.size() );
+
+    ///On each thread, two spans are either disjoint or nested. Timestamps are truncated to the microsecond.
+    for (std::map<int, std::vector<TracedSpan> >::const_iterator it = spansPerThread.begin(); it != spansPerThread.end(); ++it) {
+        const std::vector<TracedSpan>& spans = it->second;
+        for (std::size_t i = 0; i < spans.size(); ++i) {
+            for (std::size_t j = 0; j < spans.size(); ++j) {
+                if ( (i == j) || (spans[i].start > spans[j].start) ) {
+                    continue;
+                }
+                bool disjoint = spans[j].start >= spans[i].end - 1.;
+                bool nested = spans[j].end <= spans[i].end + 1.;
+                EXPECT_TRUE(disjoint || nested) << "tid " << it->first << ": [" << spans[i].start << ", " << spans[i].end
+                                                << "] and [" << spans[j].start << ", " << spans[j].end << "]";
+            }
+        }
+    }
+}
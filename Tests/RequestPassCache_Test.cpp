@@ -0,0 +1,181 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "BaseTest.h"
+
+#include "Engine/EffectInstance.h"
+#include "Engine/Node.h"
+#include "Engine/ParallelRenderArgs.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+///The datas of a node that is identity of its input 0 at the frame being rendered
+FrameViewRequestGlobalData
+makeIdentityData(double time)
+{
+    FrameViewRequestGlobalData data;
+
+    data.rod = RectD(0, 0, 100, 100);
+    data.isProjectFormat = false;
+    data.isIdentity = true;
+    data.identityInputNb = 0;
+    data.inputIdentityTime = time;
+    data.frameViewsNeeded[0][0].push_back( OfxRangeD() );
+    data.frameViewsNeeded[0][0].back().min = data.frameViewsNeeded[0][0].back().max = time;
+
+    return data;
+}
+
+///The datas of a node that is not identity and needs the given frame of its input 0
+FrameViewRequestGlobalData
+makeRenderData(double neededTime)
+{
+    FrameViewRequestGlobalData data = makeIdentityData(neededTime);
+
+    data.isIdentity = false;
+    data.identityInputNb = -1;
+    data.inputIdentityTime = 0.;
+
+    return data;
+}
+
+std::vector<RectD>
+makeInputsRoD(double size)
+{
+    return std::vector<RectD>( 1, RectD(0, 0, size, size) );
+}
+
+double
+getNeededTime(const FrameViewRequestGlobalData& data)
+{
+    return data.frameViewsNeeded.find(0)->second.find(0)->second.front().min;
+}
+} // anon namespace
+
+// Only the nodes declaring their request pass time invariant are cached
+TEST_F(BaseTest, RequestPassCacheOptIn) {
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    boost::shared_ptr<Node> dot = createNode(PLUGINID_NATRON_DOT);
+
+    connectNodes(generator, dot, 0, true);
+    // The generator is an OpenFX plug-in that does not opt in, as FrameRange or TimeOffset
+    EXPECT_FALSE( RequestPassCache::isEffectStatic( generator->getLiveInstance() ) );
+    EXPECT_TRUE( RequestPassCache::isEffectStatic( dot->getLiveInstance() ) );
+}
+
+// The times of a node identity at the frame being rendered are shifted to the requested frame
+TEST_F(BaseTest, RequestPassCacheRelative) {
+    EffectInstance* effect = createNode(_dotGeneratorPluginID)->getLiveInstance();
+    RequestPassCache cache;
+    FrameViewRequestGlobalData data;
+    int version = 0;
+
+    cache.setGlobalData(effect, 1, 0, 0, 1., makeInputsRoD(100), makeIdentityData(1.));
+    // A single frame does not tell how the datas depend on the frame
+    EXPECT_FALSE( cache.getGlobalData(effect, 1, 0, 0, 2., makeInputsRoD(100), &data, &version) );
+    cache.setGlobalData(effect, 1, 0, 0, 2., makeInputsRoD(100), makeIdentityData(2.));
+
+    ASSERT_TRUE( cache.getGlobalData(effect, 1, 0, 0, 10., makeInputsRoD(100), &data, &version) );
+    EXPECT_TRUE(data.isIdentity);
+    EXPECT_EQ(10., data.inputIdentityTime);
+    EXPECT_EQ( 10., getNeededTime(data) );
+    EXPECT_NE(0, version);
+
+    // Another node hash, level or view is another entry
+    EXPECT_FALSE( cache.getGlobalData(effect, 2, 0, 0, 10., makeInputsRoD(100), &data, &version) );
+    EXPECT_FALSE( cache.getGlobalData(effect, 1, 1, 0, 10., makeInputsRoD(100), &data, &version) );
+    EXPECT_FALSE( cache.getGlobalData(effect, 1, 0, 1, 10., makeInputsRoD(100), &data, &version) );
+}
+
+// The datas of a node needing the same frame whatever the frame being rendered (e.g FrameHold) are not shifted
+TEST_F(BaseTest, RequestPassCacheAbsolute) {
+    EffectInstance* effect = createNode(_dotGeneratorPluginID)->getLiveInstance();
+    RequestPassCache cache;
+    FrameViewRequestGlobalData data;
+    int version = 0;
+
+    cache.setGlobalData(effect, 1, 0, 0, 1., makeInputsRoD(100), makeRenderData(5.));
+    cache.setGlobalData(effect, 1, 0, 0, 2., makeInputsRoD(100), makeRenderData(5.));
+    ASSERT_TRUE( cache.getGlobalData(effect, 1, 0, 0, 10., makeInputsRoD(100), &data, &version) );
+    EXPECT_FALSE(data.isIdentity);
+    EXPECT_EQ( 5., getNeededTime(data) );
+}
+
+// A FrameRange node with the range [1, 10] is identity inside the range only: the first frames look relative,
+// the datas recorded once outside of the range make it uncacheable.
+TEST_F(BaseTest, RequestPassCacheFrameRangeIdentityFlip) {
+    EffectInstance* effect = createNode(_dotGeneratorPluginID)->getLiveInstance();
+    RequestPassCache cache;
+    FrameViewRequestGlobalData data;
+    int version = 0;
+
+    cache.setGlobalData(effect, 1, 0, 0, 1., makeInputsRoD(100), makeIdentityData(1.));
+    cache.setGlobalData(effect, 1, 0, 0, 2., makeInputsRoD(100), makeIdentityData(2.));
+    EXPECT_TRUE( cache.isCacheable(effect, 1, 0, 0) );
+    // The cache cannot find out by itself: this is why FrameRange does not declare its request pass time invariant
+    ASSERT_TRUE( cache.getGlobalData(effect, 1, 0, 0, 11., makeInputsRoD(100), &data, &version) );
+    EXPECT_TRUE(data.isIdentity);
+
+    FrameViewRequestGlobalData outsideRange = makeRenderData(11.);
+    outsideRange.rod = RectD();
+    cache.setGlobalData(effect, 1, 0, 0, 11., makeInputsRoD(100), outsideRange);
+    EXPECT_FALSE( cache.isCacheable(effect, 1, 0, 0) );
+    EXPECT_FALSE( cache.getGlobalData(effect, 1, 0, 0, 3., makeInputsRoD(100), &data, &version) );
+    EXPECT_FALSE( cache.getGlobalData(effect, 1, 0, 0, 12., makeInputsRoD(100), &data, &version) );
+}
+
+// The datas are not used once the RoDs of the inputs changed, and the regions of interest follow their version
+TEST_F(BaseTest, RequestPassCacheInputsRoD) {
+    EffectInstance* effect = createNode(_dotGeneratorPluginID)->getLiveInstance();
+    RequestPassCache cache;
+    FrameViewRequestGlobalData data;
+    int version = 0;
+    RectD window(0, 0, 50, 50);
+    RoIMap rois;
+
+    rois[effect] = window;
+    cache.setGlobalData(effect, 1, 0, 0, 1., makeInputsRoD(100), makeIdentityData(1.));
+    cache.setGlobalData(effect, 1, 0, 0, 2., makeInputsRoD(100), makeIdentityData(2.));
+    ASSERT_TRUE( cache.getGlobalData(effect, 1, 0, 0, 3., makeInputsRoD(100), &data, &version) );
+    int firstVersion = version;
+    cache.setInputsRoI(effect, 1, 0, 0, firstVersion, window, rois);
+    RoIMap cachedRois;
+    EXPECT_TRUE( cache.getInputsRoI(effect, 1, 0, 0, firstVersion, window, &cachedRois) );
+    EXPECT_TRUE(cachedRois == rois);
+    EXPECT_FALSE( cache.getInputsRoI(effect, 1, 0, 0, firstVersion, RectD(0, 0, 10, 10), &cachedRois) );
+
+    EXPECT_FALSE( cache.getGlobalData(effect, 1, 0, 0, 3., makeInputsRoD(200), &data, &version) );
+    // Recording the new inputs starts over, the previous regions of interest are dropped
+    cache.setGlobalData(effect, 1, 0, 0, 3., makeInputsRoD(200), makeIdentityData(3.));
+    cache.setGlobalData(effect, 1, 0, 0, 4., makeInputsRoD(200), makeIdentityData(4.));
+    ASSERT_TRUE( cache.getGlobalData(effect, 1, 0, 0, 5., makeInputsRoD(200), &data, &version) );
+    EXPECT_NE(firstVersion, version);
+    EXPECT_FALSE( cache.getInputsRoI(effect, 1, 0, 0, firstVersion, window, &cachedRois) );
+    EXPECT_FALSE( cache.getInputsRoI(effect, 1, 0, 0, version, window, &cachedRois) );
+}
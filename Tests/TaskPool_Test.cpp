@@ -0,0 +1,104 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <stdexcept>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+
+#include "Engine/TaskPool.h"
+
+NATRON_NAMESPACE_USING
+
+namespace {
+// a tile that renders its "inputs" with nested batches, like EffectInstance::renderRoI
+int
+renderTile(TaskPool* pool,
+           QAtomicInt* nLeaves,
+           int depth)
+{
+    if (depth == 0) {
+        nLeaves->fetchAndAddOrdered(1);
+
+        return 1;
+    }
+    std::vector<int> tiles(4, depth - 1);
+    std::vector<int> results;
+    bool ok = pool->mapped( tiles, boost::bind(&renderTile, pool, nLeaves, _1), &results );
+    int sum = 0;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        sum += results[i];
+    }
+
+    return ok ? sum : -1;
+}
+
+void
+throwIfOdd(int i)
+{
+    if (i % 2) {
+        throw std::runtime_error("odd");
+    }
+}
+} // anon namespace
+
+// Nested batches must not dead-lock, even with less threads than nesting levels.
+TEST(TaskPool, NestedBatches) {
+    for (int nThreads = 0; nThreads <= 4; ++nThreads) {
+        TaskPool pool(nThreads);
+        QAtomicInt nLeaves(0);
+        EXPECT_EQ( 4 * 4 * 4 * 4, renderTile(&pool, &nLeaves, 4) );
+        EXPECT_EQ( 4 * 4 * 4 * 4, (int)nLeaves );
+
+        TaskPool::Stats stats = pool.getStats();
+        EXPECT_EQ( (U64)(1 + 4 + 4 * 4 + 4 * 4 * 4), stats.nBatches );
+        EXPECT_EQ( (U64)(4 + 4 * 4 + 4 * 4 * 4 + 4 * 4 * 4 * 4), stats.nTasks );
+        if (nThreads == 0) {
+            EXPECT_EQ(stats.nTasks, stats.nTasksHelped);
+        }
+    }
+}
+
+TEST(TaskPool, Exceptions) {
+    TaskPool pool(2);
+    std::vector<TaskPool::Task> tasks;
+
+    for (int i = 0; i < 10; ++i) {
+        tasks.push_back( boost::bind(&throwIfOdd, i * 2) );
+    }
+    EXPECT_TRUE( pool.run(tasks) );
+    tasks.push_back( boost::bind(&throwIfOdd, 1) );
+    EXPECT_FALSE( pool.run(tasks) );
+
+    // the pool can be resized while it is used
+    pool.setMaxThreadCount(0);
+    EXPECT_FALSE( pool.run(tasks) );
+    pool.setMaxThreadCount(3);
+    QAtomicInt nLeaves(0);
+    EXPECT_EQ( 4 * 4 * 4, renderTile(&pool, &nLeaves, 3) );
+}
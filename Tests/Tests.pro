@@ -220,8 +220,21 @@ SOURCES += \
     Hash64_Test.cpp \
     Image_Test.cpp \
     Lut_Test.cpp \
+    NativeExpression_Test.cpp \
     KnobFile_Test.cpp \
-    Curve_Test.cpp
+    Curve_Test.cpp \
+    Cache_Test.cpp \
+    ParallelRenderController_Test.cpp \
+    RenderMetrics_Test.cpp \
+    ImageConversionCache_Test.cpp \
+    RequestPassCache_Test.cpp \
+    RenderPlan_Test.cpp \
+    OfxBundleIndex_Test.cpp \
+    TaskPool_Test.cpp \
+    RenderDaemon_Test.cpp \
+    OfxThreadPool_Test.cpp \
+    ImageArena_Test.cpp \
+    RenderStats_Test.cpp
 
 HEADERS += \
     BaseTest.h